@@ -0,0 +1,113 @@
+# ELF executables, objects and shared libraries, 32 or 64 bit, in either
+# byte order.
+
+struct Ident {
+	char magic[4];
+	# 1 for 32 bit, 2 for 64 bit.
+	u8 class;
+	# 1 for little endian, 2 for big endian.
+	u8 data;
+	u8 version;
+	u8 osabi;
+	u8 abiversion;
+	bytes pad[7];
+}
+
+struct Header32 {
+	u16 type;
+	u16 machine;
+	u32 version;
+	u32 entry;
+	u32 phoff;
+	u32 shoff;
+	u32 flags;
+	u16 ehsize;
+	u16 phentsize;
+	u16 phnum;
+	u16 shentsize;
+	u16 shnum;
+	u16 shstrndx;
+}
+
+struct Header64 {
+	u16 type;
+	u16 machine;
+	u32 version;
+	u64 entry;
+	u64 phoff;
+	u64 shoff;
+	u32 flags;
+	u16 ehsize;
+	u16 phentsize;
+	u16 phnum;
+	u16 shentsize;
+	u16 shnum;
+	u16 shstrndx;
+}
+
+struct ProgramHeader32 {
+	u32 type;
+	u32 offset;
+	u32 vaddr;
+	u32 paddr;
+	u32 filesz;
+	u32 memsz;
+	u32 flags;
+	u32 align;
+}
+
+struct ProgramHeader64 {
+	u32 type;
+	u32 flags;
+	u64 offset;
+	u64 vaddr;
+	u64 paddr;
+	u64 filesz;
+	u64 memsz;
+	u64 align;
+}
+
+struct SectionHeader32 {
+	u32 name;
+	u32 type;
+	u32 flags;
+	u32 addr;
+	u32 offset;
+	u32 size;
+	u32 link;
+	u32 info;
+	u32 addralign;
+	u32 entsize;
+}
+
+struct SectionHeader64 {
+	u32 name;
+	u32 type;
+	u64 flags;
+	u64 addr;
+	u64 offset;
+	u64 size;
+	u32 link;
+	u32 info;
+	u64 addralign;
+	u64 entsize;
+}
+
+Ident ident;
+if (ident.magic != "\x7fELF") {
+	# Not an ELF file, nothing more to decode.
+	bytes rest[];
+} else {
+	if (ident.data == 2) {
+		endian big;
+	}
+	if (ident.class == 2) {
+		Header64 header;
+		ProgramHeader64 segments[header.phnum] @ header.phoff;
+		SectionHeader64 sections[header.shnum] @ header.shoff;
+	} else {
+		Header32 header;
+		ProgramHeader32 segments[header.phnum] @ header.phoff;
+		SectionHeader32 sections[header.shnum] @ header.shoff;
+	}
+}
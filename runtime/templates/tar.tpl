@@ -0,0 +1,30 @@
+# Tar archives. Each file has a 512 byte header, followed by its contents
+# padded to a multiple of 512 bytes. Two zero blocks end the archive.
+
+struct Header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char checksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	bytes pad[12];
+}
+
+struct Entry {
+	Header header;
+	bytes data[octal(header.size)];
+	bytes padding[align(octal(header.size), 512) - octal(header.size)];
+}
+
+Entry entries[] while (u8(@) != 0);
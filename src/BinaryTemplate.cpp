@@ -0,0 +1,678 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "BinaryTemplate.hpp"
+
+using namespace std;
+
+namespace
+{
+
+struct Token
+{
+	enum Kind
+	{
+		End,
+		Identifier,
+		Number,
+		String,
+		Punctuation,
+	};
+	Kind kind;
+	string text;
+	int64_t number = 0;
+	int line;
+};
+
+typedef BinaryTemplate::Expr Expr;
+typedef BinaryTemplate::Statement Statement;
+typedef BinaryTemplate::StructDef StructDef;
+typedef BinaryTemplate::Type Type;
+
+vector<Token> Tokenize(const string &text)
+{
+	static const char *const kTwoCharPunctuation[] = {
+		"==", "!=", "<=", ">=", "<<", ">>", "&&", "||",
+	};
+
+	vector<Token> tokens;
+	int line = 1;
+	size_t i = 0;
+
+	auto error = [&line](const string &message)
+	{
+		return invalid_argument("Line " + to_string(line) + ": " + message);
+	};
+
+	while (i < text.size())
+	{
+		const char c = text[i];
+		if (c == '\n')
+		{
+			++line;
+			++i;
+			continue;
+		}
+		if (isspace((uint8_t)c))
+		{
+			++i;
+			continue;
+		}
+		if (c == '#' || text.compare(i, 2, "//") == 0)
+		{
+			i = text.find('\n', i);
+			if (i == string::npos)
+			{
+				break;
+			}
+			continue;
+		}
+
+		Token token;
+		token.line = line;
+
+		if (isalpha((uint8_t)c) || c == '_')
+		{
+			const size_t begin = i;
+			while (i < text.size() && (isalnum((uint8_t)text[i]) || text[i] == '_'))
+			{
+				++i;
+			}
+			token.kind = Token::Identifier;
+			token.text = text.substr(begin, i - begin);
+		}
+		else if (isdigit((uint8_t)c))
+		{
+			const size_t begin = i;
+			while (i < text.size() && isalnum((uint8_t)text[i]))
+			{
+				++i;
+			}
+			token.kind = Token::Number;
+			token.text = text.substr(begin, i - begin);
+
+			size_t parsed = 0;
+			try
+			{
+				token.number = stoll(token.text, &parsed, 0);
+			}
+			catch (exception &e)
+			{
+			}
+			if (parsed != token.text.size())
+			{
+				throw error("Invalid number " + token.text);
+			}
+		}
+		else if (c == '"')
+		{
+			for (++i; i < text.size() && text[i] != '"'; ++i)
+			{
+				if (text[i] == '\n')
+				{
+					throw error("String is not closed");
+				}
+				if (text[i] != '\\')
+				{
+					token.text.push_back(text[i]);
+					continue;
+				}
+
+				// Escapes like those of :find.
+				if (++i == text.size())
+				{
+					break;
+				}
+				switch (text[i])
+				{
+				case 'x':
+					if (i + 2 >= text.size() || !isxdigit((uint8_t)text[i + 1]) || !isxdigit((uint8_t)text[i + 2]))
+					{
+						throw error("Expected two hex digits after \\x");
+					}
+					token.text.push_back((char)stoi(text.substr(i + 1, 2), nullptr, 16));
+					i += 2;
+					break;
+				case 'n':
+					token.text.push_back('\n');
+					break;
+				case 't':
+					token.text.push_back('\t');
+					break;
+				case '0':
+					token.text.push_back('\0');
+					break;
+				default:
+					token.text.push_back(text[i]);
+					break;
+				}
+			}
+			if (i == text.size())
+			{
+				throw error("String is not closed");
+			}
+			++i;
+			token.kind = Token::String;
+		}
+		else
+		{
+			token.kind = Token::Punctuation;
+			token.text = string(1, c);
+			for (const char *two : kTwoCharPunctuation)
+			{
+				if (text.compare(i, 2, two) == 0)
+				{
+					token.text = two;
+					break;
+				}
+			}
+			if (token.text.size() == 1 && !strchr("{}()[];,.@?:+-*/%&|^<>!~=", c))
+			{
+				throw error(string("Unexpected character ") + c);
+			}
+			i += token.text.size();
+		}
+
+		tokens.push_back(move(token));
+	}
+
+	Token end;
+	end.kind = Token::End;
+	end.line = line;
+	tokens.push_back(end);
+	return tokens;
+}
+
+}
+
+bool BinaryTemplate::ParseIntegerType(const string &name, Type &type)
+{
+	string base = name;
+	if (base.size() > 2 && (base.compare(base.size() - 2, 2, "le") == 0 || base.compare(base.size() - 2, 2, "be") == 0))
+	{
+		type.has_endianness = true;
+		type.endianness = (base.compare(base.size() - 2, 2, "be") == 0 ? Endianness::BigEndian : Endianness::LittleEndian);
+		base.resize(base.size() - 2);
+	}
+
+	static const map<string, int> kWidths = {{"8", 1}, {"16", 2}, {"32", 4}, {"64", 8}};
+	if (base.size() < 2 || (base[0] != 'u' && base[0] != 'i') || !kWidths.count(base.substr(1)))
+	{
+		return false;
+	}
+
+	type.base = Type::Integer;
+	type.is_signed = (base[0] == 'i');
+	type.width = kWidths.at(base.substr(1));
+	type.name = name;
+	return true;
+}
+
+namespace
+{
+
+int Precedence(const string &op)
+{
+	static const map<string, int> kPrecedences = {
+		{"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5},
+		{"==", 6}, {"!=", 6},
+		{"<", 7}, {"<=", 7}, {">", 7}, {">=", 7},
+		{"<<", 8}, {">>", 8},
+		{"+", 9}, {"-", 9},
+		{"*", 10}, {"/", 10}, {"%", 10},
+	};
+	auto it = kPrecedences.find(op);
+	return it == kPrecedences.end() ? -1 : it->second;
+}
+
+// Argument counts of the functions, -1 for the integer readers, which take
+// an offset and are named like types.
+int FunctionArity(const string &name)
+{
+	static const map<string, int> kArities = {
+		{"octal", 1}, {"align", 2}, {"filesize", 0}, {"size", 1}, {"offset", 1},
+	};
+	auto it = kArities.find(name);
+	if (it != kArities.end())
+	{
+		return it->second;
+	}
+
+	Type type;
+	return BinaryTemplate::ParseIntegerType(name, type) ? 1 : -1;
+}
+
+class Parser
+{
+public:
+	Parser(const string &text, vector< unique_ptr<StructDef> > &structs)
+	  : tokens(Tokenize(text)), structs(structs)
+	{
+	}
+
+	void ParseFile(StructDef &root)
+	{
+		while (Peek().kind != Token::End)
+		{
+			if (Peek().text == "struct" && Peek().kind == Token::Identifier)
+			{
+				ParseStruct();
+			}
+			else
+			{
+				root.body.push_back(ParseStatement());
+			}
+		}
+		root.fixed_size = FixedSize(root.body);
+	}
+
+private:
+	const Token& Peek() const
+	{
+		return tokens[pos];
+	}
+
+	const Token& Next()
+	{
+		const Token &token = tokens[pos];
+		if (token.kind != Token::End)
+		{
+			++pos;
+		}
+		return token;
+	}
+
+	bool Accept(const string &punctuation)
+	{
+		if (Peek().kind == Token::Punctuation && Peek().text == punctuation)
+		{
+			++pos;
+			return true;
+		}
+		return false;
+	}
+
+	invalid_argument Error(const string &message) const
+	{
+		const Token &token = Peek();
+		const string found = (token.kind == Token::End ? "end of file" : "\"" + token.text + "\"");
+		return invalid_argument("Line " + to_string(token.line) + ": " + message + ", found " + found);
+	}
+
+	void Expect(const string &punctuation)
+	{
+		if (!Accept(punctuation))
+		{
+			throw Error("Expected \"" + punctuation + "\"");
+		}
+	}
+
+	string ExpectIdentifier(const string &what)
+	{
+		if (Peek().kind != Token::Identifier)
+		{
+			throw Error("Expected " + what);
+		}
+		return Next().text;
+	}
+
+	void ParseStruct()
+	{
+		Next();
+		const string name = ExpectIdentifier("struct name");
+		Type unused;
+		if (FindStruct(name) || BinaryTemplate::ParseIntegerType(name, unused) || name == "char" || name == "bytes")
+		{
+			--pos;
+			throw Error("Type is already defined");
+		}
+
+		auto def = unique_ptr<StructDef>(new StructDef);
+		def->name = name;
+		Expect("{");
+		def->body = ParseBlockBody();
+		Accept(";");
+
+		def->fixed_size = FixedSize(def->body);
+		structs.push_back(move(def));
+	}
+
+	// Statements up to the closing brace, which is consumed.
+	vector<Statement> ParseBlockBody()
+	{
+		vector<Statement> body;
+		while (!Accept("}"))
+		{
+			if (Peek().kind == Token::End)
+			{
+				throw Error("Expected \"}\"");
+			}
+			body.push_back(ParseStatement());
+		}
+		return body;
+	}
+
+	Statement ParseStatement()
+	{
+		Statement statement;
+		statement.line = Peek().line;
+
+		const string word = ExpectIdentifier("a type, if or endian");
+		if (word == "if")
+		{
+			statement.kind = Statement::If;
+			Expect("(");
+			statement.condition = ParseExpr();
+			Expect(")");
+			Expect("{");
+			statement.then_body = ParseBlockBody();
+			if (Peek().kind == Token::Identifier && Peek().text == "else")
+			{
+				Next();
+				if (Peek().kind == Token::Identifier && Peek().text == "if")
+				{
+					statement.else_body.push_back(ParseStatement());
+				}
+				else
+				{
+					Expect("{");
+					statement.else_body = ParseBlockBody();
+				}
+			}
+			return statement;
+		}
+
+		if (word == "endian")
+		{
+			statement.kind = Statement::SetEndianness;
+			const string which = ExpectIdentifier("big or little");
+			if (which != "big" && which != "little")
+			{
+				--pos;
+				throw Error("Expected big or little");
+			}
+			statement.endianness = (which == "big" ? Endianness::BigEndian : Endianness::LittleEndian);
+			Expect(";");
+			return statement;
+		}
+
+		statement.kind = Statement::Field;
+		statement.type.name = word;
+		if (word == "char")
+		{
+			statement.type.base = Type::Char;
+		}
+		else if (word == "bytes")
+		{
+			statement.type.base = Type::Bytes;
+		}
+		else if (const StructDef *def = FindStruct(word))
+		{
+			statement.type.base = Type::Struct;
+			statement.type.def = def;
+		}
+		else if (!BinaryTemplate::ParseIntegerType(word, statement.type))
+		{
+			--pos;
+			throw Error("Unknown type");
+		}
+
+		statement.name = ExpectIdentifier("field name");
+
+		const bool is_text = (statement.type.base == Type::Char || statement.type.base == Type::Bytes);
+		if (Accept("["))
+		{
+			statement.is_array = !is_text;
+			if (!Accept("]"))
+			{
+				statement.count = ParseExpr();
+				Expect("]");
+			}
+		}
+		else if (is_text)
+		{
+			// A single character or byte.
+			statement.count = unique_ptr<Expr>(new Expr{Expr::Number});
+			statement.count->number = 1;
+		}
+
+		if (Peek().kind == Token::Identifier && Peek().text == "while")
+		{
+			if (!statement.is_array)
+			{
+				throw Error("Only arrays can have a while condition");
+			}
+			Next();
+			Expect("(");
+			statement.while_condition = ParseExpr();
+			Expect(")");
+		}
+
+		if (Accept("@"))
+		{
+			statement.at = ParseExpr();
+		}
+		Expect(";");
+		return statement;
+	}
+
+	unique_ptr<Expr> ParseExpr()
+	{
+		unique_ptr<Expr> condition = ParseBinary(1);
+		if (!Accept("?"))
+		{
+			return condition;
+		}
+
+		auto expr = unique_ptr<Expr>(new Expr{Expr::Conditional});
+		expr->args.push_back(move(condition));
+		expr->args.push_back(ParseExpr());
+		Expect(":");
+		expr->args.push_back(ParseExpr());
+		return expr;
+	}
+
+	unique_ptr<Expr> ParseBinary(int min_precedence)
+	{
+		unique_ptr<Expr> lhs = ParseUnary();
+		while (Peek().kind == Token::Punctuation)
+		{
+			const int precedence = Precedence(Peek().text);
+			if (precedence < min_precedence)
+			{
+				break;
+			}
+
+			auto expr = unique_ptr<Expr>(new Expr{Expr::Binary});
+			expr->text = Next().text;
+			expr->args.push_back(move(lhs));
+			expr->args.push_back(ParseBinary(precedence + 1));
+			lhs = move(expr);
+		}
+		return lhs;
+	}
+
+	unique_ptr<Expr> ParseUnary()
+	{
+		if (Peek().kind == Token::Punctuation && (Peek().text == "-" || Peek().text == "!" || Peek().text == "~"))
+		{
+			auto expr = unique_ptr<Expr>(new Expr{Expr::Unary});
+			expr->text = Next().text;
+			expr->args.push_back(ParseUnary());
+			return expr;
+		}
+		return ParsePrimary();
+	}
+
+	unique_ptr<Expr> ParsePrimary()
+	{
+		if (Accept("("))
+		{
+			unique_ptr<Expr> expr = ParseExpr();
+			Expect(")");
+			return expr;
+		}
+		if (Accept("@"))
+		{
+			return unique_ptr<Expr>(new Expr{Expr::Offset});
+		}
+
+		const Token &token = Peek();
+		if (token.kind == Token::Number)
+		{
+			auto expr = unique_ptr<Expr>(new Expr{Expr::Number});
+			expr->number = Next().number;
+			return expr;
+		}
+		if (token.kind == Token::String)
+		{
+			auto expr = unique_ptr<Expr>(new Expr{Expr::String});
+			expr->text = Next().text;
+			return expr;
+		}
+		if (token.kind != Token::Identifier)
+		{
+			throw Error("Expected an expression");
+		}
+
+		const string name = Next().text;
+		if (Accept("("))
+		{
+			const int arity = FunctionArity(name);
+			if (arity < 0)
+			{
+				pos -= 2;
+				throw Error("Unknown function");
+			}
+
+			auto expr = unique_ptr<Expr>(new Expr{Expr::Call});
+			expr->text = name;
+			if (!Accept(")"))
+			{
+				do
+				{
+					expr->args.push_back(ParseExpr());
+				}
+				while (Accept(","));
+				Expect(")");
+			}
+			if ((int)expr->args.size() != arity)
+			{
+				--pos;
+				throw Error(name + " takes " + to_string(arity) + " arguments");
+			}
+			if ((name == "size" || name == "offset") && expr->args[0]->kind != Expr::Name)
+			{
+				--pos;
+				throw Error(name + " takes a field name");
+			}
+			return expr;
+		}
+
+		auto expr = unique_ptr<Expr>(new Expr{Expr::Name});
+		expr->path.push_back(name);
+		while (Accept("."))
+		{
+			expr->path.push_back(ExpectIdentifier("field name"));
+		}
+		return expr;
+	}
+
+	const StructDef* FindStruct(const string &name) const
+	{
+		for (const auto &def : structs)
+		{
+			if (def->name == name)
+			{
+				return def.get();
+			}
+		}
+		return nullptr;
+	}
+
+	static int64_t FixedSize(const vector<Statement> &body)
+	{
+		int64_t size = 0;
+		for (const Statement &statement : body)
+		{
+			if (statement.kind == Statement::SetEndianness || statement.at)
+			{
+				continue;
+			}
+			if (statement.kind == Statement::If || statement.while_condition)
+			{
+				return -1;
+			}
+
+			int64_t element_size = 1;
+			if (statement.type.base == Type::Integer)
+			{
+				element_size = statement.type.width;
+			}
+			else if (statement.type.base == Type::Struct)
+			{
+				element_size = statement.type.def->fixed_size;
+			}
+			if (element_size < 0)
+			{
+				return -1;
+			}
+
+			if (statement.is_array || statement.type.base == Type::Char || statement.type.base == Type::Bytes)
+			{
+				if (!statement.count || statement.count->kind != Expr::Number)
+				{
+					return -1;
+				}
+				element_size *= statement.count->number;
+			}
+			size += element_size;
+		}
+		return size;
+	}
+
+	vector<Token> tokens;
+	size_t pos = 0;
+	vector< unique_ptr<StructDef> > &structs;
+};
+
+}
+
+BinaryTemplate::BinaryTemplate(const string &text)
+{
+	root.name = "file";
+	Parser(text, structs).ParseFile(root);
+}
+
+shared_ptr<const BinaryTemplate> BinaryTemplate::Load(const string &file_name)
+{
+	ifstream file(file_name);
+	if (!file.is_open())
+	{
+		throw runtime_error("Unable to load \"" + file_name + "\"");
+	}
+
+	stringstream text;
+	text << file.rdbuf();
+	return make_shared<BinaryTemplate>(text.str());
+}
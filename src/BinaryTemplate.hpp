@@ -0,0 +1,150 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Endianness.hpp"
+
+// Declarative description of a binary format, parsed once and then
+// decoded over buffers by TemplateTree. Like
+//
+//     struct Entry {
+//         Header header;
+//         bytes data[octal(header.size)];
+//     }
+//     Entry entries[] while (u8(@) != 0);
+//
+// Syntax is described in runtime/templates/README.md.
+class BinaryTemplate
+{
+public:
+	// Throws invalid_argument with the line of the first error.
+	explicit BinaryTemplate(const std::string &text);
+	BinaryTemplate(const BinaryTemplate &ot) = delete;
+	BinaryTemplate& operator=(const BinaryTemplate &ot) = delete;
+
+	// Throws runtime_error if the file can not be read.
+	static std::shared_ptr<const BinaryTemplate> Load(const std::string &file_name);
+
+	struct Expr
+	{
+		enum Kind
+		{
+			Number,
+			String,
+			// Field, like `header.size`.
+			Name,
+			// Offset the next field would be at.
+			Offset,
+			Unary,
+			Binary,
+			// a ? b : c
+			Conditional,
+			Call,
+		};
+		Kind kind;
+
+		int64_t number = 0;
+		// String literal, operator or function name.
+		std::string text;
+		std::vector<std::string> path;
+		std::vector< std::unique_ptr<Expr> > args;
+	};
+
+	struct StructDef;
+
+	struct Type
+	{
+		enum Base
+		{
+			Integer,
+			// Text, shown up to the first NUL.
+			Char,
+			Bytes,
+			Struct,
+		};
+		Base base;
+
+		// Of integers.
+		int width = 0;
+		bool is_signed = false;
+		// Set by suffixes like u32be, otherwise the one in effect is used.
+		bool has_endianness = false;
+		Endianness endianness = Endianness::LittleEndian;
+
+		const StructDef *def = nullptr;
+		std::string name;
+	};
+
+	struct Statement
+	{
+		enum Kind
+		{
+			Field,
+			If,
+			// `endian big;`, for the fields after it in the struct.
+			SetEndianness,
+		};
+		Kind kind;
+		int line;
+
+		Type type;
+		std::string name;
+		// For char and bytes `count` is the length, they are not arrays.
+		bool is_array = false;
+		// Null for arrays and lengths up to the end of the file.
+		std::unique_ptr<Expr> count;
+		// Checked before each element, with `@` at its offset.
+		std::unique_ptr<Expr> while_condition;
+		// Absolute offset. Such fields do not move the ones after them.
+		std::unique_ptr<Expr> at;
+
+		std::unique_ptr<Expr> condition;
+		std::vector<Statement> then_body;
+		std::vector<Statement> else_body;
+
+		Endianness endianness = Endianness::LittleEndian;
+	};
+
+	struct StructDef
+	{
+		std::string name;
+		std::vector<Statement> body;
+
+		// Size if it does not depend on contents, otherwise -1. Arrays of
+		// such structs are indexed without decoding the elements.
+		int64_t fixed_size = -1;
+	};
+
+	// Integer types like u32, i16le or u64be. Returns false for other names.
+	static bool ParseIntegerType(const std::string &name, Type &type);
+
+	// Fields at the top level, making up the whole file.
+	const StructDef& Root() const
+	{
+		return root;
+	}
+
+private:
+	// Owned here, types point to them.
+	std::vector< std::unique_ptr<StructDef> > structs;
+	StructDef root;
+};
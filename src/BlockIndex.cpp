@@ -0,0 +1,170 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "BlockIndex.hpp"
+#include "ByteSource.hpp"
+#include "IndexCache.hpp"
+#include "XXHash64.hpp"
+
+using namespace std;
+
+static const char kBlockIndexMagic[8] = {'H', 'E', 'X', 'A', 'B', 'L', 'K', '1'};
+
+shared_ptr<BlockIndex> BlockIndex::Compute(const ByteSource &source, const function<bool()> &cancelled)
+{
+	const uint8_t *data = source.Data();
+	const uint64_t size = source.Size();
+	const size_t block_count = (size + kBlockSize - 1) / kBlockSize;
+
+	auto index = make_shared<BlockIndex>();
+	index->size = size;
+	index->fingerprints.reserve(block_count);
+	index->uniform.reserve(block_count);
+
+	static const uint8_t zero_block[kBlockSize] = {0};
+	const uint64_t zero_fingerprint = XXHash64(zero_block, kBlockSize);
+
+	auto hole = source.Holes().begin();
+	const auto holes_end = source.Holes().end();
+
+	for (uint64_t offset = 0; offset < size; offset += kBlockSize)
+	{
+		if (offset / kBlockSize % (ByteSource::kCancelCheckBytes / kBlockSize) == 0 && cancelled())
+		{
+			return nullptr;
+		}
+
+		const uint64_t length = min(kBlockSize, size - offset);
+
+		while (hole != holes_end && hole->second <= offset)
+		{
+			++hole;
+		}
+
+		if (length == kBlockSize && hole != holes_end
+		    && hole->first <= offset && hole->second >= offset + kBlockSize)
+		{
+			index->fingerprints.push_back(zero_fingerprint);
+			index->uniform.push_back(0);
+			continue;
+		}
+
+		source.Materialize(offset, length);
+		const uint8_t *block = data + offset;
+
+		index->fingerprints.push_back(XXHash64(block, length));
+
+		// Every byte equals the next one. Compares in wide words, and the
+		// block is already in cache from hashing.
+		const bool is_uniform = memcmp(block, block + 1, length - 1) == 0;
+		index->uniform.push_back(is_uniform ? block[0] : kNotUniform);
+	}
+
+	return index;
+}
+
+shared_ptr<BlockIndex> BlockIndex::Load(const string &index_dir,
+                                        const string &file_name,
+                                        const struct stat &st)
+{
+	ifstream file(IndexCacheFileName(index_dir, file_name, ".blk"), ios::binary);
+	char magic[sizeof(kBlockIndexMagic)];
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, kBlockIndexMagic, sizeof(magic)) != 0)
+	{
+		return nullptr;
+	}
+
+	// Index is valid only for the exact file it is built from.
+	uint64_t size, inode, count;
+	int64_t mtime_sec, mtime_nsec;
+	if (!ReadIndexField(file, size) || size != (uint64_t)st.st_size
+	    || !ReadIndexField(file, inode) || inode != (uint64_t)st.st_ino
+	    || !ReadIndexField(file, mtime_sec) || mtime_sec != (int64_t)st.st_mtim.tv_sec
+	    || !ReadIndexField(file, mtime_nsec) || mtime_nsec != (int64_t)st.st_mtim.tv_nsec
+	    || !ReadIndexField(file, count) || count != (size + kBlockSize - 1) / kBlockSize)
+	{
+		return nullptr;
+	}
+
+	auto index = make_shared<BlockIndex>();
+	index->size = size;
+	index->fingerprints.resize(count);
+	index->uniform.resize(count);
+
+	if (!file.read(reinterpret_cast<char*>(index->fingerprints.data()), count * sizeof(uint64_t))
+	    || !file.read(reinterpret_cast<char*>(index->uniform.data()), count * sizeof(int16_t)))
+	{
+		return nullptr;
+	}
+	return index;
+}
+
+void BlockIndex::Save(const string &index_dir, const string &file_name, const struct stat &st) const
+{
+	// Status must match the mapped contents, or a later load would trust
+	// fingerprints of other contents.
+	if ((uint64_t)st.st_size != size)
+	{
+		return;
+	}
+
+	const string cache_file_name = IndexCacheFileName(index_dir, file_name, ".blk");
+	WriteIndexCacheFile(index_dir, cache_file_name, [this, &st](ofstream &file)
+	{
+		file.write(kBlockIndexMagic, sizeof(kBlockIndexMagic));
+		WriteIndexField(file, size);
+		WriteIndexField(file, (uint64_t)st.st_ino);
+		WriteIndexField(file, (int64_t)st.st_mtim.tv_sec);
+		WriteIndexField(file, (int64_t)st.st_mtim.tv_nsec);
+		WriteIndexField(file, (uint64_t)fingerprints.size());
+
+		file.write(reinterpret_cast<const char*>(fingerprints.data()), fingerprints.size() * sizeof(uint64_t));
+		file.write(reinterpret_cast<const char*>(uniform.data()), uniform.size() * sizeof(int16_t));
+	});
+}
+
+vector< pair<uint64_t, uint64_t> > BlockIndex::ChangedRanges(const BlockIndex &newer) const
+{
+	vector< pair<uint64_t, uint64_t> > ranges;
+
+	const uint64_t end = max(size, newer.size);
+	const size_t block_count = max(fingerprints.size(), newer.fingerprints.size());
+
+	for (size_t i = 0; i < block_count; ++i)
+	{
+		if (i < fingerprints.size() && i < newer.fingerprints.size()
+		    && fingerprints[i] == newer.fingerprints[i])
+		{
+			continue;
+		}
+
+		const uint64_t begin = i * kBlockSize;
+		if (!ranges.empty() && ranges.back().second == begin)
+		{
+			ranges.back().second = min(end, begin + kBlockSize);
+		}
+		else
+		{
+			ranges.emplace_back(begin, min(end, begin + kBlockSize));
+		}
+	}
+
+	return ranges;
+}
@@ -0,0 +1,87 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+class ByteSource;
+
+// Fingerprints of fixed size blocks of a source, computed once in
+// background and cached in the index directory.
+//
+// They tell which parts of a file changed on disk without keeping a copy of
+// it, and which blocks are a single repeated byte without reading them
+// again. Offsets are in the source, edits never change them.
+class BlockIndex
+{
+public:
+	static constexpr uint64_t kBlockSize = 4096;
+
+	// UniformByte of blocks with different bytes in them.
+	static constexpr int kNotUniform = -1;
+
+	// Blocks inside holes of the source are not read. Returns null if
+	// `cancelled` returns true before it is done.
+	static std::shared_ptr<BlockIndex> Compute(const ByteSource &source,
+	                                           const std::function<bool()> &cancelled);
+
+	// Index saved for the file with status `st`, null if there is none.
+	static std::shared_ptr<BlockIndex> Load(const std::string &index_dir,
+	                                        const std::string &file_name,
+	                                        const struct stat &st);
+	void Save(const std::string &index_dir,
+	          const std::string &file_name,
+	          const struct stat &st) const;
+
+	// Source size the index covers.
+	uint64_t Size() const
+	{
+		return size;
+	}
+
+	size_t BlockCount() const
+	{
+		return fingerprints.size();
+	}
+
+	uint64_t Fingerprint(size_t block) const
+	{
+		return fingerprints[block];
+	}
+
+	// Value of all bytes in the block, kNotUniform if they differ.
+	int UniformByte(size_t block) const
+	{
+		return uniform[block];
+	}
+
+	// Returns [begin, end) byte ranges, block aligned, where `newer` differs.
+	// Adjacent changed blocks are merged into one range.
+	std::vector< std::pair<uint64_t, uint64_t> > ChangedRanges(const BlockIndex &newer) const;
+
+private:
+	uint64_t size = 0;
+	std::vector<uint64_t> fingerprints;
+	std::vector<int16_t> uniform;
+};
@@ -0,0 +1,498 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HEXA_X86_COMPARE
+#endif
+
+#include "BufferDiff.hpp"
+
+using namespace std;
+
+// Equal runs shorter than this inside differing bytes are not worth a hunk
+// boundary, they are made part of the hunk.
+static constexpr uint64_t kMinEqualRun = 8;
+
+// Anchors are about 2^kAnchorBits bytes apart, unless a window would have
+// more than kMaxAnchors of them.
+static constexpr int kAnchorBits = 9;
+static constexpr uint64_t kMaxAnchors = 1 << 20;
+
+// Bytes compared at once when extending matches.
+static constexpr uint64_t kCompareBlockSize = 4096;
+
+// Random values per byte for the gear hash, where each byte is shifted out
+// after 64 more, so the hash depends only on the last 64 bytes.
+static const uint64_t (&GearTable())[256]
+{
+	static uint64_t table[256];
+	static bool initialized = []()
+	{
+		// splitmix64, any fixed random values would do.
+		uint64_t state = 0x6865786164696666ull;
+		for (uint64_t &value : table)
+		{
+			uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			value = z ^ (z >> 31);
+		}
+		return true;
+	}();
+	(void)initialized;
+	return table;
+}
+
+static uint64_t FirstDifferencePortable(const uint8_t *a, const uint8_t *b, uint64_t length)
+{
+	uint64_t i = 0;
+	for (; i + 8 <= length; i += 8)
+	{
+		uint64_t x, y;
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		if (x != y)
+		{
+			break;
+		}
+	}
+	for (; i < length; ++i)
+	{
+		if (a[i] != b[i])
+		{
+			return i;
+		}
+	}
+	return length;
+}
+
+#ifdef HEXA_X86_COMPARE
+
+__attribute__((target("avx2")))
+static uint64_t FirstDifferenceAvx2(const uint8_t *a, const uint8_t *b, uint64_t length)
+{
+	uint64_t i = 0;
+	for (; i + 64 <= length; i += 64)
+	{
+		const __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)),
+		                                      _mm256_loadu_si256((const __m256i*)(b + i)));
+		const __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i + 32)),
+		                                      _mm256_loadu_si256((const __m256i*)(b + i + 32)));
+		if (_mm256_movemask_epi8(_mm256_and_si256(eq0, eq1)) != -1)
+		{
+			const uint64_t mask = (uint32_t)_mm256_movemask_epi8(eq0)
+			                    | (uint64_t)(uint32_t)_mm256_movemask_epi8(eq1) << 32;
+			return i + __builtin_ctzll(~mask);
+		}
+	}
+	return i + FirstDifferencePortable(a + i, b + i, length - i);
+}
+
+static uint64_t FirstDifferenceSse2(const uint8_t *a, const uint8_t *b, uint64_t length)
+{
+	uint64_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+		                                                  _mm_loadu_si128((const __m128i*)(b + i))));
+		if (mask != 0xFFFF)
+		{
+			return i + __builtin_ctz(~mask);
+		}
+	}
+	return i + FirstDifferencePortable(a + i, b + i, length - i);
+}
+
+static bool HasAvx2()
+{
+	static const bool has = __builtin_cpu_supports("avx2");
+	return has;
+}
+
+#endif
+
+uint64_t BufferDiff::FirstDifference(const uint8_t *a, const uint8_t *b, uint64_t length)
+{
+#ifdef HEXA_X86_COMPARE
+	return HasAvx2() ? FirstDifferenceAvx2(a, b, length) : FirstDifferenceSse2(a, b, length);
+#else
+	return FirstDifferencePortable(a, b, length);
+#endif
+}
+
+BufferDiff::BufferDiff(BufferSnapshot a, BufferSnapshot b)
+  : a(move(a)), b(move(b))
+{
+}
+
+void BufferDiff::AddHunks(const vector<Hunk> &found, uint64_t scanned_length)
+{
+	scanned += scanned_length;
+	if (found.empty())
+	{
+		return;
+	}
+
+	auto pos = upper_bound(hunks.begin(), hunks.end(), found.front(), [](const Hunk &x, const Hunk &y)
+	{
+		return x.a_begin < y.a_begin || (x.a_begin == y.a_begin && x.b_begin < y.b_begin);
+	});
+	const size_t first = pos - hunks.begin();
+	hunks.insert(pos, found.begin(), found.end());
+
+	// Found hunks might touch the ones around them, found by other jobs.
+	const size_t merge_begin = (first > 0 ? first - 1 : 0);
+	const size_t merge_end = min(hunks.size(), first + found.size() + 1);
+
+	vector<Hunk> merged;
+	for (size_t i = merge_begin; i < merge_end; ++i)
+	{
+		const Hunk &h = hunks[i];
+		if (!merged.empty() && merged.back().a_end == h.a_begin && merged.back().b_end == h.b_begin)
+		{
+			merged.back().a_end = h.a_end;
+			merged.back().b_end = h.b_end;
+			continue;
+		}
+		merged.push_back(h);
+	}
+
+	hunks.erase(hunks.begin() + merge_begin, hunks.begin() + merge_end);
+	hunks.insert(hunks.begin() + merge_begin, merged.begin(), merged.end());
+}
+
+BufferDiff::Hunk BufferDiff::Region(size_t region) const
+{
+	const size_t k = region / 2;
+	if (region % 2 == 1)
+	{
+		return hunks[k];
+	}
+
+	Hunk h;
+	h.a_begin = (k == 0 ? 0 : hunks[k - 1].a_end);
+	h.b_begin = (k == 0 ? 0 : hunks[k - 1].b_end);
+	h.a_end = (k < hunks.size() ? hunks[k].a_begin : max(h.a_begin, a.Size()));
+	h.b_end = (k < hunks.size() ? hunks[k].b_begin : max(h.b_begin, b.Size()));
+	return h;
+}
+
+uint64_t BufferDiff::RowCount(size_t region, int columns) const
+{
+	const Hunk h = Region(region);
+	const uint64_t length = max(h.a_end - h.a_begin, h.b_end - h.b_begin);
+	return length == 0 ? 0 : (h.a_begin % columns + length + columns - 1) / columns;
+}
+
+uint64_t BufferDiff::RowOffset(const Row &row, int columns) const
+{
+	return row.index == 0 ? 0 : row.index * columns - Region(row.region).a_begin % columns;
+}
+
+BufferDiff::Row BufferDiff::RowOf(uint64_t a_pos, int columns) const
+{
+	auto it = upper_bound(hunks.begin(), hunks.end(), a_pos,
+	    [](uint64_t p, const Hunk &h) { return p < h.a_end; });
+	const size_t k = it - hunks.begin();
+
+	Row row;
+	row.region = (it != hunks.end() && it->a_begin <= a_pos ? 2 * k + 1 : 2 * k);
+
+	const uint64_t a_begin = min(a_pos, Region(row.region).a_begin);
+	row.index = (a_pos - a_begin + a_begin % columns) / columns;
+	return row;
+}
+
+bool BufferDiff::NextRow(Row &row, int columns) const
+{
+	if (row.index + 1 < RowCount(row.region, columns))
+	{
+		++row.index;
+		return true;
+	}
+
+	for (size_t region = row.region + 1; region < RegionCount(); ++region)
+	{
+		if (RowCount(region, columns) > 0)
+		{
+			row = Row{region, 0};
+			return true;
+		}
+	}
+	return false;
+}
+
+bool BufferDiff::PrevRow(Row &row, int columns) const
+{
+	if (row.index > 0)
+	{
+		--row.index;
+		return true;
+	}
+
+	for (size_t region = row.region; region-- > 0; )
+	{
+		const uint64_t row_count = RowCount(region, columns);
+		if (row_count > 0)
+		{
+			row = Row{region, row_count - 1};
+			return true;
+		}
+	}
+	return false;
+}
+
+vector<BufferDiff::Hunk> BufferDiff::CompareInPlace(const BufferSnapshot &a, const BufferSnapshot &b,
+                                                    uint64_t begin, uint64_t end,
+                                                    const function<bool()> &cancelled)
+{
+	vector<Hunk> hunks;
+
+	auto compare = [&](uint64_t pos, const uint8_t *a_data, const uint8_t *b_data, uint64_t length)
+	{
+		for (uint64_t i = 0; i < length; )
+		{
+			i += FirstDifference(a_data + i, b_data + i, length - i);
+			if (i == length)
+			{
+				break;
+			}
+
+			uint64_t j = i + 1;
+			while (j < length && a_data[j] != b_data[j])
+			{
+				++j;
+			}
+
+			if (!hunks.empty() && pos + i - hunks.back().a_end < kMinEqualRun)
+			{
+				hunks.back().a_end = hunks.back().b_end = pos + j;
+			}
+			else
+			{
+				hunks.push_back(Hunk{pos + i, pos + j, pos + i, pos + j});
+			}
+			i = j;
+		}
+	};
+
+	// Pieces of the two are split at different places, walk spans of B
+	// inside each span of A.
+	a.ForEachSpan(begin, end - begin, [&](uint64_t a_pos, const uint8_t *a_data, uint64_t a_length)
+	{
+		return b.ForEachSpan(a_pos, a_length, [&](uint64_t b_pos, const uint8_t *b_data, uint64_t b_length)
+		{
+			compare(b_pos, a_data + (b_pos - a_pos), b_data, b_length);
+			return !cancelled();
+		});
+	});
+
+	return hunks;
+}
+
+int BufferDiff::AnchorBits(uint64_t length)
+{
+	int bits = kAnchorBits;
+	while (bits < 63 && (length >> bits) > kMaxAnchors)
+	{
+		++bits;
+	}
+	return bits;
+}
+
+vector<BufferDiff::Anchor> BufferDiff::FindAnchors(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+                                                   int anchor_bits, const function<bool()> &cancelled)
+{
+	const auto &gear = GearTable();
+	const uint64_t anchor_mask = ~0ull << (64 - anchor_bits);
+	vector<Anchor> anchors;
+
+	// Start early enough for the hash to be the same as if hashing started
+	// from the beginning.
+	const uint64_t start = (begin > 64 ? begin - 64 : 0);
+	uint64_t hash = 0;
+
+	// Runs of a repeated byte keep the same hash, only their first position
+	// is taken.
+	bool previous_is_anchor = false;
+	uint64_t previous_hash = 0;
+
+	snapshot.ForEachSpan(start, end - start, [&](uint64_t pos, const uint8_t *data, uint64_t length)
+	{
+		for (uint64_t i = 0; i < length; ++i)
+		{
+			hash = (hash << 1) + gear[data[i]];
+
+			const bool is_anchor = ((hash & anchor_mask) == 0);
+			if (is_anchor && pos + i >= begin && !(previous_is_anchor && hash == previous_hash))
+			{
+				anchors.push_back(Anchor{hash, pos + i + 1});
+			}
+			previous_is_anchor = is_anchor;
+			previous_hash = hash;
+		}
+		return !cancelled();
+	});
+
+	return anchors;
+}
+
+vector< pair<uint64_t, uint64_t> > BufferDiff::MatchAnchors(const vector<Anchor> &a_anchors,
+                                                           const vector<Anchor> &b_anchors)
+{
+	// Hashes unique in both are found walking both sorted by hash, which
+	// takes no more memory than the anchors.
+	auto by_hash = [](const Anchor &x, const Anchor &y)
+	{
+		return x.hash < y.hash || (x.hash == y.hash && x.pos < y.pos);
+	};
+	vector<Anchor> a_sorted(a_anchors), b_sorted(b_anchors);
+	sort(a_sorted.begin(), a_sorted.end(), by_hash);
+	sort(b_sorted.begin(), b_sorted.end(), by_hash);
+
+	vector< pair<uint64_t, uint64_t> > pairs;
+	for (size_t i = 0, j = 0; i < a_sorted.size() && j < b_sorted.size(); )
+	{
+		const uint64_t hash = a_sorted[i].hash;
+		if (hash < b_sorted[j].hash)
+		{
+			++i;
+			continue;
+		}
+		if (hash > b_sorted[j].hash)
+		{
+			++j;
+			continue;
+		}
+
+		size_t a_count = 0, b_count = 0;
+		for (; i + a_count < a_sorted.size() && a_sorted[i + a_count].hash == hash; ++a_count)
+		{
+		}
+		for (; j + b_count < b_sorted.size() && b_sorted[j + b_count].hash == hash; ++b_count)
+		{
+		}
+		if (a_count == 1 && b_count == 1)
+		{
+			pairs.emplace_back(a_sorted[i].pos, b_sorted[j].pos);
+		}
+		i += a_count;
+		j += b_count;
+	}
+	sort(pairs.begin(), pairs.end());
+
+	// Pairs are increasing in A, keep the longest chain increasing in B.
+	// Moved blocks are left out, and become hunks.
+	vector<size_t> tails;
+	vector<size_t> previous(pairs.size());
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+		auto it = lower_bound(tails.begin(), tails.end(), pairs[i].second,
+		    [&pairs](size_t t, uint64_t b_pos) { return pairs[t].second < b_pos; });
+
+		previous[i] = (it == tails.begin() ? ~(size_t)0 : *(it - 1));
+		if (it == tails.end())
+		{
+			tails.push_back(i);
+		}
+		else
+		{
+			*it = i;
+		}
+	}
+
+	vector< pair<uint64_t, uint64_t> > chain(tails.size());
+	size_t i = (tails.empty() ? ~(size_t)0 : tails.back());
+	for (size_t n = chain.size(); n-- > 0; i = previous[i])
+	{
+		chain[n] = pairs[i];
+	}
+	return chain;
+}
+
+// Length of the common prefix of A from `a_pos` and B from `b_pos`, up to
+// `length`.
+static uint64_t CommonPrefix(const BufferSnapshot &a, uint64_t a_pos,
+                             const BufferSnapshot &b, uint64_t b_pos, uint64_t length)
+{
+	uint8_t a_block[kCompareBlockSize], b_block[kCompareBlockSize];
+
+	uint64_t common = 0;
+	while (common < length)
+	{
+		const uint64_t n = min(kCompareBlockSize, length - common);
+		a.Read(a_pos + common, a_block, n);
+		b.Read(b_pos + common, b_block, n);
+
+		const uint64_t same = BufferDiff::FirstDifference(a_block, b_block, n);
+		common += same;
+		if (same < n)
+		{
+			break;
+		}
+	}
+	return common;
+}
+
+// Same as above, for the common suffix of A before `a_end` and B before
+// `b_end`.
+static uint64_t CommonSuffix(const BufferSnapshot &a, uint64_t a_end,
+                             const BufferSnapshot &b, uint64_t b_end, uint64_t length)
+{
+	uint8_t a_block[kCompareBlockSize], b_block[kCompareBlockSize];
+
+	uint64_t common = 0;
+	while (common < length)
+	{
+		const uint64_t n = min(kCompareBlockSize, length - common);
+		a.Read(a_end - common - n, a_block, n);
+		b.Read(b_end - common - n, b_block, n);
+
+		uint64_t same = 0;
+		while (same < n && a_block[n - 1 - same] == b_block[n - 1 - same])
+		{
+			++same;
+		}
+		common += same;
+		if (same < n)
+		{
+			break;
+		}
+	}
+	return common;
+}
+
+void BufferDiff::AlignBetween(const BufferSnapshot &a, const BufferSnapshot &b,
+                              uint64_t a_begin, uint64_t a_end, uint64_t b_begin, uint64_t b_end,
+                              vector<Hunk> &hunks)
+{
+	const uint64_t prefix = CommonPrefix(a, a_begin, b, b_begin, min(a_end - a_begin, b_end - b_begin));
+	a_begin += prefix;
+	b_begin += prefix;
+
+	const uint64_t suffix = CommonSuffix(a, a_end, b, b_end, min(a_end - a_begin, b_end - b_begin));
+	a_end -= suffix;
+	b_end -= suffix;
+
+	if (a_begin < a_end || b_begin < b_end)
+	{
+		hunks.push_back(Hunk{a_begin, a_end, b_begin, b_end});
+	}
+}
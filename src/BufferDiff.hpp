@@ -0,0 +1,185 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "FileBuffer.hpp"
+
+// Differences between two buffers, A and B, as hunks of A replaced by
+// bytes of B. Bytes between hunks are the same in both.
+//
+// Computed in background: workers produce hunks with the static functions
+// below, and they are added on the main thread as they come, so the diff
+// can be shown before it is complete.
+class BufferDiff
+{
+public:
+	struct Hunk
+	{
+		uint64_t a_begin;
+		uint64_t a_end;
+		uint64_t b_begin;
+		uint64_t b_end;
+	};
+
+	// Content defined position: bytes before `pos` hashed to `hash`.
+	struct Anchor
+	{
+		uint64_t hash;
+		uint64_t pos;
+	};
+
+	// Row of the side by side view. Regions alternate between ranges which
+	// are the same in both and hunks: region 2k is the range before hunk
+	// k, 2k + 1 is hunk k, and the last one is the range after all hunks.
+	struct Row
+	{
+		size_t region;
+		uint64_t index;
+
+		bool operator<(const Row &o) const
+		{
+			return region < o.region || (region == o.region && index < o.index);
+		}
+	};
+
+	BufferDiff(BufferSnapshot a, BufferSnapshot b);
+	BufferDiff(const BufferDiff &ot) = delete;
+	BufferDiff& operator=(const BufferDiff &ot) = delete;
+
+	const BufferSnapshot& A() const
+	{
+		return a;
+	}
+
+	const BufferSnapshot& B() const
+	{
+		return b;
+	}
+
+	// Sorted, in both A and B offsets.
+	const std::vector<Hunk>& Hunks() const
+	{
+		return hunks;
+	}
+
+	// Adds hunks found in `scanned_length` more bytes of A, merging ones
+	// which touch.
+	void AddHunks(const std::vector<Hunk> &found, uint64_t scanned_length);
+
+	void Finish()
+	{
+		complete = true;
+	}
+
+	bool Complete() const
+	{
+		return complete;
+	}
+
+	// Percent of A compared so far.
+	int Progress() const
+	{
+		return a.Size() == 0 ? 100 : (int)(std::min(scanned, a.Size()) * 100 / a.Size());
+	}
+
+	// Stops the background jobs computing the diff.
+	void Cancel()
+	{
+		cancelled = true;
+	}
+
+	bool Cancelled() const
+	{
+		return cancelled;
+	}
+
+	// Range of A and B a region covers, see Row.
+	Hunk Region(size_t region) const;
+
+	size_t RegionCount() const
+	{
+		return 2 * hunks.size() + 1;
+	}
+
+	// Rows a region takes with `columns` bytes per row. Rows are aligned to
+	// multiples of `columns` in A, so the first one might be shorter.
+	uint64_t RowCount(size_t region, int columns) const;
+
+	// Offset of a row from the start of its region.
+	uint64_t RowOffset(const Row &row, int columns) const;
+
+	// Row showing byte `a_pos` of A.
+	Row RowOf(uint64_t a_pos, int columns) const;
+
+	// Move to the adjacent row, skipping empty regions. Return false at
+	// either end.
+	bool NextRow(Row &row, int columns) const;
+	bool PrevRow(Row &row, int columns) const;
+
+	// Index of the first differing byte of `a` and `b`, `length` if none.
+	static uint64_t FirstDifference(const uint8_t *a, const uint8_t *b, uint64_t length);
+
+	// Hunks of [begin, end) of equally sized snapshots, comparing bytes at
+	// the same offsets.
+	static std::vector<Hunk> CompareInPlace(const BufferSnapshot &a, const BufferSnapshot &b,
+	                                        uint64_t begin, uint64_t end,
+	                                        const std::function<bool()> &cancelled);
+
+	// Anchors are matched in windows of about this many bytes of both, see
+	// AnchorBits.
+	static constexpr uint64_t kAnchorWindow = 64 << 20;
+
+	// Bits of the hash which are zero at anchors in a window of `length`
+	// bytes. Anchors are about 512 bytes apart, sparser in windows too long
+	// for that, so a window has at most about a million of them.
+	static int AnchorBits(uint64_t length);
+
+	// Anchors in [begin, end) of the snapshot, where a rolling hash of the
+	// bytes before has its top `anchor_bits` bits zero. They depend only on
+	// the contents, so inserted or deleted bytes do not move the ones around
+	// them.
+	static std::vector<Anchor> FindAnchors(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+	                                       int anchor_bits, const std::function<bool()> &cancelled);
+
+	// Pairs of A and B positions of anchors whose hashes are unique in both,
+	// the longest chain increasing in both. Anchors are sorted by position.
+	static std::vector< std::pair<uint64_t, uint64_t> > MatchAnchors(const std::vector<Anchor> &a_anchors,
+	                                                               const std::vector<Anchor> &b_anchors);
+
+	// Appends the hunk of [a_begin, a_end) and [b_begin, b_end) after their
+	// common prefix and suffix, if any.
+	static void AlignBetween(const BufferSnapshot &a, const BufferSnapshot &b,
+	                         uint64_t a_begin, uint64_t a_end, uint64_t b_begin, uint64_t b_end,
+	                         std::vector<Hunk> &hunks);
+
+private:
+	const BufferSnapshot a;
+	const BufferSnapshot b;
+
+	std::vector<Hunk> hunks;
+
+	// Bytes of A compared so far.
+	uint64_t scanned = 0;
+	bool complete = false;
+
+	std::atomic<bool> cancelled{false};
+};
@@ -0,0 +1,108 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "ByteHistogram.hpp"
+
+using namespace std;
+
+// Counted into 32 bit bins, flushed before they might overflow.
+static constexpr uint64_t kFlushLength = 1ull << 30;
+
+// c * log2(c) for counts up to a page. Entropy of n bytes is then
+// log2(n) - sum(c * log2(c)) / n, small inputs need no logarithm.
+static constexpr size_t kCountLogTableSize = 4096 + 1;
+
+static const vector<float>& CountLogTable()
+{
+	static const vector<float> table = []()
+	{
+		vector<float> t(kCountLogTableSize, 0.0f);
+		for (size_t c = 1; c < t.size(); ++c)
+		{
+			t[c] = c * log2((double)c);
+		}
+		return t;
+	}();
+	return table;
+}
+
+void ByteHistogram::Add(const uint8_t *data, uint64_t length)
+{
+	while (length > 0)
+	{
+		const uint64_t part = min(length, kFlushLength);
+
+		// Counting into four tables breaks the dependency between
+		// consecutive increments of the same bin, which otherwise
+		// serialises runs of equal bytes. The compiler keeps the four
+		// streams in flight together.
+		uint32_t part_counts[4][256] = {{0}};
+
+		uint64_t i = 0;
+		for (; i + 4 <= part; i += 4)
+		{
+			++part_counts[0][data[i]];
+			++part_counts[1][data[i + 1]];
+			++part_counts[2][data[i + 2]];
+			++part_counts[3][data[i + 3]];
+		}
+		for (; i < part; ++i)
+		{
+			++part_counts[0][data[i]];
+		}
+
+		for (int b = 0; b < 256; ++b)
+		{
+			counts[b] += (uint64_t)part_counts[0][b] + part_counts[1][b]
+			           + part_counts[2][b] + part_counts[3][b];
+		}
+
+		data += part;
+		length -= part;
+	}
+}
+
+uint64_t ByteHistogram::Total() const
+{
+	uint64_t total = 0;
+	for (uint64_t c : counts)
+	{
+		total += c;
+	}
+	return total;
+}
+
+double ByteHistogram::Entropy() const
+{
+	const uint64_t total = Total();
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	const vector<float> &count_log = CountLogTable();
+	double sum = 0;
+	for (uint64_t c : counts)
+	{
+		sum += (c < count_log.size() ? count_log[c] : c * log2((double)c));
+	}
+
+	return max(0.0, log2((double)total) - sum / total);
+}
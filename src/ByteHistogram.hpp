@@ -0,0 +1,62 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Counts of each byte value in some data.
+//
+// Large inputs are split in parts, each counted into its own histogram on
+// a different thread, and merged at the end.
+class ByteHistogram
+{
+public:
+	ByteHistogram()
+	{
+		counts.fill(0);
+	}
+
+	void Add(const uint8_t *data, uint64_t length);
+
+	// Adds `count` bytes of `value` without reading them, like for holes.
+	void AddRepeated(uint8_t value, uint64_t count)
+	{
+		counts[value] += count;
+	}
+
+	void Merge(const ByteHistogram &ot)
+	{
+		for (int b = 0; b < 256; ++b)
+		{
+			counts[b] += ot.counts[b];
+		}
+	}
+
+	uint64_t Count(uint8_t value) const
+	{
+		return counts[value];
+	}
+
+	uint64_t Total() const;
+
+	// Shannon entropy in bits per byte, from 0 to 8.
+	double Entropy() const;
+
+private:
+	std::array<uint64_t, 256> counts;
+};
@@ -0,0 +1,975 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "ByteRegex.hpp"
+
+using namespace std;
+
+// Repetitions are expanded into copies, these keep the NFA small enough.
+static const int kMaxRepeat = 1000;
+static const size_t kMaxNfaStates = 100000;
+
+// DFA states kept at once, the cache is cleared when there are more.
+static const size_t kMaxDfaStates = 2000;
+
+// Transitions not computed yet, and what ends each group of NFA states in
+// a DFA state.
+static const int kUnknown = -1;
+static const int kGroupEnd = -1;
+
+struct ByteRegex::Node
+{
+	enum class Type
+	{
+		Bytes,
+		Concat,
+		Alternate,
+		Repeat,
+	};
+
+	Type type;
+	bitset<256> bytes;
+	vector<Node> children;
+
+	// Repeat bounds, -1 for no upper bound.
+	int min = 0;
+	int max = 0;
+};
+
+// Part of the NFA being built: its first state and the unset outs of its
+// last states, as (state, whether it is out2).
+struct ByteRegex::Fragment
+{
+	int start;
+	vector< pair<int, bool> > outs;
+};
+
+namespace
+{
+
+typedef ByteRegex::Match Match;
+
+class Parser
+{
+public:
+	typedef bitset<256> Bytes;
+
+	explicit Parser(const string &pattern)
+	  : pattern(pattern)
+	{
+	}
+
+	template <typename Node>
+	Node Parse()
+	{
+		Node node = ParseAlternate<Node>();
+		if (pos < pattern.size())
+		{
+			Fail(pattern[pos] == ')' ? "Unmatched )" : "Unexpected character");
+		}
+		return node;
+	}
+
+private:
+	[[noreturn]] void Fail(const string &message) const
+	{
+		throw invalid_argument(message + " at " + to_string(pos) + " in pattern");
+	}
+
+	bool AtEnd() const
+	{
+		return pos >= pattern.size();
+	}
+
+	uint8_t Peek() const
+	{
+		return pattern[pos];
+	}
+
+	template <typename Node>
+	Node ParseAlternate()
+	{
+		Node node = ParseConcat<Node>();
+		if (AtEnd() || Peek() != '|')
+		{
+			return node;
+		}
+
+		Node alternate;
+		alternate.type = Node::Type::Alternate;
+		alternate.children.push_back(move(node));
+		while (!AtEnd() && Peek() == '|')
+		{
+			++pos;
+			alternate.children.push_back(ParseConcat<Node>());
+		}
+		return alternate;
+	}
+
+	template <typename Node>
+	Node ParseConcat()
+	{
+		Node concat;
+		concat.type = Node::Type::Concat;
+		while (!AtEnd() && Peek() != '|' && Peek() != ')')
+		{
+			concat.children.push_back(ParseRepeat<Node>());
+		}
+		return concat;
+	}
+
+	template <typename Node>
+	Node ParseRepeat()
+	{
+		Node node = ParseAtom<Node>();
+		while (!AtEnd())
+		{
+			int min, max;
+			const size_t repeat_pos = pos;
+			if (Peek() == '*')
+			{
+				min = 0, max = -1;
+				++pos;
+			}
+			else if (Peek() == '+')
+			{
+				min = 1, max = -1;
+				++pos;
+			}
+			else if (Peek() == '?')
+			{
+				min = 0, max = 1;
+				++pos;
+			}
+			else if (Peek() == '{')
+			{
+				++pos;
+				min = max = ParseCount();
+				if (!AtEnd() && Peek() == ',')
+				{
+					++pos;
+					max = (!AtEnd() && Peek() == '}' ? -1 : ParseCount());
+				}
+				if (AtEnd() || Peek() != '}')
+				{
+					Fail("Expected }");
+				}
+				++pos;
+				if (max != -1 && max < min)
+				{
+					pos = repeat_pos;
+					Fail("Repeat bounds are reversed");
+				}
+			}
+			else
+			{
+				break;
+			}
+
+			Node repeat;
+			repeat.type = Node::Type::Repeat;
+			repeat.min = min;
+			repeat.max = max;
+			repeat.children.push_back(move(node));
+			node = move(repeat);
+		}
+		return node;
+	}
+
+	int ParseCount()
+	{
+		int count = 0;
+		const size_t count_pos = pos;
+		while (!AtEnd() && isdigit(Peek()))
+		{
+			count = count * 10 + (Peek() - '0');
+			if (count > kMaxRepeat)
+			{
+				Fail("Repeat count is more than " + to_string(kMaxRepeat));
+			}
+			++pos;
+		}
+		if (pos == count_pos)
+		{
+			Fail("Expected a number");
+		}
+		return count;
+	}
+
+	template <typename Node>
+	Node ParseAtom()
+	{
+		Node node;
+		node.type = Node::Type::Bytes;
+
+		const uint8_t c = Peek();
+		if (c == '(')
+		{
+			++pos;
+			node = ParseAlternate<Node>();
+			if (AtEnd() || Peek() != ')')
+			{
+				Fail("Expected )");
+			}
+			++pos;
+		}
+		else if (c == '[')
+		{
+			node.bytes = ParseClass();
+		}
+		else if (c == '.')
+		{
+			node.bytes.set();
+			++pos;
+		}
+		else if (c == '\\')
+		{
+			node.bytes = ParseEscape();
+		}
+		else if (c == '*' || c == '+' || c == '?' || c == '{')
+		{
+			Fail("Nothing to repeat");
+		}
+		else
+		{
+			node.bytes.set(c);
+			++pos;
+		}
+		return node;
+	}
+
+	Bytes ParseClass()
+	{
+		++pos;
+		bool negate = false;
+		if (!AtEnd() && Peek() == '^')
+		{
+			negate = true;
+			++pos;
+		}
+
+		Bytes bytes;
+		bool first = true;
+		while (!AtEnd() && (Peek() != ']' || first))
+		{
+			first = false;
+
+			int low;
+			Bytes item = ParseClassItem(low);
+			if (low >= 0 && pos + 1 < pattern.size() && Peek() == '-' && pattern[pos + 1] != ']')
+			{
+				++pos;
+				int high;
+				const size_t high_pos = pos;
+				ParseClassItem(high);
+				if (high < 0 || high < low)
+				{
+					pos = high_pos;
+					Fail("Invalid range");
+				}
+				for (int b = low; b <= high; ++b)
+				{
+					item.set(b);
+				}
+			}
+			bytes |= item;
+		}
+		if (AtEnd())
+		{
+			Fail("Expected ]");
+		}
+		++pos;
+
+		return negate ? ~bytes : bytes;
+	}
+
+	// Single byte in `byte`, or -1 for classes like \d.
+	Bytes ParseClassItem(int &byte)
+	{
+		Bytes bytes;
+		if (Peek() == '\\')
+		{
+			bytes = ParseEscape();
+		}
+		else
+		{
+			bytes.set(Peek());
+			++pos;
+		}
+		byte = -1;
+		if (bytes.count() == 1)
+		{
+			for (int b = 0; b < 256; ++b)
+				if (bytes[b])
+					byte = b;
+		}
+		return bytes;
+	}
+
+	Bytes ParseEscape()
+	{
+		++pos;
+		if (AtEnd())
+		{
+			Fail("Pattern ends with \\");
+		}
+
+		Bytes bytes;
+		const uint8_t c = Peek();
+		++pos;
+
+		auto set_range = [&bytes](int low, int high)
+		{
+			for (int b = low; b <= high; ++b)
+				bytes.set(b);
+		};
+
+		switch (c)
+		{
+		case 'x':
+		{
+			if (pos + 2 > pattern.size() || !isxdigit((uint8_t)pattern[pos]) || !isxdigit((uint8_t)pattern[pos + 1]))
+			{
+				Fail("Expected two hex digits");
+			}
+			bytes.set(stoi(pattern.substr(pos, 2), nullptr, 16));
+			pos += 2;
+			return bytes;
+		}
+		case 'n':
+			bytes.set('\n');
+			return bytes;
+		case 'r':
+			bytes.set('\r');
+			return bytes;
+		case 't':
+			bytes.set('\t');
+			return bytes;
+		case '0':
+			bytes.set(0);
+			return bytes;
+		case 'd':
+		case 'D':
+			set_range('0', '9');
+			break;
+		case 'w':
+		case 'W':
+			set_range('0', '9');
+			set_range('a', 'z');
+			set_range('A', 'Z');
+			bytes.set('_');
+			break;
+		case 's':
+		case 'S':
+			for (char space : string(" \t\n\r\v\f"))
+				bytes.set(space);
+			break;
+		default:
+			if (isalnum(c))
+			{
+				--pos;
+				Fail("Unknown escape");
+			}
+			// Escaped punctuation is taken as is.
+			bytes.set(c);
+			return bytes;
+		}
+
+		return isupper(c) ? ~bytes : bytes;
+	}
+
+	const string &pattern;
+	size_t pos = 0;
+};
+
+// Appends the bytes the node always matches, returns whether all of it is
+// such bytes, so the ones after it can follow.
+template <typename Node>
+bool AppendLiteral(const Node &node, string &literal)
+{
+	const size_t kMaxLiteral = 64;
+	if (literal.size() >= kMaxLiteral)
+	{
+		return false;
+	}
+
+	switch (node.type)
+	{
+	case Node::Type::Bytes:
+		if (node.bytes.count() != 1)
+		{
+			return false;
+		}
+		for (int b = 0; b < 256; ++b)
+		{
+			if (node.bytes[b])
+			{
+				literal.push_back((char)b);
+			}
+		}
+		return true;
+	case Node::Type::Concat:
+		for (const Node &child : node.children)
+		{
+			if (!AppendLiteral(child, literal))
+			{
+				return false;
+			}
+		}
+		return true;
+	case Node::Type::Repeat:
+		for (int i = 0; i < node.min; ++i)
+		{
+			if (!AppendLiteral(node.children[0], literal))
+			{
+				return false;
+			}
+		}
+		return node.max == node.min;
+	case Node::Type::Alternate:
+		return false;
+	}
+	return false;
+}
+
+// Makes the node match its bytes in reverse order.
+template <typename Node>
+void Reverse(Node &node)
+{
+	if (node.type == Node::Type::Concat)
+	{
+		reverse(node.children.begin(), node.children.end());
+	}
+	for (Node &child : node.children)
+	{
+		Reverse(child);
+	}
+}
+
+} // namespace
+
+// Reads a snapshot a block at a time, going either way.
+class ByteRegex::BlockReader
+{
+public:
+	explicit BlockReader(const BufferSnapshot &snapshot)
+	  : snapshot(snapshot)
+	  , size(snapshot.Size())
+	  , block(kBlockLength)
+	{
+	}
+
+	// Bytes from `pos` on, `available` of them. These are at least a few
+	// unless the snapshot ends.
+	const uint8_t* From(uint64_t pos, uint64_t &available)
+	{
+		if (pos < block_begin || pos > block_end || (block_end - pos < kMinAvailable && block_end < size))
+		{
+			Load(pos);
+		}
+		available = block_end - pos;
+		return block.data() + (pos - block_begin);
+	}
+
+	// Bytes before `pos`, `available` of them, which end at the returned
+	// pointer. `pos` must not be 0.
+	const uint8_t* Before(uint64_t pos, uint64_t &available)
+	{
+		if (pos <= block_begin || pos > block_end)
+		{
+			Load(pos - min(pos, kBlockLength));
+		}
+		available = pos - block_begin;
+		return block.data() + (pos - block_begin);
+	}
+
+private:
+	static constexpr uint64_t kBlockLength = 1 << 20;
+	static constexpr uint64_t kMinAvailable = 4 << 10;
+
+	void Load(uint64_t pos)
+	{
+		block_begin = pos;
+		block_end = pos + snapshot.Read(pos, block.data(), block.size());
+	}
+
+	const BufferSnapshot &snapshot;
+	const uint64_t size;
+	vector<uint8_t> block;
+	uint64_t block_begin = 0;
+	uint64_t block_end = 0;
+};
+
+ByteRegex::ByteRegex(const string &pattern)
+{
+	if (pattern.empty())
+	{
+		throw invalid_argument("Pattern is empty");
+	}
+
+	Parser parser(pattern);
+	Node root = parser.Parse<Node>();
+
+	start = CompileMatch(root);
+
+	vector<int> first = {start};
+	vector<bool> seen(states.size());
+	Closure(first, seen);
+	for (int s : first)
+	{
+		if (states[s].type == State::Type::Match)
+		{
+			throw invalid_argument("Pattern matches no bytes");
+		}
+		for (int b = 0; b < 256; ++b)
+		{
+			first_bytes[b] |= states[s].bytes[b];
+		}
+	}
+
+	AppendLiteral(root, literal_prefix);
+
+	Reverse(root);
+	reverse_start = CompileMatch(root);
+}
+
+int ByteRegex::CompileMatch(const Node &node)
+{
+	Fragment fragment = Compile(node);
+	const int match = AddState(State::Type::Match);
+	for (const auto &out : fragment.outs)
+	{
+		(out.second ? states[out.first].out2 : states[out.first].out) = match;
+	}
+	return fragment.start;
+}
+
+int ByteRegex::AddState(State::Type type)
+{
+	if (states.size() >= kMaxNfaStates)
+	{
+		throw invalid_argument("Pattern is too large");
+	}
+	states.emplace_back();
+	states.back().type = type;
+	return states.size() - 1;
+}
+
+ByteRegex::Fragment ByteRegex::Compile(const Node &node)
+{
+	auto patch = [this](const Fragment &fragment, int target)
+	{
+		for (const auto &out : fragment.outs)
+		{
+			(out.second ? states[out.first].out2 : states[out.first].out) = target;
+		}
+	};
+
+	// Matches nothing, a split state with one way out.
+	auto empty = [this]()
+	{
+		const int s = AddState(State::Type::Split);
+		return Fragment{s, {{s, false}}};
+	};
+
+	switch (node.type)
+	{
+	case Node::Type::Bytes:
+	{
+		const int s = AddState(State::Type::Byte);
+		states[s].bytes = node.bytes;
+		return Fragment{s, {{s, false}}};
+	}
+	case Node::Type::Concat:
+	{
+		if (node.children.empty())
+		{
+			return empty();
+		}
+		Fragment result = Compile(node.children[0]);
+		for (size_t i = 1; i < node.children.size(); ++i)
+		{
+			Fragment next = Compile(node.children[i]);
+			patch(result, next.start);
+			result.outs = move(next.outs);
+		}
+		return result;
+	}
+	case Node::Type::Alternate:
+	{
+		Fragment result = Compile(node.children.back());
+		for (size_t i = node.children.size() - 1; i-- > 0; )
+		{
+			Fragment option = Compile(node.children[i]);
+			const int s = AddState(State::Type::Split);
+			states[s].out = option.start;
+			states[s].out2 = result.start;
+			option.outs.insert(option.outs.end(), result.outs.begin(), result.outs.end());
+			result = Fragment{s, move(option.outs)};
+		}
+		return result;
+	}
+	case Node::Type::Repeat:
+	{
+		const Node &child = node.children[0];
+		Fragment result = empty();
+
+		// Required copies, then either a loop or optional copies.
+		for (int i = 0; i < node.min; ++i)
+		{
+			Fragment copy = Compile(child);
+			patch(result, copy.start);
+			result.outs = move(copy.outs);
+		}
+
+		if (node.max == -1)
+		{
+			Fragment copy = Compile(child);
+			const int s = AddState(State::Type::Split);
+			states[s].out = copy.start;
+			patch(copy, s);
+			patch(result, s);
+			result.outs = {{s, true}};
+		}
+		for (int i = node.min; i < node.max; ++i)
+		{
+			Fragment copy = Compile(child);
+			const int s = AddState(State::Type::Split);
+			states[s].out = copy.start;
+			patch(result, s);
+			copy.outs.emplace_back(s, true);
+			result.outs = move(copy.outs);
+		}
+		return result;
+	}
+	}
+	return empty();
+}
+
+void ByteRegex::Closure(vector<int> &nfa_states, vector<bool> &seen) const
+{
+	vector<int> stack = nfa_states;
+	nfa_states.clear();
+
+	while (!stack.empty())
+	{
+		const int s = stack.back();
+		stack.pop_back();
+		if (s < 0 || seen[s])
+		{
+			continue;
+		}
+		seen[s] = true;
+
+		if (states[s].type == State::Type::Split)
+		{
+			stack.push_back(states[s].out2);
+			stack.push_back(states[s].out);
+		}
+		else
+		{
+			nfa_states.push_back(s);
+		}
+	}
+	sort(nfa_states.begin(), nfa_states.end());
+}
+
+ByteRegex::Dfa::Dfa(const ByteRegex &regex, int nfa_start)
+  : regex(regex)
+  , start_states({nfa_start})
+{
+	vector<bool> seen(regex.states.size());
+	regex.Closure(start_states, seen);
+	empty = StateOf({});
+}
+
+int ByteRegex::Dfa::StateOf(vector<int> state_groups)
+{
+	auto it = ids.find(state_groups);
+	if (it != ids.end())
+	{
+		return it->second;
+	}
+
+	bool accepts = false;
+	for (int s : state_groups)
+	{
+		accepts |= (s != kGroupEnd && regex.states[s].type == State::Type::Match);
+	}
+
+	const int id = groups.size();
+	ids.emplace(state_groups, id);
+	groups.push_back(move(state_groups));
+	accepting.push_back(accepts);
+	transitions.emplace_back(512, kUnknown);
+	return id;
+}
+
+int ByteRegex::Dfa::Next(int state, uint8_t byte, bool start)
+{
+	const int index = byte + (start ? 256 : 0);
+	int next = transitions[state][index];
+	if (next != kUnknown)
+	{
+		return next;
+	}
+
+	// NFA states are kept in the first group reaching them, as matches
+	// from the others would be the same but start later.
+	vector<int> next_groups;
+	vector<bool> seen(regex.states.size());
+	auto add_group = [&](const int *begin, const int *end)
+	{
+		vector<int> nfa_states;
+		for (const int *s = begin; s != end; ++s)
+		{
+			const State &nfa_state = regex.states[*s];
+			if (nfa_state.type == State::Type::Byte && nfa_state.bytes[byte])
+			{
+				nfa_states.push_back(nfa_state.out);
+			}
+		}
+		regex.Closure(nfa_states, seen);
+
+		bool accepts = false;
+		for (int s : nfa_states)
+		{
+			accepts |= (regex.states[s].type == State::Type::Match);
+		}
+		if (!nfa_states.empty())
+		{
+			next_groups.insert(next_groups.end(), nfa_states.begin(), nfa_states.end());
+			next_groups.push_back(kGroupEnd);
+		}
+		return accepts;
+	};
+
+	const vector<int> &current = groups[state];
+	bool accepts = false;
+	size_t group_begin = 0;
+	for (size_t i = 0; i < current.size() && !accepts; ++i)
+	{
+		if (current[i] == kGroupEnd)
+		{
+			accepts = add_group(current.data() + group_begin, current.data() + i);
+			group_begin = i + 1;
+		}
+	}
+	if (start && !accepts)
+	{
+		add_group(start_states.data(), start_states.data() + start_states.size());
+	}
+
+	if (groups.size() >= kMaxDfaStates)
+	{
+		// Starts over, the transition is not kept as `state` is gone.
+		groups.clear();
+		accepting.clear();
+		transitions.clear();
+		ids.clear();
+		empty = StateOf({});
+		return StateOf(move(next_groups));
+	}
+
+	next = StateOf(move(next_groups));
+	transitions[state][index] = next;
+	return next;
+}
+
+uint64_t ByteRegex::NextCandidate(BlockReader &reader, uint64_t pos, uint64_t end) const
+{
+	while (pos < end)
+	{
+		uint64_t available;
+		const uint8_t *data = reader.From(pos, available);
+
+		if (!literal_prefix.empty())
+		{
+			const uint64_t haystack = min(available, end - pos + literal_prefix.size() - 1);
+			const void *candidate = memmem(data, haystack, literal_prefix.data(), literal_prefix.size());
+			if (candidate)
+			{
+				return pos + (static_cast<const uint8_t*>(candidate) - data);
+			}
+			if (haystack < literal_prefix.size())
+			{
+				break;
+			}
+			// The prefix might start in the last bytes and go on after them.
+			pos += haystack - literal_prefix.size() + 1;
+		}
+		else
+		{
+			const uint64_t length = min(available, end - pos);
+			if (length == 0)
+			{
+				break;
+			}
+			for (uint64_t i = 0; i < length; ++i)
+			{
+				if (first_bytes[data[i]])
+				{
+					return pos + i;
+				}
+			}
+			pos += length;
+		}
+	}
+	return end;
+}
+
+bool ByteRegex::FindEnd(Dfa &forward, BlockReader &reader, uint64_t pos, uint64_t end,
+                        uint64_t &match_end, const function<bool()> &cancelled) const
+{
+	uint64_t next_cancel_check = pos;
+
+	// After a match no threads are started, those would start later.
+	bool matched = false;
+	int state = forward.Empty();
+	while (1)
+	{
+		if (state == forward.Empty())
+		{
+			if (matched || pos >= end)
+			{
+				return matched;
+			}
+			pos = NextCandidate(reader, pos, end);
+			if (pos >= end)
+			{
+				return false;
+			}
+		}
+		if (pos >= next_cancel_check)
+		{
+			if (cancelled())
+			{
+				return false;
+			}
+			next_cancel_check = pos + ByteSource::kCancelCheckBytes;
+		}
+
+		uint64_t available;
+		const uint8_t *data = reader.From(pos, available);
+		if (available == 0)
+		{
+			return matched;
+		}
+
+		uint64_t i = 0;
+		do
+		{
+			state = forward.Next(state, data[i], !matched && pos + i < end);
+			++i;
+			if (forward.Accepting(state))
+			{
+				matched = true;
+				match_end = pos + i;
+			}
+		} while (i < available && state != forward.Empty());
+		pos += i;
+	}
+}
+
+uint64_t ByteRegex::FindBegin(Dfa &backward, BlockReader &reader, uint64_t pos, uint64_t match_end) const
+{
+	uint64_t match_begin = match_end;
+	int state = backward.Empty();
+	uint64_t i = match_end;
+	while (i > pos)
+	{
+		uint64_t available;
+		const uint8_t *data = reader.Before(i, available);
+		available = min(available, i - pos);
+		for (uint64_t k = 0; k < available; ++k)
+		{
+			state = backward.Next(state, *--data, i == match_end);
+			--i;
+			if (backward.Accepting(state))
+			{
+				match_begin = i;
+			}
+			else if (state == backward.Empty())
+			{
+				return match_begin;
+			}
+		}
+	}
+	return match_begin;
+}
+
+vector<Match> ByteRegex::Find(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+                              size_t limit, const function<bool()> &cancelled) const
+{
+	vector<Match> found;
+	end = min(end, snapshot.Size());
+
+	Dfa forward(*this, start);
+	Dfa backward(*this, reverse_start);
+	BlockReader reader(snapshot);
+
+	uint64_t pos = begin;
+	uint64_t match_end;
+	while (pos < end && found.size() < limit
+	       && FindEnd(forward, reader, pos, end, match_end, cancelled))
+	{
+		found.push_back(Match{FindBegin(backward, reader, pos, match_end), match_end});
+		pos = match_end;
+	}
+
+	return found;
+}
+
+void ByteRegex::Append(const BufferSnapshot &snapshot, vector<Match> &matches,
+                       const vector<Match> &next, uint64_t next_begin) const
+{
+	// Where a search over all would go on from.
+	uint64_t pos = (matches.empty() ? next_begin : max(next_begin, matches.back().end));
+
+	size_t i = 0;
+	while (1)
+	{
+		while (i < next.size() && next[i].end <= pos)
+		{
+			++i;
+		}
+
+		// Search of `next` went on from `pos` too, so they agree after it.
+		if (i == next.size() || next[i].begin >= pos)
+		{
+			break;
+		}
+
+		// Otherwise `pos` is in one of its matches, its bytes are searched
+		// again.
+		const vector<Match> again = Find(snapshot, pos, next[i].end, 1, []() { return false; });
+		if (again.empty())
+		{
+			pos = next[i].end;
+			++i;
+			break;
+		}
+		matches.push_back(again[0]);
+		pos = again[0].end;
+	}
+
+	matches.insert(matches.end(), next.begin() + i, next.end());
+}
@@ -0,0 +1,161 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "FileBuffer.hpp"
+
+// Regular expression over raw bytes, like `\x7fELF.{12}\x02\x00` or
+// `PK\x03\x04.{22}[\x00-\x10]`.
+//
+// Supports literals, `.` for any byte, classes like `[^\x00-\x1f]`,
+// escapes `\xHH`, `\n`, `\r`, `\t`, `\0`, `\d`, `\w`, `\s` (and their
+// negations), groups, `|`, and the `*`, `+`, `?`, `{n}`, `{n,}`, `{n,m}`
+// repetitions. Matches are leftmost longest, and do not overlap.
+//
+// The pattern is compiled to an NFA, which is turned into a DFA lazily
+// while searching. One pass follows matches from every position at once
+// to find where the next one ends, then the pattern reversed is run back
+// from there to find where it starts. So each byte is looked at a bounded
+// number of times however long matches are, except past a match's end,
+// while a longer match from its start is still possible. Positions a match
+// can not start at are skipped with memmem for a literal prefix, or with a
+// table of first bytes otherwise.
+class ByteRegex
+{
+public:
+	struct Match
+	{
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	// Throws invalid_argument if the pattern is not valid, or might match
+	// no bytes.
+	explicit ByteRegex(const std::string &pattern);
+
+	// Matches starting in [begin, end), searching from `begin`, the first
+	// `limit` ones. Matches might end after `end`.
+	std::vector<Match> Find(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+	                        size_t limit, const std::function<bool()> &cancelled) const;
+
+	// Appends matches found by Find from `next_begin` to `matches`, which
+	// has the matches before it. Those overlapping the last match are
+	// dropped, and the bytes after it are searched again until the two
+	// searches are in the same state. So slices searched in parallel
+	// give the same matches as one search over all.
+	void Append(const BufferSnapshot &snapshot, std::vector<Match> &matches,
+	            const std::vector<Match> &next, uint64_t next_begin) const;
+
+private:
+	struct Node;
+	struct Fragment;
+	class BlockReader;
+
+	// NFA state. Byte states go to `out` on bytes in `bytes`, split states
+	// go to both `out` and `out2` without reading.
+	struct State
+	{
+		enum class Type
+		{
+			Byte,
+			Split,
+			Match,
+		};
+
+		Type type;
+		std::bitset<256> bytes;
+		int out = -1;
+		int out2 = -1;
+	};
+
+	// DFA built while searching. Each state is a list of groups of NFA
+	// states, one group for the threads from each start position still
+	// running, earliest first. Groups after one which accepts are dropped,
+	// as they would give matches starting later.
+	class Dfa
+	{
+	public:
+		// Runs the NFA from state `nfa_start`.
+		Dfa(const ByteRegex &regex, int nfa_start);
+
+		// State after `byte`, with a thread starting at it if `start`.
+		int Next(int state, uint8_t byte, bool start);
+
+		bool Accepting(int state) const
+		{
+			return accepting[state];
+		}
+
+		// State with no threads, which is also where searches start.
+		int Empty() const
+		{
+			return empty;
+		}
+
+	private:
+		int StateOf(std::vector<int> groups);
+
+		const ByteRegex &regex;
+
+		// States a thread starting at a byte is in before reading it.
+		std::vector<int> start_states;
+
+		std::vector< std::vector<int> > groups;
+		std::vector<bool> accepting;
+		std::vector< std::vector<int> > transitions;
+		std::map<std::vector<int>, int> ids;
+		int empty;
+	};
+
+	int AddState(State::Type type);
+	Fragment Compile(const Node &node);
+
+	// Compiles `node` followed by a match state, returns its first state.
+	int CompileMatch(const Node &node);
+
+	// Adds the states reachable without reading from `nfa_states`, skipping
+	// the ones in `seen` and marking them. Sorted, only non-split states.
+	void Closure(std::vector<int> &nfa_states, std::vector<bool> &seen) const;
+
+	// First position in [pos, end) a match might start at, or `end`.
+	uint64_t NextCandidate(BlockReader &reader, uint64_t pos, uint64_t end) const;
+
+	// End of the leftmost longest match starting in [pos, end), or false
+	// if there is none.
+	bool FindEnd(Dfa &forward, BlockReader &reader, uint64_t pos, uint64_t end,
+	             uint64_t &match_end, const std::function<bool()> &cancelled) const;
+
+	// Start of the longest match ending at `match_end` that starts at
+	// `pos` or after, there has to be one.
+	uint64_t FindBegin(Dfa &backward, BlockReader &reader, uint64_t pos, uint64_t match_end) const;
+
+	// NFA of the pattern, and of it reversed, sharing `states`.
+	std::vector<State> states;
+	int start = -1;
+	int reverse_start = -1;
+
+	// Bytes of every match start with, and the bytes the first can be.
+	std::string literal_prefix;
+	bool first_bytes[256] = {};
+};
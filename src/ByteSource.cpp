@@ -0,0 +1,559 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "ByteSource.hpp"
+
+using namespace std;
+
+static uint64_t RoundUpToPage(uint64_t length)
+{
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	return (length + page_size - 1) / page_size * page_size;
+}
+
+ByteSource::~ByteSource()
+{
+	if (base)
+	{
+		munmap(base, reserved_length);
+	}
+}
+
+void ByteSource::ReserveAddressSpace(uint64_t length)
+{
+	length = RoundUpToPage(length);
+
+	void *addr = mmap(nullptr, length, PROT_NONE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (addr == MAP_FAILED)
+	{
+		throw runtime_error(string("Unable to reserve address space: ") + strerror(errno));
+	}
+
+	base = static_cast<uint8_t*>(addr);
+	reserved_length = length;
+}
+
+// Reservations of mapped files, for the SIGBUS handler. Slots are claimed
+// by setting `truncated`, and read by the handler without locking once
+// `begin` is set.
+struct GuardedMapping
+{
+	atomic<uintptr_t> begin{0};
+	atomic<uintptr_t> end{0};
+	atomic< atomic<bool>* > truncated{nullptr};
+};
+
+static const int kMaxGuardedMappings = 1024;
+static GuardedMapping guarded_mappings[kMaxGuardedMappings];
+static struct sigaction previous_sigbus_action;
+static uintptr_t sigbus_page_size;
+static int truncation_fd = -1;
+
+// Pages of a mapping past the end of its file raise SIGBUS when read. The
+// page is replaced with a zero one, which the faulting read then sees.
+static void HandleSigbus(int sig, siginfo_t *info, void *context)
+{
+	const uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+	for (GuardedMapping &m : guarded_mappings)
+	{
+		const uintptr_t begin = m.begin.load(memory_order_acquire);
+		if (begin == 0 || addr < begin || addr >= m.end.load(memory_order_acquire))
+		{
+			continue;
+		}
+
+		void *page = reinterpret_cast<void*>(addr / sigbus_page_size * sigbus_page_size);
+		if (mmap(page, sigbus_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+		         -1, 0) != MAP_FAILED)
+		{
+			m.truncated.load(memory_order_acquire)->store(true, memory_order_relaxed);
+			uint64_t one = 1;
+			write(truncation_fd, &one, sizeof(one));
+			return;
+		}
+	}
+
+	// Not one of ours, leave it to the handler before, or let the fault
+	// kill the process when it happens again.
+	if ((previous_sigbus_action.sa_flags & SA_SIGINFO) && previous_sigbus_action.sa_sigaction)
+	{
+		previous_sigbus_action.sa_sigaction(sig, info, context);
+	}
+	else if (previous_sigbus_action.sa_handler != SIG_DFL && previous_sigbus_action.sa_handler != SIG_IGN)
+	{
+		previous_sigbus_action.sa_handler(sig);
+	}
+	else
+	{
+		signal(SIGBUS, SIG_DFL);
+	}
+}
+
+// Installs the handler once. Mappings which do not fit the table are not
+// guarded, they still raise SIGBUS.
+static GuardedMapping* GuardMapping(const uint8_t *base, uint64_t length, atomic<bool> *truncated)
+{
+	static const bool installed = []()
+	{
+		sigbus_page_size = sysconf(_SC_PAGESIZE);
+		MappedFileSource::TruncationFd();
+
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = HandleSigbus;
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		return sigaction(SIGBUS, &action, &previous_sigbus_action) == 0;
+	}();
+	if (!installed)
+	{
+		return nullptr;
+	}
+
+	for (GuardedMapping &m : guarded_mappings)
+	{
+		atomic<bool> *expected = nullptr;
+		if (m.truncated.compare_exchange_strong(expected, truncated))
+		{
+			m.end.store(reinterpret_cast<uintptr_t>(base) + length, memory_order_release);
+			m.begin.store(reinterpret_cast<uintptr_t>(base), memory_order_release);
+			return &m;
+		}
+	}
+	return nullptr;
+}
+
+static void UnguardMapping(GuardedMapping *m)
+{
+	if (m)
+	{
+		m->begin.store(0, memory_order_release);
+		m->end.store(0, memory_order_release);
+		m->truncated.store(nullptr, memory_order_release);
+	}
+}
+
+int ByteSource::CreateTemporaryFile()
+{
+	const char *tmp_dir = getenv("TMPDIR");
+	string dir = tmp_dir ? tmp_dir : "/tmp";
+
+	int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0)
+	{
+		// Filesystem without O_TMPFILE support.
+		string tmpl = dir + "/hexa-XXXXXX";
+		fd = mkstemp(&tmpl[0]);
+		if (fd >= 0)
+		{
+			unlink(tmpl.c_str());
+		}
+	}
+	return fd;
+}
+
+// Holes of the file up to `length`. Filesystems without hole support
+// report the whole file as data.
+static vector< pair<uint64_t, uint64_t> > FindHoles(int fd, uint64_t length)
+{
+	vector< pair<uint64_t, uint64_t> > holes;
+
+	off_t pos = 0;
+	while ((uint64_t)pos < length)
+	{
+		off_t data = lseek(fd, pos, SEEK_DATA);
+		if (data < 0)
+		{
+			// No data after `pos`, rest of the file is a hole.
+			if (errno == ENXIO)
+			{
+				holes.emplace_back(pos, length);
+			}
+			break;
+		}
+		if ((uint64_t)data >= length)
+		{
+			holes.emplace_back(pos, length);
+			break;
+		}
+		if (data > pos)
+		{
+			holes.emplace_back(pos, data);
+		}
+
+		pos = lseek(fd, data, SEEK_HOLE);
+		if (pos < 0)
+		{
+			break;
+		}
+	}
+
+	return holes;
+}
+
+MappedFileSource::MappedFileSource(const string &file_name)
+  : file_name(file_name)
+{
+	memset(&mapped_stat, 0, sizeof(mapped_stat));
+
+	fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		return;
+	}
+
+	holes = FindHoles(fd, st.st_size);
+
+	// Leave room for the file to grow, see Refresh.
+	ReserveAddressSpace(st.st_size + max<uint64_t>(st.st_size, kMinGrowthReservation));
+	guard = GuardMapping(base, reserved_length, &truncated);
+	Refresh();
+}
+
+void MappedFileSource::Refresh()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		return;
+	}
+
+	const uint64_t old_size = Size();
+	const uint64_t new_size = min<uint64_t>(st.st_size, reserved_length);
+	if (new_size < old_size)
+	{
+		// Truncated, published bytes can not be taken back. Left for a reload.
+		return;
+	}
+
+	mapped_stat = st;
+	if (new_size == old_size)
+	{
+		return;
+	}
+
+	// Remap from the page containing the old end, mmap offsets must be page
+	// aligned. That page has the same contents, so readers are not affected.
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	const uint64_t map_start = old_size / page_size * page_size;
+
+	if (mmap(base + map_start, new_size - map_start, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+	         fd, map_start) == MAP_FAILED)
+	{
+		throw runtime_error("Unable to map \"" + file_name + "\": " + strerror(errno));
+	}
+
+	size.store(new_size, memory_order_release);
+}
+
+bool MappedFileSource::ChangedOnDisk() const
+{
+	struct stat st;
+	if (stat(file_name.c_str(), &st) != 0)
+	{
+		// Deleted, but mapping still has the contents. Nothing to reload.
+		return false;
+	}
+
+	return Truncated()
+	    || st.st_dev != mapped_stat.st_dev
+	    || st.st_ino != mapped_stat.st_ino
+	    || st.st_size != mapped_stat.st_size
+	    || st.st_mtim.tv_sec != mapped_stat.st_mtim.tv_sec
+	    || st.st_mtim.tv_nsec != mapped_stat.st_mtim.tv_nsec;
+}
+
+bool MappedFileSource::Shrank() const
+{
+	struct stat st;
+	return fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size < Size();
+}
+
+int MappedFileSource::TruncationFd()
+{
+	static const int fd = []()
+	{
+		truncation_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		return truncation_fd;
+	}();
+	return fd;
+}
+
+MappedFileSource::~MappedFileSource()
+{
+	UnguardMapping(guard);
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+ChunkStore::ChunkStore(uint64_t memory_limit, uint64_t reservation)
+  : memory_limit(memory_limit), reservation(reservation)
+{
+}
+
+ChunkStore::~ChunkStore()
+{
+	if (spill_fd >= 0)
+	{
+		close(spill_fd);
+	}
+}
+
+uint64_t ChunkStore::Append(const void *bytes, uint64_t length)
+{
+	const uint64_t offset = Size();
+	const uint8_t *src = static_cast<const uint8_t*>(bytes);
+
+	while (length > 0)
+	{
+		uint64_t tail_length;
+		uint8_t *tail = WritableTail(tail_length);
+
+		tail_length = min(tail_length, length);
+		memcpy(tail, src, tail_length);
+		Commit(tail_length);
+
+		src += tail_length;
+		length -= tail_length;
+	}
+
+	return offset;
+}
+
+uint8_t* ChunkStore::WritableTail(uint64_t &length)
+{
+	const uint64_t current_size = Size();
+
+	if (current_size == committed_length)
+	{
+		if (!base)
+		{
+			ReserveAddressSpace(reservation);
+		}
+		if (committed_length + kChunkSize > reserved_length)
+		{
+			throw runtime_error("Buffer is too large");
+		}
+
+		if (mmap(base + committed_length, kChunkSize, PROT_READ | PROT_WRITE,
+		         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+		{
+			throw runtime_error(string("Unable to allocate chunk: ") + strerror(errno));
+		}
+
+		resident_chunks.push_back(committed_length);
+		committed_length += kChunkSize;
+	}
+
+	length = committed_length - current_size;
+	return base + current_size;
+}
+
+void ChunkStore::Commit(uint64_t length)
+{
+	size.fetch_add(length, memory_order_release);
+	SpillIfNeeded();
+}
+
+void ChunkStore::SpillIfNeeded()
+{
+	if (memory_limit == 0)
+	{
+		return;
+	}
+
+	while (resident_chunks.size() * kChunkSize > memory_limit)
+	{
+		const uint64_t offset = resident_chunks.front();
+
+		// Only full chunks are spilled, tail is still being written.
+		if (offset + kChunkSize > Size())
+		{
+			return;
+		}
+
+		if (spill_fd < 0)
+		{
+			spill_fd = CreateTemporaryFile();
+			if (spill_fd < 0)
+			{
+				// Nowhere to spill, keep everything in memory then.
+				memory_limit = 0;
+				return;
+			}
+		}
+
+		uint64_t written = 0;
+		while (written < kChunkSize)
+		{
+			ssize_t n = pwrite(spill_fd, base + offset + written,
+			                   kChunkSize - written, offset + written);
+			if (n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n <= 0)
+			{
+				memory_limit = 0;
+				return;
+			}
+			written += n;
+		}
+
+		// Replace anonymous pages with identical file backed ones. Address
+		// stays the same, so readers on other threads are not affected.
+		if (mmap(base + offset, kChunkSize, PROT_READ, MAP_SHARED | MAP_FIXED,
+		         spill_fd, offset) == MAP_FAILED)
+		{
+			memory_limit = 0;
+			return;
+		}
+
+		resident_chunks.pop_front();
+	}
+}
+
+StreamSource::StreamSource(int fd, uint64_t memory_limit, function<void()> on_growth)
+  : ChunkStore(memory_limit), fd(fd), on_growth(move(on_growth))
+{
+	stop_fd = eventfd(0, EFD_CLOEXEC);
+	reader = thread(&StreamSource::ReaderMain, this);
+}
+
+StreamSource::~StreamSource()
+{
+	uint64_t one = 1;
+	write(stop_fd, &one, sizeof(one));
+	reader.join();
+
+	close(stop_fd);
+	close(fd);
+}
+
+void StreamSource::ReaderMain()
+{
+	using Clock = chrono::steady_clock;
+
+	// Growth is reported at most this often, so a fast pipe does not keep
+	// the main loop busy with re-rendering.
+	const auto notify_interval = chrono::milliseconds(50);
+
+	Clock::time_point last_notify = Clock::now() - notify_interval;
+	bool has_unreported_bytes = false;
+
+	auto notify = [this]()
+	{
+		if (!notify_pending.exchange(true))
+		{
+			on_growth();
+			return true;
+		}
+		return false;
+	};
+
+	while (1)
+	{
+		int timeout_ms = -1;
+		if (has_unreported_bytes)
+		{
+			auto wait = notify_interval - (Clock::now() - last_notify);
+			timeout_ms = max<int>(10, chrono::duration_cast<chrono::milliseconds>(wait).count());
+		}
+
+		pollfd fds[2] = {{fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+		int ready = poll(fds, 2, timeout_ms);
+		if (ready < 0 && errno != EINTR)
+		{
+			break;
+		}
+
+		if (fds[1].revents)
+		{
+			return;
+		}
+
+		if (ready > 0 && fds[0].revents)
+		{
+			ssize_t n;
+			try
+			{
+				uint64_t tail_length;
+				uint8_t *tail = WritableTail(tail_length);
+				n = read(fd, tail, tail_length);
+			}
+			catch (exception &e)
+			{
+				break;
+			}
+
+			if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			{
+				continue;
+			}
+			if (n <= 0)
+			{
+				break;
+			}
+
+			Commit(n);
+			has_unreported_bytes = true;
+		}
+
+		if (has_unreported_bytes && Clock::now() - last_notify >= notify_interval)
+		{
+			if (notify())
+			{
+				last_notify = Clock::now();
+				has_unreported_bytes = false;
+			}
+		}
+	}
+
+	eof.store(true, memory_order_release);
+	notify();
+}
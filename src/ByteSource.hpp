@@ -0,0 +1,318 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+class BlockIndex;
+class EntropyIndex;
+class NgramIndex;
+struct GuardedMapping;
+
+// Bytes a FileBuffer is built from.
+//
+// A source lives at a fixed address for its whole lifetime, and bytes that
+// are published through `Size()` never change. So pointers into a source can
+// be handed to background threads without any locking, even while the
+// source keeps growing.
+class ByteSource
+{
+public:
+	ByteSource() = default;
+	ByteSource(const ByteSource &ot) = delete;
+	ByteSource& operator=(const ByteSource &ot) = delete;
+	virtual ~ByteSource();
+
+	const uint8_t* Data() const
+	{
+		return base;
+	}
+
+	uint64_t Size() const
+	{
+		return size.load(std::memory_order_acquire);
+	}
+
+	// [begin, end) ranges which read as zeros without being stored, like
+	// holes of a sparse file. Sorted, and fixed once the source is created.
+	const std::vector< std::pair<uint64_t, uint64_t> >& Holes() const
+	{
+		return holes;
+	}
+
+	// Background scans over the bytes of a source check whether they are
+	// cancelled about once per this many bytes, so they stop quickly without
+	// the check costing anything next to the scanning.
+	static constexpr uint64_t kCancelCheckBytes = 1 << 20;
+
+	// Whether more bytes might still be appended, like a pipe still being read.
+	virtual bool IsGrowing() const
+	{
+		return false;
+	}
+
+	// Growing sources call back when new bytes are published. This is called
+	// once such a notification is handled, to receive the next one.
+	virtual void AcknowledgeGrowth()
+	{
+	}
+
+	// Picks up bytes appended to the underlying file, without reading the
+	// ones already published.
+	virtual void Refresh()
+	{
+	}
+
+	// Makes published bytes starting at `offset` readable through `Data()`.
+	// Returns how many of the `length` bytes are readable, at least one.
+	// Sources producing bytes on demand override this, it is safe to call
+	// from any thread.
+	virtual uint64_t Materialize(uint64_t offset, uint64_t length) const
+	{
+		(void)offset;
+		return length;
+	}
+
+	// Whether bytes in [offset, offset + length) are readable without
+	// producing them first, so `Materialize` returns at once. Safe to call
+	// from any thread.
+	virtual bool Materialized(uint64_t offset, uint64_t length) const
+	{
+		(void)offset;
+		(void)length;
+		return true;
+	}
+
+	// Fingerprints of the source's blocks, null until they are computed.
+	// Safe to call from any thread.
+	std::shared_ptr<const BlockIndex> Blocks() const
+	{
+		return std::atomic_load(&blocks);
+	}
+
+	void SetBlocks(std::shared_ptr<const BlockIndex> new_blocks)
+	{
+		std::atomic_store(&blocks, std::move(new_blocks));
+	}
+
+	// Entropy of the source's blocks, null until they are computed.
+	std::shared_ptr<const EntropyIndex> Entropy() const
+	{
+		return std::atomic_load(&entropy);
+	}
+
+	void SetEntropy(std::shared_ptr<const EntropyIndex> new_entropy)
+	{
+		std::atomic_store(&entropy, std::move(new_entropy));
+	}
+
+	// Search index of the source, null unless built or loaded by :index.
+	std::shared_ptr<const NgramIndex> Ngrams() const
+	{
+		return std::atomic_load(&ngrams);
+	}
+
+	void SetNgrams(std::shared_ptr<const NgramIndex> new_ngrams)
+	{
+		std::atomic_store(&ngrams, std::move(new_ngrams));
+	}
+
+protected:
+	// Address space reserved for streams, which might grow to any size. This
+	// is only virtual memory, nothing is committed until chunks are mapped
+	// into it, but the address space of a process is only a hundred times as
+	// large.
+	static constexpr uint64_t kGrowableReservation = 1ull << 40;
+
+	// Reserves address space to grow into, without committing any memory.
+	void ReserveAddressSpace(uint64_t length);
+
+	// Unlinked temporary file to move bytes out of memory, -1 on failure.
+	static int CreateTemporaryFile();
+
+	uint8_t *base = nullptr;
+	uint64_t reserved_length = 0;
+
+	std::vector< std::pair<uint64_t, uint64_t> > holes;
+
+	std::atomic<uint64_t> size{0};
+
+private:
+	std::shared_ptr<const BlockIndex> blocks;
+	std::shared_ptr<const EntropyIndex> entropy;
+	std::shared_ptr<const NgramIndex> ngrams;
+};
+
+// Read only mapping of a regular file. Holes of sparse files are found
+// with SEEK_HOLE when the file is mapped, bytes appended later are taken
+// as data.
+//
+// Address space is reserved for the file to double in size. Reading pages
+// past the end of a file truncated by another process raises SIGBUS, those
+// pages are replaced with zeros instead and the source is marked truncated.
+class MappedFileSource : public ByteSource
+{
+public:
+	// Least address space reserved for bytes appended to a file.
+	static constexpr uint64_t kMinGrowthReservation = 64ull << 20;
+
+	// Files which can not be opened are treated as empty.
+	explicit MappedFileSource(const std::string &file_name);
+	~MappedFileSource() override;
+
+	// Maps the region appended to the file since last refresh, as much of
+	// it as fits in the reservation.
+	void Refresh() override;
+
+	// Whether the file grew past the reserved address space, the rest of it
+	// is then to be mapped by a new source.
+	bool Outgrown() const
+	{
+		return (uint64_t)mapped_stat.st_size > Size();
+	}
+
+	// Whether pages past the end of the file were read since it was
+	// truncated, which read as zeros.
+	bool Truncated() const
+	{
+		return truncated.load(std::memory_order_relaxed);
+	}
+
+	// Whether the file is now shorter than the bytes mapped. Checked on the
+	// open file, without touching the mapped pages.
+	bool Shrank() const;
+
+	// Becomes readable when pages of any truncated file are read, so the
+	// main loop can map the file again. Nonblocking eventfd.
+	static int TruncationFd();
+
+	const std::string& FileName() const
+	{
+		return file_name;
+	}
+
+	// Whether the file name points to another file now, or the file was
+	// modified since it was mapped.
+	bool ChangedOnDisk() const;
+
+	// Status of the file as of last mapping.
+	const struct stat& MappedStat() const
+	{
+		return mapped_stat;
+	}
+
+private:
+	std::string file_name;
+	int fd = -1;
+
+	// File status as of last mapping.
+	struct stat mapped_stat;
+
+	// Set by the SIGBUS handler, on any thread.
+	std::atomic<bool> truncated{false};
+	GuardedMapping *guard = nullptr;
+};
+
+// Append only store made of fixed size anonymous chunks.
+//
+// When more than `memory_limit` bytes are resident, oldest chunks are written
+// to an unlinked temporary file and mapped back from there at the same
+// address. Kernel can then drop them from memory as it sees fit.
+//
+// Address space for `reservation` bytes is reserved on the first append,
+// so stores nothing is appended to take none.
+class ChunkStore : public ByteSource
+{
+public:
+	static constexpr uint64_t kChunkSize = 1 << 20;
+
+	// Address space reserved for the bytes of edits.
+	static constexpr uint64_t kEditReservation = 64ull << 30;
+
+	// Zero memory limit means chunks are never spilled.
+	explicit ChunkStore(uint64_t memory_limit = 0, uint64_t reservation = kGrowableReservation);
+	~ChunkStore() override;
+
+	// Appends bytes and returns the offset they were stored at.
+	// Only one thread may append to a store.
+	uint64_t Append(const void *bytes, uint64_t length);
+
+protected:
+	// Returns writable space after the last byte, at most up to the end of
+	// the current chunk. Bytes are published with `Commit`.
+	uint8_t* WritableTail(uint64_t &length);
+	void Commit(uint64_t length);
+
+private:
+	void SpillIfNeeded();
+
+	uint64_t memory_limit;
+	uint64_t reservation;
+
+	// Bytes of the reservation backed by chunks.
+	uint64_t committed_length = 0;
+
+	// Offsets of chunks still kept in anonymous memory, oldest first.
+	std::deque<uint64_t> resident_chunks;
+
+	// Spill file, created on first spill.
+	int spill_fd = -1;
+};
+
+// Reads a file descriptor (like a pipe on stdin) on a background thread
+// into a ChunkStore. The buffer is usable while this is still reading.
+class StreamSource : public ChunkStore
+{
+public:
+	// `on_growth` is called on the reader thread after new bytes are
+	// published, at most once per `AcknowledgeGrowth` call.
+	StreamSource(int fd, uint64_t memory_limit, std::function<void()> on_growth);
+	~StreamSource() override;
+
+	bool IsGrowing() const override
+	{
+		return !eof.load(std::memory_order_acquire);
+	}
+
+	void AcknowledgeGrowth() override
+	{
+		notify_pending.store(false, std::memory_order_release);
+	}
+
+private:
+	void ReaderMain();
+
+	int fd;
+	int stop_fd = -1;
+
+	std::function<void()> on_growth;
+	std::atomic<bool> notify_pending{false};
+	std::atomic<bool> eof{false};
+
+	std::thread reader;
+};
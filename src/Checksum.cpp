@@ -0,0 +1,465 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include <openssl/evp.h>
+#include <zlib.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HEXA_X86_CHECKSUMS
+#endif
+
+#include "Checksum.hpp"
+
+using namespace std;
+
+// zlib takes lengths in uInt.
+static constexpr uint64_t kZlibMaxLength = UINT_MAX & ~0xFFFull;
+
+// Reflected Castagnoli polynomial.
+static constexpr uint32_t kCrc32cPolynomial = 0x82F63B78;
+
+// Portable CRC32C, eight table lookups per eight bytes.
+static const uint32_t (&Crc32cTables())[8][256]
+{
+	static uint32_t tables[8][256];
+	static bool initialized = []()
+	{
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? (c >> 1) ^ kCrc32cPolynomial : c >> 1;
+			}
+			tables[0][n] = c;
+		}
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			for (int t = 1; t < 8; ++t)
+			{
+				tables[t][n] = (tables[t - 1][n] >> 8) ^ tables[0][tables[t - 1][n] & 0xFF];
+			}
+		}
+		return true;
+	}();
+	(void)initialized;
+	return tables;
+}
+
+static uint32_t Crc32cPortable(uint32_t crc, const uint8_t *data, uint64_t length)
+{
+	const auto &t = Crc32cTables();
+	crc = ~crc;
+
+	for (; length >= 8; data += 8, length -= 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		word ^= crc;
+		crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF]
+		    ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+		    ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF]
+		    ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+	}
+	for (; length > 0; ++data, --length)
+	{
+		crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+	}
+	return ~crc;
+}
+
+static uint32_t Crc32Zlib(uint32_t crc, const uint8_t *data, uint64_t length)
+{
+	while (length > 0)
+	{
+		const uint64_t part = min(length, kZlibMaxLength);
+		crc = crc32(crc, data, part);
+		data += part;
+		length -= part;
+	}
+	return crc;
+}
+
+#ifdef HEXA_X86_CHECKSUMS
+
+// CRC32 instruction of SSE4.2 computes CRC32C.
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(uint32_t crc, const uint8_t *data, uint64_t length)
+{
+	uint64_t c = ~crc;
+	for (; length >= 8; data += 8, length -= 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		c = _mm_crc32_u64(c, word);
+	}
+	for (; length > 0; ++data, --length)
+	{
+		c = _mm_crc32_u8(c, *data);
+	}
+	return ~(uint32_t)c;
+}
+
+// CRC32 by folding 64 bytes at a time with carry-less multiplication, then
+// a Barrett reduction. From "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction" by Intel, constants are for the reflected
+// CRC32 polynomial. `length` must be a multiple of 16, and at least 64.
+// Takes and returns the CRC without the final inversion.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t Crc32FoldPclmul(uint32_t crc, const uint8_t *data, uint64_t length)
+{
+	alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+	alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+
+	data += 64;
+	length -= 64;
+
+	// Four independent folds in parallel.
+	while (length >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		data += 64;
+		length -= 64;
+	}
+
+	// Fold the four into one.
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (length >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i*)data);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		data += 16;
+		length -= 16;
+	}
+
+	// 128 bits to 64.
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits.
+	x0 = _mm_load_si128((const __m128i*)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t Crc32Pclmul(uint32_t crc, const uint8_t *data, uint64_t length)
+{
+	if (length >= 64)
+	{
+		const uint64_t folded = length & ~15ull;
+		crc = ~Crc32FoldPclmul(~crc, data, folded);
+		data += folded;
+		length -= folded;
+	}
+	return Crc32Zlib(crc, data, length);
+}
+
+static bool HasSse42()
+{
+	static const bool has = __builtin_cpu_supports("sse4.2");
+	return has;
+}
+
+static bool HasPclmul()
+{
+	static const bool has = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+	return has;
+}
+
+#else
+
+static bool HasSse42()
+{
+	return false;
+}
+
+static bool HasPclmul()
+{
+	return false;
+}
+
+#endif
+
+// Combining multiplies the first CRC by x^(8 * second_length) modulo the
+// polynomial, like zlib does for CRC32.
+static uint32_t MultiplyModP(uint32_t a, uint32_t b, uint32_t polynomial)
+{
+	uint32_t m = 1u << 31;
+	uint32_t p = 0;
+	while (1)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+			{
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ polynomial : b >> 1;
+	}
+	return p;
+}
+
+static uint32_t Crc32cCombine(uint32_t first, uint32_t second, uint64_t second_length)
+{
+	// x^(2^k) modulo the polynomial, x^1 is 1 << 30 in reflected order.
+	static const vector<uint32_t> powers = []()
+	{
+		vector<uint32_t> p(64);
+		p[0] = 1u << 30;
+		for (size_t k = 1; k < p.size(); ++k)
+		{
+			p[k] = MultiplyModP(p[k - 1], p[k - 1], kCrc32cPolynomial);
+		}
+		return p;
+	}();
+
+	// x^(8 * second_length), starting from x^(2^3) for the bytes.
+	uint32_t shift = 1u << 31;
+	for (size_t k = 3; second_length > 0; second_length >>= 1, ++k)
+	{
+		if (second_length & 1)
+		{
+			shift = MultiplyModP(powers[k % powers.size()], shift, kCrc32cPolynomial);
+		}
+	}
+	return MultiplyModP(shift, first, kCrc32cPolynomial) ^ second;
+}
+
+bool Checksum::FromName(const string &name, Type &type)
+{
+	if (name == "crc32")
+		type = Type::Crc32;
+	else if (name == "crc32c")
+		type = Type::Crc32c;
+	else if (name == "adler32")
+		type = Type::Adler32;
+	else
+		return false;
+	return true;
+}
+
+uint32_t Checksum::Initial(Type type)
+{
+	return type == Type::Adler32 ? 1 : 0;
+}
+
+uint32_t Checksum::Update(Type type, uint32_t value, const uint8_t *data, uint64_t length)
+{
+	switch (type)
+	{
+	case Type::Crc32:
+#ifdef HEXA_X86_CHECKSUMS
+		if (HasPclmul())
+		{
+			return Crc32Pclmul(value, data, length);
+		}
+#endif
+		return Crc32Zlib(value, data, length);
+	case Type::Crc32c:
+#ifdef HEXA_X86_CHECKSUMS
+		if (HasSse42())
+		{
+			return Crc32cSse42(value, data, length);
+		}
+#endif
+		return Crc32cPortable(value, data, length);
+	case Type::Adler32:
+		while (length > 0)
+		{
+			const uint64_t part = min(length, kZlibMaxLength);
+			value = adler32(value, data, part);
+			data += part;
+			length -= part;
+		}
+		return value;
+	}
+	return value;
+}
+
+uint32_t Checksum::UpdateZeros(Type type, uint32_t value, uint64_t length)
+{
+	// Checksum of 2^k zeros, doubled for each bit of the length.
+	const uint8_t zero = 0;
+	uint32_t zeros = Update(type, Initial(type), &zero, 1);
+	for (uint64_t zeros_length = 1; length > 0; length >>= 1, zeros_length <<= 1)
+	{
+		if (length & 1)
+		{
+			value = Combine(type, value, zeros, zeros_length);
+		}
+		if (length > 1)
+		{
+			zeros = Combine(type, zeros, zeros, zeros_length);
+		}
+	}
+	return value;
+}
+
+uint32_t Checksum::Combine(Type type, uint32_t first, uint32_t second, uint64_t second_length)
+{
+	switch (type)
+	{
+	case Type::Crc32:
+		return crc32_combine64(first, second, second_length);
+	case Type::Crc32c:
+		return Crc32cCombine(first, second, second_length);
+	case Type::Adler32:
+		return adler32_combine64(first, second, second_length);
+	}
+	return first;
+}
+
+string Checksum::Implementation(Type type)
+{
+	switch (type)
+	{
+	case Type::Crc32:
+		return HasPclmul() ? "pclmul" : "zlib";
+	case Type::Crc32c:
+		return HasSse42() ? "sse4.2" : "portable";
+	case Type::Adler32:
+		return "zlib";
+	}
+	return "";
+}
+
+static const EVP_MD* DigestByName(const string &name)
+{
+	if (name == "md5")
+		return EVP_md5();
+	if (name == "sha1")
+		return EVP_sha1();
+	if (name == "sha256")
+		return EVP_sha256();
+	return nullptr;
+}
+
+Digest::Digest(const string &name)
+{
+	const EVP_MD *md = DigestByName(name);
+	if (!md)
+	{
+		throw invalid_argument("Unknown hash: " + name);
+	}
+
+	ctx = EVP_MD_CTX_new();
+	if (!ctx || EVP_DigestInit_ex(ctx, md, nullptr) != 1)
+	{
+		EVP_MD_CTX_free(ctx);
+		throw runtime_error("Unable to initialize " + name);
+	}
+}
+
+Digest::~Digest()
+{
+	EVP_MD_CTX_free(ctx);
+}
+
+bool Digest::IsKnown(const string &name)
+{
+	return DigestByName(name) != nullptr;
+}
+
+void Digest::Update(const uint8_t *data, uint64_t length)
+{
+	EVP_DigestUpdate(ctx, data, length);
+}
+
+string Digest::HexFinal()
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_length = 0;
+	EVP_DigestFinal_ex(ctx, md, &md_length);
+
+	static const char kHexDigits[] = "0123456789abcdef";
+	string hex;
+	for (unsigned int i = 0; i < md_length; ++i)
+	{
+		hex += kHexDigits[md[i] >> 4];
+		hex += kHexDigits[md[i] & 0xF];
+	}
+	return hex;
+}
@@ -0,0 +1,77 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 32 bit checksums, computed with CPU instructions where available.
+//
+// Checksums of adjacent ranges can be combined into the checksum of both,
+// so after an edit only the changed parts of a range need to be read.
+class Checksum
+{
+public:
+	enum class Type
+	{
+		Crc32,
+		Crc32c,
+		Adler32,
+	};
+
+	// Returns false for names other than "crc32", "crc32c" and "adler32".
+	static bool FromName(const std::string &name, Type &type);
+
+	// Checksum of no bytes.
+	static uint32_t Initial(Type type);
+
+	static uint32_t Update(Type type, uint32_t value, const uint8_t *data, uint64_t length);
+
+	// Same as Update over `length` zeros, like holes, without reading any.
+	// Takes O(log length) combines.
+	static uint32_t UpdateZeros(Type type, uint32_t value, uint64_t length);
+
+	// Checksum of two adjacent ranges, given the checksums of each.
+	static uint32_t Combine(Type type, uint32_t first, uint32_t second, uint64_t second_length);
+
+	// Names of the implementations used on this CPU, like "pclmul".
+	static std::string Implementation(Type type);
+};
+
+// Cryptographic hashes, from libcrypto which uses SHA and AVX instructions
+// where available.
+class Digest
+{
+public:
+	// Throws invalid_argument for names other than "md5", "sha1" and
+	// "sha256".
+	explicit Digest(const std::string &name);
+	Digest(const Digest &ot) = delete;
+	Digest& operator=(const Digest &ot) = delete;
+	~Digest();
+
+	static bool IsKnown(const std::string &name);
+
+	void Update(const uint8_t *data, uint64_t length);
+
+	// Lowercase hex of the hash, no more updates can be made.
+	std::string HexFinal();
+
+private:
+	struct evp_md_ctx_st *ctx = nullptr;
+};
@@ -0,0 +1,811 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <lzma.h>
+#include <zlib.h>
+#ifdef HEXA_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "CompressedSource.hpp"
+#include "IndexCache.hpp"
+
+using namespace std;
+
+// Deflate refers back at most this many bytes.
+static constexpr size_t kGzipWindowSize = 32768;
+
+// zlib counts input in 32 bit integers, it is fed in slices of this size.
+static constexpr uint64_t kGzipInputSlice = 1 << 30;
+
+static const char kIndexMagic[8] = {'H', 'E', 'X', 'A', 'I', 'D', 'X', '1'};
+
+namespace
+{
+
+// Decompresses starting from a checkpoint.
+class Decoder
+{
+public:
+	virtual ~Decoder() = default;
+
+	// Fills up to `length` bytes. Returns 0 at the end of the data the
+	// checkpoint covers, or on corrupt input.
+	virtual size_t Decode(uint8_t *out, size_t length) = 0;
+};
+
+class GzipDecoder : public Decoder
+{
+public:
+	GzipDecoder(const uint8_t *data, uint64_t size, const CompressedFileSource::Checkpoint &cp)
+	  : data(data), size(size), raw(cp.param >= 0)
+	{
+		memset(&strm, 0, sizeof(strm));
+		if (inflateInit2(&strm, raw ? -15 : 15 + 16) != Z_OK)
+		{
+			finished = true;
+			return;
+		}
+		strm.next_in = const_cast<uint8_t*>(data + cp.in);
+
+		// Checkpoints inside a member are at deflate block boundaries, which
+		// are not byte aligned. Decoder is primed with the remaining bits,
+		// and the window the block might refer back to.
+		if (raw)
+		{
+			if (cp.param > 0)
+			{
+				inflatePrime(&strm, cp.param, data[cp.in - 1] >> (8 - cp.param));
+			}
+			inflateSetDictionary(&strm, cp.window.data(), cp.window.size());
+		}
+	}
+
+	~GzipDecoder() override
+	{
+		inflateEnd(&strm);
+	}
+
+	size_t Decode(uint8_t *out, size_t length) override
+	{
+		strm.next_out = out;
+		strm.avail_out = min<uint64_t>(length, kGzipInputSlice);
+
+		while (!finished && strm.avail_out > 0)
+		{
+			const uint64_t in = strm.next_in - data;
+			if (strm.avail_in == 0)
+			{
+				if (in == size)
+				{
+					finished = true;
+					break;
+				}
+				strm.avail_in = min(size - in, kGzipInputSlice);
+			}
+
+			int ret = inflate(&strm, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END)
+			{
+				// Raw deflate stops before the member's trailer.
+				uint64_t next = strm.next_in - data + (raw ? 8 : 0);
+				if (next + 2 > size || data[next] != 0x1f || data[next + 1] != 0x8b)
+				{
+					finished = true;
+					break;
+				}
+
+				// Concatenated gzip members are one file.
+				strm.next_in = const_cast<uint8_t*>(data + next);
+				strm.avail_in = 0;
+				inflateReset2(&strm, 15 + 16);
+				raw = false;
+			}
+			else if (ret != Z_OK)
+			{
+				finished = true;
+			}
+		}
+
+		return strm.next_out - out;
+	}
+
+private:
+	const uint8_t *data;
+	uint64_t size;
+	bool raw;
+	bool finished = false;
+	z_stream strm;
+};
+
+class XzDecoder : public Decoder
+{
+public:
+	XzDecoder(const uint8_t *data, uint64_t size, const CompressedFileSource::Checkpoint &cp)
+	{
+		if (cp.param < 0)
+		{
+			finished = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK;
+			strm.next_in = data;
+			strm.avail_in = size;
+			return;
+		}
+
+		lzma_filter filters[LZMA_FILTERS_MAX + 1];
+		lzma_block block;
+		memset(&block, 0, sizeof(block));
+		block.version = 1;
+		block.check = static_cast<lzma_check>(cp.param);
+		block.filters = filters;
+		block.header_size = lzma_block_header_size_decode(data[cp.in]);
+
+		if (cp.in + block.header_size > size
+		    || lzma_block_header_decode(&block, nullptr, data + cp.in) != LZMA_OK)
+		{
+			finished = true;
+			return;
+		}
+
+		finished = lzma_block_decoder(&strm, &block) != LZMA_OK;
+		lzma_filters_free(filters, nullptr);
+
+		strm.next_in = data + cp.in + block.header_size;
+		strm.avail_in = size - cp.in - block.header_size;
+	}
+
+	~XzDecoder() override
+	{
+		lzma_end(&strm);
+	}
+
+	size_t Decode(uint8_t *out, size_t length) override
+	{
+		strm.next_out = out;
+		strm.avail_out = length;
+
+		while (!finished && strm.avail_out > 0)
+		{
+			if (lzma_code(&strm, LZMA_FINISH) != LZMA_OK)
+			{
+				finished = true;
+			}
+		}
+
+		return strm.next_out - out;
+	}
+
+private:
+	lzma_stream strm = LZMA_STREAM_INIT;
+	bool finished = false;
+};
+
+#ifdef HEXA_WITH_ZSTD
+class ZstdDecoder : public Decoder
+{
+public:
+	ZstdDecoder(const uint8_t *data, uint64_t size, const CompressedFileSource::Checkpoint &cp)
+	  : stream(ZSTD_createDStream())
+	{
+		ZSTD_initDStream(stream);
+		input = {data + cp.in, size - cp.in, 0};
+	}
+
+	~ZstdDecoder() override
+	{
+		ZSTD_freeDStream(stream);
+	}
+
+	size_t Decode(uint8_t *out, size_t length) override
+	{
+		ZSTD_outBuffer output = {out, length, 0};
+
+		while (!finished && output.pos < output.size)
+		{
+			const size_t in_pos = input.pos;
+			const size_t out_pos = output.pos;
+
+			// Continues with the next frame after one ends.
+			if (ZSTD_isError(ZSTD_decompressStream(stream, &output, &input))
+			    || (input.pos == in_pos && output.pos == out_pos))
+			{
+				finished = true;
+			}
+		}
+
+		return output.pos;
+	}
+
+private:
+	ZSTD_DStream *stream;
+	ZSTD_inBuffer input;
+	bool finished = false;
+};
+#endif
+
+unique_ptr<Decoder> MakeDecoder(CompressedFileSource::Format format,
+                                const uint8_t *data,
+                                uint64_t size,
+                                const CompressedFileSource::Checkpoint &cp)
+{
+	switch (format)
+	{
+	case CompressedFileSource::Format::Gzip:
+		return unique_ptr<Decoder>(new GzipDecoder(data, size, cp));
+	case CompressedFileSource::Format::Xz:
+		return unique_ptr<Decoder>(new XzDecoder(data, size, cp));
+#ifdef HEXA_WITH_ZSTD
+	case CompressedFileSource::Format::Zstd:
+		return unique_ptr<Decoder>(new ZstdDecoder(data, size, cp));
+#endif
+	default:
+		throw logic_error("Unsupported compression format");
+	}
+}
+
+} // namespace
+
+bool CompressedFileSource::DetectFormat(const string &file_name, Format &format)
+{
+	uint8_t magic[6] = {0};
+
+	ifstream file(file_name, ios::binary);
+	if (!file.read(reinterpret_cast<char*>(magic), sizeof(magic)))
+	{
+		return false;
+	}
+
+	if (magic[0] == 0x1f && magic[1] == 0x8b)
+	{
+		format = Format::Gzip;
+		return true;
+	}
+	if (memcmp(magic, "\xfd" "7zXZ\0", 6) == 0)
+	{
+		format = Format::Xz;
+		return true;
+	}
+#ifdef HEXA_WITH_ZSTD
+	if (memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0)
+	{
+		format = Format::Zstd;
+		return true;
+	}
+#endif
+	return false;
+}
+
+CompressedFileSource::CompressedFileSource(const string &file_name,
+                                           Format format,
+                                           const string &index_dir,
+                                           function<void()> on_growth)
+  : compressed(file_name), format(format), index_dir(index_dir), on_growth(move(on_growth))
+{
+	spill_fd = CreateTemporaryFile();
+
+	if (LoadIndex())
+	{
+		// Size is known, a unit more is reserved for partial mappings.
+		ReserveAddressSpace(Size() + kUnitSize);
+		indexed.store(true, memory_order_release);
+		return;
+	}
+
+	ReserveAddressSpace(kGrowableReservation);
+	last_notify = chrono::steady_clock::now();
+	indexer = thread(&CompressedFileSource::IndexerMain, this);
+}
+
+CompressedFileSource::~CompressedFileSource()
+{
+	stop.store(true, memory_order_release);
+	if (indexer.joinable())
+	{
+		indexer.join();
+	}
+
+	if (spill_fd >= 0)
+	{
+		close(spill_fd);
+	}
+}
+
+void CompressedFileSource::IndexerMain()
+{
+	switch (format)
+	{
+	case Format::Gzip:
+		IndexGzip();
+		break;
+	case Format::Xz:
+		IndexXz();
+		break;
+	case Format::Zstd:
+		IndexZstd();
+		break;
+	}
+
+	if (stop.load(memory_order_acquire))
+	{
+		return;
+	}
+
+	SaveIndex();
+
+	indexed.store(true, memory_order_release);
+	NotifyGrowth();
+}
+
+void CompressedFileSource::IndexGzip()
+{
+	const uint8_t *data = compressed.Data();
+	const uint64_t in_size = compressed.Size();
+
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	if (in_size == 0 || inflateInit2(&strm, 15 + 16) != Z_OK)
+	{
+		return;
+	}
+	strm.next_in = const_cast<uint8_t*>(data);
+
+	// Output is discarded, only the last window is kept for checkpoints.
+	vector<uint8_t> window(kGzipWindowSize);
+	uint64_t out = 0;
+	uint64_t last_checkpoint = 0;
+
+	AddCheckpoint(Checkpoint{0, 0, -1, {}});
+
+	while (!stop.load(memory_order_relaxed))
+	{
+		if (strm.avail_in == 0)
+		{
+			strm.avail_in = min(in_size - (strm.next_in - data), kGzipInputSlice);
+		}
+		if (strm.avail_out == 0)
+		{
+			strm.next_out = window.data();
+			strm.avail_out = window.size();
+		}
+
+		const uInt avail_out = strm.avail_out;
+		int ret = inflate(&strm, Z_BLOCK);
+		out += avail_out - strm.avail_out;
+		PublishSize(out);
+
+		if (ret == Z_STREAM_END)
+		{
+			const uint64_t next = strm.next_in - data;
+			if (next + 2 > in_size || data[next] != 0x1f || data[next + 1] != 0x8b)
+			{
+				break;
+			}
+
+			inflateReset(&strm);
+			if (out - last_checkpoint >= kCheckpointSpan)
+			{
+				AddCheckpoint(Checkpoint{out, next, -1, {}});
+				last_checkpoint = out;
+			}
+			continue;
+		}
+
+		if (ret != Z_OK)
+		{
+			// Truncated or corrupt, what is decoded so far is the file.
+			break;
+		}
+
+		// Stopped at the end of a deflate block, which is not the last one.
+		const bool block_end = (strm.data_type & 128) && !(strm.data_type & 64);
+		if (block_end && out - last_checkpoint >= kCheckpointSpan)
+		{
+			Checkpoint cp{out, (uint64_t)(strm.next_in - data), strm.data_type & 7, {}};
+
+			// Window is a ring buffer once it is filled.
+			const size_t next_write = window.size() - strm.avail_out;
+			if (out >= window.size())
+			{
+				cp.window.assign(window.begin() + next_write, window.end());
+			}
+			cp.window.insert(cp.window.end(), window.begin(), window.begin() + next_write);
+
+			AddCheckpoint(move(cp));
+			last_checkpoint = out;
+		}
+	}
+
+	inflateEnd(&strm);
+}
+
+void CompressedFileSource::IndexXz()
+{
+	const uint8_t *data = compressed.Data();
+	const uint64_t in_size = compressed.Size();
+
+	// Xz files end with an index of their blocks, read without decompressing.
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_index *index = nullptr;
+	lzma_ret ret = lzma_file_info_decoder(&strm, &index, UINT64_MAX, in_size);
+
+	strm.next_in = data;
+	strm.avail_in = in_size;
+	while (ret == LZMA_OK || ret == LZMA_SEEK_NEEDED)
+	{
+		if (ret == LZMA_SEEK_NEEDED)
+		{
+			strm.next_in = data + strm.seek_pos;
+			strm.avail_in = in_size - strm.seek_pos;
+		}
+		ret = lzma_code(&strm, LZMA_RUN);
+	}
+	lzma_end(&strm);
+
+	if (ret == LZMA_STREAM_END)
+	{
+		lzma_index_iter iter;
+		lzma_index_iter_init(&iter, index);
+		while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK))
+		{
+			AddCheckpoint(Checkpoint{iter.block.uncompressed_file_offset,
+			                         iter.block.compressed_file_offset,
+			                         (int32_t)iter.stream.flags->check, {}});
+		}
+
+		PublishSize(lzma_index_uncompressed_size(index));
+		lzma_index_end(index, nullptr);
+		return;
+	}
+
+	// No usable index, like in a truncated file. It is decoded as a whole
+	// to find how much is there.
+	AddCheckpoint(Checkpoint{0, 0, -1, {}});
+
+	XzDecoder decoder(data, in_size, checkpoints.front());
+	vector<uint8_t> scratch(kUnitSize);
+	uint64_t out = 0;
+
+	while (!stop.load(memory_order_relaxed))
+	{
+		const size_t n = decoder.Decode(scratch.data(), scratch.size());
+		if (n == 0)
+		{
+			break;
+		}
+		out += n;
+		PublishSize(out);
+	}
+}
+
+void CompressedFileSource::IndexZstd()
+{
+#ifdef HEXA_WITH_ZSTD
+	const uint8_t *data = compressed.Data();
+	const uint64_t in_size = compressed.Size();
+
+	uint64_t in = 0;
+	uint64_t out = 0;
+	uint64_t last_checkpoint = 0;
+	vector<uint8_t> scratch;
+
+	// Zstd can only restart at frame boundaries, most frames have their
+	// decompressed size in the header.
+	while (in < in_size && !stop.load(memory_order_relaxed))
+	{
+		const size_t frame_size = ZSTD_findFrameCompressedSize(data + in, in_size - in);
+		if (ZSTD_isError(frame_size))
+		{
+			break;
+		}
+
+		if (in == 0 || out - last_checkpoint >= kCheckpointSpan)
+		{
+			AddCheckpoint(Checkpoint{out, in, 0, {}});
+			last_checkpoint = out;
+		}
+
+		unsigned long long content_size = ZSTD_getFrameContentSize(data + in, frame_size);
+		if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR)
+		{
+			scratch.resize(kUnitSize);
+			ZstdDecoder decoder(data, in + frame_size, Checkpoint{out, in, 0, {}});
+
+			content_size = 0;
+			while (size_t n = decoder.Decode(scratch.data(), scratch.size()))
+			{
+				content_size += n;
+				PublishSize(out + content_size);
+			}
+		}
+
+		in += frame_size;
+		out += content_size;
+		PublishSize(out);
+	}
+#endif
+}
+
+void CompressedFileSource::AddCheckpoint(Checkpoint checkpoint)
+{
+	lock_guard<std::mutex> lock(mutex);
+	checkpoints.push_back(move(checkpoint));
+}
+
+void CompressedFileSource::PublishSize(uint64_t new_size)
+{
+	size.store(new_size, memory_order_release);
+
+	// Growth is reported at most this often, like streams do.
+	const auto now = chrono::steady_clock::now();
+	if (now - last_notify >= chrono::milliseconds(50))
+	{
+		last_notify = now;
+		NotifyGrowth();
+	}
+}
+
+void CompressedFileSource::NotifyGrowth()
+{
+	if (on_growth && !notify_pending.exchange(true))
+	{
+		on_growth();
+	}
+}
+
+uint64_t CompressedFileSource::Materialize(uint64_t offset, uint64_t length) const
+{
+	const uint64_t unit = offset / kUnitSize;
+	const uint64_t unit_begin = unit * kUnitSize;
+	const uint64_t unit_end = min(unit_begin + kUnitSize, Size());
+	length = min(length, unit_end - offset);
+
+	// Unit might be partially filled while the size was not known yet.
+	if (Materialized(offset, length))
+	{
+		return length;
+	}
+
+	lock_guard<std::mutex> fill_lock(fill_mutex);
+	vector<Checkpoint> from;
+	uint64_t filled_end;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		if (unit >= filled.size())
+		{
+			filled.resize(unit + 1, 0);
+		}
+
+		// Another thread might have filled it meanwhile.
+		filled_end = filled[unit];
+		if (filled_end >= offset + length)
+		{
+			return length;
+		}
+
+		// Checkpoints are copied, the indexer might still be adding some.
+		auto first = upper_bound(checkpoints.begin(), checkpoints.end(), unit_begin,
+		    [](uint64_t pos, const Checkpoint &cp) { return pos < cp.out; }) - 1;
+		auto last = lower_bound(first, checkpoints.end(), unit_end,
+		    [](const Checkpoint &cp, uint64_t pos) { return cp.out < pos; });
+		from.assign(first, last);
+	}
+
+	Fill(unit_begin, unit_end, from, filled_end);
+
+	lock_guard<std::mutex> lock(mutex);
+	filled[unit] = unit_end;
+	return length;
+}
+
+bool CompressedFileSource::Materialized(uint64_t offset, uint64_t length) const
+{
+	lock_guard<std::mutex> lock(mutex);
+	for (uint64_t pos = offset; pos < offset + length; )
+	{
+		const uint64_t unit = pos / kUnitSize;
+		const uint64_t end = min((unit + 1) * kUnitSize, offset + length);
+		if (unit >= filled.size() || filled[unit] < end)
+		{
+			return false;
+		}
+		pos = end;
+	}
+	return true;
+}
+
+void CompressedFileSource::Fill(uint64_t begin, uint64_t end, const vector<Checkpoint> &from, uint64_t filled_end) const
+{
+	const uint8_t *data = compressed.Data();
+	const uint64_t in_size = compressed.Size();
+
+	// Left zero if the data turns out to be corrupt.
+	vector<uint8_t> out(end - begin);
+	vector<uint8_t> skipped(min<uint64_t>(begin - from[0].out, kUnitSize));
+
+	size_t i = 0;
+	uint64_t pos = from[0].out;
+	unique_ptr<Decoder> decoder = MakeDecoder(format, data, in_size, from[0]);
+
+	while (pos < end)
+	{
+		size_t n;
+		if (pos < begin)
+		{
+			n = decoder->Decode(skipped.data(), min<uint64_t>(skipped.size(), begin - pos));
+		}
+		else
+		{
+			n = decoder->Decode(out.data() + (pos - begin), end - pos);
+		}
+
+		if (n == 0)
+		{
+			// End of an xz block, decoding continues with the next one.
+			if (i + 1 < from.size() && from[i + 1].out == pos)
+			{
+				decoder = MakeDecoder(format, data, in_size, from[++i]);
+				continue;
+			}
+			break;
+		}
+		pos += n;
+	}
+
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	const uint64_t map_length = (end - begin + page_size - 1) / page_size * page_size;
+
+	if (spill_fd >= 0)
+	{
+		uint64_t written = 0;
+		while (written < out.size())
+		{
+			ssize_t n = pwrite(spill_fd, out.data() + written, out.size() - written, begin + written);
+			if (n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n <= 0)
+			{
+				throw runtime_error(string("Unable to write decompressed data: ") + strerror(errno));
+			}
+			written += n;
+		}
+
+		// A partially filled unit is mapped again with the same bytes at the
+		// start, so readers of those are not affected.
+		if (mmap(base + begin, map_length, PROT_READ, MAP_SHARED | MAP_FIXED,
+		         spill_fd, begin) == MAP_FAILED)
+		{
+			throw runtime_error(string("Unable to map decompressed data: ") + strerror(errno));
+		}
+		return;
+	}
+
+	// No temporary file, keep the unit in memory. Only bytes not filled
+	// before are written, others might be read concurrently.
+	if (filled_end == 0)
+	{
+		if (mmap(base + begin, kUnitSize, PROT_READ | PROT_WRITE,
+		         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+		{
+			throw runtime_error(string("Unable to allocate memory: ") + strerror(errno));
+		}
+	}
+	const uint64_t already = filled_end == 0 ? 0 : filled_end - begin;
+	memcpy(base + begin + already, out.data() + already, out.size() - already);
+}
+
+bool CompressedFileSource::LoadIndex()
+{
+	if (index_dir.empty())
+	{
+		return false;
+	}
+
+	ifstream file(IndexCacheFileName(index_dir, compressed.FileName(), ".idx"), ios::binary);
+	char magic[sizeof(kIndexMagic)];
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, kIndexMagic, sizeof(magic)) != 0)
+	{
+		return false;
+	}
+
+	// Index is valid only for the exact file it is built from.
+	const struct stat &st = compressed.MappedStat();
+	uint32_t index_format;
+	uint64_t compressed_size, decompressed_size, count;
+	int64_t mtime_sec, mtime_nsec;
+	if (!ReadIndexField(file, index_format) || index_format != (uint32_t)format
+	    || !ReadIndexField(file, compressed_size) || compressed_size != (uint64_t)st.st_size
+	    || !ReadIndexField(file, mtime_sec) || mtime_sec != (int64_t)st.st_mtim.tv_sec
+	    || !ReadIndexField(file, mtime_nsec) || mtime_nsec != (int64_t)st.st_mtim.tv_nsec
+	    || !ReadIndexField(file, decompressed_size)
+	    || !ReadIndexField(file, count) || count == 0)
+	{
+		return false;
+	}
+
+	vector<Checkpoint> loaded;
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		Checkpoint cp;
+		uint32_t window_length;
+		if (!ReadIndexField(file, cp.out) || !ReadIndexField(file, cp.in) || !ReadIndexField(file, cp.param)
+		    || !ReadIndexField(file, window_length) || window_length > kGzipWindowSize)
+		{
+			return false;
+		}
+
+		// Reads find the checkpoint before an offset by bisecting, starting
+		// from the one at offset 0.
+		const bool ordered = (loaded.empty() ? cp.out == 0
+		                      : cp.out > loaded.back().out && cp.in > loaded.back().in);
+		if (!ordered || cp.in > compressed_size)
+		{
+			return false;
+		}
+
+		cp.window.resize(window_length);
+		if (!file.read(reinterpret_cast<char*>(cp.window.data()), window_length))
+		{
+			return false;
+		}
+		loaded.push_back(move(cp));
+	}
+
+	checkpoints = move(loaded);
+	size.store(decompressed_size, memory_order_release);
+	return true;
+}
+
+void CompressedFileSource::SaveIndex() const
+{
+	const string file_name = IndexCacheFileName(index_dir, compressed.FileName(), ".idx");
+	WriteIndexCacheFile(index_dir, file_name, [this](ofstream &file)
+	{
+		const struct stat &st = compressed.MappedStat();
+
+		file.write(kIndexMagic, sizeof(kIndexMagic));
+		WriteIndexField(file, (uint32_t)format);
+		WriteIndexField(file, (uint64_t)st.st_size);
+		WriteIndexField(file, (int64_t)st.st_mtim.tv_sec);
+		WriteIndexField(file, (int64_t)st.st_mtim.tv_nsec);
+		WriteIndexField(file, Size());
+		WriteIndexField(file, (uint64_t)checkpoints.size());
+
+		for (const Checkpoint &cp : checkpoints)
+		{
+			WriteIndexField(file, cp.out);
+			WriteIndexField(file, cp.in);
+			WriteIndexField(file, cp.param);
+			WriteIndexField(file, (uint32_t)cp.window.size());
+			file.write(reinterpret_cast<const char*>(cp.window.data()), cp.window.size());
+		}
+	});
+}
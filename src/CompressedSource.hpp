@@ -0,0 +1,140 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ByteSource.hpp"
+
+// Decompressed contents of a gzip, xz or zstd file.
+//
+// A background thread decompresses the file once to find its size, and
+// records checkpoints where decoding can be restarted. Bytes are then
+// decompressed on demand from the nearest checkpoint before them, into an
+// unlinked temporary file mapped at a fixed address. Checkpoints are saved
+// in `index_dir`, so the file opens without the first pass next time.
+class CompressedFileSource : public ByteSource
+{
+public:
+	enum class Format
+	{
+		Gzip,
+		Xz,
+		Zstd,
+	};
+
+	// Place in the compressed file where decoding can be restarted.
+	struct Checkpoint
+	{
+		// Decompressed offset.
+		uint64_t out;
+		// Compressed offset.
+		uint64_t in;
+		// Gzip: bits of the byte before `in` not decoded yet, or -1 at the
+		// start of a member. Xz: check type of the block's stream, or -1 if
+		// the file is decoded as a whole.
+		int32_t param;
+		// Gzip: last 32 KiB decompressed before `out`.
+		std::vector<uint8_t> window;
+	};
+
+	// Decompressed bytes are produced in units of this size.
+	static constexpr uint64_t kUnitSize = 1 << 20;
+
+	// Distance between gzip and zstd checkpoints. Xz files can only be
+	// restarted at block boundaries, so they get one per block.
+	static constexpr uint64_t kCheckpointSpan = 1 << 20;
+
+	// Returns false if the file is not in a supported format, judging by
+	// its magic bytes.
+	static bool DetectFormat(const std::string &file_name, Format &format);
+
+	// `on_growth` is called on the indexing thread as more of the
+	// decompressed size becomes known, at most once per `AcknowledgeGrowth`.
+	CompressedFileSource(const std::string &file_name,
+	                     Format format,
+	                     const std::string &index_dir,
+	                     std::function<void()> on_growth);
+	~CompressedFileSource() override;
+
+	bool IsGrowing() const override
+	{
+		return !indexed.load(std::memory_order_acquire);
+	}
+
+	void AcknowledgeGrowth() override
+	{
+		notify_pending.store(false, std::memory_order_release);
+	}
+
+	uint64_t Materialize(uint64_t offset, uint64_t length) const override;
+	bool Materialized(uint64_t offset, uint64_t length) const override;
+
+private:
+	void IndexerMain();
+	void IndexGzip();
+	void IndexXz();
+	void IndexZstd();
+
+	void AddCheckpoint(Checkpoint checkpoint);
+
+	// Publishes the decompressed size found so far.
+	void PublishSize(uint64_t new_size);
+	void NotifyGrowth();
+
+	// Decompresses [begin, end) into the temporary file, and maps it,
+	// starting from the first of `from`, which are the checkpoints before
+	// `end`. Bytes before `filled_end` were decompressed already. Called
+	// with `fill_mutex` held.
+	void Fill(uint64_t begin, uint64_t end, const std::vector<Checkpoint> &from, uint64_t filled_end) const;
+
+	bool LoadIndex();
+	void SaveIndex() const;
+
+	MappedFileSource compressed;
+	Format format;
+	std::string index_dir;
+
+	// Guards the checkpoints and `filled`, only held briefly.
+	mutable std::mutex mutex;
+	std::vector<Checkpoint> checkpoints;
+
+	// End of the bytes decompressed so far in each unit, 0 if none.
+	mutable std::vector<uint64_t> filled;
+
+	// Held while decompressing, one unit at a time. Readers of units filled
+	// before do not wait for it.
+	mutable std::mutex fill_mutex;
+
+	// Decompressed bytes are kept here, so kernel can drop them from memory.
+	mutable int spill_fd = -1;
+
+	std::function<void()> on_growth;
+	std::atomic<bool> notify_pending{false};
+	std::chrono::steady_clock::time_point last_notify;
+
+	std::atomic<bool> indexed{false};
+	std::atomic<bool> stop{false};
+	std::thread indexer;
+};
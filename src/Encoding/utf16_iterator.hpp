@@ -37,9 +37,10 @@ public:
 	{
 	}
 
+	// Bytes after the last whole code unit are left out.
 	utf16_iterator(const char *it, const char *end,
 	               Endianness endianness = Endianness::LittleEndian)
-	  : it((const char16_t*)it), end((const char16_t*)end)
+	  : it((const char16_t*)it), end((const char16_t*)(end - (end - it) % sizeof(char16_t)))
 	  , next_it((const char16_t*)it), endianness(endianness)
 	{
 	}
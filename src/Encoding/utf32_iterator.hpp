@@ -36,9 +36,10 @@ public:
 	{
 	}
 
+	// Bytes after the last whole code unit are left out.
 	utf32_iterator(const char *it, const char *end,
 	               Endianness endianness = Endianness::LittleEndian)
-	  : it((const char32_t*)it), end((const char32_t*)end)
+	  : it((const char32_t*)it), end((const char32_t*)(end - (end - it) % sizeof(char32_t)))
 	  , next_it((const char32_t*)it), endianness(endianness)
 	{
 	}
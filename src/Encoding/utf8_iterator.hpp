@@ -17,21 +17,213 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include "unicode_iterator.hpp"
 
 namespace unicode_iterator
 {
 
+namespace utf8_detail
+{
+
+inline bool IsTrailByte(uint8_t c)
+{
+	return (0b11000000 & c) == 0b10000000;
+}
+
+// Decodes the multi byte sequence at `p`, which has `available` bytes.
+// Returns its length, or 0 with `code_point` set to CP_CORRUPT or
+// CP_END_OF_STREAM. Overlong forms, surrogates and code points past
+// U+10FFFF are corrupt.
+//
+// Valid UTF-8 code points:
+// 0xxxxxxx
+// 110xxxxx  10xxxxxx
+// 1110xxxx  10xxxxxx  10xxxxxx
+// 11110xxx  10xxxxxx  10xxxxxx  10xxxxxx
+//
+// Unused:
+// 111110xx  10xxxxxx  10xxxxxx  10xxxxxx  10xxxxxx
+// 1111110x  10xxxxxx  10xxxxxx  10xxxxxx  10xxxxxx  10xxxxxx
+inline int DecodeSequence(const uint8_t *p, ptrdiff_t available, char32_t &code_point)
+{
+	int length;
+	char32_t min_code_point;
+	if (p[0] >= 0b11000000 && p[0] < 0b11100000)
+	{
+		length = 2;
+		min_code_point = 0x80;
+		code_point = p[0] & 0b00011111;
+	}
+	else if (p[0] >= 0b11100000 && p[0] < 0b11110000)
+	{
+		length = 3;
+		min_code_point = 0x800;
+		code_point = p[0] & 0b00001111;
+	}
+	else if (p[0] >= 0b11110000 && p[0] < 0b11111000)
+	{
+		length = 4;
+		min_code_point = 0x10000;
+		code_point = p[0] & 0b00000111;
+	}
+	else
+	{
+		// Trail byte, or unused lead byte.
+		code_point = ::unicode_iterator::CP_CORRUPT;
+		return 0;
+	}
+
+	// Trail bytes seen so far are checked first, so a corrupt sequence is
+	// reported as such even if it is cut by the end.
+	for (int i = 1; i < length; ++i)
+	{
+		if (i >= available)
+		{
+			code_point = ::unicode_iterator::CP_END_OF_STREAM;
+			return 0;
+		}
+		if (!IsTrailByte(p[i]))
+		{
+			code_point = ::unicode_iterator::CP_CORRUPT;
+			return 0;
+		}
+		code_point = (code_point << 6) | (p[i] & 0b00111111);
+	}
+
+	if (code_point < min_code_point || code_point > 0x10ffff
+	    || (code_point >= 0xd800 && code_point <= 0xdfff))
+	{
+		code_point = ::unicode_iterator::CP_CORRUPT;
+		return 0;
+	}
+	return length;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline size_t AsciiPrefixAvx2(const uint8_t *p, size_t length)
+{
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		const uint32_t high = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(p + i)));
+		if (high)
+		{
+			return i + __builtin_ctz(high);
+		}
+	}
+	while (i < length && p[i] < 0x80)
+	{
+		++i;
+	}
+	return i;
+}
+
+inline size_t AsciiPrefixSse2(const uint8_t *p, size_t length)
+{
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		const uint32_t high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i)));
+		if (high)
+		{
+			return i + __builtin_ctz(high);
+		}
+	}
+	while (i < length && p[i] < 0x80)
+	{
+		++i;
+	}
+	return i;
+}
+#endif
+
+// Length of the ASCII prefix of [p, p + length).
+inline size_t AsciiPrefix(const uint8_t *p, size_t length)
+{
+#if defined(__x86_64__)
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	return has_avx2 ? AsciiPrefixAvx2(p, length) : AsciiPrefixSse2(p, length);
+#else
+	size_t i = 0;
+	while (i < length && p[i] < 0x80)
+	{
+		++i;
+	}
+	return i;
+#endif
+}
+
+// Bytes `code_point` takes in UTF-8.
+inline int EncodedLength(char32_t code_point)
+{
+	return code_point < 0x80 ? 1 : code_point < 0x800 ? 2 : code_point < 0x10000 ? 3 : 4;
+}
+
+} // namespace utf8_detail
+
+// Decodes code points of [it, end) into `out`, until `capacity` of them
+// are written or the next bytes are not valid UTF-8. Advances `it` past the
+// decoded ones and returns how many there are.
+//
+// This is the bulk path for long text, where most bytes are ASCII: those
+// are found a vector at a time and widened without per byte checks. Other
+// sequences are validated one by one.
+inline size_t utf8_decode(const char *&it, const char *end, char32_t *out, size_t capacity)
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(it);
+	const uint8_t *const stop = reinterpret_cast<const uint8_t*>(end);
+	size_t count = 0;
+
+	while (count < capacity && p < stop)
+	{
+		const size_t ascii = utf8_detail::AsciiPrefix(p, std::min<size_t>(stop - p, capacity - count));
+		for (size_t i = 0; i < ascii; ++i)
+		{
+			out[count + i] = p[i];
+		}
+		count += ascii;
+		p += ascii;
+
+		if (count == capacity || p == stop || *p < 0x80)
+		{
+			continue;
+		}
+
+		char32_t code_point;
+		const int length = utf8_detail::DecodeSequence(p, stop - p, code_point);
+		if (length == 0)
+		{
+			break;
+		}
+		out[count++] = code_point;
+		p += length;
+	}
+
+	it = reinterpret_cast<const char*>(p);
+	return count;
+}
+
 // TODO CP_TRAIL_BYTES not handled.
 // InputIterator,
 // Returns special values for Corrupt and Trail and Eof
+//
+// One code point at a time. They are decoded a batch at a time with
+// utf8_decode, the bytes it stops at are reported as CP_CORRUPT or
+// CP_END_OF_STREAM, and not stepped over.
 class utf8_iterator
 {
 public:
 	utf8_iterator(const char *it, const char *end)
-	  : it(reinterpret_cast<const uint8_t*>(it))
-	  , end(reinterpret_cast<const uint8_t*>(end))
-	  , next_it(reinterpret_cast<const uint8_t*>(it))
+	  : it(it), end(end)
 	{
 	}
 
@@ -39,132 +231,54 @@ public:
 
 	char32_t operator*()
 	{
-		if (next_code_point == ::unicode_iterator::CP_NOT_DECODED)
+		if (index == count)
 		{
-			ExtractNextCodePoint();
+			DecodeBatch();
 		}
-		return next_code_point;
+		return index < count ? decoded[index] : stopped_at;
 	}
 
 	utf8_iterator& operator++()
 	{
-		if (next_it == it)
+		if (index == count)
+		{
+			DecodeBatch();
+		}
+		if (index < count)
 		{
-			ExtractNextCodePoint();
+			++index;
 		}
-		it = next_it;
-		next_code_point = ::unicode_iterator::CP_NOT_DECODED;
 		return *this;
 	}
 
 private:
-	// Valid UTF-8 code points:
-	// 0xxxxxxx
-	// 110xxxxx  10xxxxxx
-	// 1110xxxx  10xxxxxx  10xxxxxx
-	// 11110xxx  10xxxxxx  10xxxxxx  10xxxxxx
-	//
-	// Unused:
-	// 111110xx  10xxxxxx  10xxxxxx  10xxxxxx  10xxxxxx
-	// 1111110x  10xxxxxx  10xxxxxx  10xxxxxx  10xxxxxx  10xxxxxx
-	void ExtractNextCodePoint()
-	{
-		next_it = it;
-
-		if (end - next_it <= 0)
-		{
-			next_code_point = ::unicode_iterator::CP_END_OF_STREAM;
-			return;
-		}
-
-		if (*next_it < 0b10000000)
-		{
-			next_code_point = *(next_it++);
-			return;
-		}
+	// Enough for a line of text, which is what most users take.
+	static constexpr size_t kBatchSize = 32;
 
-		// TODO FIXME corrupt before EOF not found here.
-
-		// Two byte seq
-		if (*next_it < 0b11100000)
-		{
-			if (end - next_it < 2)
-			{
-				next_code_point = ::unicode_iterator::CP_END_OF_STREAM;
-				return;
-			}
-			if (!IsTrailByte(next_it[1]))
-			{
-				next_code_point = ::unicode_iterator::CP_CORRUPT;
-				return;
-			}
-
-			next_code_point = 0b00011111 & *(next_it++);
-			next_code_point <<= 6;
-			next_code_point |= 0b00111111 & *(next_it++);
-			return;
-		}
-
-		// Three byte seq
-		if (*next_it < 0b11110000)
+	void DecodeBatch()
+	{
+		index = 0;
+		count = utf8_decode(it, end, decoded, kBatchSize);
+		if (count > 0)
 		{
-			if (end - next_it < 3)
-			{
-				next_code_point = ::unicode_iterator::CP_END_OF_STREAM;
-				return;
-			}
-			if (!IsTrailByte(next_it[1]) || !IsTrailByte(next_it[2]))
-			{
-				next_code_point = ::unicode_iterator::CP_CORRUPT;
-				return;
-			}
-
-			next_code_point = 0b00011111 & *(next_it++);
-			next_code_point <<= 6;
-			next_code_point |= 0b00111111 & *(next_it++);
-			next_code_point <<= 6;
-			next_code_point |= 0b00111111 & *(next_it++);
 			return;
 		}
 
-		// Four byte seq
-		if (*next_it < 0b11111000)
+		if (end - it <= 0)
 		{
-			if (end - next_it < 4)
-			{
-				next_code_point = ::unicode_iterator::CP_END_OF_STREAM;
-				return;
-			}
-			if (!IsTrailByte(next_it[1]) || !IsTrailByte(next_it[2]) || !IsTrailByte(next_it[3]))
-			{
-				next_code_point = ::unicode_iterator::CP_CORRUPT;
-				return;
-			}
-
-			next_code_point = 0b00011111 & *(next_it++);
-			next_code_point <<= 6;
-			next_code_point |= 0b00111111 & *(next_it++);
-			next_code_point <<= 6;
-			next_code_point |= 0b00111111 & *(next_it++);
-			next_code_point <<= 6;
-			next_code_point |= 0b00111111 & *(next_it++);
+			stopped_at = ::unicode_iterator::CP_END_OF_STREAM;
 			return;
 		}
-
-		next_code_point = ::unicode_iterator::CP_CORRUPT;
-		return;
-	}
-
-	bool IsTrailByte(char c)
-	{
-		return (0b11000000 & c) == 0b10000000;
+		utf8_detail::DecodeSequence(reinterpret_cast<const uint8_t*>(it), end - it, stopped_at);
 	}
 
-	const uint8_t *it = nullptr;
-	const uint8_t *end = nullptr;
+	const char *it = nullptr;
+	const char *end = nullptr;
 
-	const uint8_t *next_it = nullptr;
-	char32_t next_code_point = ::unicode_iterator::CP_NOT_DECODED;
+	char32_t decoded[kBatchSize];
+	size_t index = 0;
+	size_t count = 0;
+	char32_t stopped_at = ::unicode_iterator::CP_NOT_DECODED;
 };
 
 } // namespace unicode_iterator
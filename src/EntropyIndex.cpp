@@ -0,0 +1,132 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cmath>
+
+#include "ByteHistogram.hpp"
+#include "ByteSource.hpp"
+#include "EntropyIndex.hpp"
+
+using namespace std;
+
+EntropyIndex::EntropyIndex(uint64_t size)
+  : size(size), entropy((size + kBlockSize - 1) / kBlockSize, 0)
+{
+}
+
+int EntropyIndex::Measure(const uint8_t *data, uint64_t length)
+{
+	ByteHistogram histogram;
+	histogram.Add(data, length);
+	return min(kMaxEntropy, (int)lround(histogram.Entropy() * kScale));
+}
+
+void EntropyIndex::SumUp()
+{
+	const size_t group_count = entropy.size() / kSumBlocks;
+	sums.assign(group_count + 1, 0);
+	for (size_t group = 0; group < group_count; ++group)
+	{
+		uint64_t sum = 0;
+		for (size_t block = group * kSumBlocks; block < (group + 1) * kSumBlocks; ++block)
+		{
+			sum += (uint64_t)entropy[block] * min(kBlockSize, size - block * kBlockSize);
+		}
+		sums[group + 1] = sums[group] + sum;
+	}
+}
+
+uint64_t EntropyIndex::WeightedSum(uint64_t begin, uint64_t end) const
+{
+	end = min(end, size);
+	if (begin >= end)
+	{
+		return 0;
+	}
+
+	uint64_t sum = 0;
+	auto add_blocks = [&](size_t first, size_t last)
+	{
+		for (size_t block = first; block < last; ++block)
+		{
+			const uint64_t block_begin = max(begin, block * kBlockSize);
+			const uint64_t block_end = min(end, (block + 1) * kBlockSize);
+			sum += (uint64_t)entropy[block] * (block_end - block_begin);
+		}
+	};
+
+	// Groups whose blocks are all in range are taken from the running sums,
+	// blocks before and after them one by one.
+	const size_t first_block = begin / kBlockSize;
+	const size_t last_block = (end + kBlockSize - 1) / kBlockSize;
+	const size_t first_whole = (begin + kBlockSize - 1) / kBlockSize;
+	const size_t last_whole = (end == size ? entropy.size() : end / kBlockSize);
+	const size_t first_group = (first_whole + kSumBlocks - 1) / kSumBlocks;
+	const size_t last_group = min(last_whole / kSumBlocks, sums.empty() ? 0 : sums.size() - 1);
+
+	if (first_group >= last_group)
+	{
+		add_blocks(first_block, last_block);
+		return sum;
+	}
+
+	add_blocks(first_block, first_group * kSumBlocks);
+	sum += sums[last_group] - sums[first_group];
+	add_blocks(last_group * kSumBlocks, last_block);
+	return sum;
+}
+
+bool EntropyIndex::Compute(const ByteSource &source,
+                           size_t first_block,
+                           size_t last_block,
+                           const function<bool()> &cancelled)
+{
+	const auto &holes = source.Holes();
+	auto hole = upper_bound(holes.begin(), holes.end(), first_block * kBlockSize,
+	    [](uint64_t p, const pair<uint64_t, uint64_t> &h) { return p < h.second; });
+
+	last_block = min(last_block, entropy.size());
+	for (size_t block = first_block; block < last_block; ++block)
+	{
+		if ((block - first_block) % (ByteSource::kCancelCheckBytes / kBlockSize) == 0 && cancelled())
+		{
+			return false;
+		}
+
+		const uint64_t offset = block * kBlockSize;
+		const uint64_t length = min(kBlockSize, size - offset);
+
+		while (hole != holes.end() && hole->second <= offset)
+		{
+			++hole;
+		}
+
+		// Zeros of a hole have no entropy, they are not read.
+		if (hole != holes.end() && hole->first <= offset && hole->second >= offset + length)
+		{
+			entropy[block] = 0;
+			continue;
+		}
+
+		for (uint64_t readable = 0; readable < length; )
+		{
+			readable += source.Materialize(offset + readable, length - readable);
+		}
+		entropy[block] = Measure(source.Data() + offset, length);
+	}
+	return true;
+}
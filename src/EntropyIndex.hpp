@@ -0,0 +1,89 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "BlockIndex.hpp"
+
+class ByteSource;
+
+// Shannon entropy of fixed size blocks of a source, for finding compressed
+// or encrypted regions at a glance.
+//
+// Like BlockIndex, offsets are in the source, so edits never invalidate
+// it. Bytes added by edits are few, they are measured when needed.
+class EntropyIndex
+{
+public:
+	static constexpr uint64_t kBlockSize = BlockIndex::kBlockSize;
+
+	// Entropy values are in 1/kScale bits per byte, clamped to 255, so
+	// random data is at the top of the range.
+	static constexpr int kScale = 32;
+	static constexpr int kMaxEntropy = 255;
+
+	// Index of a source with `size` bytes, with nothing computed yet.
+	explicit EntropyIndex(uint64_t size);
+
+	// Computes blocks [first_block, last_block). Disjoint ranges can be
+	// computed on different threads at the same time. Returns false if
+	// `cancelled` returns true before it is done.
+	bool Compute(const ByteSource &source,
+	             size_t first_block,
+	             size_t last_block,
+	             const std::function<bool()> &cancelled);
+
+	// Entropy of `length` bytes, in the same units as the index.
+	static int Measure(const uint8_t *data, uint64_t length);
+
+	// Computes the running sums WeightedSum uses, once every block is.
+	void SumUp();
+
+	// Entropy of each byte of [begin, end) added up, a byte having the
+	// entropy of its block. At most two groups of blocks at the ends are
+	// looked at, so the minimap takes the same time for any file size.
+	uint64_t WeightedSum(uint64_t begin, uint64_t end) const;
+
+	// Source size the index covers.
+	uint64_t Size() const
+	{
+		return size;
+	}
+
+	size_t BlockCount() const
+	{
+		return entropy.size();
+	}
+
+	int Entropy(size_t block) const
+	{
+		return entropy[block];
+	}
+
+private:
+	// Blocks summed up together, see `sums`.
+	static constexpr size_t kSumBlocks = 64;
+
+	uint64_t size;
+	std::vector<uint8_t> entropy;
+
+	// WeightedSum of the groups of kSumBlocks blocks before each group.
+	std::vector<uint64_t> sums;
+};
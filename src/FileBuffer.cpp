@@ -0,0 +1,612 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "CompressedSource.hpp"
+#include "FileBuffer.hpp"
+
+using namespace std;
+
+BufferSnapshot::BufferSnapshot()
+  : table(make_shared<Table>())
+{
+}
+
+uint8_t BufferSnapshot::ByteAt(uint64_t pos) const
+{
+	if (pos >= table->size)
+	{
+		throw out_of_range("Position out of buffer: " + to_string(pos));
+	}
+
+	const size_t i = FindPiece(pos);
+	const Piece &piece = table->pieces[i];
+	const uint64_t offset = piece.offset + pos - table->starts[i];
+	piece.source->Materialize(offset, 1);
+	return piece.source->Data()[offset];
+}
+
+bool BufferSnapshot::Materialized(uint64_t pos, uint64_t length) const
+{
+	bool materialized = true;
+	ForEachSourceRange(pos, length, [&](const ByteSource &source, uint64_t offset, uint64_t range_length)
+	{
+		materialized = materialized && source.Materialized(offset, range_length);
+	});
+	return materialized;
+}
+
+uint64_t BufferSnapshot::Read(uint64_t pos, void *out, uint64_t length) const
+{
+	uint8_t *dst = static_cast<uint8_t*>(out);
+	uint64_t copied = 0;
+
+	ForEachSpan(pos, length, [&](uint64_t, const uint8_t *data, uint64_t span_length)
+	{
+		memcpy(dst + copied, data, span_length);
+		copied += span_length;
+		return true;
+	});
+
+	return copied;
+}
+
+uint64_t BufferSnapshot::NextDataExtent(uint64_t pos) const
+{
+	const auto &holes = table->holes;
+	auto hole = upper_bound(holes.begin(), holes.end(), pos,
+	    [](uint64_t p, const pair<uint64_t, uint64_t> &h) { return p < h.second; });
+
+	return hole == holes.end() ? Size() : min(hole->second, Size());
+}
+
+int BufferSnapshot::KnownUniformByte(uint64_t pos, uint64_t length) const
+{
+	const Table &t = *table;
+	if (length == 0 || pos >= t.size || length > t.size - pos)
+	{
+		return BlockIndex::kNotUniform;
+	}
+
+	const uint64_t end = pos + length;
+	int value = BlockIndex::kNotUniform;
+
+	auto agree = [&value](int v)
+	{
+		if (v == BlockIndex::kNotUniform || (value != BlockIndex::kNotUniform && v != value))
+		{
+			return false;
+		}
+		value = v;
+		return true;
+	};
+
+	for (size_t i = FindPiece(pos); pos < end; ++i)
+	{
+		const Piece &piece = t.pieces[i];
+		const shared_ptr<const BlockIndex> blocks = piece.source->Blocks();
+		const auto &holes = piece.source->Holes();
+
+		// Walk the piece in source offsets.
+		uint64_t offset = piece.offset + pos - t.starts[i];
+		const uint64_t offset_end = offset + min(end, t.starts[i] + piece.length) - pos;
+		pos += offset_end - offset;
+
+		auto hole = upper_bound(holes.begin(), holes.end(), offset,
+		    [](uint64_t p, const pair<uint64_t, uint64_t> &h) { return p < h.second; });
+
+		while (offset < offset_end)
+		{
+			if (hole != holes.end() && hole->first <= offset)
+			{
+				if (!agree(0))
+				{
+					return BlockIndex::kNotUniform;
+				}
+				offset = hole->second;
+				++hole;
+				continue;
+			}
+
+			const size_t block = offset / BlockIndex::kBlockSize;
+			if (!blocks || offset >= blocks->Size() || !agree(blocks->UniformByte(block)))
+			{
+				return BlockIndex::kNotUniform;
+			}
+			offset = (block + 1) * BlockIndex::kBlockSize;
+		}
+	}
+
+	return value;
+}
+
+bool BufferSnapshot::SameContents(const BufferSnapshot &other, uint64_t pos, uint64_t length) const
+{
+	if (pos + length > Size() || pos + length > other.Size())
+	{
+		return false;
+	}
+	if (table == other.table)
+	{
+		return true;
+	}
+
+	// Pieces might be split differently, merge adjacent ones before
+	// comparing.
+	typedef tuple<const ByteSource*, uint64_t, uint64_t> Range;
+	auto ranges = [pos, length](const BufferSnapshot &snapshot)
+	{
+		vector<Range> result;
+		snapshot.ForEachSourceRange(pos, length, [&](const ByteSource &source, uint64_t offset, uint64_t range_length)
+		{
+			if (!result.empty() && get<0>(result.back()) == &source
+			    && get<1>(result.back()) + get<2>(result.back()) == offset)
+			{
+				get<2>(result.back()) += range_length;
+				return;
+			}
+			result.emplace_back(&source, offset, range_length);
+		});
+		return result;
+	};
+
+	return ranges(*this) == ranges(other);
+}
+
+uint64_t BufferSnapshot::SamePrefixLength(const BufferSnapshot &other) const
+{
+	if (table == other.table)
+	{
+		return Size();
+	}
+
+	// Pieces might be split differently, walk both a byte range at a time.
+	const vector<Piece> &a = table->pieces, &b = other.table->pieces;
+	size_t i = 0, j = 0;
+	uint64_t a_skip = 0, b_skip = 0, length = 0;
+	while (i < a.size() && j < b.size())
+	{
+		if (a[i].source != b[j].source || a[i].offset + a_skip != b[j].offset + b_skip)
+		{
+			break;
+		}
+
+		const uint64_t step = min(a[i].length - a_skip, b[j].length - b_skip);
+		length += step;
+		a_skip += step;
+		b_skip += step;
+		if (a_skip == a[i].length)
+		{
+			++i;
+			a_skip = 0;
+		}
+		if (b_skip == b[j].length)
+		{
+			++j;
+			b_skip = 0;
+		}
+	}
+	return length;
+}
+
+uint64_t BufferSnapshot::SameSuffixLength(const BufferSnapshot &other) const
+{
+	if (table == other.table)
+	{
+		return Size();
+	}
+
+	// Same as SamePrefixLength from the ends, the skips are counted from the
+	// ends of the pieces.
+	const vector<Piece> &a = table->pieces, &b = other.table->pieces;
+	size_t i = a.size(), j = b.size();
+	uint64_t a_skip = 0, b_skip = 0, length = 0;
+	while (i > 0 && j > 0)
+	{
+		const Piece &p = a[i - 1], &q = b[j - 1];
+		if (p.source != q.source || p.offset + p.length - a_skip != q.offset + q.length - b_skip)
+		{
+			break;
+		}
+
+		const uint64_t step = min(p.length - a_skip, q.length - b_skip);
+		length += step;
+		a_skip += step;
+		b_skip += step;
+		if (a_skip == p.length)
+		{
+			--i;
+			a_skip = 0;
+		}
+		if (b_skip == q.length)
+		{
+			--j;
+			b_skip = 0;
+		}
+	}
+	return length;
+}
+
+static atomic<uint64_t> next_buffer_id{1};
+
+FileBuffer::FileBuffer(shared_ptr<ByteSource> source)
+  : source(move(source)), added(make_shared<ChunkStore>(0, ChunkStore::kEditReservation))
+  , id(next_buffer_id++)
+{
+	SyncWithSource();
+}
+
+FileBuffer::FileBuffer(shared_ptr<MappedFileSource> source)
+  : FileBuffer(static_pointer_cast<ByteSource>(source))
+{
+	mapped = move(source);
+}
+
+unique_ptr<FileBuffer> FileBuffer::Open(const string &file_name,
+                                        uint64_t stream_memory_limit,
+                                        const string &index_dir,
+                                        function<void()> on_growth)
+{
+	struct stat st;
+	if (stat(file_name.c_str(), &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+	{
+		int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			return OpenStream(fd, stream_memory_limit, move(on_growth));
+		}
+	}
+
+	CompressedFileSource::Format format;
+	if (CompressedFileSource::DetectFormat(file_name, format))
+	{
+		return unique_ptr<FileBuffer>(new FileBuffer(
+		    make_shared<CompressedFileSource>(file_name, format, index_dir, move(on_growth))));
+	}
+
+	return unique_ptr<FileBuffer>(new FileBuffer(make_shared<MappedFileSource>(file_name)));
+}
+
+unique_ptr<FileBuffer> FileBuffer::OpenStream(int fd,
+                                              uint64_t stream_memory_limit,
+                                              function<void()> on_growth)
+{
+	return unique_ptr<FileBuffer>(new FileBuffer(
+	    make_shared<StreamSource>(fd, stream_memory_limit, move(on_growth))));
+}
+
+void FileBuffer::Overwrite(uint64_t pos, const void *bytes, uint64_t length)
+{
+	if (pos + length > Size())
+	{
+		throw out_of_range("Overwrite past the end of buffer");
+	}
+
+	const uint64_t offset = added->Append(bytes, length);
+	Replace(pos, pos + length, {Piece{added.get(), offset, length}});
+}
+
+void FileBuffer::Erase(uint64_t begin, uint64_t end)
+{
+	end = min(end, Size());
+	if (begin >= end)
+	{
+		return;
+	}
+
+	Replace(begin, end, {});
+}
+
+void FileBuffer::ReplaceAll(const vector<uint64_t> &starts, uint64_t match_length,
+                            const void *bytes, uint64_t length)
+{
+	if (starts.empty())
+	{
+		return;
+	}
+	for (size_t i = 1; i < starts.size(); ++i)
+	{
+		if (starts[i] < starts[i - 1] + match_length)
+		{
+			throw invalid_argument("Replaced ranges overlap");
+		}
+	}
+	if (starts.back() + match_length > Size())
+	{
+		throw out_of_range("Replace past the end of buffer");
+	}
+
+	const uint64_t offset = (length > 0 ? added->Append(bytes, length) : 0);
+	const Piece replacement{added.get(), offset, length};
+
+	const BufferSnapshot::Table &t = *snapshot.table;
+
+	vector<Piece> pieces;
+	pieces.reserve(t.pieces.size() + starts.size() * 2 + 1);
+
+	// Pieces are walked once along with the matches, `i` is the one `pos`
+	// is in.
+	size_t i = 0;
+	uint64_t pos = 0;
+
+	auto copy_until = [&](uint64_t end)
+	{
+		while (i < t.pieces.size() && pos < end)
+		{
+			const uint64_t piece_end = t.starts[i] + t.pieces[i].length;
+
+			Piece part = t.pieces[i];
+			part.offset += pos - t.starts[i];
+			part.length = min(piece_end, end) - pos;
+			pieces.push_back(part);
+
+			pos += part.length;
+			if (pos == piece_end)
+			{
+				++i;
+			}
+		}
+	};
+
+	for (uint64_t start : starts)
+	{
+		copy_until(start);
+		pieces.push_back(replacement);
+
+		pos = start + match_length;
+		while (i < t.pieces.size() && t.starts[i] + t.pieces[i].length <= pos)
+		{
+			++i;
+		}
+	}
+	copy_until(t.size);
+
+	Publish(move(pieces));
+}
+
+bool FileBuffer::SyncWithSource()
+{
+	// Acknowledge first, so growth happening after this point is reported again.
+	source->AcknowledgeGrowth();
+
+	const uint64_t source_size = source->Size();
+	if (source_size == synced_source_size)
+	{
+		return false;
+	}
+
+	vector<Piece> pieces = snapshot.table->pieces;
+	pieces.push_back(Piece{source.get(), synced_source_size, source_size - synced_source_size});
+	synced_source_size = source_size;
+
+	Publish(move(pieces));
+	return true;
+}
+
+bool FileBuffer::Refresh()
+{
+	source->Refresh();
+	if (!mapped || !mapped->Outgrown())
+	{
+		return SyncWithSource();
+	}
+
+	// Earlier pieces keep pointing at the old mapping, unless the file was
+	// replaced, which is left for a reload.
+	auto larger = make_shared<MappedFileSource>(mapped->FileName());
+	const struct stat &st = larger->MappedStat();
+	if (st.st_dev != mapped->MappedStat().st_dev || st.st_ino != mapped->MappedStat().st_ino
+	    || larger->Size() <= synced_source_size)
+	{
+		return SyncWithSource();
+	}
+
+	vector<Piece> pieces = snapshot.table->pieces;
+	pieces.push_back(Piece{larger.get(), synced_source_size, larger->Size() - synced_source_size});
+	synced_source_size = larger->Size();
+
+	previous_sources.push_back(source);
+	source = larger;
+	mapped = move(larger);
+
+	Publish(move(pieces));
+	return true;
+}
+
+vector< pair<uint64_t, uint64_t> > FileBuffer::Reload(shared_ptr<MappedFileSource> new_source)
+{
+	const uint64_t new_size = new_source->Size();
+	const shared_ptr<const BlockIndex> old_blocks = source->Blocks();
+	const shared_ptr<const BlockIndex> new_blocks = new_source->Blocks();
+
+	vector< pair<uint64_t, uint64_t> > changed;
+	if (old_blocks && new_blocks)
+	{
+		changed = old_blocks->ChangedRanges(*new_blocks);
+	}
+	else if (max(synced_source_size, new_size) > 0)
+	{
+		changed.emplace_back(0, max(synced_source_size, new_size));
+	}
+
+	// Pieces are in file offsets unless they are edits, retarget changed
+	// parts of them to the new mapping.
+	vector<Piece> pieces;
+	for (const Piece &piece : snapshot.table->pieces)
+	{
+		if (piece.source == added.get())
+		{
+			pieces.push_back(piece);
+			continue;
+		}
+
+		uint64_t begin = piece.offset;
+		const uint64_t end = min(piece.offset + piece.length, new_size);
+
+		auto range = lower_bound(changed.begin(), changed.end(), begin,
+		    [](const pair<uint64_t, uint64_t> &r, uint64_t pos) { return r.second <= pos; });
+
+		while (begin < end)
+		{
+			if (range == changed.end() || range->first >= end)
+			{
+				pieces.push_back(Piece{piece.source, begin, end - begin});
+				break;
+			}
+
+			if (range->first > begin)
+			{
+				pieces.push_back(Piece{piece.source, begin, range->first - begin});
+				begin = range->first;
+			}
+
+			const uint64_t changed_end = min(end, range->second);
+			pieces.push_back(Piece{new_source.get(), begin, changed_end - begin});
+			begin = changed_end;
+			++range;
+		}
+	}
+
+	if (new_size > synced_source_size)
+	{
+		pieces.push_back(Piece{new_source.get(), synced_source_size, new_size - synced_source_size});
+	}
+
+	previous_sources.push_back(source);
+	source = new_source;
+	mapped = move(new_source);
+	synced_source_size = new_size;
+
+	Publish(move(pieces));
+	return changed;
+}
+
+void FileBuffer::Replace(uint64_t begin, uint64_t end, const vector<Piece> &replacement)
+{
+	const BufferSnapshot::Table &t = *snapshot.table;
+
+	vector<Piece> pieces;
+	pieces.reserve(t.pieces.size() + replacement.size() + 2);
+
+	size_t i = 0;
+
+	// Pieces before the replaced range, and the head of the one it starts in.
+	for (; i < t.pieces.size() && t.starts[i] < begin; ++i)
+	{
+		Piece head = t.pieces[i];
+		head.length = min(head.length, begin - t.starts[i]);
+		pieces.push_back(head);
+
+		if (t.starts[i] + t.pieces[i].length > begin)
+		{
+			break;
+		}
+	}
+
+	pieces.insert(pieces.end(), replacement.begin(), replacement.end());
+
+	// Skip replaced pieces, keeping the tail of the one the range ends in.
+	for (; i < t.pieces.size(); ++i)
+	{
+		const uint64_t piece_end = t.starts[i] + t.pieces[i].length;
+		if (piece_end <= end)
+		{
+			continue;
+		}
+
+		Piece tail = t.pieces[i];
+		if (t.starts[i] < end)
+		{
+			tail.offset += end - t.starts[i];
+			tail.length -= end - t.starts[i];
+		}
+		pieces.push_back(tail);
+	}
+
+	Publish(move(pieces));
+}
+
+void FileBuffer::Publish(vector<Piece> &&pieces)
+{
+	auto table = make_shared<BufferSnapshot::Table>();
+	table->sources = previous_sources;
+	table->sources.push_back(source);
+	table->sources.push_back(added);
+
+	for (const Piece &piece : pieces)
+	{
+		if (piece.length == 0)
+		{
+			continue;
+		}
+
+		// Merge with previous piece if they are adjacent in the same source,
+		// which is typical for sequential typing and stream growth.
+		if (!table->pieces.empty())
+		{
+			Piece &last = table->pieces.back();
+			if (last.source == piece.source && last.offset + last.length == piece.offset)
+			{
+				last.length += piece.length;
+				table->size += piece.length;
+				continue;
+			}
+		}
+
+		table->pieces.push_back(piece);
+		table->starts.push_back(table->size);
+		table->size += piece.length;
+	}
+
+	// Translate holes of the sources covered by pieces to buffer offsets.
+	for (size_t i = 0; i < table->pieces.size(); ++i)
+	{
+		const Piece &piece = table->pieces[i];
+		const auto &holes = piece.source->Holes();
+		const uint64_t piece_end = piece.offset + piece.length;
+
+		auto hole = upper_bound(holes.begin(), holes.end(), piece.offset,
+		    [](uint64_t p, const pair<uint64_t, uint64_t> &h) { return p < h.second; });
+
+		for (; hole != holes.end() && hole->first < piece_end; ++hole)
+		{
+			const uint64_t begin = table->starts[i] + max(hole->first, piece.offset) - piece.offset;
+			const uint64_t end = table->starts[i] + min(hole->second, piece_end) - piece.offset;
+
+			if (!table->holes.empty() && table->holes.back().second == begin)
+			{
+				table->holes.back().second = end;
+			}
+			else
+			{
+				table->holes.emplace_back(begin, end);
+			}
+		}
+	}
+
+	snapshot.table = move(table);
+	++version;
+}
@@ -0,0 +1,361 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BlockIndex.hpp"
+#include "ByteSource.hpp"
+
+// Immutable view of a FileBuffer's contents.
+//
+// Contents are kept as a piece table: a list of spans, each pointing into
+// either the original source or the bytes added by edits. Snapshots are
+// cheap to copy, and stay valid after the buffer is edited, so they can be
+// given to background jobs.
+class BufferSnapshot
+{
+public:
+	BufferSnapshot();
+
+	uint64_t Size() const
+	{
+		return table->size;
+	}
+
+	uint8_t ByteAt(uint64_t pos) const;
+
+	// Copies bytes starting at `pos`, returns number of bytes copied which
+	// might be less than `length` near the end.
+	uint64_t Read(uint64_t pos, void *out, uint64_t length) const;
+
+	// Whether [pos, pos + length) can be read without its sources producing
+	// the bytes first, like decompressing them.
+	bool Materialized(uint64_t pos, uint64_t length) const;
+
+	// Calls `fn(pos, data, length)` for each contiguous span covering
+	// [pos, pos + length). Stops early and returns false if `fn` does.
+	template <typename Fn>
+	bool ForEachSpan(uint64_t pos, uint64_t length, Fn fn) const;
+
+	// Same as above, but skips holes, which are known to be zeros.
+	template <typename Fn>
+	bool ForEachDataSpan(uint64_t pos, uint64_t length, Fn fn) const;
+
+	// Calls `fn(source, offset, length)` for the parts of pieces covering
+	// [pos, pos + length), with offsets in the source. Nothing is read, so
+	// this is for using indexes of the sources.
+	template <typename Fn>
+	void ForEachSourceRange(uint64_t pos, uint64_t length, Fn fn) const;
+
+	// [begin, end) ranges known to be zeros without being stored, like
+	// holes of sparse files. Sorted, adjacent ones merged.
+	const std::vector< std::pair<uint64_t, uint64_t> >& Holes() const
+	{
+		return table->holes;
+	}
+
+	// End of the hole containing `pos` or the first one after it, which is
+	// where the next data extent starts. Returns Size() if there is none.
+	uint64_t NextDataExtent(uint64_t pos) const;
+
+	// Value of every byte in [pos, pos + length) if that is known without
+	// reading them, from holes and block indexes of the sources. Otherwise,
+	// or if bytes differ, returns BlockIndex::kNotUniform.
+	int KnownUniformByte(uint64_t pos, uint64_t length) const;
+
+	// Whether [pos, pos + length) is made of the same source ranges in both
+	// snapshots, which means the bytes are the same without reading them.
+	// Sources are not modified in place, edits append to a store.
+	bool SameContents(const BufferSnapshot &other, uint64_t pos, uint64_t length) const;
+
+	// Lengths of the longest prefix and suffix made of the same source
+	// ranges in both snapshots, like around an edit. Nothing is read.
+	uint64_t SamePrefixLength(const BufferSnapshot &other) const;
+	uint64_t SameSuffixLength(const BufferSnapshot &other) const;
+
+private:
+	struct Piece
+	{
+		const ByteSource *source;
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	struct Table
+	{
+		std::vector<Piece> pieces;
+
+		// Buffer offset each piece starts at.
+		std::vector<uint64_t> starts;
+		uint64_t size = 0;
+
+		// Holes of the sources, in buffer offsets.
+		std::vector< std::pair<uint64_t, uint64_t> > holes;
+
+		// Keeps the sources alive as long as the snapshot is.
+		std::vector< std::shared_ptr<ByteSource> > sources;
+	};
+
+	// Index of the piece containing `pos`, `pos` must be less than size.
+	size_t FindPiece(uint64_t pos) const
+	{
+		return std::upper_bound(table->starts.begin(), table->starts.end(), pos)
+		     - table->starts.begin() - 1;
+	}
+
+	std::shared_ptr<const Table> table;
+
+friend class FileBuffer;
+};
+
+template <typename Fn>
+bool BufferSnapshot::ForEachSpan(uint64_t pos, uint64_t length, Fn fn) const
+{
+	const Table &t = *table;
+	if (pos >= t.size)
+	{
+		return true;
+	}
+
+	const uint64_t end = pos + std::min(length, t.size - pos);
+
+	for (size_t i = FindPiece(pos); pos < end; )
+	{
+		const Piece &piece = t.pieces[i];
+		const uint64_t skip = pos - t.starts[i];
+		const uint64_t piece_left = std::min(piece.length - skip, end - pos);
+
+		// Sources producing bytes on demand might give a piece in parts.
+		const uint64_t span_length = piece.source->Materialize(piece.offset + skip, piece_left);
+
+		if (!fn(pos, piece.source->Data() + piece.offset + skip, span_length))
+		{
+			return false;
+		}
+		pos += span_length;
+
+		if (span_length == piece_left)
+		{
+			++i;
+		}
+	}
+	return true;
+}
+
+template <typename Fn>
+bool BufferSnapshot::ForEachDataSpan(uint64_t pos, uint64_t length, Fn fn) const
+{
+	const uint64_t end = pos + std::min(length, Size() - std::min(pos, Size()));
+
+	const auto &holes = table->holes;
+	auto hole = std::upper_bound(holes.begin(), holes.end(), pos,
+	    [](uint64_t p, const std::pair<uint64_t, uint64_t> &h) { return p < h.second; });
+
+	while (pos < end)
+	{
+		if (hole != holes.end() && hole->first <= pos)
+		{
+			pos = hole->second;
+			++hole;
+			continue;
+		}
+
+		const uint64_t data_end = (hole == holes.end() ? end : std::min(end, hole->first));
+		if (!ForEachSpan(pos, data_end - pos, fn))
+		{
+			return false;
+		}
+		pos = data_end;
+	}
+	return true;
+}
+
+template <typename Fn>
+void BufferSnapshot::ForEachSourceRange(uint64_t pos, uint64_t length, Fn fn) const
+{
+	const Table &t = *table;
+	if (pos >= t.size)
+	{
+		return;
+	}
+
+	const uint64_t end = pos + std::min(length, t.size - pos);
+	for (size_t i = FindPiece(pos); pos < end; ++i)
+	{
+		const Piece &piece = t.pieces[i];
+		const uint64_t skip = pos - t.starts[i];
+		const uint64_t span_length = std::min(piece.length - skip, end - pos);
+
+		fn(*piece.source, piece.offset + skip, span_length);
+		pos += span_length;
+	}
+}
+
+// Contents of an opened file, including the edits made on it.
+class FileBuffer
+{
+public:
+	explicit FileBuffer(std::shared_ptr<ByteSource> source);
+	explicit FileBuffer(std::shared_ptr<MappedFileSource> source);
+	FileBuffer(const FileBuffer &ot) = delete;
+	FileBuffer& operator=(const FileBuffer &ot) = delete;
+
+	// Maps regular files, anything else (like a fifo) is read as a stream.
+	// Compressed files are opened decompressed, their seek indexes are kept
+	// in `index_dir`. `on_growth` is called from a background thread when a
+	// stream has new bytes, `SyncWithSource` should then be called on the
+	// main thread.
+	static std::unique_ptr<FileBuffer> Open(const std::string &file_name,
+	                                        uint64_t stream_memory_limit,
+	                                        const std::string &index_dir,
+	                                        std::function<void()> on_growth);
+
+	// Reads `fd` in background, taking ownership of it.
+	static std::unique_ptr<FileBuffer> OpenStream(int fd,
+	                                              uint64_t stream_memory_limit,
+	                                              std::function<void()> on_growth);
+
+	const BufferSnapshot& Snapshot() const
+	{
+		return snapshot;
+	}
+
+	uint64_t Size() const
+	{
+		return snapshot.Size();
+	}
+
+	uint8_t ByteAt(uint64_t pos) const
+	{
+		return snapshot.ByteAt(pos);
+	}
+
+	uint64_t Read(uint64_t pos, void *out, uint64_t length) const
+	{
+		return snapshot.Read(pos, out, length);
+	}
+
+	template <typename Fn>
+	bool ForEachSpan(uint64_t pos, uint64_t length, Fn fn) const
+	{
+		return snapshot.ForEachSpan(pos, length, fn);
+	}
+
+	uint64_t NextDataExtent(uint64_t pos) const
+	{
+		return snapshot.NextDataExtent(pos);
+	}
+
+	// Changes whenever the contents do, for caches derived from them.
+	uint64_t Version() const
+	{
+		return version;
+	}
+
+	// Unique in the process, unlike the address of a buffer which might be
+	// taken by another after it is gone. For finding it again later.
+	uint64_t Id() const
+	{
+		return id;
+	}
+
+	// Whether the source is still being read.
+	bool IsGrowing() const
+	{
+		return source->IsGrowing();
+	}
+
+	// Overwrites bytes in place, `pos + length` must not exceed the size.
+	void Overwrite(uint64_t pos, const void *bytes, uint64_t length);
+
+	// Removes bytes in [begin, end).
+	void Erase(uint64_t begin, uint64_t end);
+
+	// Replaces `match_length` bytes at each of `starts` with the same
+	// `length` bytes, publishing a single snapshot. Starts must be sorted,
+	// with the replaced ranges not overlapping. Bytes are stored once and
+	// shared by all of them, so a bulk replace costs a pass over the pieces
+	// rather than one per match.
+	void ReplaceAll(const std::vector<uint64_t> &starts, uint64_t match_length,
+	                const void *bytes, uint64_t length);
+
+	// Appends bytes the source received since last call to the end of the
+	// buffer. Returns whether size changed.
+	bool SyncWithSource();
+
+	// Maps bytes appended to the file on disk. Returns whether size changed.
+	// Once the file grows past the address space reserved for its mapping,
+	// later bytes are taken from a new mapping, see Reload.
+	bool Refresh();
+
+	// Source the buffer is built from. After a reload, unchanged parts still
+	// point to the previous ones.
+	std::shared_ptr<ByteSource> Source() const
+	{
+		return source;
+	}
+
+	// Mapped file the buffer is built from, null for streams.
+	std::shared_ptr<MappedFileSource> MappedSource() const
+	{
+		return mapped;
+	}
+
+	bool ChangedOnDisk() const
+	{
+		return mapped && mapped->ChangedOnDisk();
+	}
+
+	// Switches to the new mapping of the file. Only blocks whose
+	// fingerprints differ are taken from the new mapping, the rest keep
+	// pointing at the already loaded pages, and edits are kept. Without
+	// block indexes of both mappings everything is taken as changed.
+	// Returns the changed ranges.
+	std::vector< std::pair<uint64_t, uint64_t> > Reload(std::shared_ptr<MappedFileSource> new_source);
+
+private:
+	typedef BufferSnapshot::Piece Piece;
+
+	// Replaces [begin, end) with given pieces and publishes a new snapshot.
+	void Replace(uint64_t begin, uint64_t end, const std::vector<Piece> &replacement);
+
+	void Publish(std::vector<Piece> &&pieces);
+
+	std::shared_ptr<ByteSource> source;
+	std::shared_ptr<MappedFileSource> mapped;
+
+	// Sources replaced by reloads, unchanged pages still point to them.
+	std::vector< std::shared_ptr<ByteSource> > previous_sources;
+
+	// Bytes written by edits, pieces point here for modified regions.
+	std::shared_ptr<ChunkStore> added;
+
+	// Source size already included in the piece table.
+	uint64_t synced_source_size = 0;
+
+	uint64_t version = 0;
+	const uint64_t id;
+
+	BufferSnapshot snapshot;
+};
@@ -0,0 +1,110 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "FileWatcher.hpp"
+
+using namespace std;
+
+FileWatcher::FileWatcher()
+{
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher()
+{
+	close(fd);
+}
+
+bool FileWatcher::Watch(const string &file_name, uint32_t mask)
+{
+	int wd = inotify_add_watch(fd, file_name.c_str(), mask);
+	if (wd < 0)
+	{
+		return false;
+	}
+
+	// Name might point to a new file now, like after an editor saved it by
+	// renaming over. Old file is not interesting anymore.
+	auto old = wds.find(file_name);
+	if (old != wds.end() && old->second != wd)
+	{
+		inotify_rm_watch(fd, old->second);
+		watches.erase(old->second);
+	}
+
+	watches[wd] = file_name;
+	wds[file_name] = wd;
+	return true;
+}
+
+void FileWatcher::Unwatch(const string &file_name)
+{
+	auto it = wds.find(file_name);
+	if (it == wds.end())
+	{
+		return;
+	}
+
+	inotify_rm_watch(fd, it->second);
+	watches.erase(it->second);
+	wds.erase(it);
+}
+
+void FileWatcher::ReadEvents(function<void(const string&, uint32_t)> fn)
+{
+	alignas(inotify_event) char buf[4096];
+
+	while (1)
+	{
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len <= 0)
+		{
+			return;
+		}
+
+		for (char *it = buf; it < buf + len; )
+		{
+			const inotify_event *ev = reinterpret_cast<const inotify_event*>(it);
+			it += sizeof(inotify_event) + ev->len;
+
+			auto watch = watches.find(ev->wd);
+			if (watch == watches.end())
+			{
+				continue;
+			}
+
+			// Copy, as the callback might unwatch the file.
+			const string file_name = watch->second;
+			if (ev->mask & IN_IGNORED)
+			{
+				// Watch is removed by the kernel, like when file is deleted.
+				// Name might already be watched again, pointing to a new file.
+				auto wd = wds.find(file_name);
+				if (wd != wds.end() && wd->second == ev->wd)
+				{
+					wds.erase(wd);
+				}
+				watches.erase(watch);
+			}
+
+			fn(file_name, ev->mask);
+		}
+	}
+}
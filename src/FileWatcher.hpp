@@ -0,0 +1,59 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+// Watches files for modifications using inotify.
+//
+// Main loop adds `Fd()` to its epoll set and calls `ReadEvents` when it
+// becomes readable.
+class FileWatcher
+{
+public:
+	FileWatcher();
+	FileWatcher(const FileWatcher &ot) = delete;
+	FileWatcher& operator=(const FileWatcher &ot) = delete;
+	~FileWatcher();
+
+	int Fd() const
+	{
+		return fd;
+	}
+
+	// Returns false if the file can not be watched.
+	bool Watch(const std::string &file_name, uint32_t mask);
+	void Unwatch(const std::string &file_name);
+
+	bool IsWatched(const std::string &file_name) const
+	{
+		return wds.find(file_name) != wds.end();
+	}
+
+	// Reads pending events, and calls `fn(file_name, mask)` for each.
+	void ReadEvents(std::function<void(const std::string&, uint32_t)> fn);
+
+private:
+	int fd = -1;
+
+	std::map<int, std::string> watches;
+	std::map<std::string, int> wds;
+};
@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <cmath>
+#include <functional>
 #include <locale>
 
 #include "Hexa.hpp"
@@ -27,150 +29,1211 @@
 
 using namespace std;
 
+// Columns taken by the minimap, a gap, a marker and the heat map.
+static constexpr int kMinimapWidth = 4;
+
+// Columns taken by the structure pane, with its frame.
+static constexpr int kStructureWidth = 44;
+
+// 256 colour palette ramp from no entropy to random data: black, blue,
+// cyan, green, yellow, red.
+static const int kEntropyColors[] = {
+	16, 17, 18, 19, 20, 26, 32, 38, 44, 43, 42, 41,
+	40, 76, 112, 148, 184, 220, 214, 208, 202, 196,
+};
+
+// Bounds of entropy classes `gm` moves between, in bits per byte: padding,
+// code or text, packed data, compressed or encrypted data.
+static const int kEntropyClassBounds[] = {
+	1 * EntropyIndex::kScale,
+	6 * EntropyIndex::kScale,
+	7 * EntropyIndex::kScale + EntropyIndex::kScale / 2,
+};
+
+static int EntropyColor(int entropy)
+{
+	const int color_count = sizeof(kEntropyColors) / sizeof(kEntropyColors[0]);
+	return kEntropyColors[min(color_count - 1, entropy * color_count / (EntropyIndex::kMaxEntropy + 1))];
+}
+
+static int EntropyClass(int entropy)
+{
+	return upper_bound(begin(kEntropyClassBounds), end(kEntropyClassBounds), entropy)
+	     - begin(kEntropyClassBounds);
+}
+
+// Prints an ASCII line, clipped to the painter's width.
+static void PrintClipped(Painter &p, int row, const string &line)
+{
+	p.MoveTo(row, 0);
+	p.Printf("%s", line.substr(0, p.ColumnCount()).c_str());
+}
+
 template <typename UnicodeIterator>
 static void RenderStringToRow(Painter &p, int row, const char *enc, UnicodeIterator it)
 {
 	const StringInfo si(ExtractStringInfoFromUnicodeIterator(it, p.ColumnCount() - 20));
 
-	p.MoveTo(row, 0);
-	p.Printf("%10s | ", enc);
+	p.MoveTo(row, 0);
+	p.Printf("%10s | ", enc);
+
+	// Starting with leading/trailing byte
+	if (si.trails_skipped)
+	{
+		p.SetFgColor(TermColor::Red);
+		p.Printf("…"); // Implying there were trailing bytes
+		p.SetFgColor(TermColor::None);
+	}
+	else
+	{
+		p.Printf(" ");
+	}
+
+	p.Printf("%s", si.utf8_data.c_str());
+
+	if (!si.null_terminated)
+	{
+		p.SetFgColor(TermColor::Red);
+		p.Printf("�…"); // Implying there was a control character
+		p.SetFgColor(TermColor::None);
+	}
+}
+
+void HexEditor::RenderTo(Painter screen)
+{
+	// `using` like definitions
+	constexpr auto Vertical = Painter::SplitDirection::Vertical;
+	constexpr auto End = Painter::SplitEnd::End;
+	constexpr auto Split = Painter::Split;
+
+	constexpr auto Horizontal = Painter::SplitDirection::Horizontal;
+
+	Painter p(screen);
+	p.Clear();
+
+	Painter editor_painter, info_bar_painter, value_table_painter;
+
+	// Prepare render layout
+	try
+	{
+		tie(info_bar_painter, p) = Split(p, Vertical, End, 1);
+		if (minimap_shown)
+		{
+			tie(minimap_painter, p) = Split(p, Horizontal, End, kMinimapWidth);
+		}
+		if (structure_shown && structure_template && p.ColumnCount() >= 2 * kStructureWidth)
+		{
+			tie(structure_painter, p) = Split(p, Horizontal, End, kStructureWidth);
+		}
+		else
+		{
+			structure_painter = Painter();
+		}
+		tie(value_table_painter, p) = Split(p, Vertical, End, 8);
+		editor_painter = p;
+	}
+	catch (Painter::SplitException &ex)
+	{
+		// We do not have enough screen space to render anything.
+		// TODO do not handle this here?
+		Painter error_painter(screen);
+		error_painter.MoveTo(0, 0);
+		error_painter.Printf("Not enough screen space");
+		return;
+	}
+
+	if (last_column_count != editor_painter.ColumnCount())
+	{
+		// Diff view has a column of bytes for each buffer.
+		ScreenWidthUpdated(diff ? (editor_painter.ColumnCount() - 1) / 2 : editor_painter.ColumnCount());
+	}
+
+	// TODO why was this?
+	last_row_count = editor_painter.RowCount() - 1;
+
+	// Asked for again, as marks might have been added or a template
+	// applied since the last render.
+	loaded_marks_end = loaded_marks_begin;
+
+	unready_ranges.clear();
+
+	if (diff)
+	{
+		FixDiffScroll();
+	}
+	else
+	{
+		FixScroll();
+	}
+
+	RenderInfoBar(info_bar_painter);
+	if (diff)
+	{
+		RenderDiff(editor_painter);
+	}
+	else
+	{
+		RenderEditor(editor_painter);
+	}
+	if (stats)
+	{
+		RenderStats(value_table_painter);
+	}
+	else if (strings)
+	{
+		RenderStrings(value_table_painter);
+	}
+	else
+	{
+		RenderValueTable(value_table_painter);
+	}
+	if (minimap_shown)
+	{
+		RenderMinimap(minimap_painter);
+	}
+	if (structure_painter.ColumnCount() > 0)
+	{
+		RenderStructure(structure_painter);
+	}
+}
+
+void HexEditor::RenderMinimap(Painter p)
+{
+	const int64_t size = data->Size();
+	const int row_count = p.RowCount();
+	minimap_row_bytes = max<int64_t>(1, (size + row_count - 1) / row_count);
+
+	for (int row = 0; row < row_count; ++row)
+	{
+		const int64_t begin = row * minimap_row_bytes;
+		const int64_t end = min(size, begin + minimap_row_bytes);
+		if (begin >= end)
+		{
+			break;
+		}
+
+		// Cursor, and the rest of the part shown in the editor.
+		p.MoveTo(row, 1);
+		p.SetFgColor(TermColor::Yellow);
+		if (cursor_pos >= begin && cursor_pos < end)
+		{
+			p.Printf(">");
+		}
+		else if (begin < end_byte_shown && end > first_byte_shown)
+		{
+			p.Printf("│");
+		}
+		else
+		{
+			p.Printf(" ");
+		}
+
+		const int entropy = RangeEntropy(data->Snapshot(), begin, end);
+		if (entropy < 0)
+		{
+			// Not computed yet.
+			p.SetFgColor(TermColor::None);
+			p.Printf("··");
+			continue;
+		}
+
+		p.SetBgColor(static_cast<TermColor>(EntropyColor(entropy)));
+		p.Printf("  ");
+		p.SetBgColor(TermColor::None);
+	}
+	p.SetFgColor(TermColor::None);
+}
+
+int HexEditor::RangeEntropy(const BufferSnapshot &snapshot, int64_t begin, int64_t end)
+{
+	constexpr uint64_t kBlockSize = EntropyIndex::kBlockSize;
+
+	double weighted = 0;
+	uint64_t unknown = 0;
+
+	snapshot.ForEachSourceRange(begin, end - begin,
+	    [&](const ByteSource &source, uint64_t offset, uint64_t length)
+	{
+		const shared_ptr<const EntropyIndex> index = source.Entropy();
+		if (index && offset + length <= index->Size())
+		{
+			// Blocks are weighted by how much of them is in range.
+			weighted += (double)index->WeightedSum(offset, offset + length);
+		}
+		else if (length <= kBlockSize)
+		{
+			// Bytes added by edits have no index, there are only a few.
+			for (uint64_t readable = 0; readable < length; )
+			{
+				readable += source.Materialize(offset + readable, length - readable);
+			}
+			weighted += (double)EntropyIndex::Measure(source.Data() + offset, length) * length;
+		}
+		else
+		{
+			unknown += length;
+		}
+	});
+
+	const uint64_t known = end - begin - unknown;
+	if (known == 0 || unknown > known)
+	{
+		return -1;
+	}
+	return (int)(weighted / known + 0.5);
+}
+
+int64_t HexEditor::FindEntropyChange(const BufferSnapshot &snapshot, int64_t pos,
+                                     const function<bool()> &cancelled)
+{
+	constexpr int64_t kBlockSize = EntropyIndex::kBlockSize;
+
+	const int64_t size = snapshot.Size();
+	const int64_t block = pos / kBlockSize * kBlockSize;
+
+	const int entropy = RangeEntropy(snapshot, block, min(size, block + kBlockSize));
+	if (entropy < 0)
+	{
+		return -1;
+	}
+	const int current_class = EntropyClass(entropy);
+
+	// Blocks of indexed pieces are read from the index one after the other,
+	// pieces after the change is found are skipped.
+	int64_t found = -1;
+	bool done = false;
+	int64_t piece_pos = block + kBlockSize;
+	snapshot.ForEachSourceRange(piece_pos, size - piece_pos,
+	    [&](const ByteSource &source, uint64_t offset, uint64_t length)
+	{
+		const int64_t range_pos = piece_pos;
+		piece_pos += length;
+		if (done)
+		{
+			return;
+		}
+
+		const shared_ptr<const EntropyIndex> index = source.Entropy();
+		if (!index || offset + length > index->Size())
+		{
+			// Bytes added by edits, measured if there are only a few.
+			const int next = RangeEntropy(snapshot, range_pos, range_pos + length);
+			if (next < 0 || EntropyClass(next) != current_class)
+			{
+				found = (next < 0 ? -1 : range_pos);
+				done = true;
+			}
+			return;
+		}
+
+		for (uint64_t b = offset / kBlockSize; b * kBlockSize < offset + length; ++b)
+		{
+			if (b % 4096 == 0 && cancelled())
+			{
+				done = true;
+				return;
+			}
+			if (EntropyClass(index->Entropy(b)) != current_class)
+			{
+				found = range_pos + max<int64_t>(0, b * kBlockSize - offset);
+				done = true;
+				return;
+			}
+		}
+	});
+	return found;
+}
+
+bool HexEditor::MinimapClick(int screen_row, int screen_column)
+{
+	int row, column;
+	if (!minimap_shown || !minimap_painter.FromScreen(screen_row, screen_column, row, column))
+	{
+		return false;
+	}
+
+	const int64_t pos = row * minimap_row_bytes;
+	if (pos >= (int64_t)data->Size())
+	{
+		return false;
+	}
+
+	cursor_pos = pos;
+	return true;
+}
+
+TemplateTree* HexEditor::Structure()
+{
+	if (!structure_template)
+	{
+		return nullptr;
+	}
+	if (!structure || structure_version != data->Version())
+	{
+		structure = make_shared<TemplateTree>(structure_template, data->Snapshot());
+		structure_version = data->Version();
+	}
+	return structure.get();
+}
+
+// Value of a field for the structure pane, texts escaped.
+static string DescribeNode(const TemplateTree::Node &node)
+{
+	typedef TemplateTree::Node Node;
+
+	char buf[64];
+	switch (node.kind)
+	{
+	case Node::Integer:
+		if (node.value >= 10 || node.value < 0)
+		{
+			snprintf(buf, sizeof(buf), " = %" PRId64 " (0x%" PRIx64 ")", node.value, (uint64_t)node.value);
+		}
+		else
+		{
+			snprintf(buf, sizeof(buf), " = %" PRId64, node.value);
+		}
+		return buf;
+
+	case Node::Text:
+	{
+		string text = " \"";
+		for (char c : node.text.substr(0, node.text.find('\0')))
+		{
+			if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+			{
+				text.push_back(c);
+			}
+			else
+			{
+				snprintf(buf, sizeof(buf), "\\x%02x", (uint8_t)c);
+				text += buf;
+			}
+			if (text.size() > 40)
+			{
+				break;
+			}
+		}
+		return text + "\"";
+	}
+
+	default:
+		return " " + node.type_name;
+	}
+}
+
+void HexEditor::RenderStructure(Painter p)
+{
+	typedef TemplateTree::Node Node;
+
+	p.DrawFrame("Structure: " + structure_template_name);
+	p = p.FramedArea();
+	structure_row_offsets.assign(p.RowCount(), -1);
+
+	TemplateTree *tree = Structure();
+	const vector<const Node*> path = tree->PathTo(cursor_pos);
+
+	// Nodes containing the cursor are expanded, with a few siblings around
+	// them. The innermost one lists more, to fill the pane.
+	struct Row
+	{
+		int depth;
+		const Node *node;
+		string text;
+	};
+	vector<Row> rows;
+	int cursor_row = 0;
+
+	function<void(size_t)> add_children = [&](size_t level)
+	{
+		const Node &container = *path[level];
+		const Node *on_path = (level + 1 < path.size() ? path[level + 1] : nullptr);
+		const uint64_t radius = (level + 2 >= path.size() ? p.RowCount() : 2);
+		const uint64_t center = (on_path ? on_path->index : 0);
+		const uint64_t first = (center > radius ? center - radius : 0);
+		const int depth = level;
+
+		if (first > 0)
+		{
+			rows.push_back(Row{depth, nullptr, "… " + to_string(first) + " before"});
+		}
+		for (uint64_t i = first; i <= center + radius; ++i)
+		{
+			const Node *child = tree->Child(container, i);
+			if (!child)
+			{
+				return;
+			}
+			rows.push_back(Row{depth, child, ""});
+			if (child == on_path)
+			{
+				cursor_row = rows.size() - 1;
+				if (child->kind == Node::Struct || child->kind == Node::Array)
+				{
+					add_children(level + 1);
+				}
+			}
+		}
+
+		if (tree->Child(container, center + radius + 1))
+		{
+			const uint64_t known = tree->KnownChildCount(container);
+			rows.push_back(Row{depth, nullptr, tree->ChildCountKnown(container)
+			                   ? "… " + to_string(known - center - radius - 1) + " more" : "… more"});
+		}
+	};
+	add_children(0);
+	if (!tree->Root().error.empty())
+	{
+		rows.push_back(Row{0, nullptr, "! " + tree->Root().error});
+	}
+
+	const int first_row = max(0, min(cursor_row - p.RowCount() / 3, (int)rows.size() - p.RowCount()));
+	for (int row = 0; row < p.RowCount() && first_row + row < (int)rows.size(); ++row)
+	{
+		const Row &r = rows[first_row + row];
+		string line(min(r.depth * 2, 16), ' ');
+		if (!r.node)
+		{
+			line += "  " + r.text;
+		}
+		else
+		{
+			const bool container = (r.node->kind == Node::Struct || r.node->kind == Node::Array);
+			const bool expanded = (find(path.begin(), path.end(), r.node) != path.end());
+			line += (container ? (expanded ? "▾ " : "▸ ") : "  ") + r.node->name + DescribeNode(*r.node);
+			if (!r.node->error.empty())
+			{
+				line += " ! " + r.node->error;
+			}
+			structure_row_offsets[row] = r.node->offset;
+		}
+
+		// Clipped to whole characters, markers are UTF-8.
+		size_t length = line.size();
+		for (size_t chars = 0, i = 0; i < line.size(); ++i)
+		{
+			if ((line[i] & 0xc0) != 0x80 && chars++ == (size_t)p.ColumnCount())
+			{
+				length = i;
+				break;
+			}
+		}
+		line.resize(length);
+
+		if (first_row + row == cursor_row && path.size() > 1)
+		{
+			p.SetBgColor(TermColor::Cyan);
+		}
+		if (r.node ? !r.node->error.empty() : r.text[0] == '!')
+		{
+			p.SetFgColor(TermColor::Red);
+		}
+		PrintClipped(p, row, line);
+		p.SetBgColor(TermColor::None);
+		p.SetFgColor(TermColor::None);
+	}
+}
+
+bool HexEditor::StructureClick(int screen_row, int screen_column)
+{
+	int row, column;
+	if (!structure_painter.FromScreen(screen_row, screen_column, row, column))
+	{
+		return false;
+	}
+
+	// Frame is not a part of the rows.
+	--row;
+	if (row < 0 || row >= (int)structure_row_offsets.size() || structure_row_offsets[row] < 0)
+	{
+		return false;
+	}
+	cursor_pos = min<int64_t>(structure_row_offsets[row], max<int64_t>(0, data->Size() - 1));
+	return true;
+}
+
+bool HexEditor::JumpToNextField()
+{
+	TemplateTree *tree = Structure();
+	if (!tree)
+	{
+		return false;
+	}
+
+	const vector<const TemplateTree::Node*> path = tree->PathTo(cursor_pos);
+	for (size_t level = path.size() - 1; level > 0; --level)
+	{
+		const TemplateTree::Node *next = tree->Child(*path[level - 1], path[level]->index + 1);
+		if (next)
+		{
+			cursor_pos = next->offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HexEditor::JumpToPrevField()
+{
+	TemplateTree *tree = Structure();
+	if (!tree)
+	{
+		return false;
+	}
+
+	// To the start of the field first, if the cursor is in the middle.
+	const vector<const TemplateTree::Node*> path = tree->PathTo(cursor_pos);
+	if (path.size() > 1 && (int64_t)path.back()->offset < cursor_pos)
+	{
+		cursor_pos = path.back()->offset;
+		return true;
+	}
+	for (size_t level = path.size() - 1; level > 0; --level)
+	{
+		if (path[level]->index > 0)
+		{
+			cursor_pos = tree->Child(*path[level - 1], path[level]->index - 1)->offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HexEditor::JumpToNextElement()
+{
+	TemplateTree *tree = Structure();
+	if (!tree)
+	{
+		return false;
+	}
+
+	const vector<const TemplateTree::Node*> path = tree->PathTo(cursor_pos);
+	for (size_t level = path.size() - 1; level > 0; --level)
+	{
+		if (path[level - 1]->kind == TemplateTree::Node::Array)
+		{
+			const TemplateTree::Node *next = tree->Child(*path[level - 1], path[level]->index + 1);
+			if (!next)
+			{
+				return false;
+			}
+			cursor_pos = next->offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HexEditor::JumpToPrevElement()
+{
+	TemplateTree *tree = Structure();
+	if (!tree)
+	{
+		return false;
+	}
+
+	const vector<const TemplateTree::Node*> path = tree->PathTo(cursor_pos);
+	for (size_t level = path.size() - 1; level > 0; --level)
+	{
+		if (path[level - 1]->kind == TemplateTree::Node::Array)
+		{
+			if (path[level]->index == 0)
+			{
+				return false;
+			}
+			cursor_pos = tree->Child(*path[level - 1], path[level]->index - 1)->offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+void HexEditor::RenderInfoBar(Painter &p)
+{
+	p.MoveTo(0, 0);
+	p.SetFgColor(TermColor::Black);
+	p.SetBgColor(TermColor::BrightWhite);
+
+	// Ruler, along with the size which changes for growing files. Sizes
+	// take more digits for files of a gigabyte and up.
+	const int64_t size = data->Size();
+	char ruler[64];
+	snprintf(ruler, sizeof(ruler), "%9" PRId64 "/%-9" PRId64 " %3d%%", cursor_pos, size,
+	         size ? (int)(cursor_pos * 100 / size) : 0);
+
+	int fn_size = max(4, p.ColumnCount() - 4 - (int)strlen(ruler));
+
+	// TODO this is cacheable?
+	string file_name_display = file_name;
+	if (following)
+	{
+		file_name_display += " [following]";
+	}
+	else if (data->IsGrowing())
+	{
+		file_name_display += " [reading]";
+	}
+
+	// Clamp file name in the given size.
+	if ((int)file_name_display.size() > fn_size)
+	{
+		file_name_display.resize(fn_size - 3);
+		file_name_display += "...";
+	}
+	else
+	{
+		file_name_display += string(fn_size - file_name_display.size(), ' ');
+	}
+
+	// Show file name.
+	p.Printf("%s ", file_name_display.c_str());
+
+	// Print endianness.
+	p.Printf("%s ", view_endianness == Endianness::BigEndian ? "BE" : "LE");
+
+	p.Printf("%s", string(ruler).substr(0, max(0, p.ColumnCount() - fn_size - 4)).c_str());
+}
+
+void HexEditor::RenderEditor(Painter p)
+{
+	// `using` like definitions
+	constexpr auto Vertical = Painter::SplitDirection::Vertical;
+	constexpr auto Start = Painter::SplitEnd::Start;
+	constexpr auto Split = Painter::Split;
+
+	// TODO FIXME this part is lost
+	// Render column headers
+	p.SetFgColor(TermColor::Yellow);
+	for (int col = 0; col < editor_column_count; ++col)
+	{
+		// TODO align this with style_sheet
+		p.MoveTo(0, row_number_width + 2 + 4 * col);
+		p.Printf("%3d", col);
+	}
+	p.SetFgColor(TermColor::None);
+
+	mark_color_count = 0;
+	last_mark_color = 99;
+
+	Painter remaining_rows_painter = p;
+
+	for (int64_t row_first_byte = first_byte_shown; ; )
+	{
+		end_byte_shown = row_first_byte;
+
+		int required_render_rows = RowLineCount(row_first_byte);
+		if (required_render_rows > remaining_rows_painter.RowCount())
+		{
+			break;
+		}
+
+		const Fold *fold = FoldAt(row_first_byte);
+		if (fold)
+		{
+			RenderFold(remaining_rows_painter, *fold);
+			row_first_byte = fold->end;
+		}
+		else
+		{
+			RenderLine(remaining_rows_painter, row_first_byte);
+			row_first_byte += editor_column_count;
+		}
+
+		tie(ignore, remaining_rows_painter) =
+		    Split(remaining_rows_painter, Vertical, Start, required_render_rows);
+	}
+}
+
+void HexEditor::FixDiffScroll()
+{
+	const int columns = editor_column_count;
+	if (diff->Hunks().size() != diff_hunk_count || columns != diff_column_count)
+	{
+		diff_first_row = diff->RowOf(diff_first_byte, columns);
+		diff_hunk_count = diff->Hunks().size();
+		diff_column_count = columns;
+	}
+
+	const BufferDiff::Row cursor_row = diff->RowOf(cursor_pos, columns);
+
+	// Rows of bytes only the other buffer has are shown along with the row
+	// after them, as the cursor can not be on them.
+	BufferDiff::Row top = cursor_row;
+	for (BufferDiff::Row row = top; diff->PrevRow(row, columns); top = row)
+	{
+		const BufferDiff::Hunk region = diff->Region(row.region);
+		if (region.a_begin + diff->RowOffset(row, columns) < region.a_end)
+		{
+			break;
+		}
+	}
+
+	if (top < diff_first_row)
+	{
+		diff_first_row = top;
+	}
+	else
+	{
+		// Lowest first row keeping the cursor row on the screen.
+		BufferDiff::Row lowest = cursor_row;
+		for (int i = 1; i < last_row_count && diff->PrevRow(lowest, columns); ++i)
+		{
+		}
+		diff_first_row = max(diff_first_row, lowest);
+	}
+
+	const BufferDiff::Hunk region = diff->Region(diff_first_row.region);
+	diff_first_byte = min(region.a_end, region.a_begin + diff->RowOffset(diff_first_row, columns));
+}
+
+void HexEditor::RenderDiff(Painter p)
+{
+	// `using` like definitions
+	constexpr auto Vertical = Painter::SplitDirection::Vertical;
+	constexpr auto Horizontal = Painter::SplitDirection::Horizontal;
+	constexpr auto Start = Painter::SplitEnd::Start;
+	constexpr auto Split = Painter::Split;
+
+	Painter left, right;
+	tie(left, right) = Split(p, Horizontal, Start, (p.ColumnCount() - 1) / 2);
+	tie(ignore, right) = Split(right, Horizontal, Start, 1);
+
+	// Headers, names and what is known of the differences so far.
+	char summary[64];
+	if (diff->Complete())
+	{
+		snprintf(summary, sizeof(summary), " (%zu changes)", diff->Hunks().size());
+	}
+	else
+	{
+		snprintf(summary, sizeof(summary), " (comparing, %d%%)", diff->Progress());
+	}
+	if (data->Version() != diff_version)
+	{
+		strcat(summary, " (outdated)");
+	}
+
+	left.SetFgColor(TermColor::Yellow);
+	right.SetFgColor(TermColor::Yellow);
+	PrintClipped(left, 0, file_name);
+	PrintClipped(right, 0, diff_file_name + summary);
+	left.SetFgColor(TermColor::None);
+	right.SetFgColor(TermColor::None);
+
+	const int columns = editor_column_count;
+	const BufferSnapshot &a = diff->A();
+	const BufferSnapshot &b = diff->B();
+
+	Painter left_rows, right_rows;
+	tie(ignore, left_rows) = Split(left, Vertical, Start, 1);
+	tie(ignore, right_rows) = Split(right, Vertical, Start, 1);
+
+	for (BufferDiff::Row row = diff_first_row; left_rows.RowCount() > 0; )
+	{
+		const BufferDiff::Hunk region = diff->Region(row.region);
+		const uint64_t offset = diff->RowOffset(row, columns);
+		const uint64_t a_begin = min(region.a_end, region.a_begin + offset);
+		const uint64_t b_begin = min(region.b_end, region.b_begin + offset);
+
+		// First row of a region starts at its column in A.
+		const int first_column = (row.index == 0 ? region.a_begin % columns : 0);
+
+		vector<uint8_t> a_bytes(min<uint64_t>(columns - first_column, region.a_end - a_begin));
+		vector<uint8_t> b_bytes(min<uint64_t>(columns - first_column, region.b_end - b_begin));
+		a_bytes.resize(a.Read(a_begin, a_bytes.data(), a_bytes.size()));
+		b_bytes.resize(b.Read(b_begin, b_bytes.data(), b_bytes.size()));
+
+		// Odd regions are hunks.
+		const bool changed = (row.region % 2 == 1);
+		RenderDiffLine(left_rows, a_begin, first_column, a_bytes, b_bytes, changed, true);
+		RenderDiffLine(right_rows, b_begin, first_column, b_bytes, a_bytes, changed, false);
+
+		end_byte_shown = a_begin + a_bytes.size();
+		if (!diff->NextRow(row, columns))
+		{
+			break;
+		}
+
+		tie(ignore, left_rows) = Split(left_rows, Vertical, Start, 1);
+		tie(ignore, right_rows) = Split(right_rows, Vertical, Start, 1);
+	}
+}
+
+void HexEditor::RenderDiffLine(Painter p, int64_t first_byte, int first_column, const vector<uint8_t> &bytes,
+                               const vector<uint8_t> &other_bytes, bool changed, bool has_cursor)
+{
+	const int byte_padding_left = style_sheet.GetBytePaddingLeft();
+	const int byte_padding_right = style_sheet.GetBytePaddingRight();
+	const int byte_cols = 2 + byte_padding_left + byte_padding_right;
+
+	p.MoveTo(0, 0);
+
+	if (bytes.empty())
+	{
+		// Padding for bytes only the other buffer has.
+		p.SetFgColor(TermColor::Magenta);
+		p.Printf("%s", string(row_number_width, '-').c_str());
+		p.SetFgColor(TermColor::None);
+		return;
+	}
+
+	p.SetFgColor(TermColor::Yellow);
+	p.Printf("%*" PRId64 "  ", row_number_width, first_byte);
+	p.SetFgColor(TermColor::None);
+
+	// Bytes of hunks which are not the same as the ones next to them.
+	auto differs = [&](size_t i)
+	{
+		return changed && (i >= other_bytes.size() || other_bytes[i] != bytes[i]);
+	};
+
+	for (int col = 0; col < editor_column_count; ++col)
+	{
+		const size_t i = col - first_column;
+		if (col < first_column || i >= bytes.size())
+		{
+			p.Printf("%*s", byte_cols, "");
+			continue;
+		}
+
+		const bool cursor = (has_cursor && first_byte + (int64_t)i == cursor_pos);
+		p.SetBgColor(differs(i) ? TermColor::Red : TermColor::None);
+		p.SetFgColor(cursor ? TermColor::Cyan : differs(i) ? TermColor::White : TermColor::None);
+		p.Printf("%*s%02x%*s", byte_padding_left, "", (int)bytes[i], byte_padding_right, "");
+		p.SetBgColor(TermColor::None);
+		p.SetFgColor(TermColor::None);
+	}
+
+	// Padding
+	p.Printf("  %*s", first_column, "");
+
+	for (size_t i = 0; i < bytes.size(); ++i)
+	{
+		const bool cursor = (has_cursor && first_byte + (int64_t)i == cursor_pos);
+		p.SetBgColor(cursor ? TermColor::Cyan : differs(i) ? TermColor::Red : TermColor::None);
+		p.Printf("%c", isprint(bytes[i]) ? bytes[i] : '.');
+		p.SetBgColor(TermColor::None);
+	}
+}
 
-	// Starting with leading/trailing byte
-	if (si.trails_skipped)
+bool HexEditor::JumpToNextChange()
+{
+	if (!diff)
 	{
-		p.SetFgColor(TermColor::Red);
-		p.Printf("…"); // Implying there were trailing bytes
-		p.SetFgColor(TermColor::None);
+		return false;
 	}
-	else
+
+	const auto &hunks = diff->Hunks();
+	auto it = upper_bound(hunks.begin(), hunks.end(), cursor_pos,
+	    [](int64_t pos, const BufferDiff::Hunk &h) { return pos < (int64_t)h.a_begin; });
+	if (it == hunks.end())
 	{
-		p.Printf(" ");
+		return false;
 	}
 
-	p.Printf("%s", si.utf8_data.c_str());
+	// Bytes appended by the other buffer are after the last one.
+	const int64_t pos = min<int64_t>(it->a_begin, max<int64_t>(0, data->Size() - 1));
+	if (pos == cursor_pos)
+	{
+		return false;
+	}
+	cursor_pos = pos;
+	return true;
+}
 
-	if (!si.null_terminated)
+bool HexEditor::JumpToPrevChange()
+{
+	if (!diff)
 	{
-		p.SetFgColor(TermColor::Red);
-		p.Printf("�…"); // Implying there was a control character
-		p.SetFgColor(TermColor::None);
+		return false;
+	}
+
+	const auto &hunks = diff->Hunks();
+	auto it = lower_bound(hunks.begin(), hunks.end(), cursor_pos,
+	    [](const BufferDiff::Hunk &h, int64_t pos) { return (int64_t)h.a_begin < pos; });
+	if (it == hunks.begin())
+	{
+		return false;
 	}
+
+	cursor_pos = (it - 1)->a_begin;
+	return true;
 }
 
-void HexEditor::RenderTo(Painter screen)
+void HexEditor::SearchResults::Add(const vector<uint64_t> &found)
 {
-	// `using` like definitions
-	constexpr auto Vertical = Painter::SplitDirection::Vertical;
-	constexpr auto End = Painter::SplitEnd::End;
-	constexpr auto Split = Painter::Split;
+	if (found.empty())
+	{
+		return;
+	}
+	starts.insert(lower_bound(starts.begin(), starts.end(), found.front()), found.begin(), found.end());
 
-	if (last_column_count != screen.ColumnCount())
+	vector< pair<uint64_t, uint64_t> > added;
+	for (uint64_t start : found)
 	{
-		ScreenWidthUpdated(screen.ColumnCount());
+		if (!added.empty() && start <= added.back().second)
+		{
+			added.back().second = start + length;
+		}
+		else
+		{
+			added.emplace_back(start, start + length);
+		}
 	}
 
-	Painter p(screen);
-	p.Clear();
+	// Ranges touching the added ones are merged with them.
+	auto first = lower_bound(ranges.begin(), ranges.end(), added.front().first,
+	    [](const pair<uint64_t, uint64_t> &r, uint64_t pos) { return r.second < pos; });
+	auto last = upper_bound(first, ranges.end(), added.back().second,
+	    [](uint64_t pos, const pair<uint64_t, uint64_t> &r) { return pos < r.first; });
 
-	Painter editor_painter, info_bar_painter, value_table_painter;
+	vector< pair<uint64_t, uint64_t> > touching(first, last);
+	vector< pair<uint64_t, uint64_t> > sorted;
+	merge(touching.begin(), touching.end(), added.begin(), added.end(), back_inserter(sorted));
 
-	// Prepare render layout
-	try
+	vector< pair<uint64_t, uint64_t> > merged;
+	for (const auto &range : sorted)
 	{
-		tie(info_bar_painter, p) = Split(p, Vertical, End, 1);
-		tie(value_table_painter, p) = Split(p, Vertical, End, 8);
-		editor_painter = p;
+		if (!merged.empty() && range.first <= merged.back().second)
+		{
+			merged.back().second = max(merged.back().second, range.second);
+		}
+		else
+		{
+			merged.push_back(range);
+		}
 	}
-	catch (Painter::SplitException &ex)
+
+	const size_t index = first - ranges.begin();
+	ranges.erase(first, last);
+	ranges.insert(ranges.begin() + index, merged.begin(), merged.end());
+}
+
+void HexEditor::SearchResults::Truncate(size_t count)
+{
+	if (starts.size() <= count)
 	{
-		// We do not have enough screen space to render anything.
-		// TODO do not handle this here?
-		Painter error_painter(screen);
-		error_painter.MoveTo(0, 0);
-		error_painter.Printf("Not enough screen space");
 		return;
 	}
+	starts.resize(count);
+	truncated = true;
 
-	// TODO why was this?
-	last_row_count = editor_painter.RowCount() - 1;
+	// Ranges after the last match kept are dropped, and the one it is in
+	// ends with it.
+	const uint64_t end = (count == 0 ? 0 : starts.back() + length);
+	while (!ranges.empty() && ranges.back().first >= end)
+	{
+		ranges.pop_back();
+	}
+	if (!ranges.empty())
+	{
+		ranges.back().second = min(ranges.back().second, end);
+	}
+}
 
-	FixScroll();
+void HexEditor::FindMatchesInRow(int64_t row_first_byte, vector<bool> &in_match) const
+{
+	fill(in_match.begin(), in_match.end(), false);
+	if (!search)
+	{
+		return;
+	}
 
-	RenderInfoBar(info_bar_painter);
-	RenderEditor(editor_painter);
-	RenderValueTable(value_table_painter);
+	const uint64_t row_begin = row_first_byte;
+	const uint64_t row_end = row_begin + in_match.size();
+
+	const auto &ranges = search->ranges;
+	auto it = upper_bound(ranges.begin(), ranges.end(), row_begin,
+	    [](uint64_t pos, const pair<uint64_t, uint64_t> &r) { return pos < r.second; });
+	for (; it != ranges.end() && it->first < row_end; ++it)
+	{
+		for (uint64_t pos = max(it->first, row_begin); pos < min(it->second, row_end); ++pos)
+		{
+			in_match[pos - row_begin] = true;
+		}
+	}
 }
 
-void HexEditor::RenderInfoBar(Painter &p)
+bool HexEditor::JumpToNextMatch()
 {
-	p.MoveTo(0, 0);
-	p.SetFgColor(TermColor::Black);
-	p.SetBgColor(TermColor::BrightWhite);
+	if (!search)
+	{
+		return false;
+	}
 
-	int fn_size = p.ColumnCount() - 18;
+	const auto &starts = search->starts;
+	auto it = upper_bound(starts.begin(), starts.end(), (uint64_t)cursor_pos);
+	if (it == starts.end())
+	{
+		return false;
+	}
 
-	// TODO this is cacheable?
-	string file_name_display = file_name;
+	cursor_pos = *it;
+	return true;
+}
 
-	// Clamp file name in the given size.
-	if ((int)file_name_display.size() > fn_size)
+bool HexEditor::JumpToPrevMatch()
+{
+	if (!search)
 	{
-		file_name_display.resize(fn_size - 3);
-		file_name_display += "...";
+		return false;
 	}
-	else
+
+	const auto &starts = search->starts;
+	auto it = lower_bound(starts.begin(), starts.end(), (uint64_t)cursor_pos);
+	if (it == starts.begin())
 	{
-		file_name_display += string(fn_size - file_name_display.size(), ' ');
+		return false;
 	}
 
-	// Show file name.
-	p.Printf("%s ", file_name_display.c_str());
+	cursor_pos = *(it - 1);
+	return true;
+}
 
-	// Print endianness.
-	p.Printf("%s ", view_endianness == Endianness::BigEndian ? "BE" : "LE");
+bool HexEditor::JumpToMatchFrom(int64_t pos)
+{
+	if (!search || search->starts.empty())
+	{
+		return false;
+	}
 
-	// Show ruler.
-	p.Printf("%9d %3d%%", cursor_pos, cursor_pos * 100 / data->size());
+	const auto &starts = search->starts;
+	auto it = lower_bound(starts.begin(), starts.end(), (uint64_t)pos);
+	cursor_pos = (it == starts.end() ? starts.front() : *it);
+	return true;
 }
 
-void HexEditor::RenderEditor(Painter p)
+bool HexEditor::JumpToNextString()
 {
-	// `using` like definitions
-	constexpr auto Vertical = Painter::SplitDirection::Vertical;
-	constexpr auto Start = Painter::SplitEnd::Start;
-	constexpr auto Split = Painter::Split;
+	if (!strings)
+	{
+		return false;
+	}
 
-	// TODO FIXME this part is lost
-	// Render column headers
-	p.SetFgColor(TermColor::Yellow);
-	for (int col = 0; col < editor_column_count; ++col)
+	const auto &found = strings->strings;
+	auto it = upper_bound(found.begin(), found.end(), cursor_pos,
+	    [](int64_t pos, const FoundString &s) { return pos < (int64_t)s.begin; });
+	if (it == found.end())
 	{
-		// TODO align this with style_sheet
-		p.MoveTo(0, 9 + 4 * col);
-		p.Printf("%3d", col);
+		return false;
+	}
+
+	cursor_pos = it->begin;
+	return true;
+}
+
+bool HexEditor::JumpToPrevString()
+{
+	if (!strings)
+	{
+		return false;
 	}
+
+	const auto &found = strings->strings;
+	auto it = lower_bound(found.begin(), found.end(), cursor_pos,
+	    [](const FoundString &s, int64_t pos) { return (int64_t)s.begin < pos; });
+	if (it == found.begin())
+	{
+		return false;
+	}
+
+	cursor_pos = (it - 1)->begin;
+	return true;
+}
+
+void HexEditor::RenderFold(Painter p, const Fold &fold)
+{
+	p.MoveTo(0, 0);
+	p.SetFgColor(TermColor::Yellow);
+	p.Printf("%*" PRId64 "  ", row_number_width, fold.begin);
+
+	// Cursor is somewhere in the folded rows.
+	const bool has_cursor = (cursor_pos >= fold.begin && cursor_pos < fold.end);
+	p.SetFgColor(has_cursor ? TermColor::Cyan : TermColor::Magenta);
+	p.Printf(" -- %s, %" PRId64 " bytes in %" PRId64 " rows --",
+	         fold.hole ? "hole" : "same as above",
+	         fold.end - fold.begin, (fold.end - fold.begin) / editor_column_count);
 	p.SetFgColor(TermColor::None);
+}
 
-	mark_colors.clear();
+void HexEditor::UpdateFolds()
+{
+	// Index built for other contents would fold wrong rows.
+	const RowRunIndex *runs = row_runs.get();
+	if (runs && (runs->Version() != data->Version() || runs->RowLength() != editor_column_count))
+	{
+		runs = nullptr;
+	}
 
-	Painter remaining_rows_painter = p;
+	if (folds_column_count == editor_column_count && folds_version == data->Version()
+	    && folds_row_runs == runs)
+	{
+		return;
+	}
+	folds_column_count = editor_column_count;
+	folds_version = data->Version();
+	folds_row_runs = runs;
+	folds.clear();
 
-	for (int row_first_byte = first_byte_shown; ;row_first_byte += editor_column_count)
+	if (editor_column_count <= 0)
 	{
-		int required_render_rows = 1 + IsRowMarked(row_first_byte);
-		if (required_render_rows > remaining_rows_painter.RowCount())
+		return;
+	}
+
+	// Whole rows inside a hole, if there are at least two of them.
+	const int64_t cols = editor_column_count;
+	for (const auto &hole : data->Snapshot().Holes())
+	{
+		const int64_t begin = (hole.first + cols - 1) / cols * cols;
+		const int64_t end = hole.second / cols * cols;
+		if (end - begin >= RowRunIndex::kMinRunRows * cols)
 		{
-			break;
+			folds.push_back(Fold{begin, end, true});
 		}
+	}
 
-		RenderLine(remaining_rows_painter, row_first_byte);
+	if (!runs)
+	{
+		return;
+	}
 
-		tie(ignore, remaining_rows_painter) =
-		    Split(remaining_rows_painter, Vertical, Start, required_render_rows);
+	// Repeated rows, except the parts already folded as holes.
+	const size_t hole_fold_count = folds.size();
+	size_t h = 0;
+	for (const RowRunIndex::Run &run : runs->Runs())
+	{
+		for (int64_t begin = run.begin; begin < run.end; )
+		{
+			while (h < hole_fold_count && folds[h].end <= begin)
+			{
+				++h;
+			}
+
+			int64_t end = run.end;
+			if (h < hole_fold_count && folds[h].begin < end)
+			{
+				if (folds[h].begin <= begin)
+				{
+					begin = folds[h].end;
+					continue;
+				}
+				end = folds[h].begin;
+			}
+
+			if (end - begin >= RowRunIndex::kMinRunRows * cols)
+			{
+				folds.push_back(Fold{begin, end, false});
+			}
+			begin = end;
+		}
 	}
+
+	inplace_merge(folds.begin(), folds.begin() + hole_fold_count, folds.end(),
+	    [](const Fold &a, const Fold &b) { return a.begin < b.begin; });
 }
 
-void HexEditor::RenderLine(Painter p, int row_first_byte)
+void HexEditor::RenderLine(Painter p, int64_t row_first_byte)
 {
 	const int byte_padding_left = style_sheet.GetBytePaddingLeft();
 	const int byte_padding_right = style_sheet.GetBytePaddingRight();
@@ -184,47 +1247,70 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 	// Yellow row number (decimal).
 	// Showing the start index like 120, 140 (if editor_column_count is 20)
 
-	if (row_first_byte < (int)data->size())
+	if (row_first_byte < (int64_t)data->Size())
 	{
 		// Render row number only if not EOF
 		p.SetFgColor(TermColor::Yellow);
-		p.Printf("%7d  ", row_first_byte);
+		p.Printf("%*" PRId64 "  ", row_number_width, row_first_byte);
 		p.SetFgColor(TermColor::None);
 	}
 	else
 	{
 		p.SetFgColor(TermColor::Magenta);
-		p.Printf("~~~~~~~   ");
+		p.Printf("%s   ", string(row_number_width, '~').c_str());
 		p.SetFgColor(TermColor::None);
 		return;
 	}
 
+	// Bytes of the row, copied once as buffer lookups are not free. Until
+	// they are produced, placeholders are shown.
+	vector<uint8_t> row_bytes(editor_column_count);
+	const int64_t row_end = min<int64_t>(row_first_byte + editor_column_count, data->Size());
+	const bool ready = BytesReady(row_first_byte, row_end - row_first_byte);
+	if (ready)
+	{
+		data->Read(row_first_byte, row_bytes.data(), row_bytes.size());
+	}
+
+	char hex[3];
+	auto hex_text = [&](int col) -> const char*
+	{
+		if (!ready)
+		{
+			return "··";
+		}
+		snprintf(hex, sizeof(hex), "%02x", (int)row_bytes[col]);
+		return hex;
+	};
+
+	vector<bool> in_match(editor_column_count);
+	FindMatchesInRow(row_first_byte, in_match);
+
 	for (int col = 0; col < editor_column_count; ++col)
 	{
-		int cid = row_first_byte + col;
+		int64_t cid = row_first_byte + col;
 
-		const MarkData *mark = GetMarkUnder(cid);
+		const Mark *mark = GetMarkUnder(cid);
 		if (mark && mark->start_address == cid)
 		{
-			// A new mark type is being used now.
-			// Assign it a color and store for future display.
-			last_mark_color = 99 + 11 * mark_colors.size();
-			mark_colors.push_back( make_pair(mark, last_mark_color) );
+			// A new mark type is being used now, assign it a color. Colors
+			// are reused when there are many marks on the screen.
+			last_mark_color = 99 + 11 * (mark_color_count++ % 14);
 		}
 
 		if (mark)
 		{
-			pmark.MoveTo(1, 9 + (col * byte_cols));
+			pmark.MoveTo(1, row_number_width + 2 + (col * byte_cols));
 			pmark.SetFgColor(static_cast<TermColor>(last_mark_color));
 
-			int mark_text_start = byte_cols * (cid - mark->start_address);
-			if ((int)mark->user_comment.size() > mark_text_start)
+			int64_t mark_text_start = byte_cols * (cid - mark->start_address);
+			if ((int)mark->comment.size() > mark_text_start)
 			{
-				pmark.Printf("%.*s", byte_cols, mark->user_comment.c_str() + mark_text_start);
+				pmark.Printf("%.*s", byte_cols, mark->comment.c_str() + mark_text_start);
 			}
 		}
 
-		if (cid >= (int)data->size())
+		if (cid >= row_end)
 		{
 			// EOF marker tat he next character (magenta).
 			p.SetFgColor(TermColor::Magenta);
@@ -242,7 +1328,7 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 			  && cid <= max(cursor_pos, selection_start_byte));
 
 
-			p.SetBgColor(hl ? TermColor::Yellow : TermColor::None);
+			p.SetBgColor(hl ? TermColor::Yellow : in_match[col] ? TermColor::Green : TermColor::None);
 
 			if (mark)
 			{
@@ -254,7 +1340,7 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 				p.SetFgColor(cursor_pos == cid ? TermColor::Cyan
 				                               : static_cast<TermColor>(last_mark_color));
 
-				p.Printf("%02x", (int)(*data)[cid]);
+				p.Printf("%s", hex_text(col));
 
 				p.SetUnderline(mark->start_address + mark->length - 1 != cid);
 				p.SetFgColor(static_cast<TermColor>(last_mark_color));
@@ -264,8 +1350,8 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 			else
 			{
 				p.SetFgColor(cursor_pos == cid ? TermColor::Cyan : TermColor::None);
-				p.Printf("%*s%02x%*s", byte_padding_left, "", (int)(*data)[cid],
-				                       byte_padding_right, "");
+				p.Printf("%*s%s%*s", byte_padding_left, "", hex_text(col),
+				                     byte_padding_right, "");
 			}
 
 			p.SetBgColor(TermColor::None);
@@ -280,15 +1366,15 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 
 	for (int col = 0; col < editor_column_count; ++col)
 	{
-		int cid = row_first_byte + col;
+		int64_t cid = row_first_byte + col;
 
 		bool hl = (hexa->GetEditorMode() == Hexa::EditorMode::Visual
 		  && cid >= min(cursor_pos, selection_start_byte)
 		  && cid <= max(cursor_pos, selection_start_byte));
 
-		p.SetBgColor(hl ? TermColor::Yellow : TermColor::None);
+		p.SetBgColor(hl ? TermColor::Yellow : in_match[col] ? TermColor::Green : TermColor::None);
 
-		if (cid >= (int)data->size())
+		if (cid >= row_end)
 		{
 			p.SetFgColor(TermColor::Magenta);
 			p.Printf("~");
@@ -300,8 +1386,15 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 			{
 				p.SetBgColor(TermColor::Cyan);
 			}
-			char print_char = (isprint((*data)[cid]) ? (*data)[cid] : '.');
-			p.Printf("%c", print_char);
+			if (!ready)
+			{
+				p.Printf("·");
+			}
+			else
+			{
+				char print_char = (isprint(row_bytes[col]) ? row_bytes[col] : '.');
+				p.Printf("%c", print_char);
+			}
 		}
 
 		p.SetBgColor(TermColor::None);
@@ -310,6 +1403,25 @@ void HexEditor::RenderLine(Painter p, int row_first_byte)
 
 }
 
+bool HexEditor::BytesReady(int64_t pos, int64_t length)
+{
+	if (length <= 0 || data->Snapshot().Materialized(pos, length))
+	{
+		return true;
+	}
+
+	// Rows are rendered in order, consecutive ones are merged.
+	if (!unready_ranges.empty() && unready_ranges.back().first <= pos && unready_ranges.back().second >= pos)
+	{
+		unready_ranges.back().second = max(unready_ranges.back().second, pos + length);
+	}
+	else
+	{
+		unready_ranges.emplace_back(pos, pos + length);
+	}
+	return false;
+}
+
 void HexEditor::RenderValueTable(Painter &p)
 {
 	using ::unicode_iterator::utf8_iterator;
@@ -327,6 +1439,15 @@ void HexEditor::RenderValueTable(Painter &p)
 	// Max digits required:
 	//                   |   -128 |  -32768 | -2147483648 | -9223372036854775808 |
 	p.Printf("           | int8_t | int16_t |   int32_t   |        int64_t       |");
+
+	// Strings are clipped to the screen width anyway, so a few bytes for
+	// each column is enough. Values are shown once they are produced.
+	vector<uint8_t> window(min<int64_t>(p.ColumnCount() * 16, max<int64_t>(0, data->Size() - cursor_pos)));
+	if (!BytesReady(cursor_pos, window.size()))
+	{
+		return;
+	}
+
 	p.MoveTo(1, 0);
 	p.Printf("    signed | %6s | %7s | %11s | %20s |",
 	         RenderIntegerOnCursor<int8_t>().c_str(),
@@ -341,32 +1462,170 @@ void HexEditor::RenderValueTable(Painter &p)
 	         RenderIntegerOnCursor<uint32_t>().c_str(),
 	         RenderIntegerOnCursor<uint64_t>().c_str());
 
-	const char *begin = reinterpret_cast<const char*>(data->data() + cursor_pos);
-	const char *end =   reinterpret_cast<const char*>(data->data() + data->size());
+	data->Read(cursor_pos, window.data(), window.size());
+
+	const char *begin = reinterpret_cast<const char*>(window.data());
+	const char *end =   reinterpret_cast<const char*>(window.data() + window.size());
 
 	RenderStringToRow(p, 3, "UTF-8",  utf8_iterator(begin, end));
 	RenderStringToRow(p, 4, "UTF-16", utf16_iterator(begin, end, view_endianness));
 	RenderStringToRow(p, 5, "UTF-32", utf32_iterator(begin, end, view_endianness));
 }
 
+void HexEditor::RenderStats(Painter &p)
+{
+	const ByteHistogram &h = stats->histogram;
+	const uint64_t total = h.Total();
+
+	p.DrawFrame("Byte Statistics");
+	p = p.FramedArea();
+
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%" PRId64 " bytes in [%" PRId64 ", %" PRId64 "), %.0f ms, %.0f MB/s",
+	         stats->end - stats->begin, stats->begin, stats->end, stats->seconds * 1000,
+	         stats->seconds > 0 ? total / stats->seconds / 1e6 : 0.0);
+	PrintClipped(p, 0, buf);
+
+	int min_byte = -1, max_byte = -1, distinct = 0;
+	uint64_t printable = 0;
+	for (int b = 0; b < 256; ++b)
+	{
+		if (h.Count(b) == 0)
+			continue;
+		if (min_byte < 0)
+			min_byte = b;
+		max_byte = b;
+		++distinct;
+		if (b >= 0x20 && b < 0x7f)
+			printable += h.Count(b);
+	}
+
+	auto percent = [total](uint64_t count) { return total ? count * 100.0 / total : 0.0; };
+
+	snprintf(buf, sizeof(buf), "min %02x  max %02x  distinct %d  zeros %" PRIu64 " (%.1f%%)"
+	         "  printable %" PRIu64 " (%.1f%%)  entropy %.3f bits/byte",
+	         max(min_byte, 0), max(max_byte, 0), distinct,
+	         h.Count(0), percent(h.Count(0)), printable, percent(printable), h.Entropy());
+	PrintClipped(p, 1, buf);
+
+	// Most common values first.
+	vector<int> by_count(256);
+	for (int b = 0; b < 256; ++b)
+		by_count[b] = b;
+	stable_sort(by_count.begin(), by_count.end(),
+	    [&h](int a, int b) { return h.Count(a) > h.Count(b); });
+
+	string line = "most common";
+	for (int i = 0; i < 16 && h.Count(by_count[i]) > 0; ++i)
+	{
+		snprintf(buf, sizeof(buf), "  %02x %5.1f%%", by_count[i], percent(h.Count(by_count[i])));
+		line += buf;
+	}
+	PrintClipped(p, 2, line);
+
+	// Histogram on a log scale, each cell is the busiest of its values.
+	static const char *const kBars[] = {" ", "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+	const int cell_count = 64;
+	const int values_per_cell = 256 / cell_count;
+	const int label_width = 12;
+
+	uint64_t max_count = 0;
+	for (int b = 0; b < 256; ++b)
+		max_count = max(max_count, h.Count(b));
+
+	PrintClipped(p, 3, "histogram");
+	p.SetFgColor(TermColor::Cyan);
+	for (int cell = 0; cell < cell_count && label_width + cell < p.ColumnCount(); ++cell)
+	{
+		uint64_t count = 0;
+		for (int v = 0; v < values_per_cell; ++v)
+			count = max(count, h.Count(cell * values_per_cell + v));
+
+		int level = 0;
+		if (count > 0)
+			level = 1 + (int)lround(7 * log2((double)count) / max(1.0, log2((double)max_count)));
+
+		p.MoveTo(3, label_width + cell);
+		p.Printf("%s", kBars[min(level, 8)]);
+	}
+	p.SetFgColor(TermColor::None);
+
+	PrintClipped(p, 4, string(label_width, ' ') + "00              40              80              c0");
+}
+
+void HexEditor::RenderStrings(Painter &p)
+{
+	const vector<FoundString> &found = strings->strings;
+
+	char buf[100];
+	if (strings->scanned < strings->total)
+	{
+		snprintf(buf, sizeof(buf), "Strings (%zu found, %d%%)", found.size(),
+		         (int)(strings->scanned * 100 / strings->total));
+	}
+	else
+	{
+		snprintf(buf, sizeof(buf), "Strings (%zu found)", found.size());
+	}
+	p.DrawFrame(buf);
+	p = p.FramedArea();
+
+	if (found.empty() || p.RowCount() <= 0)
+	{
+		return;
+	}
+
+	// List follows the cursor, the last string starting at or before it is
+	// highlighted, a third of the way down.
+	auto after = upper_bound(found.begin(), found.end(), cursor_pos,
+	    [](int64_t pos, const FoundString &s) { return pos < (int64_t)s.begin; });
+	const int64_t current = (after - found.begin()) - 1;
+	const int64_t first = max<int64_t>(0, min<int64_t>(current - p.RowCount() / 3,
+	                                                   (int64_t)found.size() - p.RowCount()));
+
+	for (int row = 0; row < p.RowCount() && first + row < (int64_t)found.size(); ++row)
+	{
+		const FoundString &s = found[first + row];
+		const bool has_cursor = (first + row == current
+		                         && cursor_pos < (int64_t)s.end);
+
+		snprintf(buf, sizeof(buf), "%10" PRIu64 " %-7s ", s.begin, TextEncodingName(s.encoding));
+		// Clipped to whole characters, text is UTF-8.
+		string line = buf + s.text;
+		size_t length = min<size_t>(line.size(), p.ColumnCount());
+		while (length < line.size() && length > 0 && (line[length] & 0xc0) == 0x80)
+		{
+			--length;
+		}
+		line.resize(length);
+
+		if (has_cursor)
+		{
+			p.SetBgColor(TermColor::Cyan);
+		}
+		PrintClipped(p, row, line);
+		p.SetBgColor(TermColor::None);
+	}
+}
+
 void HexEditor::DeleteSelectedRegion()
 {
-	int range_begin = min(cursor_pos, selection_start_byte);
-	int range_end = max(cursor_pos, selection_start_byte) + 1;
-	data->erase(data->begin() + range_begin,
-	            data->begin() + range_end);
+	int64_t range_begin = min(cursor_pos, selection_start_byte);
+	int64_t range_end = max(cursor_pos, selection_start_byte) + 1;
+	data->Erase(range_begin, range_end);
 
 	cursor_pos = range_begin;
-	if (cursor_pos >= (int)data->size())
+	if (cursor_pos >= (int64_t)data->Size())
 	{
-		// TODO handle when data->size() == 0
-		--cursor_pos;
+		JumpToFileEnd();
 	}
 }
 
 void HexEditor::ScreenWidthUpdated(int new_screen_width)
 {
-	const int line_number_columns = 9;
+	// Row numbers of large buffers take more than the usual width.
+	row_number_width = max<int>(7, to_string(max<int64_t>(0, data->Size() - 1)).size());
+	const int line_number_columns = row_number_width + 2;
 	const int ascii_view_padding = 2;
 	const int byte_cols_for_editor = 2 + style_sheet.GetBytePaddingLeft() + style_sheet.GetBytePaddingRight();
 	const int byte_cols_for_ascii_view = 1;
@@ -379,20 +1638,44 @@ void HexEditor::ScreenWidthUpdated(int new_screen_width)
 	// TODO what happens to first_byte_shown? maybe call FixScroll?
 }
 
-void HexEditor::MarkRange(int offset, int length, const string &comment)
+void HexEditor::MarkRange(int64_t offset, int64_t length, const string &comment)
+{
+	marks.Add(offset, length, comment);
+	loaded_marks_end = loaded_marks_begin;
+}
+
+void HexEditor::LoadMarks(int64_t pos)
 {
-	MarkData m;
-	m.start_address = offset;
-	m.length = length;
-	m.user_comment = comment;
+	// A screen of rows on both sides, as FixScroll looks at the rows above
+	// the cursor and rendering at the ones below the first row shown.
+	const int64_t columns = max(editor_column_count, 1);
+	const int64_t span = (int64_t)max(last_row_count, 1) * columns;
+	const int64_t row = pos - pos % columns;
+	loaded_marks_begin = max<int64_t>(0, row - span);
+	loaded_marks_end = row + columns + span;
+	loaded_marks_version = data->Version();
+
+	loaded_marks.clear();
+	MarkProvider *providers[] = {&marks, Structure()};
+	for (MarkProvider *provider : providers)
+	{
+		if (provider)
+		{
+			provider->MarksIn(loaded_marks_begin, loaded_marks_end, loaded_marks);
+		}
+	}
+	stable_sort(loaded_marks.begin(), loaded_marks.end());
 
-	// TODO prevent overlapping comments, as they'd be hard for rendering.
-	marks.insert(m);
+	max_loaded_mark_length = 0;
+	for (const Mark &m : loaded_marks)
+	{
+		max_loaded_mark_length = max(max_loaded_mark_length, m.length);
+	}
 }
 
 void HexEditor::MarkSelection(const string &comment)
 {
-	int offset = min(cursor_pos, selection_start_byte);
-	int length = 1 + max(cursor_pos, selection_start_byte) -  min(cursor_pos, selection_start_byte);
+	int64_t offset = min(cursor_pos, selection_start_byte);
+	int64_t length = 1 + max(cursor_pos, selection_start_byte) -  min(cursor_pos, selection_start_byte);
 	MarkRange(offset, length, comment);
 }
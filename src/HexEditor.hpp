@@ -17,12 +17,17 @@
 
 #pragma once
 
+#include <atomic>
 #include <iomanip>
+#include <cinttypes>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <cstdio>
+#include <algorithm>
 #include <set>
 #include <sstream>
 #include <string>
@@ -33,7 +38,16 @@ using namespace std;
 #include <termios.h>
 #include <unistd.h>
 
+#include "BufferDiff.hpp"
+#include "ByteHistogram.hpp"
 #include "Endianness.hpp"
+#include "EntropyIndex.hpp"
+#include "FileBuffer.hpp"
+#include "MarkProvider.hpp"
+#include "RowRunIndex.hpp"
+#include "StringScanner.hpp"
+#include "TemplateTree.hpp"
+#include "ValueSearch.hpp"
 #include "Terminal.hpp"
 #include "StyleSheet.hpp"
 #include "TermColor.hpp"
@@ -43,21 +57,8 @@ class Hexa;
 // TODO this should be called FileView?
 class HexEditor
 {
-private:
-	struct MarkData
-	{
-		int start_address;
-		int length;
-		string user_comment;
-
-		bool operator<(const MarkData &o) const
-		{
-			return start_address < o.start_address;
-		}
-	};
-
 public:
-	HexEditor(const Hexa *hexa, string file_name, vector<uint8_t> *data)
+	HexEditor(const Hexa *hexa, string file_name, FileBuffer *data)
 	  : hexa(hexa), file_name(file_name), data(data)
 	{
 	}
@@ -67,9 +68,10 @@ public:
 	template <typename IntegerType>
 	string RenderIntegerOnCursor()
 	{
-		if (cursor_pos + sizeof(IntegerType) > data->size())
+		if (cursor_pos + sizeof(IntegerType) > data->Size())
 			return "~";
-		IntegerType bytes = *reinterpret_cast<IntegerType*>(&(*data)[cursor_pos]);
+		IntegerType bytes;
+		data->Read(cursor_pos, &bytes, sizeof(bytes));
 		IntegerType num = FromEndianness(view_endianness, bytes);
 		return std::to_string(num);
 	}
@@ -77,23 +79,31 @@ public:
 	template <typename ValueType>
 	void ReplaceValueOnCursor(ValueType t)
 	{
-		if (cursor_pos + sizeof(ValueType) > data->size())
+		if (cursor_pos + sizeof(ValueType) > data->Size())
 		{
 			throw std::out_of_range("Not enought space");
 		}
 		ValueType bytes = ToEndianness(view_endianness, t);
-		*reinterpret_cast<ValueType*>(&(*data)[cursor_pos]) = bytes;
+		data->Overwrite(cursor_pos, &bytes, sizeof(bytes));
 	}
 
+	// Folded rows are passed over in one step.
 	void MoveCursorDown()
 	{
-		if (cursor_pos + editor_column_count < (int)data->size())
-			cursor_pos += editor_column_count;
+		UpdateFolds();
+		const int64_t col = cursor_pos % editor_column_count;
+		const Fold *fold = FoldAt(cursor_pos - col);
+		const int64_t next_row = (fold ? fold->end : cursor_pos - col + editor_column_count);
+		if (next_row + col < (int64_t)data->Size())
+			cursor_pos = next_row + col;
 	}
 	void MoveCursorUp()
 	{
-		if (cursor_pos >= editor_column_count)
-			cursor_pos -= editor_column_count;
+		UpdateFolds();
+		const int64_t col = cursor_pos % editor_column_count;
+		const int64_t row = VisibleRowStart(cursor_pos);
+		if (row >= editor_column_count)
+			cursor_pos = VisibleRowStart(row - editor_column_count) + col;
 	}
 	void MoveCursorLeft()
 	{
@@ -102,29 +112,44 @@ public:
 	}
 	void MoveCursorRight()
 	{
-		if (cursor_pos + 1 < (int)data->size())
+		if (cursor_pos + 1 < (int64_t)data->Size())
 			++cursor_pos;
 	}
 	void DeleteSelectedRegion();
 
+	// Half a page of visible rows, a folded run counts as one.
 	void ScrollUpHalfPage()
 	{
-		cursor_pos -= (last_row_count / 2) * editor_column_count;
-		if (cursor_pos < 0)
-			cursor_pos = 0;
+		for (int i = 0; i < last_row_count / 2; ++i)
+		{
+			const int64_t old_pos = cursor_pos;
+			MoveCursorUp();
+			if (cursor_pos == old_pos)
+			{
+				JumpToFileStart();
+				break;
+			}
+		}
 	}
 
 	void ScrollDownHalfPage()
 	{
-		// Scroll down half a page.
-		cursor_pos += (last_row_count / 2) * editor_column_count;
-		if (cursor_pos >= (int)data->size())
-			cursor_pos = data->size() - 1;
+		for (int i = 0; i < last_row_count / 2; ++i)
+		{
+			const int64_t old_pos = cursor_pos;
+			MoveCursorDown();
+			if (cursor_pos == old_pos)
+			{
+				JumpToFileEnd();
+				break;
+			}
+		}
 	}
 
+	// For buffers still being read, this is the end read so far.
 	void JumpToFileEnd()
 	{
-		cursor_pos = data->size() - 1;
+		cursor_pos = max<int64_t>(0, data->Size() - 1);
 	}
 
 	void JumpToFileStart()
@@ -132,6 +157,59 @@ public:
 		cursor_pos = 0;
 	}
 
+	// Moves past the hole the cursor is in, or the next one. Returns false
+	// if there is no data after it.
+	bool JumpToNextDataExtent()
+	{
+		const uint64_t next = data->NextDataExtent(cursor_pos);
+		if (next >= data->Size())
+			return false;
+		cursor_pos = next;
+		return true;
+	}
+
+	// Start of the next region after `pos` whose entropy is in another
+	// class, like from code to compressed data. Returns -1 if there is
+	// none, or entropy is not computed yet. Reads the entropy indexes of the
+	// sources a piece at a time, and is safe to call from any thread.
+	static int64_t FindEntropyChange(const BufferSnapshot &snapshot, int64_t pos,
+	                                 const function<bool()> &cancelled);
+
+	// Move to the start of the next or previous range differing from the
+	// buffer compared with. Return false if there is none.
+	bool JumpToNextChange();
+	bool JumpToPrevChange();
+
+	// Move to the next or previous match of the last search. Return false
+	// if there is none.
+	bool JumpToNextMatch();
+	bool JumpToPrevMatch();
+	// To the first match at or after `pos`, or the first one if there is
+	// none after it.
+	bool JumpToMatchFrom(int64_t pos);
+
+	// Move to the start of the next or previous string found by :strings.
+	// Return false if there is none.
+	bool JumpToNextString();
+	bool JumpToPrevString();
+
+	// Moves to the part of the file clicked on the minimap. Returns false if
+	// the click is not on the minimap.
+	bool MinimapClick(int screen_row, int screen_column);
+
+	// Move to the next or previous field of the structure decoded by the
+	// template, going up to the enclosing ones at the last. Return false if
+	// there is none.
+	bool JumpToNextField();
+	bool JumpToPrevField();
+	// Same, for elements of the innermost array the cursor is in.
+	bool JumpToNextElement();
+	bool JumpToPrevElement();
+
+	// Moves to the field clicked on the structure pane. Returns false if
+	// the click is not on one.
+	bool StructureClick(int screen_row, int screen_column);
+
 private:
 	// When cursor is near end of the visible region, update rows shown if needed.
 	// Should ideally be called after cursor movements, but since HexEditor does not
@@ -139,10 +217,12 @@ private:
 	// screen size.
 	void FixScroll()
 	{
+		UpdateFolds();
+
 		// Handle scroll up
 		if (cursor_pos < first_byte_shown)
 		{
-			first_byte_shown = cursor_pos - (cursor_pos % editor_column_count);
+			first_byte_shown = VisibleRowStart(cursor_pos);
 			return;
 		}
 
@@ -150,52 +230,157 @@ private:
 		// TODO being conservative here as computation is wrong.
 		int line_quota = last_row_count;
 
-		int cursor_row_first_byte = cursor_pos - (cursor_pos % editor_column_count);
 		// i is the min first_byte_shown that is required to render cursor line.
-		int i = cursor_row_first_byte;
+		// Steps over a folded run at once, so this is bounded by the screen
+		// height rather than the rows folded.
+		int64_t i = VisibleRowStart(cursor_pos);
 
-		for (; i > 0 && line_quota >= 2; i -= editor_column_count)
+		for (; i > 0 && line_quota >= 2; i = VisibleRowStart(i - editor_column_count))
 		{
-			line_quota -= (1 + IsRowMarked(i));
-
+			line_quota -= RowLineCount(i);
 		}
-		if (line_quota == 1 && i > 0 && !IsRowMarked(i))
+		if (line_quota == 1 && i > 0 && RowLineCount(i) == 1)
 		{
-			i -= editor_column_count;
+			i = VisibleRowStart(i - editor_column_count);
 		}
 
-		first_byte_shown = max(first_byte_shown, i);
+		first_byte_shown = VisibleRowStart(max(first_byte_shown, i));
+	}
+
+	// Same as above, for the side by side diff view.
+	void FixDiffScroll();
+
+	// Run of whole rows shown as a single row.
+	struct Fold
+	{
+		int64_t begin;
+		int64_t end;
+
+		// Hole of a sparse file, otherwise rows repeating the one above.
+		bool hole;
+	};
+
+	// Rebuilds folds if the contents, the column count or the row run
+	// index changed.
+	void UpdateFolds();
+
+	// Whether the row run index needs to be built for current contents.
+	bool RowRunIndexWanted() const
+	{
+		return editor_column_count > 0 && !data->IsGrowing()
+		    && !(row_runs_pending_version == data->Version()
+		         && row_runs_pending_column_count == editor_column_count);
+	}
+
+	// Fold containing the row starting at `row_first_byte`, null if none.
+	const Fold* FoldAt(int64_t row_first_byte) const
+	{
+		auto it = upper_bound(folds.begin(), folds.end(), row_first_byte,
+		    [](int64_t pos, const Fold &f) { return pos < f.begin; });
+		if (it == folds.begin() || (it - 1)->end <= row_first_byte)
+			return nullptr;
+		return &*(it - 1);
+	}
+
+	// First byte of the visible row containing `pos`.
+	int64_t VisibleRowStart(int64_t pos) const
+	{
+		const int64_t row = pos - (pos % editor_column_count);
+		const Fold *fold = FoldAt(row);
+		return fold ? fold->begin : row;
+	}
+
+	// Screen lines the visible row starting at `row_first_byte` takes.
+	int RowLineCount(int64_t row_first_byte)
+	{
+		return FoldAt(row_first_byte) ? 1 : 1 + IsRowMarked(row_first_byte);
 	}
 
 	// Widgets render functions
 	void RenderEditor(Painter editor_painter);
-	void RenderLine(Painter editor_painter, int row_first_byte);
+	void RenderLine(Painter editor_painter, int64_t row_first_byte);
+
+	// Whether bytes in [pos, pos + length) can be shown without producing
+	// them first. Others are added to `unready_ranges`.
+	bool BytesReady(int64_t pos, int64_t length);
+	void RenderFold(Painter editor_painter, const Fold &fold);
+	void RenderDiff(Painter p);
+	void RenderDiffLine(Painter p, int64_t first_byte, int first_column, const vector<uint8_t> &bytes,
+	                    const vector<uint8_t> &other_bytes, bool changed, bool has_cursor);
+	void RenderMinimap(Painter p);
+	void RenderStructure(Painter p);
 	void RenderValueTable(Painter &p);
+	void RenderStats(Painter &p);
+	void RenderStrings(Painter &p);
 	void RenderInfoBar(Painter &p);
 
+	// Mean entropy of [begin, end) in EntropyIndex units, from the entropy
+	// indexes of the sources. Returns -1 if it is not computed yet.
+	static int RangeEntropy(const BufferSnapshot &snapshot, int64_t begin, int64_t end);
+
+	// Whether entropy indexes need to be computed for the minimap.
+	bool EntropyIndexWanted() const
+	{
+		return minimap_shown && !data->IsGrowing() && !data->Source()->Entropy();
+	}
+
 	// Functions to create marks.
-	void MarkRange(int offset, int length, const string &comment);
+	void MarkRange(int64_t offset, int64_t length, const string &comment);
 	void MarkSelection(const string &comment);
 
-	const MarkData* GetMarkUnder(int addr)
+	// Whether marks of [begin, end) are loaded for the current contents.
+	bool MarksLoaded(int64_t begin, int64_t end) const
+	{
+		return begin >= loaded_marks_begin && end <= loaded_marks_end
+		    && loaded_marks_version == data->Version();
+	}
+
+	// Asks the providers for the marks of a screen of rows around `pos`.
+	void LoadMarks(int64_t pos);
+
+	// Loaded marks are sorted by start, and none is longer than
+	// `max_loaded_mark_length`, so only the ones starting shortly before
+	// are looked at.
+	const Mark* GetMarkUnder(int64_t addr)
 	{
-		for (auto const &mark : marks)
+		if (!MarksLoaded(addr, addr + 1))
 		{
-			if (mark.start_address <= addr && mark.start_address + mark.length > addr)
+			LoadMarks(addr);
+		}
+		auto it = upper_bound(loaded_marks.begin(), loaded_marks.end(), addr,
+		    [](int64_t pos, const Mark &m) { return pos < m.start_address; });
+		while (it != loaded_marks.begin())
+		{
+			--it;
+			if (it->start_address + max_loaded_mark_length <= addr)
 			{
-				// TODO this is ugly.
-				return &(mark);
+				break;
+			}
+			if (it->start_address + it->length > addr)
+			{
+				return &*it;
 			}
 		}
 		return nullptr;
 	}
 
-	bool IsRowMarked(int row_first_byte) const
+	bool IsRowMarked(int64_t row_first_byte)
 	{
-		for (auto const &mark : marks)
+		const int64_t row_end = row_first_byte + editor_column_count;
+		if (!MarksLoaded(row_first_byte, row_end))
+		{
+			LoadMarks(row_first_byte);
+		}
+		auto it = lower_bound(loaded_marks.begin(), loaded_marks.end(), row_end,
+		    [](const Mark &m, int64_t pos) { return m.start_address < pos; });
+		while (it != loaded_marks.begin())
 		{
-			if (mark.start_address < row_first_byte + editor_column_count &&
-			     mark.start_address + mark.length - 1 >= row_first_byte)
+			--it;
+			if (it->start_address + max_loaded_mark_length <= row_first_byte)
+			{
+				break;
+			}
+			if (it->start_address + it->length > row_first_byte)
 			{
 				return true;
 			}
@@ -223,31 +408,179 @@ private:
 	string file_name;
 
 	// Index of the character the cursor is on.
-	int cursor_pos = 0;
+	int64_t cursor_pos = 0;
 
 	// Number of editor columns shown.
 	int editor_column_count = -1;
 
+	// Digits of the row numbers, enough for the last offset of the buffer.
+	int row_number_width = 7;
+
 	// Index of the first byte shown in the first visible line.
 	// Should be a multiple of editor_column_count.
-	int first_byte_shown = 0;
+	int64_t first_byte_shown = 0;
+
+	// End of the last visible line, as of the last render.
+	int64_t end_byte_shown = 0;
+
+	// Ranges the last render showed placeholders for, as their bytes were
+	// not produced yet, like parts of a compressed file not decompressed.
+	// Hexa produces them in background, then renders again.
+	vector< pair<int64_t, int64_t> > unready_ranges;
+
+	// Ranges being produced in background.
+	vector< pair<int64_t, int64_t> > unready_pending;
 
 	// Cached from the last RenderTo call.
 	int last_row_count = -1;
 	int last_column_count = -1;
 
+	// Whether the file is watched for appended bytes, like `tail -f`.
+	bool following = false;
+
 	// Selection is between cursor_pos and this index
-	int selection_start_byte = -1;
+	int64_t selection_start_byte = -1;
 
 	// File contents to operate on.
-	// TODO support large files with mmap?
-	vector<uint8_t> *data;
+	FileBuffer *data;
+
+	MarkSet marks;
+
+	// Marks of `marks` and of the structure overlapping [loaded_marks_begin,
+	// loaded_marks_end), for buffer version `loaded_marks_version`. Only
+	// the rows around the ones shown are asked for, so structures repeated
+	// through the file are marked as they are scrolled to.
+	vector<Mark> loaded_marks;
+	int64_t loaded_marks_begin = 0;
+	int64_t loaded_marks_end = 0;
+	uint64_t loaded_marks_version = 0;
+	int64_t max_loaded_mark_length = 0;
+
+	// Sorted, built for `folds_column_count` columns and buffer version
+	// `folds_version`.
+	vector<Fold> folds;
+	int folds_column_count = -1;
+	uint64_t folds_version = 0;
+	const RowRunIndex *folds_row_runs = nullptr;
+
+	// Last row run index built. Only used while it matches the contents.
+	shared_ptr<const RowRunIndex> row_runs;
+
+	// Index being built in background, cancelled when a newer one is needed.
+	uint64_t row_runs_pending_version = 0;
+	int row_runs_pending_column_count = -1;
+	shared_ptr< atomic<bool> > row_runs_cancelled;
+
+	// Result of :stats, shown in place of the value table until closed.
+	struct ByteStats
+	{
+		int64_t begin;
+		int64_t end;
+		ByteHistogram histogram;
+		double seconds;
+	};
+	shared_ptr<const ByteStats> stats;
+
+	// Result of :strings, listed in place of the value table until closed.
+	// Slices of the buffer are scanned in parallel and their strings are
+	// added as they finish.
+	struct StringList
+	{
+		size_t min_length;
+		vector<FoundString> strings;
+		uint64_t scanned = 0;
+		uint64_t total = 0;
+		atomic<bool> cancelled{false};
+	};
+	shared_ptr<StringList> strings;
+
+	// Matches of the last search, like :findval. They are highlighted until
+	// closed. Slices of the buffer are searched in parallel, and their
+	// matches are added as they finish.
+	struct SearchResults
+	{
+		string description;
+		int64_t length;
+		vector<uint64_t> starts;
+		uint64_t scanned = 0;
+		uint64_t total = 0;
+		bool truncated = false;
+		atomic<bool> cancelled{false};
+
+		// Bytes in matches as sorted [begin, end) ranges, overlapping and
+		// adjacent matches merged, for highlighting.
+		vector< pair<uint64_t, uint64_t> > ranges;
+
+		// Adds sorted matches of a range no other added ones start in.
+		void Add(const vector<uint64_t> &found);
+
+		// Keeps the first `count` matches only.
+		void Truncate(size_t count);
+	};
+	shared_ptr<SearchResults> search;
+
+	// Sets `in_match[i]` for bytes `row_first_byte + i` in a match of the
+	// last search. One lookup per row, so drawing does not depend on how
+	// many matches there are.
+	void FindMatchesInRow(int64_t row_first_byte, vector<bool> &in_match) const;
+
+	// Comparison with another buffer, see :diff. Shown side by side in
+	// place of the editor until closed.
+	shared_ptr<BufferDiff> diff;
+	string diff_file_name;
+
+	// Buffer version compared, the diff is outdated after edits.
+	uint64_t diff_version = 0;
+
+	// First row of the diff view. Rows are renumbered when hunks come in or
+	// columns change, then it is found again from its first byte.
+	BufferDiff::Row diff_first_row{0, 0};
+	uint64_t diff_first_byte = 0;
+	size_t diff_hunk_count = 0;
+	int diff_column_count = -1;
+
+	// Entropy heat map of the whole file next to the editor.
+	bool minimap_shown = false;
+
+	// Area the minimap is rendered to, and bytes each of its rows stands
+	// for, as of the last render. Used for clicks.
+	Painter minimap_painter;
+	int64_t minimap_row_bytes = 0;
+
+	// Template applied by :template, and the structure it decodes, which
+	// is built again after edits. Listed next to the editor while
+	// `structure_shown`.
+	shared_ptr<const BinaryTemplate> structure_template;
+	string structure_template_name;
+	shared_ptr<TemplateTree> structure;
+	uint64_t structure_version = 0;
+	bool structure_shown = false;
+
+	// Null if no template is applied.
+	TemplateTree* Structure();
+
+	// Whether open-ended arrays of the structure need to be walked in
+	// background for current contents, see TemplateTree::IndexArrays.
+	bool StructureIndexWanted() const
+	{
+		return structure_template && !data->IsGrowing()
+		    && !(structure_index_pending_version == data->Version()
+		         && structure_index_pending_template == structure_template.get());
+	}
+
+	// Walk being done, cancelled when a newer one is needed.
+	uint64_t structure_index_pending_version = 0;
+	const BinaryTemplate *structure_index_pending_template = nullptr;
+	shared_ptr< atomic<bool> > structure_index_cancelled;
 
-	set<MarkData> marks;
+	// Area the structure is rendered to, and offsets of its rows, -1 for
+	// rows without a field, as of the last render. Used for clicks.
+	Painter structure_painter;
+	vector<int64_t> structure_row_offsets;
 
 	// Helper members. TODO remove those.
-	vector< pair<const MarkData*, int > > mark_colors;
-	int last_mark_color;
+	int mark_color_count = 0;
+	int last_mark_color = 99;
 
 	Endianness view_endianness = Endianness::LittleEndian;
 
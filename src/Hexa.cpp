@@ -16,20 +16,28 @@
 // along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
+#include <cctype>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <utility>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/inotify.h>
 
 #include "Hexa.hpp"
 
 using namespace std;
 
+// Events that might mean the file has new contents on disk. Editors either
+// write in place, or rename a new file over the old one.
+static constexpr uint32_t kReloadWatchMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE
+                                           | IN_MOVE_SELF | IN_DELETE_SELF;
+
 Hexa::Hexa(const gengetopt_args_info &args)
   : args(args)
 {
@@ -43,19 +51,60 @@ Hexa::Hexa(const gengetopt_args_info &args)
 	}
 
 	script_engine.RegisterFunction<string>("exec", [this](string f){this->sc_Exec(f);});
+	script_engine.RegisterFunction("follow", [this](){this->sc_Follow();});
 	script_engine.RegisterFunction<int>("tab", [this](int t){this->sc_SwitchToTab(t);});
 
 	// Process :mark "sadasdas" // For selection
 	script_engine.RegisterFunction<string>("mark", [this](string c){this->sc_MarkSelection(c);});
 	// or :mark 0:4 "Header" // For absolute offset:length
-	script_engine.RegisterFunction<string, string>("mark", [this](string r, string c){this->sc_MarkAbsoluteRange(r, c);});
+	script_engine.RegisterFunction<string_view, const string&>("mark",
+	    [this](string_view r, const string &c){this->sc_MarkAbsoluteRange(r, c);});
+	// or :mark 0 4 "Header", like scripts computing them do
+	script_engine.RegisterFunction<int64_t, int64_t, const string&>("mark",
+	    [this](int64_t offset, int64_t length, const string &c){this->sc_MarkRange(offset, length, c);});
+
+	script_engine.RegisterFunction("minimap", [this](){this->sc_Minimap();});
 
 	script_engine.RegisterFunction("q", [this](){this->sc_Quit();});
 	script_engine.RegisterFunction("quit", [this](){this->sc_Quit();});
 
+	script_engine.RegisterFunction<string>("regex",
+	    [this](string pattern){this->sc_Regex(pattern);});
+	script_engine.RegisterFunction("reload", [this](){this->sc_Reload();});
+
 	script_engine.RegisterFunction<string, string>("replace",
 	    [this](string t, string v){this->sc_Replace(t,v);});
 
+	script_engine.RegisterFunction("stats", [this](){this->sc_Stats();});
+	script_engine.RegisterFunction("strings", [this](){this->sc_Strings(4);});
+	script_engine.RegisterFunction<int>("strings",
+	    [this](int min_length){this->sc_Strings(min_length);});
+	script_engine.RegisterFunction<int>("diff",
+	    [this](int tab_no){this->sc_Diff(tab_no);});
+	script_engine.RegisterFunction<string, string>("findval",
+	    [this](string t, string v){this->sc_FindValue(t, v, "");});
+	script_engine.RegisterFunction<string, string, string>("findval",
+	    [this](string t, string v, string flags){this->sc_FindValue(t, v, flags);});
+	script_engine.RegisterFunction<string>("find",
+	    [this](string text){this->sc_Find(text);});
+	script_engine.RegisterFunction("index", [this](){this->sc_Index();});
+	script_engine.RegisterFunction<string>("hash",
+	    [this](string algorithm){this->sc_Hash(algorithm);});
+	script_engine.RegisterFunction<string>("template",
+	    [this](string name){this->sc_Template(name);});
+	script_engine.RegisterFunction("tree", [this](){this->sc_Tree();});
+
+	// Patterns and text are full of characters scripts give a meaning to,
+	// so the rest of the line is taken as is for these.
+	script_engine.RegisterRawCommand("find ", [this](string text){this->sc_Find(text);});
+	script_engine.RegisterRawCommand("regex ", [this](string pattern){this->sc_Regex(pattern);});
+	script_engine.RegisterRawCommand("s/", [this](string expression){this->sc_Substitute(expression);});
+
+	// :123 moves cursor to 123rd byte.
+	script_engine.RegisterNumberCommand([this](string number){this->sc_Goto(number);});
+
+	script_engine.SetBuffer(&script_buffer);
+
 
 	script_engine.RegisterVariable<int>("byte-padding-left", [this](int v)
 	{
@@ -69,15 +118,12 @@ Hexa::Hexa(const gengetopt_args_info &args)
 
 	script_engine.RegisterVariable<string>("filetype", [this](string v)
 	{
-		// Since the scripting language does not even support
-		// branching and looping, most filetypes can not be marked
-		// with `*.hexa` files. Here some file types are directly
-		// implemented in C++. After having enought of them,
-		// it might be decided how to evolve HexaScript to support
-		// such use cases.
-		if (v == "tar")
+		// Formats are described by templates, decoded into the structure
+		// pane, or by `*.hexa` scripts marking what they read.
+		const string template_file = string(this->args.runtime_dir_arg) + "/templates/" + v + ".tpl";
+		if (access(template_file.c_str(), R_OK) == 0)
 		{
-			this->MarkFileType_Tar();
+			this->sc_Template(v);
 			return;
 		}
 		this->LoadScriptFile(string(this->args.runtime_dir_arg) + "/marks/" + v + ".hexa");
@@ -95,50 +141,727 @@ Hexa::Hexa(const gengetopt_args_info &args)
 	});
 }
 
+Hexa::~Hexa()
+{
+	// Jobs might read the buffers, they are stopped first. Then stream
+	// sources join their reader threads, which post growth to the worker,
+	// while it is still there.
+	worker.Stop();
+	tabs.clear();
+	file_contents.clear();
+}
+
 void Hexa::LoadScriptFile(const string &file_name)
 {
+	struct stat st;
 	ifstream script(file_name);
 
-	if (!script.is_open())
+	if (!script.is_open() || stat(file_name.c_str(), &st) != 0)
 	{
 		SetStatus(StatusType::ERROR, "Unable to load \"" + file_name + "\"");
 		return;
 	}
 
-	// Each line is a command.
-	string command;
-	while (getline(script, command))
+	// Compiled again only if the file changed since.
+	CompiledScript &compiled = compiled_scripts[file_name];
+	if (!compiled.program || compiled.size != st.st_size
+	    || compiled.mtime.tv_sec != st.st_mtim.tv_sec || compiled.mtime.tv_nsec != st.st_mtim.tv_nsec)
+	{
+		stringstream source;
+		source << script.rdbuf();
+		try
+		{
+			compiled.program = script_engine.Compile(source.str());
+		}
+		catch (HexaScript::Error &e)
+		{
+			compiled_scripts.erase(file_name);
+			SetStatus(StatusType::ERROR, "\"" + file_name + "\" " + e.ErrorInfo());
+			return;
+		}
+		compiled.size = st.st_size;
+		compiled.mtime = st.st_mtim;
+	}
+
+	// Kept alive, the script might load itself again.
+	shared_ptr<const HexaScript::Program> program = compiled.program;
+	try
+	{
+		script_engine.Run(*program);
+	}
+	catch (HexaScript::Error &e)
 	{
-		ProcessCommand(command);
+		SetStatus(StatusType::ERROR, "\"" + file_name + "\" " + e.ErrorInfo());
 	}
 }
 
-vector<uint8_t> ReadFile(const string &fileName)
+uint64_t Hexa::ScriptBuffer::Size() const
 {
-	ifstream testFile(fileName, std::ios::binary);
+	return hexa->tabs.empty() ? 0 : hexa->GetCurrentEditor()->data->Size();
+}
 
-	vector<uint8_t> fileContents;
-	fileContents.assign(std::istreambuf_iterator<char>(testFile),
-	                    std::istreambuf_iterator<char>());
-	return fileContents;
+uint64_t Hexa::ScriptBuffer::Read(uint64_t pos, void *out, uint64_t length) const
+{
+	return hexa->tabs.empty() ? 0 : hexa->GetCurrentEditor()->data->Read(pos, out, length);
 }
 
+uint64_t Hexa::ScriptBuffer::Cursor() const
+{
+	return hexa->tabs.empty() ? 0 : hexa->GetCurrentEditor()->cursor_pos;
+}
 
 void Hexa::AddNewTab(const string &file_name)
 {
 	if (file_contents.find(file_name) == file_contents.end())
 	{
+		const uint64_t stream_memory_limit = (uint64_t)args.stream_memory_arg << 20;
+
+		// Growth is reported from the reader thread, buffer is updated on
+		// the main thread.
+		auto on_growth = [this, file_name]()
+		{
+			worker.PostToMain([this, file_name]() { this->StreamGrown(file_name); });
+		};
+
 		// TODO handle file not existing?
-		file_contents[file_name] = ReadFile(file_name);
+		unique_ptr<FileBuffer> buffer;
+		if (file_name == "-")
+			buffer = FileBuffer::OpenStream(dup(STDIN_FILENO), stream_memory_limit, on_growth);
+		else
+			buffer = FileBuffer::Open(file_name, stream_memory_limit, index_dir, on_growth);
+
+		file_contents[file_name] = move(buffer);
+		WatchFile(file_name);
 	}
 
-	TabInfo ti {file_name, {this, file_name, &(file_contents[file_name])}};
+	const string display_name = (file_name == "-" ? "<stdin>" : file_name);
+
+	TabInfo ti {display_name, {this, display_name, file_contents[file_name].get()}};
 	ti.editor.style_sheet = base_style_sheet;
 	tabs.push_back(ti);
 
 	// TODO switch to new tab
 
-	SetStatus(StatusType::NORMAL, "\"" + file_name + "\" opened");
+	SetStatus(StatusType::NORMAL, "\"" + display_name + "\" opened");
+}
+
+void Hexa::ProcessBackgroundEvents()
+{
+	worker.RunCompletions();
+}
+
+void Hexa::StreamGrown(const string &file_name)
+{
+	FileBuffer *buffer = file_contents[file_name].get();
+	const uint64_t old_size = buffer->Size();
+	buffer->SyncWithSource();
+	BufferGrown(buffer, old_size);
+
+	if (!buffer->IsGrowing())
+	{
+		for (const TabInfo &ti : tabs)
+		{
+			if (ti.editor.data == buffer)
+			{
+				SetStatus(StatusType::NORMAL, "\"" + ti.file_name + "\" "
+				    + to_string(buffer->Size()) + " bytes read");
+				break;
+			}
+		}
+	}
+}
+
+void Hexa::ProcessFileEvents()
+{
+	file_watcher.ReadEvents([this](const string &file_name, uint32_t mask)
+	{
+		auto it = file_contents.find(file_name);
+		if (it == file_contents.end())
+		{
+			return;
+		}
+
+		FileBuffer *buffer = it->second.get();
+
+		// Kernel drops the watch when the file is deleted or replaced, keep
+		// watching the name for the file saved in its place.
+		if (mask & (IN_IGNORED | IN_MOVE_SELF | IN_DELETE_SELF))
+		{
+			file_watcher.Watch(file_name, kReloadWatchMask);
+		}
+
+		if (mask & (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE))
+		{
+			RemapIfShrunk(file_name);
+		}
+
+		if (IsFollowed(buffer))
+		{
+			const uint64_t old_size = buffer->Size();
+			const shared_ptr<MappedFileSource> old_source = buffer->MappedSource();
+			if (buffer->Refresh())
+			{
+				BufferGrown(buffer, old_size);
+			}
+
+			// Grown past the reservation of the mapping, see FileBuffer::Refresh.
+			if (buffer->MappedSource() != old_source)
+			{
+				IndexBlocks(buffer->MappedSource());
+			}
+		}
+
+		if (buffer->ChangedOnDisk() && changed_on_disk.insert(buffer).second)
+		{
+			SetStatus(StatusType::NORMAL, "\"" + file_name + "\" changed on disk, :reload to update");
+		}
+	});
+}
+
+void Hexa::WatchFile(const string &file_name)
+{
+	FileBuffer *buffer = file_contents[file_name].get();
+	shared_ptr<MappedFileSource> source = buffer->MappedSource();
+	if (!source)
+	{
+		return;
+	}
+
+	file_watcher.Watch(file_name, kReloadWatchMask);
+	IndexBlocks(source);
+}
+
+void Hexa::IndexBlocks(shared_ptr<MappedFileSource> source, function<void()> done)
+{
+	// Index is already published to readers on other threads when `done`
+	// runs, editors of the buffer pick it up on their next index build.
+	worker.Post([this, source]()
+	{
+		shared_ptr<BlockIndex> blocks = BlockIndex::Load(index_dir, source->FileName(), source->MappedStat());
+		if (!blocks)
+		{
+			blocks = BlockIndex::Compute(*source, [this]() { return worker.ShuttingDown(); });
+			if (!blocks)
+			{
+				return;
+			}
+			blocks->Save(index_dir, source->FileName(), source->MappedStat());
+		}
+		source->SetBlocks(move(blocks));
+
+		if (!source->Ngrams())
+		{
+			source->SetNgrams(NgramIndex::Load(index_dir, source->FileName(), source->MappedStat(), *source));
+		}
+	},
+	move(done));
+}
+
+void Hexa::IndexRowRuns(HexEditor *editor)
+{
+	if (!editor->RowRunIndexWanted())
+	{
+		return;
+	}
+
+	if (editor->row_runs_cancelled)
+	{
+		editor->row_runs_cancelled->store(true);
+	}
+
+	FileBuffer *buffer = editor->data;
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const uint64_t version = buffer->Version();
+	const int column_count = editor->editor_column_count;
+
+	// Runs found for an earlier version are updated around the edits.
+	shared_ptr<const RowRunIndex> previous = editor->row_runs;
+	if (previous && previous->RowLength() != column_count)
+	{
+		previous = nullptr;
+	}
+
+	auto cancelled = make_shared< atomic<bool> >(false);
+	auto index = make_shared<RowRunIndex>();
+
+	editor->row_runs_pending_version = version;
+	editor->row_runs_pending_column_count = column_count;
+	editor->row_runs_cancelled = cancelled;
+
+	const uint64_t buffer_id = buffer->Id();
+	worker.Post([snapshot, version, column_count, previous, cancelled, index]()
+	{
+		*index = (previous ? RowRunIndex::Update(*previous, snapshot, version, *cancelled)
+		                   : RowRunIndex::Build(snapshot, version, column_count, *cancelled));
+	},
+	[this, buffer_id, cancelled, index]()
+	{
+		if (*cancelled)
+		{
+			return;
+		}
+
+		ForEachEditorOf(buffer_id, [&index](HexEditor &e)
+		{
+			if (e.editor_column_count == index->RowLength())
+			{
+				e.row_runs = index;
+			}
+		});
+	});
+}
+
+void Hexa::IndexStructure(HexEditor *editor)
+{
+	if (!editor->StructureIndexWanted())
+	{
+		return;
+	}
+
+	if (editor->structure_index_cancelled)
+	{
+		editor->structure_index_cancelled->store(true);
+	}
+
+	FileBuffer *buffer = editor->data;
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const uint64_t version = buffer->Version();
+	shared_ptr<const BinaryTemplate> tpl = editor->structure_template;
+
+	auto cancelled = make_shared< atomic<bool> >(false);
+	auto indexed = make_shared< unique_ptr<TemplateTree> >();
+
+	editor->structure_index_pending_version = version;
+	editor->structure_index_pending_template = tpl.get();
+	editor->structure_index_cancelled = cancelled;
+
+	const uint64_t buffer_id = buffer->Id();
+	worker.Post([snapshot, tpl, cancelled, indexed]()
+	{
+		indexed->reset(new TemplateTree(tpl, snapshot));
+		if (!(*indexed)->IndexArrays(*cancelled))
+		{
+			indexed->reset();
+		}
+	},
+	[this, buffer_id, version, tpl, cancelled, indexed]()
+	{
+		if (*cancelled || !*indexed)
+		{
+			return;
+		}
+
+		ForEachEditorOf(buffer_id, [&](HexEditor &e)
+		{
+			if (e.data->Version() == version && e.structure_template == tpl)
+			{
+				e.Structure()->AdoptIndex(**indexed);
+			}
+		});
+	});
+}
+
+void Hexa::MaterializeShown(HexEditor *editor)
+{
+	if (editor->unready_ranges.empty() || editor->unready_ranges == editor->unready_pending)
+	{
+		return;
+	}
+
+	FileBuffer *buffer = editor->data;
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const vector< pair<int64_t, int64_t> > ranges = editor->unready_ranges;
+	editor->unready_pending = ranges;
+
+	const uint64_t buffer_id = buffer->Id();
+	worker.Post([snapshot, ranges]()
+	{
+		for (const auto &range : ranges)
+		{
+			snapshot.ForEachSpan(range.first, range.second - range.first,
+			    [](uint64_t, const uint8_t*, uint64_t) { return true; });
+		}
+	},
+	[this, buffer_id, ranges]()
+	{
+		// Rendering after this shows the bytes.
+		ForEachEditorOf(buffer_id, [&ranges](HexEditor &e)
+		{
+			if (e.unready_pending == ranges)
+			{
+				e.unready_pending.clear();
+			}
+		});
+	});
+}
+
+void Hexa::IndexEntropy(HexEditor *editor)
+{
+	if (!editor->EntropyIndexWanted())
+	{
+		return;
+	}
+
+	shared_ptr<ByteSource> source = editor->data->Source();
+	if (!entropy_pending.insert(source.get()).second)
+	{
+		return;
+	}
+
+	auto index = make_shared<EntropyIndex>(source->Size());
+	const size_t block_count = index->BlockCount();
+
+	// A few slices per thread, so threads finishing early take more.
+	const size_t slice_count = max<size_t>(1, min<size_t>(block_count, worker.ThreadCount() * 4));
+	const size_t slice_blocks = (block_count + slice_count - 1) / slice_count;
+
+	// Slices write disjoint blocks. Done callbacks run on the main thread,
+	// the last one has the running sums computed, then publishes the index.
+	auto remaining = make_shared<size_t>(slice_count);
+	auto cancelled = make_shared< atomic<bool> >(false);
+
+	for (size_t slice = 0; slice < slice_count; ++slice)
+	{
+		const size_t first = slice * slice_blocks;
+		const size_t last = min(block_count, first + slice_blocks);
+
+		worker.Post([this, source, index, first, last, cancelled]()
+		{
+			if (!index->Compute(*source, first, last, [this]() { return worker.ShuttingDown(); }))
+			{
+				*cancelled = true;
+			}
+		},
+		[this, source, index, remaining, cancelled]()
+		{
+			if (--*remaining > 0)
+			{
+				return;
+			}
+
+			if (*cancelled)
+			{
+				entropy_pending.erase(source.get());
+				return;
+			}
+			worker.Post([index]() { index->SumUp(); },
+			[this, source, index]()
+			{
+				entropy_pending.erase(source.get());
+				source->SetEntropy(index);
+			});
+		});
+	}
+}
+
+void Hexa::JumpToNextEntropyChange(HexEditor *editor)
+{
+	FileBuffer *buffer = editor->data;
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const uint64_t version = buffer->Version();
+	const int64_t from = editor->cursor_pos;
+	const uint64_t buffer_id = buffer->Id();
+	auto found = make_shared<int64_t>(-1);
+
+	worker.Post([this, snapshot, from, found]()
+	{
+		*found = HexEditor::FindEntropyChange(snapshot, from, [this]() { return worker.ShuttingDown(); });
+	},
+	[this, buffer_id, version, from, found]()
+	{
+		// Moved only if nothing else moved the cursor meanwhile.
+		HexEditor *editor = GetCurrentEditor();
+		if (editor->data->Id() != buffer_id || editor->data->Version() != version
+		    || editor->cursor_pos != from)
+		{
+			return;
+		}
+		if (*found < 0)
+		{
+			SetStatus(StatusType::ERROR, "No entropy change after cursor");
+			return;
+		}
+		editor->cursor_pos = *found;
+	});
+}
+
+void Hexa::ComputeDiff(shared_ptr<BufferDiff> diff)
+{
+	const BufferSnapshot &a = diff->A();
+	const BufferSnapshot &b = diff->B();
+	auto cancelled = [this, diff]() { return diff->Cancelled() || worker.ShuttingDown(); };
+
+	auto finish = [this, diff]()
+	{
+		if (diff->Cancelled())
+		{
+			return;
+		}
+		diff->Finish();
+		SetStatus(StatusType::NORMAL, to_string(diff->Hunks().size()) + " changes, "
+		          "]c and [c to move between them, Escape to close the diff");
+	};
+
+	if (a.Size() != b.Size())
+	{
+		// Bytes are inserted or deleted. Anchors are matched window by
+		// window, so they take bounded memory and hunks are added as the
+		// alignment goes on.
+		AlignDiffWindow(diff, 0, 0, BufferDiff::kAnchorWindow, finish);
+		return;
+	}
+
+	// Same size, like a patched firmware, bytes are compared in place. A
+	// few slices per thread, so threads finishing early take more. Hunks of
+	// each slice are added as soon as it is done.
+	const uint64_t kMinSliceLength = 4 << 20;
+	const uint64_t length = a.Size();
+	const uint64_t slice_count = max<uint64_t>(1, min<uint64_t>((length + kMinSliceLength - 1) / kMinSliceLength,
+	                                                            worker.ThreadCount() * 4));
+	const uint64_t slice_length = (length + slice_count - 1) / slice_count;
+	auto remaining = make_shared<uint64_t>(slice_count);
+
+	for (uint64_t slice = 0; slice < slice_count; ++slice)
+	{
+		const uint64_t begin = slice * slice_length;
+		const uint64_t end = min(length, begin + slice_length);
+		auto hunks = make_shared< vector<BufferDiff::Hunk> >();
+
+		worker.Post([diff, cancelled, begin, end, hunks]()
+		{
+			*hunks = BufferDiff::CompareInPlace(diff->A(), diff->B(), begin, end, cancelled);
+		},
+		[diff, begin, end, hunks, remaining, finish]()
+		{
+			diff->AddHunks(*hunks, end - begin);
+			if (--*remaining == 0)
+			{
+				finish();
+			}
+		});
+	}
+}
+
+void Hexa::AlignDiffWindow(shared_ptr<BufferDiff> diff, uint64_t a_pos, uint64_t b_pos, uint64_t window,
+                           function<void()> finish)
+{
+	const uint64_t a_end = min(diff->A().Size(), a_pos + window);
+	const uint64_t b_end = min(diff->B().Size(), b_pos + window);
+	const bool last = (a_end == diff->A().Size() && b_end == diff->B().Size());
+	const int anchor_bits = BufferDiff::AnchorBits(window);
+	auto cancelled = [this, diff]() { return diff->Cancelled() || worker.ShuttingDown(); };
+
+	// A few slices per thread, so threads finishing early take more.
+	const uint64_t kMinSliceLength = 4 << 20;
+	const uint64_t length = max(a_end - a_pos, b_end - b_pos);
+	const uint64_t slice_count = max<uint64_t>(1, min<uint64_t>((length + kMinSliceLength - 1) / kMinSliceLength,
+	                                                            worker.ThreadCount() * 4));
+	const uint64_t slice_length = (length + slice_count - 1) / slice_count;
+	auto remaining = make_shared<uint64_t>(2 * slice_count);
+
+	auto a_anchors = make_shared< vector< vector<BufferDiff::Anchor> > >(slice_count);
+	auto b_anchors = make_shared< vector< vector<BufferDiff::Anchor> > >(slice_count);
+
+	// Once anchors of both are found, they are matched and the ranges
+	// between matching ones aligned.
+	auto align = [this, diff, cancelled, a_pos, b_pos, window, last, a_anchors, b_anchors, finish]()
+	{
+		auto hunks = make_shared< vector<BufferDiff::Hunk> >();
+		auto aligned = make_shared< pair<uint64_t, uint64_t> >(a_pos, b_pos);
+
+		worker.Post([diff, cancelled, a_pos, b_pos, window, last, a_anchors, b_anchors, hunks, aligned]()
+		{
+			auto concat = [](vector< vector<BufferDiff::Anchor> > &slices)
+			{
+				vector<BufferDiff::Anchor> all;
+				for (auto &slice : slices)
+				{
+					all.insert(all.end(), slice.begin(), slice.end());
+					vector<BufferDiff::Anchor>().swap(slice);
+				}
+				return all;
+			};
+			auto pairs = BufferDiff::MatchAnchors(concat(*a_anchors), concat(*b_anchors));
+
+			if (last)
+			{
+				pairs.emplace_back(diff->A().Size(), diff->B().Size());
+			}
+			else if (!pairs.empty())
+			{
+				// Anchors unique in the window might not be in the rest of the
+				// buffers, pairs past its middle are left to the next one.
+				auto past = find_if(pairs.begin() + 1, pairs.end(), [&](const pair<uint64_t, uint64_t> &p)
+				{
+					return p.first - a_pos > window / 2 || p.second - b_pos > window / 2;
+				});
+				pairs.erase(past, pairs.end());
+			}
+
+			for (const auto &pair : pairs)
+			{
+				if (cancelled())
+				{
+					return;
+				}
+				BufferDiff::AlignBetween(diff->A(), diff->B(), aligned->first, pair.first,
+				                         aligned->second, pair.second, *hunks);
+				*aligned = pair;
+			}
+		},
+		[this, diff, a_pos, b_pos, window, last, hunks, aligned, finish]()
+		{
+			if (diff->Cancelled())
+			{
+				return;
+			}
+
+			// Nothing matched, the bytes inserted or deleted here might be
+			// more than the window.
+			if (!last && *aligned == make_pair(a_pos, b_pos))
+			{
+				AlignDiffWindow(diff, a_pos, b_pos, 2 * window, finish);
+				return;
+			}
+
+			diff->AddHunks(*hunks, aligned->first - a_pos);
+			if (last)
+			{
+				finish();
+				return;
+			}
+			AlignDiffWindow(diff, aligned->first, aligned->second, BufferDiff::kAnchorWindow, finish);
+		});
+	};
+
+	for (uint64_t slice = 0; slice < slice_count; ++slice)
+	{
+		for (int side = 0; side < 2; ++side)
+		{
+			const uint64_t begin = (side == 0 ? a_pos : b_pos) + slice * slice_length;
+			const uint64_t end = min(side == 0 ? a_end : b_end, begin + slice_length);
+			auto anchors = (side == 0 ? a_anchors : b_anchors);
+
+			worker.Post([diff, cancelled, side, slice, begin, end, anchor_bits, anchors]()
+			{
+				if (begin < end)
+				{
+					(*anchors)[slice] = BufferDiff::FindAnchors(side == 0 ? diff->A() : diff->B(),
+					                                            begin, end, anchor_bits, cancelled);
+				}
+			},
+			[remaining, align]()
+			{
+				if (--*remaining == 0)
+				{
+					align();
+				}
+			});
+		}
+	}
+}
+
+bool Hexa::IsFollowed(const FileBuffer *buffer) const
+{
+	for (const TabInfo &ti : tabs)
+	{
+		if (ti.editor.data == buffer && ti.editor.following)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void Hexa::BufferGrown(FileBuffer *buffer, uint64_t old_size)
+{
+	for (TabInfo &ti : tabs)
+	{
+		HexEditor &editor = ti.editor;
+		if (editor.data == buffer && old_size > 0 && editor.cursor_pos == (int64_t)old_size - 1)
+		{
+			editor.JumpToFileEnd();
+		}
+	}
+}
+
+void Hexa::BufferShrunk(FileBuffer *buffer)
+{
+	for (TabInfo &ti : tabs)
+	{
+		HexEditor &editor = ti.editor;
+		if (editor.data == buffer && editor.cursor_pos >= (int64_t)buffer->Size())
+		{
+			editor.JumpToFileEnd();
+		}
+	}
+}
+
+void Hexa::ProcessTruncatedFiles()
+{
+	uint64_t counter;
+	read(MappedFileSource::TruncationFd(), &counter, sizeof(counter));
+
+	for (const auto &fc : file_contents)
+	{
+		shared_ptr<MappedFileSource> source = fc.second->MappedSource();
+		if (source && source->Truncated())
+		{
+			RemapIfShrunk(fc.first);
+		}
+	}
+}
+
+void Hexa::RemapIfShrunk(const string &file_name)
+{
+	FileBuffer *buffer = file_contents[file_name].get();
+	shared_ptr<MappedFileSource> source = buffer->MappedSource();
+	if (!source || !source->Shrank())
+	{
+		return;
+	}
+
+	auto new_source = make_shared<MappedFileSource>(file_name);
+	if (!new_source->Data())
+	{
+		return;
+	}
+
+	// Without the block index of the new mapping, every byte is taken
+	// from it. Edits are kept.
+	buffer->Reload(new_source);
+	changed_on_disk.erase(buffer);
+	BufferShrunk(buffer);
+	IndexBlocks(new_source);
+
+	SetStatus(StatusType::NORMAL, "\"" + file_name + "\" shrank to "
+	    + to_string(new_source->Size()) + " bytes on disk, reloaded");
+}
+
+bool Hexa::ForEachEditorOf(uint64_t buffer_id, const function<void(HexEditor&)> &fn)
+{
+	bool found = false;
+	for (TabInfo &ti : tabs)
+	{
+		if (ti.editor.data->Id() == buffer_id)
+		{
+			fn(ti.editor);
+			found = true;
+		}
+	}
+	return found;
+}
+
+const string& Hexa::BufferFileName(const FileBuffer *buffer) const
+{
+	for (const auto &fc : file_contents)
+	{
+		if (fc.second.get() == buffer)
+		{
+			return fc.first;
+		}
+	}
+	throw out_of_range("Unknown buffer");
 }
 
 void Hexa::InputKey(Key k)
@@ -149,6 +872,29 @@ void Hexa::InputKey(Key k)
 		return;
 	}
 
+	if (entering_command && command_prompt == '/')
+	{
+		if (k == Key::ENTER)
+		{
+			CloseSearchPrompt(true);
+		}
+		else if (k == Key::ESCAPE || (k == Key::BACKSPACE && command_buffer.empty()))
+		{
+			CloseSearchPrompt(false);
+		}
+		else if (k == Key::BACKSPACE)
+		{
+			command_buffer.pop_back();
+			RefineTypedSearch();
+		}
+		else if (k > 0 && k < 256 && isprint(k))
+		{
+			command_buffer.push_back((char) k);
+			RefineTypedSearch();
+		}
+		return;
+	}
+
 	if (entering_command)
 	{
 		if (k == Key::ENTER)
@@ -252,6 +998,7 @@ void Hexa::InputKey(Key k)
 		else if (k == Key::COLON)
 		{
 			entering_command = true;
+			command_prompt = ':';
 			history_index = command_history.commands.size();
 			SetStatus(StatusType::NONE);
 		}
@@ -263,9 +1010,20 @@ void Hexa::InputKey(Key k)
 	{
 		case Key::COLON:
 			entering_command = true;
+			command_prompt = ':';
 			history_index = command_history.commands.size();
 			SetStatus(StatusType::NONE);
 			break;
+		case Key::SLASH:
+			entering_command = true;
+			command_prompt = '/';
+			typed_searches.clear();
+			typed_searches_version = GetCurrentEditor()->data->Version();
+			typed_search_buffer_id = GetCurrentEditor()->data->Id();
+			typed_search_origin = GetCurrentEditor()->cursor_pos;
+			typed_search_pending = false;
+			SetStatus(StatusType::NONE);
+			break;
 		case Key::LOWERCASE_I:
 			SwitchToInsertMode();
 			break;
@@ -285,6 +1043,54 @@ void Hexa::InputKey(Key k)
 		case Key::UPPERCASE_G:
 			GetCurrentEditor()->JumpToFileEnd();
 			break;
+		case Key::LOWERCASE_N:
+			if (!GetCurrentEditor()->search)
+			{
+				SetStatus(StatusType::ERROR, "Nothing searched for");
+			}
+			else if (!GetCurrentEditor()->JumpToNextMatch())
+			{
+				SetStatus(StatusType::ERROR, "No match after cursor");
+			}
+			break;
+		case Key::UPPERCASE_N:
+			if (!GetCurrentEditor()->search)
+			{
+				SetStatus(StatusType::ERROR, "Nothing searched for");
+			}
+			else if (!GetCurrentEditor()->JumpToPrevMatch())
+			{
+				SetStatus(StatusType::ERROR, "No match before cursor");
+			}
+			break;
+		case Key::LEFT_BRACKET:
+		case Key::RIGHT_BRACKET:
+			command_key = k;
+			input_key_handler = &Hexa::InputKeyBracket;
+			break;
+		case Key::ESCAPE:
+			// Closes the statistics pane, then the strings, then search
+			// highlights, then the diff.
+			if (GetCurrentEditor()->stats)
+			{
+				GetCurrentEditor()->stats.reset();
+			}
+			else if (GetCurrentEditor()->strings)
+			{
+				GetCurrentEditor()->strings->cancelled = true;
+				GetCurrentEditor()->strings.reset();
+			}
+			else if (GetCurrentEditor()->search)
+			{
+				GetCurrentEditor()->search->cancelled = true;
+				GetCurrentEditor()->search.reset();
+			}
+			else if (GetCurrentEditor()->diff)
+			{
+				GetCurrentEditor()->diff->Cancel();
+				GetCurrentEditor()->diff.reset();
+			}
+			break;
 		default:
 			;
 	}
@@ -298,6 +1104,17 @@ void Hexa::InputKeyGoto(Key cmdKey, Key k)
 			GetCurrentEditor()->JumpToFileStart();
 			input_key_handler = nullptr;
 			return;
+		case Key::LOWERCASE_D:
+			if (!GetCurrentEditor()->JumpToNextDataExtent())
+			{
+				SetStatus(StatusType::ERROR, "No data after cursor");
+			}
+			input_key_handler = nullptr;
+			return;
+		case Key::LOWERCASE_M:
+			JumpToNextEntropyChange(GetCurrentEditor());
+			input_key_handler = nullptr;
+			return;
 		case Key::LOWERCASE_T:
 			++current_tab;
 			if (current_tab >= (int)tabs.size())
@@ -318,38 +1135,259 @@ void Hexa::InputKeyGoto(Key cmdKey, Key k)
 	input_key_handler = nullptr;
 }
 
-void Hexa::SetStatus(StatusType status_type, const string &status_text)
+void Hexa::InputKeyBracket(Key cmdKey, Key k)
 {
-	this->status_type = status_type;
-	this->status_text = status_text;
+	input_key_handler = nullptr;
+	HexEditor *editor = GetCurrentEditor();
+
+	if (k == Key::LOWERCASE_S)
+	{
+		if (!editor->strings)
+		{
+			SetStatus(StatusType::ERROR, "No strings listed, see :strings");
+		}
+		else if (cmdKey == Key::RIGHT_BRACKET && !editor->JumpToNextString())
+		{
+			SetStatus(StatusType::ERROR, "No string after cursor");
+		}
+		else if (cmdKey == Key::LEFT_BRACKET && !editor->JumpToPrevString())
+		{
+			SetStatus(StatusType::ERROR, "No string before cursor");
+		}
+		return;
+	}
+
+	if (k == Key::LOWERCASE_F || k == Key::LOWERCASE_E)
+	{
+		const bool field = (k == Key::LOWERCASE_F);
+		const char *what = (field ? "field" : "element");
+		if (!editor->structure_template)
+		{
+			SetStatus(StatusType::ERROR, "No template applied, see :template");
+		}
+		else if (cmdKey == Key::RIGHT_BRACKET && !(field ? editor->JumpToNextField() : editor->JumpToNextElement()))
+		{
+			SetStatus(StatusType::ERROR, string("No ") + what + " after cursor");
+		}
+		else if (cmdKey == Key::LEFT_BRACKET && !(field ? editor->JumpToPrevField() : editor->JumpToPrevElement()))
+		{
+			SetStatus(StatusType::ERROR, string("No ") + what + " before cursor");
+		}
+		return;
+	}
+
+	if (k != Key::LOWERCASE_C)
+	{
+		return;
+	}
+
+	if (!editor->diff)
+	{
+		SetStatus(StatusType::ERROR, "Not comparing with another tab, see :diff");
+		return;
+	}
+
+	if (cmdKey == Key::RIGHT_BRACKET && !editor->JumpToNextChange())
+	{
+		SetStatus(StatusType::ERROR, "No change after cursor");
+	}
+	else if (cmdKey == Key::LEFT_BRACKET && !editor->JumpToPrevChange())
+	{
+		SetStatus(StatusType::ERROR, "No change before cursor");
+	}
 }
 
-void Hexa::ProcessCommand(const string &cmd)
+void Hexa::RefineTypedSearch()
 {
-	// Check if string is numeric, :123 should move cursor to 123rd byte.
-	if (strspn(cmd.c_str(), "0123456789") == cmd.size())
+	typed_search_text = command_buffer;
+	if (typed_search_running)
 	{
-		int new_pos;
-		try
+		// Running one is of no use anymore, the newest text is searched
+		// once it stops.
+		if (GetCurrentEditor()->search)
 		{
-			new_pos = stoi(cmd);
+			GetCurrentEditor()->search->cancelled = true;
 		}
-		catch (out_of_range ex)
+		typed_search_pending = true;
+		return;
+	}
+	StartTypedSearch(typed_search_text);
+}
+
+void Hexa::StartTypedSearch(const string &text)
+{
+	HexEditor *editor = GetCurrentEditor();
+	FileBuffer *buffer = editor->data;
+
+	// Another tab is shown than the one '/' was pressed in.
+	if (buffer->Id() != typed_search_buffer_id)
+	{
+		return;
+	}
+
+	if (text.empty())
+	{
+		editor->search.reset();
+		editor->cursor_pos = typed_search_origin;
+		return;
+	}
+
+	shared_ptr<const LiteralSearch> search;
+	try
+	{
+		search = make_shared<const LiteralSearch>(text);
+	}
+	catch (invalid_argument &e)
+	{
+		// Likely an escape not typed fully yet, earlier matches are kept.
+		return;
+	}
+
+	if (buffer->Version() != typed_searches_version)
+	{
+		typed_searches.clear();
+		typed_searches_version = buffer->Version();
+	}
+
+	auto typed = typed_searches.find(text);
+	if (typed != typed_searches.end())
+	{
+		editor->search = typed->second;
+		editor->JumpToMatchFrom(typed_search_origin);
+		return;
+	}
+
+	// Longest text searched which this one extends, this one can only be
+	// where that one is.
+	shared_ptr<const HexEditor::SearchResults> base;
+	size_t base_length = 0;
+	for (const auto &earlier : typed_searches)
+	{
+		const string &earlier_text = earlier.first;
+		if (earlier_text.size() > base_length && !earlier.second->truncated
+		    && text.compare(0, earlier_text.size(), earlier_text) == 0)
 		{
-			new_pos = -1;
+			base = earlier.second;
+			base_length = earlier_text.size();
 		}
+	}
+
+	typed_search_running = true;
+	const uint64_t version = buffer->Version();
+	const uint64_t buffer_id = buffer->Id();
+	auto finished = [this, text, buffer_id, version](shared_ptr<HexEditor::SearchResults> results)
+	{
+		typed_search_running = false;
 
-		if (new_pos < 0 || new_pos >= (int)GetCurrentEditor()->data->size())
+		// Tabs or contents might have changed while it ran.
+		const FileBuffer *shown_buffer = GetCurrentEditor()->data;
+		const bool shown = (buffer_id == typed_search_buffer_id && shown_buffer->Id() == buffer_id);
+		if (!results->cancelled && shown && shown_buffer->Version() == version
+		    && entering_command && command_prompt == '/')
 		{
-			SetStatus(StatusType::ERROR, "Position out of file boundary: " + cmd);
+			typed_searches[text] = results;
+			GetCurrentEditor()->JumpToMatchFrom(typed_search_origin);
 		}
-		else
+		if (typed_search_pending)
 		{
-			GetCurrentEditor()->cursor_pos = new_pos;
+			typed_search_pending = false;
+			if (shown)
+			{
+				StartTypedSearch(typed_search_text);
+			}
 		}
+	};
+
+	if (!base)
+	{
+		FindInBackground(search, search->Length(), "", finished);
 		return;
 	}
 
+	if (editor->search)
+	{
+		editor->search->cancelled = true;
+	}
+	auto results = make_shared<HexEditor::SearchResults>();
+	results->description = search->Description();
+	results->length = search->Length();
+	results->total = buffer->Size();
+	editor->search = results;
+
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	auto found = make_shared< vector<uint64_t> >();
+	worker.Post([this, snapshot, search, base, results, found]()
+	{
+		*found = search->FindAt(snapshot, base->starts,
+		    [this, &results]() { return results->cancelled || worker.ShuttingDown(); });
+	},
+	[this, results, found, finished]()
+	{
+		if (!results->cancelled)
+		{
+			results->Add(*found);
+			results->scanned = results->total;
+			ShowSearchStatus(*results, "");
+		}
+		finished(results);
+	});
+}
+
+void Hexa::CloseSearchPrompt(bool accept)
+{
+	entering_command = false;
+	command_prompt = ':';
+	command_buffer.clear();
+	typed_searches.clear();
+
+	HexEditor *editor = GetCurrentEditor();
+	if (!accept)
+	{
+		typed_search_buffer_id = 0;
+		typed_search_pending = false;
+		if (editor->search)
+		{
+			editor->search->cancelled = true;
+			editor->search.reset();
+		}
+		editor->cursor_pos = typed_search_origin;
+		SetStatus(StatusType::NONE);
+		return;
+	}
+
+	// Pending text is still searched, matches show up when it is done.
+	if (!typed_search_running && editor->search)
+	{
+		ShowSearchStatus(*editor->search, "");
+	}
+}
+
+void Hexa::InputClick(int row, int column)
+{
+	if (input_key_handler || entering_command)
+	{
+		return;
+	}
+
+	if (!GetCurrentEditor()->MinimapClick(row, column))
+	{
+		GetCurrentEditor()->StructureClick(row, column);
+	}
+}
+
+bool Hexa::WantsMouse()
+{
+	return GetCurrentEditor()->minimap_shown || GetCurrentEditor()->structure_shown;
+}
+
+void Hexa::SetStatus(StatusType status_type, const string &status_text)
+{
+	this->status_type = status_type;
+	this->status_text = status_text;
+}
+
+void Hexa::ProcessCommand(const string &cmd)
+{
 	try
 	{
 		script_engine.ExecLine(cmd);
@@ -385,6 +1423,12 @@ void Hexa::RenderTo(Painter &p)
 	RenderStatusLine(status_line_painter);
 	RenderTabsList(tabs_list_painter);
 	GetCurrentEditor()->RenderTo(p);
+	MaterializeShown(GetCurrentEditor());
+
+	// Column count is known after rendering.
+	IndexRowRuns(GetCurrentEditor());
+	IndexEntropy(GetCurrentEditor());
+	IndexStructure(GetCurrentEditor());
 }
 
 void SetStatusTypeColorsFor(Painter &p, Hexa::StatusType status_type)
@@ -447,7 +1491,7 @@ void Hexa::RenderStatusLine(Painter &p)
 	if (entering_command)
 	{
 		p.MoveTo(0, 0);
-		p.Printf(":%s", command_buffer.c_str());
+		p.Printf("%c%s", command_prompt, command_buffer.c_str());
 	}
 	else
 	{
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 #include <utility>
@@ -28,11 +30,18 @@
 
 #include "CommandLineFlags.hpp"
 
+#include "ByteRegex.hpp"
+#include "Checksum.hpp"
 #include "CommandHistory.hpp"
+#include "FileBuffer.hpp"
+#include "FileWatcher.hpp"
 #include "HexEditor.hpp"
+#include "LiteralSearch.hpp"
+#include "NgramIndex.hpp"
 #include "Painter.hpp"
 #include "StyleSheet.hpp"
 #include "TermInput.hpp"
+#include "Worker.hpp"
 
 #include "HexaScript/HexaScript.hpp"
 
@@ -40,12 +49,43 @@ class Hexa
 {
 public:
 	Hexa(const gengetopt_args_info &args);
+	~Hexa();
 	Hexa(const Hexa &ot) = delete;
 	Hexa& operator=(const Hexa &ot) = delete;
 
+	// File name "-" opens the standard input.
 	void AddNewTab(const std::string &file_name);
+
+	// Where indexes of opened files are cached: block fingerprints, seek
+	// indexes of compressed files and search indexes. See IndexCache.
+	void SetIndexDir(const std::string &dir)
+	{
+		index_dir = dir;
+	}
 	void RenderTo(Painter &p);
 
+	// Main loop polls this fd, and calls `ProcessBackgroundEvents` when it
+	// is readable.
+	int BackgroundEventFd() const
+	{
+		return worker.NotifyFd();
+	}
+	void ProcessBackgroundEvents();
+
+	// Same as above, for modifications to the opened files.
+	int FileWatcherFd() const
+	{
+		return file_watcher.Fd();
+	}
+	void ProcessFileEvents();
+
+	// Same as above, for pages of truncated files read as zeros.
+	int TruncationFd() const
+	{
+		return MappedFileSource::TruncationFd();
+	}
+	void ProcessTruncatedFiles();
+
 	bool QuitRequested() const
 	{
 		return quit_requested;
@@ -54,6 +94,13 @@ public:
 	// Key handlers, for commands requiring multiple key presses, like `gg`
 	void InputKey(Key k);
 	void InputKeyGoto(Key cmdKey, Key k);
+	void InputKeyBracket(Key cmdKey, Key k);
+
+	// Mouse click at zero based screen position.
+	void InputClick(int row, int column);
+
+	// Whether clicks should be reported as MOUSE_LEFT_CLICK keys.
+	bool WantsMouse();
 
 	enum class EditorMode
 	{
@@ -95,22 +142,117 @@ private:
 	// Loads file and executes commands from it
 	void LoadScriptFile(const std::string &file_name);
 
+	// Called on main thread after a streamed file received more bytes.
+	void StreamGrown(const std::string &file_name);
+
+	// Keeps cursors which were on the last byte pinned to the end.
+	void BufferGrown(FileBuffer *buffer, uint64_t old_size);
+
+	// Moves cursors past the end of the buffer to its end.
+	void BufferShrunk(FileBuffer *buffer);
+
+	// Maps the file again if another process truncated it, as its pages
+	// past the new end would read as zeros. Checked on file events, and
+	// once such pages are read.
+	void RemapIfShrunk(const std::string &file_name);
+
+	// Key of the buffer in `file_contents`.
+	const std::string& BufferFileName(const FileBuffer *buffer) const;
+
+	// Calls `fn` for the editors showing the buffer with `buffer_id`, and
+	// returns whether there were any. For callbacks of background jobs, as
+	// editors might have moved since they were posted, and buffers be gone.
+	bool ForEachEditorOf(uint64_t buffer_id, const std::function<void(HexEditor&)> &fn);
+
+	// Watches a mapped file for changes, and indexes its blocks to reload
+	// it later.
+	void WatchFile(const std::string &file_name);
+
+	// Loads the block index of a mapped file from the index directory, or
+	// computes and saves it, in background. Then calls `done`. The search
+	// index is loaded too if one was saved by :index, it is not computed.
+	void IndexBlocks(std::shared_ptr<MappedFileSource> source, std::function<void()> done = nullptr);
+
+	// Whether any editor of the buffer is in follow mode.
+	bool IsFollowed(const FileBuffer *buffer) const;
+
+	// Builds the index of repeated rows the editor folds, in background.
+	void IndexRowRuns(HexEditor *editor);
+
+	// Produces bytes the editor showed placeholders for in background, like
+	// decompressing them, so rendering does not wait for it.
+	void MaterializeShown(HexEditor *editor);
+
+	// Computes entropy of the buffer's source for the minimap, split in
+	// slices over the worker threads.
+	void IndexEntropy(HexEditor *editor);
+
+	// Moves the cursor of the editor to the next region whose entropy is in
+	// another class, looked for in background.
+	void JumpToNextEntropyChange(HexEditor *editor);
+
+	// Walks open-ended arrays of the template applied to the editor on a
+	// tree of its own in background, then gives the walk to the editor's.
+	void IndexStructure(HexEditor *editor);
+
+	// Compares the buffers of the diff in background, adding hunks to it as
+	// they are found.
+	void ComputeDiff(std::shared_ptr<BufferDiff> diff);
+
+	// Aligns the buffers of a diff from `a_pos` and `b_pos` on, matching
+	// anchors in the next `window` bytes of both, then goes on with the
+	// next window. Calls `finish` once both ends are reached.
+	void AlignDiffWindow(std::shared_ptr<BufferDiff> diff, uint64_t a_pos, uint64_t b_pos, uint64_t window,
+	                     std::function<void()> finish);
+
 private:
 	// Functions registered to `HexaScript` engine
 	// They are prefixed with `sc_` for no reason.
+	void sc_Diff(int tab_no);
 	void sc_Exec(string file_name);
-	void sc_MarkAbsoluteRange(string range, string comment);
+	void sc_Find(string text);
+	void sc_FindValue(string type, string value, string flags);
+	void sc_Follow();
+	void sc_Goto(string number);
+	void sc_Hash(string algorithm);
+	void sc_Index();
+	void sc_MarkAbsoluteRange(string_view range, const string &comment);
+	void sc_MarkRange(int64_t offset, int64_t length, const string &comment);
 	void sc_MarkSelection(string comment);
+	void sc_Minimap();
+	void sc_Regex(string pattern);
+	void sc_Reload();
 	void sc_Replace(string type, string value);
+	void sc_Stats();
+	void sc_Substitute(string expression);
+	void sc_Strings(int min_length);
 	void sc_SwitchToTab(int tab_no);
+	void sc_Template(string name);
+	void sc_Tree();
 	void sc_Quit();
 
-	// Functions to use when marking some file types.
-	void MarkFileType_Tar();
+	// Runs a search like ValueSearch or LiteralSearch over the current
+	// buffer in background, its matches are shown like :findval's. `note`
+	// is added to the final status. `done` is called with the results once
+	// all slices are finished, or cancelled, which might be before this
+	// returns.
+	template <typename Search>
+	std::shared_ptr<HexEditor::SearchResults> FindInBackground(std::shared_ptr<const Search> search,
+	                                                           int64_t match_length,
+	                                                           const std::string &note,
+	                                                           std::function<void(std::shared_ptr<HexEditor::SearchResults>)> done);
+
+	// Searches the text of the '/' prompt after it changed.
+	void RefineTypedSearch();
+	void StartTypedSearch(const std::string &text);
+	// Keeps the results and the cursor if `accept`, otherwise goes back.
+	void CloseSearchPrompt(bool accept);
+
+	// Like "3 matches for ...", or an error if there are none.
+	void ShowSearchStatus(const HexEditor::SearchResults &results, const std::string &note);
 
 private:
-	// TODO make FileBuffer class.
-	std::map< std::string, std::vector<uint8_t> > file_contents;
+	std::map< std::string, std::unique_ptr<FileBuffer> > file_contents;
 
 	struct TabInfo
 	{
@@ -119,7 +261,58 @@ private:
 	};
 	std::vector< TabInfo > tabs;
 
+	// Buffers already reported as changed on disk, until they are reloaded.
+	std::set<const FileBuffer*> changed_on_disk;
+
+	std::string index_dir;
+
+	// Sources whose entropy index is being computed.
+	std::set<const ByteSource*> entropy_pending;
+
+	// Last checksum computed, by chunks, so hashing the range again after
+	// a few edits only reads the chunks containing them.
+	struct ChecksumCache
+	{
+		uint64_t buffer_id;
+		Checksum::Type type;
+		int64_t begin;
+		int64_t end;
+		BufferSnapshot snapshot;
+		std::vector<uint32_t> chunk_values;
+	};
+	std::shared_ptr<const ChecksumCache> checksum_cache;
+
+	// Scripts loaded by :exec or for file types, compiled the first time
+	// they are loaded, and again when the file changed since.
+	struct CompiledScript
+	{
+		off_t size = 0;
+		timespec mtime;
+		std::shared_ptr<const HexaScript::Program> program;
+	};
+	std::map<std::string, CompiledScript> compiled_scripts;
+
+	// Contents of the current tab, read by expressions of scripts.
+	class ScriptBuffer : public HexaScript::Buffer
+	{
+	public:
+		explicit ScriptBuffer(Hexa *hexa)
+		  : hexa(hexa)
+		{
+		}
+
+		uint64_t Size() const override;
+		uint64_t Read(uint64_t pos, void *out, uint64_t length) const override;
+		uint64_t Cursor() const override;
+
+	private:
+		Hexa *hexa;
+	};
+	ScriptBuffer script_buffer{this};
+
 private:
+	Worker worker;
+	FileWatcher file_watcher;
 	HexaScript script_engine;
 	CommandHistory command_history;
 
@@ -142,6 +335,26 @@ private:
 	size_t history_index = -1;
 	// Command that is being entered
 	string command_buffer;
+	// ':' for commands, '/' for a search refined as it is typed.
+	char command_prompt = ':';
+
+	// Results of the texts searched since '/' was pressed, so typing more
+	// only checks the earlier matches, and deleting goes back to them.
+	// Only for `typed_search_buffer_id` at `typed_searches_version`, cleared
+	// when it changes.
+	map<string, shared_ptr<HexEditor::SearchResults>> typed_searches;
+	uint64_t typed_searches_version = 0;
+	// Id of the buffer of the editor '/' was pressed in, 0 for none, and the
+	// cursor then. Matches
+	// are looked for from there. Searches finishing after the buffer shown
+	// changed are dropped.
+	uint64_t typed_search_buffer_id = 0;
+	int64_t typed_search_origin = 0;
+	// One search runs at a time, the text typed meanwhile is searched
+	// when it stops.
+	string typed_search_text;
+	bool typed_search_running = false;
+	bool typed_search_pending = false;
 
 	int current_tab = 0;
 
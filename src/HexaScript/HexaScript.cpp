@@ -15,6 +15,14 @@
 // You should have received a copy of the GNU General Public License
 // along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
 #include "HexaScript.hpp"
 
 using namespace std;
@@ -88,8 +96,10 @@ static string::const_iterator ExtractQuotedString(string::const_iterator it, std
 
 static string::const_iterator ExtractUnquotedString(string::const_iterator it, std::string &arg)
 {
-	// Allowed characters are [a-zA-Z0-9_\-=:]
-	if (!(isalnum(*it) || *it == '_' || *it == '-' || *it == '=' || *it == ':'))
+	// Allowed characters are [a-zA-Z0-9_\-=:.+], and `,` and `~` after the
+	// first one, so numbers like 1.5e-3 and lists like le,aligned need no
+	// quotes.
+	if (!(isalnum(*it) || *it == '_' || *it == '-' || *it == '=' || *it == ':' || *it == '.' || *it == '+'))
 	{
 		// Unexpected token.
 		throw it;
@@ -97,7 +107,8 @@ static string::const_iterator ExtractUnquotedString(string::const_iterator it, s
 	arg.push_back(*(it++));
 
 	// TODO, should anything be accepted here?
-	while (isalnum(*it) || *it == '_' || *it == '-' || *it == '=' || *it == ':' || *it == '"' || *it == '\\')
+	while (isalnum(*it) || *it == '_' || *it == '-' || *it == '=' || *it == ':' || *it == '"' || *it == '\\'
+	       || *it == '.' || *it == '+' || *it == ',' || *it == '~')
 		arg.push_back(*(it++));
 
 	return it;
@@ -117,11 +128,26 @@ static string::const_iterator ExtractArg(string::const_iterator it, std::string
 // commands for settings variables.
 HexaScript::HexaScript()
 {
-	RegisterFunction<string>("set", [this](string s) { this->Set(s); });
+	FunctionDef set;
+	set.num_args = 1;
+	set.bind = [this](const string_view *args) { return this->CompileSet(string(args[0])); };
+	set.call = [this](const string_view *args) { this->CompileSet(string(args[0]))(); };
+	functions["set$1"] = set;
+}
+
+const HexaScript::FunctionDef& HexaScript::FindFunction(const string &fn_name, size_t num_args) const
+{
+	auto fn = functions.find(fn_name + "$" + to_string(num_args));
+	if (fn == functions.end())
+	{
+		Error e;
+		e.error_info = "No such function";
+		throw e;
+	}
+	return fn->second;
 }
 
-// Handles expressions like `a=3` and sets the variables registered.
-void HexaScript::Set(string expr)
+function<void()> HexaScript::CompileSet(const string &expr) const
 try
 {
 	string name;
@@ -134,29 +160,27 @@ try
 	if (*it != '=')
 	{
 		// Must be an option like `:set big-endian`
-		std::unordered_map<std::string, OptionDef>::iterator opt = options.find(name);
+		auto opt = options.find(name);
 		if (opt == options.end())
 		{
 			Error e;
 			e.error_info = "No such option: " + name;
 			throw e;
 		}
-		opt->second.setter_function();
-		return;
+		return opt->second.setter_function;
 	}
 	++it;
 
 	it = ExtractArg(it, value);
 
-	// Set the var
-	std::unordered_map<std::string, VariableDef>::iterator var = variables.find(name);
+	auto var = variables.find(name);
 	if (var == variables.end())
 	{
 		Error e;
 		e.error_info = "No such variable: " + name;
 		throw e;
 	}
-	var->second.setter_function(value);
+	return var->second.bind(value);
 }
 catch (string::const_iterator it)
 {
@@ -167,31 +191,290 @@ catch (string::const_iterator it)
 	throw e;
 }
 
-void HexaScript::ExecLine(const string &line)
-try
+static string::const_iterator ExtractIdentifier(string::const_iterator it, std::string &n)
 {
-	string fn_name;
-	vector<string> args;
+	n.clear();
+
+	if (!isalpha(*it) && *it != '_')
+	{
+		// Unexpected token.
+		throw it;
+	}
+	n.push_back(*(it++));
+
+	while (isalnum(*it) || *it == '_')
+		n.push_back(*(it++));
 
-	string::const_iterator it = line.begin();
+	return it;
+}
 
+static void ExpectEnd(string::const_iterator it)
+{
 	it = SkipWs(it);
-	if (*it == '\0') return;
+	if (*it != '\0')
+		throw it;
+}
 
-	it = ExtractName(it, fn_name);
+// Calls of script functions nested deeper than this fail, rather than
+// overflowing the stack.
+static const int kMaxCallDepth = 1000;
 
-	// Extract the arguments
-	while (1)
+// Compiles lines one at a time, emitting the code of expressions as they are
+// parsed.
+class HexaScript::Compiler
+{
+public:
+	explicit Compiler(const HexaScript &script);
+
+	void Line(const string &line, int line_no);
+
+	// Throws Error if a block is not ended.
+	shared_ptr<Program> Finish();
+
+private:
+	typedef Program::Op Op;
+	typedef string::const_iterator It;
+
+	// Registers of the function being compiled. Variables take the first
+	// ones, temporaries of a statement come after them.
+	struct Scope
 	{
-		it = SkipWs(it);
-		if (*it == '\0') break;
+		int function = 0;
+		unordered_map<string, int> variables;
+		int num_variables = 0;
+		int next_temp = 0;
+		int num_registers = 0;
+		unordered_map<int64_t, int> number_constants;
+	};
 
-		string arg;
-		it = ExtractArg(it, arg);
-		args.push_back(arg);
+	struct Block
+	{
+		enum Type { If, While, For, Fn } type;
+		int line;
+		// Start of the loop.
+		int top = 0;
+		// Jump to the next branch of an `if`, -1 after `else`.
+		int pending = -1;
+		// Jumps out of the block, and to the next iteration of a loop.
+		vector<int> end_jumps;
+		vector<int> continue_jumps;
+		// Registers of `for`.
+		int loop_var = -1;
+		int step = -1;
+	};
+
+	struct UserFunction
+	{
+		int index;
+		int num_args;
+	};
+
+	[[noreturn]] void Fail(const string &message) const;
+
+	vector<Program::Instruction>& Code()
+	{
+		return program->functions[scope->function].code;
+	}
+
+	int Emit(Op op, int a = 0, int b = 0, int c = 0);
+	void PatchJumps(const vector<int> &jumps, int target);
+
+	int Temp();
+	bool IsTemp(int reg) const
+	{
+		return reg >= scope->num_variables;
+	}
+	// Unnamed variables keep values through a block, like the limit of a
+	// `for`.
+	int Declare(const string &name);
+
+	// Constants are referred to with negative numbers until the function is
+	// compiled, when their registers are known.
+	int NumberConstant(int64_t number);
+	int TextConstant(const string &text);
+	const Program::Value& ConstantValue(int reg);
+
+	// Moves the value in `reg` to `dest`, by changing the instruction which
+	// computed it if possible.
+	void MoveInto(int dest, int reg);
+
+	void EndScope();
+
+	void Statement(It it);
+	void Let(It it);
+	void For(It it, int line_no);
+	void Loop(It it, bool is_continue);
+	void FunctionDefinition(It it, int line_no);
+	void Return(It it);
+	void End(It it);
+	void Command(const string &name, It it);
+	It Arg(It it, vector< pair<int, string> > &parts);
+
+	// Expressions return the register holding their value.
+	int Expression(It &it)
+	{
+		return Binary(it, 0);
+	}
+	int Binary(It &it, int level);
+	int Unary(It &it);
+	int Primary(It &it);
+	int Call(const string &name, It &it);
+
+	const char* At(It it) const
+	{
+		return current_line->c_str() + (it - current_line->begin());
 	}
 
-	CallFunction(fn_name, args);
+	const HexaScript &script;
+	shared_ptr<Program> program;
+
+	Scope top;
+	Scope function;
+	Scope *scope;
+
+	vector<Block> blocks;
+	unordered_map<string, UserFunction> user_functions;
+
+	const string *current_line = nullptr;
+	int current_line_no = 0;
+};
+
+HexaScript::Compiler::Compiler(const HexaScript &script)
+  : script(script), program(make_shared<Program>()), scope(&top)
+{
+	program->functions.emplace_back();
+}
+
+void HexaScript::Compiler::Fail(const string &message) const
+{
+	Error e;
+	e.error_info = "HexaScript Error: " + message + "\n"
+	               "On line: " + *current_line;
+	throw e;
+}
+
+int HexaScript::Compiler::Emit(Op op, int a, int b, int c)
+{
+	Program::Instruction in = {op, 0, false, false, a, b, c, -1, current_line_no};
+	Code().push_back(in);
+	return Code().size() - 1;
+}
+
+void HexaScript::Compiler::PatchJumps(const vector<int> &jumps, int target)
+{
+	for (int jump : jumps)
+	{
+		Code()[jump].target = target;
+	}
+}
+
+int HexaScript::Compiler::Temp()
+{
+	const int reg = scope->next_temp++;
+	scope->num_registers = max(scope->num_registers, scope->next_temp);
+	return reg;
+}
+
+int HexaScript::Compiler::Declare(const string &name)
+{
+	const int reg = scope->num_variables++;
+	if (!name.empty())
+	{
+		scope->variables[name] = reg;
+	}
+	scope->next_temp = max(scope->next_temp, scope->num_variables);
+	scope->num_registers = max(scope->num_registers, scope->num_variables);
+	return reg;
+}
+
+int HexaScript::Compiler::NumberConstant(int64_t number)
+{
+	auto known = scope->number_constants.find(number);
+	if (known != scope->number_constants.end())
+	{
+		return known->second;
+	}
+
+	auto &constants = program->functions[scope->function].constants;
+	constants.emplace_back();
+	constants.back().number = number;
+	return scope->number_constants[number] = -(int)constants.size();
+}
+
+int HexaScript::Compiler::TextConstant(const string &text)
+{
+	auto &constants = program->functions[scope->function].constants;
+	constants.emplace_back();
+	constants.back().is_text = true;
+	constants.back().text = text;
+	return -(int)constants.size();
+}
+
+const HexaScript::Program::Value& HexaScript::Compiler::ConstantValue(int reg)
+{
+	return program->functions[scope->function].constants[-1 - reg];
+}
+
+void HexaScript::Compiler::MoveInto(int dest, int reg)
+{
+	if (reg == dest)
+	{
+		return;
+	}
+
+	// Instruction computing a temporary is the last one of its expression,
+	// operands are read before writing, so it can write `dest` instead.
+	auto &code = Code();
+	if (IsTemp(reg) && !code.empty() && code.back().a == reg)
+	{
+		switch (code.back().op)
+		{
+			case Op::SetGlobal:
+			case Op::Jump:
+			case Op::JumpIfFalse:
+			case Op::JumpIfTrue:
+			case Op::ForTest:
+			case Op::Return:
+			case Op::ReturnNothing:
+			case Op::Command:
+			case Op::CommandWith:
+				break;
+			default:
+				code.back().a = dest;
+				return;
+		}
+	}
+	Emit(Op::Move, dest, reg);
+}
+
+void HexaScript::Compiler::EndScope()
+{
+	Program::Function &fn = program->functions[scope->function];
+	fn.num_registers = scope->num_registers;
+
+	auto resolve = [&fn](int32_t &reg)
+	{
+		if (reg < 0)
+		{
+			reg = fn.num_registers - 1 - reg;
+		}
+	};
+	for (Program::Instruction &in : fn.code)
+	{
+		resolve(in.a);
+		resolve(in.b);
+		resolve(in.c);
+	}
+}
+
+void HexaScript::Compiler::Line(const string &line, int line_no)
+try
+{
+	current_line = &line;
+	current_line_no = line_no;
+	scope->next_temp = scope->num_variables;
+
+	Statement(line.begin());
 }
 catch (string::const_iterator it)
 {
@@ -201,3 +484,1003 @@ catch (string::const_iterator it)
 	               "         " + string(it - line.begin(), ' ') + "^ here";
 	throw e;
 }
+catch (logic_error &ex)
+{
+	// Conversion of an argument failed, like stoi of a name.
+	Error e;
+	e.error_info = "HexaScript Error: Invalid argument\n"
+	               "On line: " + line;
+	throw e;
+}
+
+void HexaScript::Compiler::Statement(It it)
+{
+	const string &line = *current_line;
+
+	it = SkipWs(it);
+	if (*it == '\0' || *it == '#') return;
+
+	if (script.number_command && strspn(line.c_str(), "0123456789") == line.size())
+	{
+		const auto &fn = script.number_command;
+		program->calls.push_back([fn, line]() { fn(line); });
+		Emit(Op::Command, 0, program->calls.size() - 1);
+		return;
+	}
+
+	for (const auto &raw_command : script.raw_commands)
+	{
+		const string &prefix = raw_command.first;
+		if (line.compare(0, prefix.size(), prefix) == 0)
+		{
+			const auto &fn = raw_command.second;
+			const string text = line.substr(prefix.size());
+			program->calls.push_back([fn, text]() { fn(text); });
+			Emit(Op::Command, 0, program->calls.size() - 1);
+			return;
+		}
+	}
+
+	string name;
+	It after = ExtractName(it, name);
+
+	if (name == "let")
+	{
+		Let(after);
+	}
+	else if (name == "if")
+	{
+		Block block = {Block::If, current_line_no};
+		const int condition = Expression(after);
+		ExpectEnd(after);
+		block.pending = Emit(Op::JumpIfFalse, condition);
+		blocks.push_back(block);
+	}
+	else if (name == "elif" || name == "else")
+	{
+		if (blocks.empty() || blocks.back().type != Block::If || blocks.back().pending < 0)
+		{
+			Fail(name + " without if");
+		}
+		blocks.back().end_jumps.push_back(Emit(Op::Jump));
+		Code()[blocks.back().pending].target = Code().size();
+
+		if (name == "elif")
+		{
+			const int condition = Expression(after);
+			ExpectEnd(after);
+			blocks.back().pending = Emit(Op::JumpIfFalse, condition);
+		}
+		else
+		{
+			ExpectEnd(after);
+			blocks.back().pending = -1;
+		}
+	}
+	else if (name == "while")
+	{
+		Block block = {Block::While, current_line_no};
+		block.top = Code().size();
+		const int condition = Expression(after);
+		ExpectEnd(after);
+		block.end_jumps.push_back(Emit(Op::JumpIfFalse, condition));
+		blocks.push_back(block);
+	}
+	else if (name == "for")
+	{
+		For(after, current_line_no);
+	}
+	else if (name == "break" || name == "continue")
+	{
+		Loop(after, name == "continue");
+	}
+	else if (name == "fn")
+	{
+		FunctionDefinition(after, current_line_no);
+	}
+	else if (name == "return")
+	{
+		Return(after);
+	}
+	else if (name == "end")
+	{
+		End(after);
+	}
+	else if (*after == '(')
+	{
+		// Call for its effects, like `walk(0)`.
+		Expression(it);
+		ExpectEnd(it);
+	}
+	else
+	{
+		Command(name, after);
+	}
+}
+
+void HexaScript::Compiler::Let(It it)
+{
+	string name;
+	it = ExtractIdentifier(SkipWs(it), name);
+	it = SkipWs(it);
+	if (*it != '=')
+		throw it;
+	++it;
+
+	const int value = Expression(it);
+	ExpectEnd(it);
+
+	auto local = scope->variables.find(name);
+	if (local != scope->variables.end())
+	{
+		MoveInto(local->second, value);
+		return;
+	}
+
+	// Functions assign to the globals defined before them.
+	if (scope != &top)
+	{
+		auto global = top.variables.find(name);
+		if (global != top.variables.end())
+		{
+			Emit(Op::SetGlobal, global->second, value);
+			return;
+		}
+	}
+
+	MoveInto(Declare(name), value);
+}
+
+void HexaScript::Compiler::For(It it, int line_no)
+{
+	string name;
+	it = ExtractIdentifier(SkipWs(it), name);
+	it = SkipWs(it);
+	if (*it != '=')
+		throw it;
+	++it;
+
+	const int start = Expression(it);
+	it = SkipWs(it);
+	if (*it != ',')
+		throw it;
+	++it;
+
+	auto local = scope->variables.find(name);
+	const int loop_var = (local != scope->variables.end() ? local->second : Declare(name));
+	MoveInto(loop_var, start);
+
+	const int limit = Declare("");
+	MoveInto(limit, Expression(it));
+
+	int step;
+	it = SkipWs(it);
+	if (*it == ',')
+	{
+		++it;
+		step = Declare("");
+		MoveInto(step, Expression(it));
+	}
+	else
+	{
+		step = NumberConstant(1);
+	}
+	ExpectEnd(it);
+
+	Block block = {Block::For, line_no};
+	block.loop_var = loop_var;
+	block.step = step;
+	block.top = Code().size();
+	block.end_jumps.push_back(Emit(Op::ForTest, loop_var, limit, step));
+	blocks.push_back(block);
+}
+
+void HexaScript::Compiler::Loop(It it, bool is_continue)
+{
+	ExpectEnd(it);
+
+	for (auto block = blocks.rbegin(); block != blocks.rend() && block->type != Block::Fn; ++block)
+	{
+		if (block->type == Block::While || block->type == Block::For)
+		{
+			const int jump = Emit(Op::Jump);
+			if (is_continue && block->type == Block::While)
+			{
+				Code()[jump].target = block->top;
+			}
+			else
+			{
+				(is_continue ? block->continue_jumps : block->end_jumps).push_back(jump);
+			}
+			return;
+		}
+	}
+	Fail(string(is_continue ? "continue" : "break") + " outside a loop");
+}
+
+void HexaScript::Compiler::FunctionDefinition(It it, int line_no)
+{
+	if (!blocks.empty())
+	{
+		Fail("Functions must be defined at the top level");
+	}
+
+	string name;
+	it = ExtractIdentifier(SkipWs(it), name);
+	it = SkipWs(it);
+	if (*it != '(')
+		throw it;
+	++it;
+
+	// First register is where the result is returned.
+	function = Scope();
+	function.num_registers = 1;
+	function.function = program->functions.size();
+	program->functions.emplace_back();
+	scope = &function;
+
+	it = SkipWs(it);
+	while (*it != ')')
+	{
+		string arg;
+		it = ExtractIdentifier(SkipWs(it), arg);
+		if (function.variables.count(arg))
+		{
+			Fail("Repeated argument: " + arg);
+		}
+		Declare(arg);
+
+		it = SkipWs(it);
+		if (*it == ',')
+		{
+			++it;
+		}
+		else if (*it != ')')
+		{
+			throw it;
+		}
+	}
+	++it;
+	ExpectEnd(it);
+
+	program->functions.back().num_args = function.num_variables;
+
+	// Known before the body, for recursive calls.
+	user_functions[name] = {function.function, function.num_variables};
+	blocks.push_back({Block::Fn, line_no});
+}
+
+void HexaScript::Compiler::Return(It it)
+{
+	it = SkipWs(it);
+	if (*it == '\0')
+	{
+		Emit(Op::ReturnNothing);
+		return;
+	}
+
+	if (scope == &top)
+	{
+		Fail("Only functions return values");
+	}
+	const int value = Expression(it);
+	ExpectEnd(it);
+	Emit(Op::Return, value);
+}
+
+void HexaScript::Compiler::End(It it)
+{
+	ExpectEnd(it);
+	if (blocks.empty())
+	{
+		Fail("end without a block");
+	}
+
+	Block block = blocks.back();
+	blocks.pop_back();
+
+	switch (block.type)
+	{
+		case Block::If:
+			if (block.pending >= 0)
+			{
+				Code()[block.pending].target = Code().size();
+			}
+			PatchJumps(block.end_jumps, Code().size());
+			break;
+
+		case Block::While:
+			Code()[Emit(Op::Jump)].target = block.top;
+			PatchJumps(block.end_jumps, Code().size());
+			break;
+
+		case Block::For:
+		{
+			const int next = Emit(Op::Add, block.loop_var, block.loop_var, block.step);
+			Code()[Emit(Op::Jump)].target = block.top;
+			PatchJumps(block.continue_jumps, next);
+			PatchJumps(block.end_jumps, Code().size());
+			break;
+		}
+
+		case Block::Fn:
+			Emit(Op::ReturnNothing);
+			EndScope();
+			scope = &top;
+			break;
+	}
+}
+
+void HexaScript::Compiler::Command(const string &name, It it)
+{
+	vector< vector< pair<int, string> > > args;
+	bool has_expressions = false;
+
+	while (1)
+	{
+		it = SkipWs(it);
+		if (*it == '\0') break;
+
+		args.emplace_back();
+		it = Arg(it, args.back());
+		for (const auto &part : args.back())
+		{
+			has_expressions |= (part.first != -1);
+		}
+	}
+
+	const FunctionDef &fn = script.FindFunction(name, args.size());
+
+	if (has_expressions)
+	{
+		program->commands.push_back({fn.call, move(args)});
+		Emit(Op::CommandWith, 0, program->commands.size() - 1);
+		return;
+	}
+
+	vector<string_view> texts;
+	for (const auto &parts : args)
+	{
+		texts.push_back(parts.front().second);
+	}
+	program->calls.push_back(fn.bind(texts.data()));
+	Emit(Op::Command, 0, program->calls.size() - 1);
+}
+
+HexaScript::Compiler::It HexaScript::Compiler::Arg(It it, vector< pair<int, string> > &parts)
+{
+	auto append_text = [&parts](const string &text)
+	{
+		if (!parts.empty() && parts.back().first == -1)
+			parts.back().second += text;
+		else
+			parts.emplace_back(-1, text);
+	};
+
+	while (1)
+	{
+		bool is_expression = (*it == '(');
+		if (is_expression)
+		{
+			++it;
+			const int value = Expression(it);
+			it = SkipWs(it);
+			if (*it != ')')
+				throw it;
+			++it;
+
+			if (value < 0)
+				append_text(ConstantValue(value).Text());
+			else
+				parts.emplace_back(value, "");
+		}
+		else
+		{
+			string text;
+			if (*it == '"')
+				it = ExtractQuotedString(it, text);
+			else
+				it = ExtractUnquotedString(it, text);
+			append_text(text);
+		}
+
+		// Parts are joined around expressions only, like `(pos):4`.
+		if (*it == '(' || (is_expression && *it != '\0' && *it != ' ' && *it != '\t'))
+			continue;
+		return it;
+	}
+}
+
+int HexaScript::Compiler::Binary(It &it, int level)
+{
+	struct BinaryOperator
+	{
+		const char *text;
+		int level;
+		Op op;
+	};
+	// Longer ones first, so `<` does not match `<=`. Jumps are for
+	// short-circuit evaluation.
+	static const BinaryOperator operators[] =
+	{
+		{"||", 0, Op::JumpIfTrue}, {"&&", 1, Op::JumpIfFalse},
+		{"==", 5, Op::Eq}, {"!=", 5, Op::Ne}, {"<=", 6, Op::Le}, {">=", 6, Op::Ge},
+		{"<<", 7, Op::Shl}, {">>", 7, Op::Shr},
+		{"|", 2, Op::BitOr}, {"^", 3, Op::BitXor}, {"&", 4, Op::BitAnd},
+		{"<", 6, Op::Lt}, {">", 6, Op::Gt},
+		{"+", 8, Op::Add}, {"-", 8, Op::Sub},
+		{"*", 9, Op::Mul}, {"/", 9, Op::Div}, {"%", 9, Op::Mod},
+	};
+	const int unary_level = 10;
+
+	if (level == unary_level)
+	{
+		return Unary(it);
+	}
+
+	int left = Binary(it, level + 1);
+	while (1)
+	{
+		it = SkipWs(it);
+
+		const BinaryOperator *op = nullptr;
+		for (const BinaryOperator &o : operators)
+		{
+			if (strncmp(At(it), o.text, strlen(o.text)) == 0)
+			{
+				op = &o;
+				break;
+			}
+		}
+		if (!op || op->level != level)
+		{
+			return left;
+		}
+		it += strlen(op->text);
+
+		if (op->op == Op::JumpIfFalse || op->op == Op::JumpIfTrue)
+		{
+			const int result = IsTemp(left) ? left : Temp();
+			MoveInto(result, left);
+			const int jump = Emit(op->op, result);
+			MoveInto(result, Binary(it, level + 1));
+			const int normalize = Emit(Op::Bool, result, result);
+			Code()[jump].target = normalize;
+			left = result;
+			continue;
+		}
+
+		const int right = Binary(it, level + 1);
+		const int result = IsTemp(left) ? left : IsTemp(right) ? right : Temp();
+		Emit(op->op, result, left, right);
+		left = result;
+	}
+}
+
+int HexaScript::Compiler::Unary(It &it)
+{
+	it = SkipWs(it);
+
+	Op op;
+	switch (*it)
+	{
+		case '-': op = Op::Neg; break;
+		case '!': op = Op::Not; break;
+		case '~': op = Op::BitNot; break;
+		default: return Primary(it);
+	}
+	++it;
+
+	const int operand = Unary(it);
+	if (op == Op::Neg && operand < 0 && !ConstantValue(operand).is_text)
+	{
+		return NumberConstant(-(uint64_t)ConstantValue(operand).number);
+	}
+
+	const int result = IsTemp(operand) ? operand : Temp();
+	Emit(op, result, operand);
+	return result;
+}
+
+int HexaScript::Compiler::Primary(It &it)
+{
+	it = SkipWs(it);
+
+	if (*it == '(')
+	{
+		++it;
+		const int value = Expression(it);
+		it = SkipWs(it);
+		if (*it != ')')
+			throw it;
+		++it;
+		return value;
+	}
+
+	if (isdigit(*it))
+	{
+		const char *begin = At(it);
+		const bool is_hex = (begin[0] == '0' && (begin[1] == 'x' || begin[1] == 'X'));
+		char *end;
+		errno = 0;
+		const uint64_t number = strtoull(begin, &end, is_hex ? 16 : 10);
+		if (errno == ERANGE)
+		{
+			Fail("Number is too large");
+		}
+		it += end - begin;
+		if (isalnum(*it) || *it == '_')
+			throw it;
+		return NumberConstant(number);
+	}
+
+	if (*it == '"')
+	{
+		string text;
+		it = ExtractQuotedString(it, text);
+		return TextConstant(text);
+	}
+
+	if (*it == '@')
+	{
+		++it;
+		const int result = Temp();
+		Emit(Op::Cursor, result);
+		return result;
+	}
+
+	string name;
+	It after = ExtractIdentifier(it, name);
+	if (*SkipWs(after) == '(')
+	{
+		it = SkipWs(after) + 1;
+		return Call(name, it);
+	}
+	it = after;
+
+	auto local = scope->variables.find(name);
+	if (local != scope->variables.end())
+	{
+		return local->second;
+	}
+	if (scope != &top)
+	{
+		auto global = top.variables.find(name);
+		if (global != top.variables.end())
+		{
+			const int result = Temp();
+			Emit(Op::GetGlobal, result, global->second);
+			return result;
+		}
+	}
+	Fail("No such variable: " + name);
+}
+
+int HexaScript::Compiler::Call(const string &name, It &it)
+{
+	// Arguments are put in consecutive registers, the result is left in the
+	// first one.
+	const int first = scope->next_temp;
+	int num_args = 0;
+
+	it = SkipWs(it);
+	while (*it != ')')
+	{
+		const int slot = Temp();
+		MoveInto(slot, Expression(it));
+		scope->next_temp = slot + 1;
+		++num_args;
+
+		it = SkipWs(it);
+		if (*it == ',')
+			++it;
+		else if (*it != ')')
+			throw it;
+	}
+	++it;
+
+	if (num_args == 0)
+	{
+		Temp();
+	}
+	scope->next_temp = first + 1;
+
+	auto expect_args = [&](int n)
+	{
+		if (num_args != n)
+		{
+			Fail(name + " takes " + to_string(n) + " arguments");
+		}
+	};
+
+	auto user_function = user_functions.find(name);
+	if (user_function != user_functions.end())
+	{
+		expect_args(user_function->second.num_args);
+		Emit(Op::Call, first, user_function->second.index, first);
+		return first;
+	}
+
+	// Readers of integers, like u8, i32 and u64be. Little-endian unless
+	// `be` is given.
+	int width;
+	char endianness[3] = "";
+	if ((name[0] == 'u' || name[0] == 'i')
+	    && sscanf(name.c_str() + 1, "%d%2s", &width, endianness) >= 1
+	    && (width == 8 || width == 16 || width == 32 || width == 64)
+	    && name == name.substr(0, 1) + to_string(width) + endianness
+	    && (endianness[0] == '\0' || !strcmp(endianness, "le") || !strcmp(endianness, "be")))
+	{
+		expect_args(1);
+		Program::Instruction &in = Code()[Emit(Op::Read, first, first)];
+		in.width = width / 8;
+		in.is_signed = (name[0] == 'i');
+		in.big_endian = !strcmp(endianness, "be");
+		return first;
+	}
+
+	if (name == "filesize")
+	{
+		expect_args(0);
+		Emit(Op::FileSize, first);
+	}
+	else if (name == "hex")
+	{
+		expect_args(1);
+		Emit(Op::Hex, first, first);
+	}
+	else if (name == "len")
+	{
+		expect_args(1);
+		Emit(Op::Len, first, first);
+	}
+	else
+	{
+		Fail("No such function: " + name);
+	}
+	return first;
+}
+
+shared_ptr<HexaScript::Program> HexaScript::Compiler::Finish()
+{
+	if (!blocks.empty())
+	{
+		Error e;
+		e.error_info = "Line " + to_string(blocks.back().line) + ": HexaScript Error: Block is not ended";
+		throw e;
+	}
+	EndScope();
+	return program;
+}
+
+shared_ptr<const HexaScript::Program> HexaScript::Compile(const string &source) const
+{
+	Compiler compiler(*this);
+
+	istringstream lines(source);
+	string line;
+	for (int line_no = 1; getline(lines, line); ++line_no)
+	{
+		try
+		{
+			compiler.Line(line, line_no);
+		}
+		catch (Error &e)
+		{
+			e.error_info = "Line " + to_string(line_no) + ": " + e.error_info;
+			throw;
+		}
+	}
+	return compiler.Finish();
+}
+
+void HexaScript::Run(const Program &program) const
+{
+	Machine machine;
+	Execute(program, 0, 0, machine, 0);
+}
+
+void HexaScript::Execute(const Program &program, int function, size_t base,
+                         Machine &machine, int depth) const
+{
+	typedef Program::Op Op;
+	typedef Program::Value Value;
+	typedef Program::Instruction Instruction;
+
+	vector<Value> &stack = machine.stack;
+	const Program::Function &fn = program.functions[function];
+	const size_t frame_size = fn.num_registers + fn.constants.size();
+	if (stack.size() < base + frame_size)
+	{
+		stack.resize(base + frame_size);
+	}
+	copy(fn.constants.begin(), fn.constants.end(), stack.begin() + base + fn.num_registers);
+
+	auto fail = [](const Instruction &in, const string &message)
+	{
+		Error e;
+		e.error_info = "Line " + to_string(in.line) + ": " + message;
+		throw e;
+	};
+	auto number = [&fail](const Instruction &in, const Value &v)
+	{
+		if (v.is_text)
+		{
+			fail(in, "Expected a number, not \"" + v.text + "\"");
+		}
+		return v.number;
+	};
+	auto set = [](Value &v, int64_t number)
+	{
+		v.is_text = false;
+		v.number = number;
+	};
+	auto assign = [](Value &to, const Value &from)
+	{
+		to.is_text = from.is_text;
+		to.number = from.number;
+		if (from.is_text)
+		{
+			to.text = from.text;
+		}
+	};
+
+	// Arithmetic wraps around, done on unsigned values.
+	#define HEXASCRIPT_NUMBER_OP(OP, EXPR) \
+		case Op::OP: \
+		{ \
+			const uint64_t x = number(in, r[in.b]), y = number(in, r[in.c]); \
+			set(r[in.a], (EXPR)); \
+			break; \
+		}
+
+	Value *r = stack.data() + base;
+	const Instruction *code = fn.code.data();
+	const size_t code_size = fn.code.size();
+	size_t pc = 0;
+	while (pc < code_size)
+	{
+		const Instruction &in = code[pc++];
+		switch (in.op)
+		{
+			case Op::Move:
+				assign(r[in.a], r[in.b]);
+				break;
+
+			case Op::Add:
+				if (r[in.b].is_text || r[in.c].is_text)
+				{
+					string text = r[in.b].Text() + r[in.c].Text();
+					r[in.a].is_text = true;
+					r[in.a].text = move(text);
+					break;
+				}
+				set(r[in.a], (uint64_t)r[in.b].number + (uint64_t)r[in.c].number);
+				break;
+
+			HEXASCRIPT_NUMBER_OP(Sub, x - y)
+			HEXASCRIPT_NUMBER_OP(Mul, x * y)
+			HEXASCRIPT_NUMBER_OP(BitAnd, x & y)
+			HEXASCRIPT_NUMBER_OP(BitOr, x | y)
+			HEXASCRIPT_NUMBER_OP(BitXor, x ^ y)
+			HEXASCRIPT_NUMBER_OP(Shl, x << (y & 63))
+			HEXASCRIPT_NUMBER_OP(Shr, (int64_t)x >> (y & 63))
+			HEXASCRIPT_NUMBER_OP(Lt, (int64_t)x < (int64_t)y)
+			HEXASCRIPT_NUMBER_OP(Le, (int64_t)x <= (int64_t)y)
+			HEXASCRIPT_NUMBER_OP(Gt, (int64_t)x > (int64_t)y)
+			HEXASCRIPT_NUMBER_OP(Ge, (int64_t)x >= (int64_t)y)
+
+			case Op::Div:
+			case Op::Mod:
+			{
+				const int64_t x = number(in, r[in.b]), y = number(in, r[in.c]);
+				if (y == 0)
+				{
+					fail(in, "Division by zero");
+				}
+				// Dividing the smallest number by -1 overflows.
+				if (in.op == Op::Div)
+					set(r[in.a], y == -1 ? -(uint64_t)x : x / y);
+				else
+					set(r[in.a], y == -1 ? 0 : x % y);
+				break;
+			}
+
+			case Op::Eq:
+			case Op::Ne:
+			{
+				const Value &x = r[in.b], &y = r[in.c];
+				const bool equal = (x.is_text == y.is_text)
+				                && (x.is_text ? x.text == y.text : x.number == y.number);
+				set(r[in.a], equal == (in.op == Op::Eq));
+				break;
+			}
+
+			case Op::Neg:
+				set(r[in.a], -(uint64_t)number(in, r[in.b]));
+				break;
+
+			case Op::Not:
+				set(r[in.a], !r[in.b].IsTrue());
+				break;
+
+			case Op::BitNot:
+				set(r[in.a], ~number(in, r[in.b]));
+				break;
+
+			case Op::Bool:
+				set(r[in.a], r[in.b].IsTrue());
+				break;
+
+			case Op::Read:
+			{
+				const int64_t pos = number(in, r[in.b]);
+				uint8_t bytes[8];
+				if (!buffer)
+				{
+					fail(in, "Nothing to read from");
+				}
+				if (pos < 0 || buffer->Read(pos, bytes, in.width) < in.width)
+				{
+					fail(in, "Reading past the end at " + to_string(pos));
+				}
+
+				uint64_t value = 0;
+				for (int i = 0; i < in.width; ++i)
+				{
+					value = (value << 8) | bytes[in.big_endian ? i : in.width - 1 - i];
+				}
+				if (in.is_signed && in.width < 8)
+				{
+					const int shift = 64 - 8 * in.width;
+					value = (int64_t)(value << shift) >> shift;
+				}
+				set(r[in.a], value);
+				break;
+			}
+
+			case Op::Cursor:
+			case Op::FileSize:
+				if (!buffer)
+				{
+					fail(in, "Nothing to read from");
+				}
+				set(r[in.a], in.op == Op::Cursor ? buffer->Cursor() : buffer->Size());
+				break;
+
+			case Op::Hex:
+			{
+				char text[20];
+				snprintf(text, sizeof(text), "0x%llx", (unsigned long long)number(in, r[in.b]));
+				r[in.a].is_text = true;
+				r[in.a].text = text;
+				break;
+			}
+
+			case Op::Len:
+				if (!r[in.b].is_text)
+				{
+					fail(in, "Expected a text");
+				}
+				set(r[in.a], r[in.b].text.size());
+				break;
+
+			case Op::GetGlobal:
+				assign(r[in.a], stack[in.b]);
+				break;
+
+			case Op::SetGlobal:
+				assign(stack[in.a], r[in.b]);
+				break;
+
+			case Op::Jump:
+				pc = in.target;
+				break;
+
+			case Op::JumpIfFalse:
+				if (!r[in.a].IsTrue())
+					pc = in.target;
+				break;
+
+			case Op::JumpIfTrue:
+				if (r[in.a].IsTrue())
+					pc = in.target;
+				break;
+
+			case Op::ForTest:
+			{
+				const int64_t i = number(in, r[in.a]), limit = number(in, r[in.b]);
+				if (number(in, r[in.c]) >= 0 ? i >= limit : i <= limit)
+					pc = in.target;
+				break;
+			}
+
+			case Op::Call:
+			{
+				if (depth >= kMaxCallDepth)
+				{
+					fail(in, "Calls are nested too deep");
+				}
+
+				// Called function's registers come after this one's, arguments
+				// are copied to the first ones.
+				const size_t callee_base = base + frame_size;
+				const Program::Function &callee = program.functions[in.b];
+				if (stack.size() < callee_base + callee.num_registers + callee.constants.size())
+				{
+					stack.resize(callee_base + callee.num_registers + callee.constants.size());
+					r = stack.data() + base;
+				}
+				for (int i = 0; i < callee.num_args; ++i)
+				{
+					assign(stack[callee_base + i], r[in.c + i]);
+				}
+
+				Execute(program, in.b, callee_base, machine, depth + 1);
+				r = stack.data() + base;
+				assign(r[in.a], stack[callee_base]);
+				break;
+			}
+
+			case Op::Return:
+				assign(r[0], r[in.a]);
+				return;
+
+			case Op::ReturnNothing:
+				if (function != 0)
+				{
+					set(r[0], 0);
+				}
+				return;
+
+			case Op::Command:
+				program.calls[in.b]();
+				break;
+
+			case Op::CommandWith:
+			{
+				const Program::Command &command = program.commands[in.b];
+
+				// Texts keep their buffers from earlier calls.
+				const size_t num_args = command.args.size();
+				if (machine.arg_texts.size() < num_args)
+				{
+					machine.arg_texts.resize(num_args);
+					machine.args.resize(num_args);
+				}
+				for (size_t i = 0; i < num_args; ++i)
+				{
+					string &text = machine.arg_texts[i];
+					text.clear();
+					for (const auto &part : command.args[i])
+					{
+						if (part.first == -1)
+							text += part.second;
+						else
+							r[part.first].AppendTo(text);
+					}
+					machine.args[i] = text;
+				}
+
+				try
+				{
+					command.call(machine.args.data());
+				}
+				catch (_hexascript_helper::bad_argument &ex)
+				{
+					fail(in, "HexaScript Error: Invalid argument");
+				}
+				break;
+			}
+		}
+	}
+
+	#undef HEXASCRIPT_NUMBER_OP
+}
+
+void HexaScript::ExecLine(const string &line)
+{
+	Compiler compiler(*this);
+	compiler.Line(line, 1);
+	Run(*compiler.Finish());
+}
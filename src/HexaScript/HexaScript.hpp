@@ -17,44 +17,179 @@
 
 #pragma once
 
+#include <charconv>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace _hexascript_helper
 {
+// Converts the text of an argument, throwing std::invalid_argument or
+// std::out_of_range if it is not a valid value. Compiled calls keep the
+// converted arguments as `slot`s.
 template <typename T>
 struct from_string_trait;
 
+template <typename T>
+T parse_number(std::string_view s)
+{
+	if (s.size() > 1 && s[0] == '+' && s[1] != '-')
+	{
+		s.remove_prefix(1);
+	}
+
+	T value;
+	auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+	if (result.ec == std::errc::result_out_of_range)
+	{
+		throw std::out_of_range(std::string(s));
+	}
+	if (result.ec != std::errc() || result.ptr != s.data() + s.size())
+	{
+		throw std::invalid_argument(std::string(s));
+	}
+	return value;
+}
+
 template <>
 struct from_string_trait<bool>
 {
-	static bool fn(const std::string &s)
+	typedef bool slot;
+	static bool fn(std::string_view s)
 	{
 		if (s == "true") return true;
 		if (s == "false") return false;
-		return false; // THROW HERE
+		throw std::invalid_argument(std::string(s));
 	}
 };
 
 template <>
 struct from_string_trait<int>
 {
-	static int fn(const std::string &s)
+	typedef int slot;
+	static int fn(std::string_view s)
 	{
-		return std::stoi(s);
+		return parse_number<int>(s);
+	}
+};
+
+template <>
+struct from_string_trait<int64_t>
+{
+	typedef int64_t slot;
+	static int64_t fn(std::string_view s)
+	{
+		return parse_number<int64_t>(s);
+	}
+};
+
+template <>
+struct from_string_trait<double>
+{
+	typedef double slot;
+	static double fn(std::string_view s)
+	{
+		return parse_number<double>(s);
 	}
 };
 
 template <>
 struct from_string_trait<std::string>
 {
-	static std::string fn(const std::string &s)
+	typedef std::string slot;
+	static std::string fn(std::string_view s)
+	{
+		return std::string(s);
+	}
+};
+
+// Points into the line being run, or into the slot of a compiled call.
+template <>
+struct from_string_trait<std::string_view>
+{
+	typedef std::string slot;
+	static std::string_view fn(std::string_view s)
 	{
 		return s;
 	}
 };
+
+// Bytes in hex, like `7f454c46`.
+template <>
+struct from_string_trait< std::vector<uint8_t> >
+{
+	typedef std::vector<uint8_t> slot;
+	static std::vector<uint8_t> fn(std::string_view s)
+	{
+		auto digit = [s](char c) -> uint8_t
+		{
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			throw std::invalid_argument(std::string(s));
+		};
+
+		if (s.size() % 2 != 0)
+		{
+			throw std::invalid_argument(std::string(s));
+		}
+		std::vector<uint8_t> bytes(s.size() / 2);
+		for (size_t i = 0; i < bytes.size(); ++i)
+		{
+			bytes[i] = digit(s[2 * i]) << 4 | digit(s[2 * i + 1]);
+		}
+		return bytes;
+	}
+};
+
+template <typename Arg>
+using arg_trait = from_string_trait<typename std::decay<Arg>::type>;
+
+// Keeps template arguments of RegisterFunction from being deduced, so they
+// are given explicitly and lambdas convert to the std::function.
+template <typename T>
+struct identity
+{
+	typedef T type;
+};
+
+// Thrown for arguments that do not convert when a call is made.
+struct bad_argument
+{
+};
+
+template <typename... Args, size_t... I>
+std::function<void()> bind_slots(const std::function<void(Args...)> &fn,
+                                 const std::string_view *args, std::index_sequence<I...>)
+{
+	// Braces convert in the order of arguments.
+	std::tuple<typename arg_trait<Args>::slot...> slots{typename arg_trait<Args>::slot(arg_trait<Args>::fn(args[I]))...};
+	return [fn, slots]() { std::apply(fn, slots); };
+}
+
+template <typename... Args, size_t... I>
+void call_converted(const std::function<void(Args...)> &fn,
+                    const std::string_view *args, std::index_sequence<I...>)
+{
+	std::tuple<decltype(arg_trait<Args>::fn(args[I]))...> converted;
+	try
+	{
+		converted = decltype(converted){arg_trait<Args>::fn(args[I])...};
+	}
+	catch (std::logic_error &ex)
+	{
+		throw bad_argument();
+	}
+	std::apply(fn, std::move(converted));
+}
 }
 
 class HexaScript
@@ -81,79 +216,41 @@ public:
 	HexaScript& operator=(const HexaScript &ot) = delete;
 
 
-	// TODO merge RegisterFunction functions into one variadic function if possible?
-
-	void RegisterFunction(const std::string &fn_name, std::function<void(void)> fn)
+	// Arguments are converted into typed slots when a line is compiled, and
+	// kept with the function to call. Arguments with expressions are
+	// converted each time the line runs, numbers and `std::string_view`s
+	// without allocating.
+	template <typename... Args>
+	void RegisterFunction(const std::string &fn_name,
+	                      typename ::_hexascript_helper::identity< std::function<void(Args...)> >::type fn)
 	{
 		FunctionDef f;
-		f.num_args = 0;
-		f.stringified_function = [fn](const std::vector<std::string> &args)
+		f.num_args = sizeof...(Args);
+		f.bind = [fn](const std::string_view *args)
 		{
-			return fn();
+			return ::_hexascript_helper::bind_slots(fn, args, std::index_sequence_for<Args...>());
 		};
-		functions[fn_name + "$" + std::to_string(f.num_args)] = f;
-	}
-
-	template <typename Arg1>
-	void RegisterFunction(const std::string &fn_name, std::function<void(Arg1)> fn)
-	{
-		FunctionDef f;
-		f.num_args = 1;
-		f.stringified_function = [fn](const std::vector<std::string> &args)
+		f.call = [fn](const std::string_view *args)
 		{
-			return fn(::_hexascript_helper::from_string_trait<Arg1>::fn(args[0]));
-		};
-		functions[fn_name + "$" + std::to_string(f.num_args)] = f;
-	}
-
-	template <typename Arg1, typename Arg2>
-	void RegisterFunction(const std::string &fn_name, std::function<void(Arg1, Arg2)> fn)
-	{
-		FunctionDef f;
-		f.num_args = 2;
-		f.stringified_function = [fn](const std::vector<std::string> &args)
-		{
-			return fn(::_hexascript_helper::from_string_trait<Arg1>::fn(args[0]),
-			          ::_hexascript_helper::from_string_trait<Arg2>::fn(args[1]));
-		};
-		functions[fn_name + "$" + std::to_string(f.num_args)] = f;
-	}
-
-	template <typename Arg1, typename Arg2, typename Arg3>
-	void RegisterFunction(const std::string &fn_name, std::function<void(Arg1, Arg2, Arg3)> fn)
-	{
-		FunctionDef f;
-		f.num_args = 3;
-		f.stringified_function = [fn](const std::vector<std::string> &args)
-		{
-			return fn(::_hexascript_helper::from_string_trait<Arg1>::fn(args[0]),
-			          ::_hexascript_helper::from_string_trait<Arg2>::fn(args[1]),
-			          ::_hexascript_helper::from_string_trait<Arg3>::fn(args[2]));
+			::_hexascript_helper::call_converted(fn, args, std::index_sequence_for<Args...>());
 		};
 		functions[fn_name + "$" + std::to_string(f.num_args)] = f;
 	}
 
 	void CallFunction(const std::string &fn_name, const std::vector<std::string> &args)
 	{
-		std::unordered_map<std::string, FunctionDef>::iterator fn;
-		fn  = functions.find(fn_name + "$" + std::to_string(args.size()));
-		if (fn == functions.end())
-		{
-			Error e;
-			e.error_info = "No such function";
-			throw e;
-		}
-
-		fn->second.stringified_function(args);
+		std::vector<std::string_view> views(args.begin(), args.end());
+		FindFunction(fn_name, args.size()).bind(views.data())();
 	}
 
 	template <typename T>
 	void RegisterVariable(const std::string &var_name, std::function<void(T)> setter_fn)
 	{
 		VariableDef v;
-		v.setter_function = [setter_fn](std::string s)
+		v.bind = [setter_fn](const std::string &s) -> std::function<void()>
 		{
-			setter_fn(::_hexascript_helper::from_string_trait<T>::fn(s));
+			typename ::_hexascript_helper::arg_trait<T>::slot value = ::_hexascript_helper::arg_trait<T>::fn(s);
+			return [setter_fn, value]() { setter_fn(value); };
 		};
 		variables[var_name] = v;
 	}
@@ -165,20 +262,156 @@ public:
 		options[opt_name] = o;
 	}
 
+	// Lines starting with `prefix` are given to `fn` as they are, without
+	// the prefix, for commands taking text full of special characters.
+	void RegisterRawCommand(const std::string &prefix, std::function<void(const std::string&)> fn)
+	{
+		raw_commands.emplace_back(prefix, fn);
+	}
+
+	// Lines made of digits only are given to `fn`, like `:123`.
+	void RegisterNumberCommand(std::function<void(const std::string&)> fn)
+	{
+		number_command = fn;
+	}
+
+	// Contents read by expressions like `u32le(@ + 4)`, `@` being the
+	// cursor.
+	class Buffer
+	{
+	public:
+		virtual ~Buffer() = default;
+
+		virtual uint64_t Size() const = 0;
+
+		// Copies bytes starting at `pos`, returns number of bytes copied which
+		// might be less than `length` near the end.
+		virtual uint64_t Read(uint64_t pos, void *out, uint64_t length) const = 0;
+
+		virtual uint64_t Cursor() const = 0;
+	};
+
+	void SetBuffer(const Buffer *buffer)
+	{
+		this->buffer = buffer;
+	}
+
+	// Lines compiled once, to be run any number of times. Functions are
+	// looked up, arguments converted and variables given registers when
+	// compiling, so running only evaluates and makes the calls.
+	class Program
+	{
+	public:
+		// Number of instructions at the top level.
+		size_t Size() const
+		{
+			return functions[0].code.size();
+		}
+
+	private:
+		enum class Op : uint8_t
+		{
+			Move, Add, Sub, Mul, Div, Mod, BitAnd, BitOr, BitXor, Shl, Shr,
+			Eq, Ne, Lt, Le, Gt, Ge, Neg, Not, BitNot, Bool,
+			Read, Cursor, FileSize, Hex, Len, GetGlobal, SetGlobal,
+			Jump, JumpIfFalse, JumpIfTrue, ForTest, Call, Return, ReturnNothing,
+			Command, CommandWith,
+		};
+
+		// Operates on registers of the running function, writing to `a`
+		// unless it is a jump, a return or a call of a command.
+		struct Instruction
+		{
+			Op op;
+			uint8_t width;
+			bool is_signed;
+			bool big_endian;
+			int32_t a, b, c;
+			int32_t target;
+			int32_t line;
+		};
+
+		struct Value
+		{
+			bool is_text = false;
+			int64_t number = 0;
+			std::string text;
+
+			std::string Text() const
+			{
+				return is_text ? text : std::to_string(number);
+			}
+
+			// Same as above without allocating, if `out` has room.
+			void AppendTo(std::string &out) const
+			{
+				if (is_text)
+				{
+					out += text;
+					return;
+				}
+				char digits[24];
+				out.append(digits, std::to_chars(digits, digits + sizeof(digits), number).ptr);
+			}
+
+			bool IsTrue() const
+			{
+				return is_text ? !text.empty() : number != 0;
+			}
+		};
+
+		// Registers are the variables and temporaries, followed by the
+		// constants, which are copied in when the function is called.
+		// Arguments are the first registers.
+		struct Function
+		{
+			int num_args = 0;
+			int num_registers = 0;
+			std::vector<Value> constants;
+			std::vector<Instruction> code;
+		};
+
+		// Call of a command with expressions in its arguments, converted when
+		// run. Arguments are made of texts, and registers when the first of
+		// the pair is not -1.
+		struct Command
+		{
+			std::function<void(const std::string_view*)> call;
+			std::vector< std::vector< std::pair<int, std::string> > > args;
+		};
+
+		// First one is the top level, whose registers are the globals.
+		std::vector<Function> functions;
+		std::vector< std::function<void()> > calls;
+		std::vector<Command> commands;
+
+		friend class HexaScript;
+	};
+
+	// Compiles each line of `source`. Throws Error for the first line that
+	// does not compile, naming it.
+	std::shared_ptr<const Program> Compile(const std::string &source) const;
+
+	// Throws Error for failing expressions, like reading past the end,
+	// naming the line.
+	void Run(const Program &program) const;
+
 	void ExecLine(const std::string &line);
 
 private:
-	void Set(std::string expr);
-
 	struct FunctionDef
 	{
 		int num_args;
-		std::function<void(std::vector<std::string>)> stringified_function;
+		// Converts the arguments, and returns the call to make with them.
+		std::function<std::function<void()>(const std::string_view*)> bind;
+		// Converts the arguments and makes the call at once, throws
+		// bad_argument if they do not convert.
+		std::function<void(const std::string_view*)> call;
 	};
 
 	struct VariableDef
 	{
-		std::function<void(std::string s)> setter_function;
+		std::function<std::function<void()>(const std::string&)> bind;
 	};
 
 	struct OptionDef
@@ -186,7 +419,30 @@ private:
 		std::function<void()> setter_function;
 	};
 
+	const FunctionDef& FindFunction(const std::string &fn_name, size_t num_args) const;
+
+	// Handles expressions like `a=3` and `big-endian` of `set`.
+	std::function<void()> CompileSet(const std::string &expr) const;
+
+	class Compiler;
+
+	// State of a running program.
+	struct Machine
+	{
+		std::vector<Program::Value> stack;
+		// Texts of arguments with expressions, reused by each call.
+		std::vector<std::string> arg_texts;
+		std::vector<std::string_view> args;
+	};
+
+	// Runs `function` with its registers starting at `base` of the stack.
+	void Execute(const Program &program, int function, size_t base,
+	             Machine &machine, int depth) const;
+
 	std::unordered_map<std::string, FunctionDef> functions;
 	std::unordered_map<std::string, VariableDef> variables;
 	std::unordered_map<std::string, OptionDef> options;
+	std::vector< std::pair<std::string, std::function<void(const std::string&)>> > raw_commands;
+	std::function<void(const std::string&)> number_command;
+	const Buffer *buffer = nullptr;
 };
@@ -0,0 +1,102 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+// Time and heap allocations per call of registered functions, for each way
+// arguments reach them.
+
+#include "HexaScript.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+using namespace std;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+	++allocations;
+	if (void *p = malloc(size ? size : 1))
+	{
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+static int64_t sink = 0;
+
+static void Measure(HexaScript &hs, const char *name, const string &source, int calls)
+{
+	auto program = hs.Compile(source);
+
+	// Once to warm up, so buffers reused between calls exist.
+	hs.Run(*program);
+
+	const size_t allocations_before = allocations;
+	const auto start = chrono::steady_clock::now();
+	hs.Run(*program);
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	printf("%-28s %8.1f ns/call %8.2f allocations/call\n", name,
+	       seconds * 1e9 / calls, (double)(allocations - allocations_before) / calls);
+}
+
+int main()
+{
+	HexaScript hs;
+	hs.RegisterFunction<int, int>("add", [](int a, int b) { sink += a + b; });
+	hs.RegisterFunction<int64_t, int64_t>("add64", [](int64_t a, int64_t b) { sink += a + b; });
+	hs.RegisterFunction<double>("scale", [](double d) { sink += d * 2; });
+	hs.RegisterFunction<string_view>("view", [](string_view v) { sink += v.size(); });
+	hs.RegisterFunction<string>("copy", [](string s) { sink += s.size(); });
+
+	const int calls = 1000000;
+	const string loop = "for i = 0, " + to_string(calls) + "\n";
+
+	Measure(hs, "constant int arguments", loop + "  add 3 4\nend\n", calls);
+	Measure(hs, "constant text argument", loop + "  view \"a text longer than a short string\"\nend\n", calls);
+	Measure(hs, "int64 expressions", loop + "  add64 (i) (i * 2)\nend\n", calls);
+	Measure(hs, "double expression", loop + "  scale (i).5\nend\n", calls);
+	Measure(hs, "string_view expression", loop + "  view \"a text longer than a short string\"(i)\nend\n", calls);
+	Measure(hs, "string expression", loop + "  copy \"a text longer than a short string\"(i)\nend\n", calls);
+
+	// Compiled each time, like commands typed at the prompt.
+	const int lines = calls / 10;
+	const size_t allocations_before = allocations;
+	const auto start = chrono::steady_clock::now();
+	for (int i = 0; i < lines; ++i)
+	{
+		hs.ExecLine("add 3 4");
+	}
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("%-28s %8.1f ns/call %8.2f allocations/call\n", "ExecLine",
+	       seconds * 1e9 / lines, (double)(allocations - allocations_before) / lines);
+
+	return sink == 0;
+}
@@ -87,6 +87,40 @@ void fn_overload_2(string arg1, string arg2)
 	last_arg_2 = arg2;
 }
 
+// Contents of a string, read by scripts.
+class StringBuffer : public HexaScript::Buffer
+{
+public:
+	explicit StringBuffer(const string &contents)
+	  : contents(contents)
+	{
+	}
+
+	uint64_t Size() const override
+	{
+		return contents.size();
+	}
+
+	uint64_t Read(uint64_t pos, void *out, uint64_t length) const override
+	{
+		return pos < contents.size() ? contents.copy(static_cast<char*>(out), length, pos) : 0;
+	}
+
+	uint64_t Cursor() const override
+	{
+		return 2;
+	}
+
+private:
+	string contents;
+};
+
+vector<string> collected;
+void collect(string s)
+{
+	collected.push_back(s);
+}
+
 int main()
 {
 	HexaScript hs;
@@ -178,6 +212,12 @@ int main()
 	hs.ExecLine("arg_copy wqewqewq");
 	EXPECT(last_arg == "wqewqewq");
 
+	// Test unquoted numbers and lists
+	hs.ExecLine("arg_copy -1.5e+3~0.25");
+	EXPECT(last_arg == "-1.5e+3~0.25");
+	hs.ExecLine("arg_copy le,aligned");
+	EXPECT(last_arg == "le,aligned");
+
 	// Test quoted arg
 	hs.ExecLine("arg_copy \"wqewqewq\"");
 	EXPECT(last_arg == "wqewqewq");
@@ -266,7 +306,214 @@ int main()
 	hs.ExecLine("overloaded_fn foo bar");
 	EXPECT(last_arg_cnt == 2 && last_arg_1 == "foo" && last_arg_2 == "bar");
 
-	// TODO test value cast errors
+	// Test value cast errors, found when compiling
+	try
+	{
+		hs.ExecLine("factorial five");
+		FAIL("value cast error");
+	}
+	catch (HexaScript::Error &e)
+	{
+		cerr << e.ErrorInfo() << endl;
+		PASS("value cast error");
+	}
+
+	// Test raw and number commands
+	string raw_text;
+	hs.RegisterRawCommand("find ", [&raw_text](string text) { raw_text = text; });
+	hs.ExecLine("find a \"b\" \\c");
+	EXPECT(raw_text == "a \"b\" \\c");
+
+	string number_text;
+	hs.RegisterNumberCommand([&number_text](string text) { number_text = text; });
+	hs.ExecLine("1234");
+	EXPECT(number_text == "1234");
+
+	// Test compiled programs, run more than once
+	auto program = hs.Compile("multiply 2 3\n"
+	                          "\n"
+	                          "factorial 4\n"
+	                          "set var_int=7\n");
+	EXPECT(program->Size() == 3);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		last_multiplication = -1;
+		last_factorial = -1;
+		var_int = -1;
+		hs.Run(*program);
+		EXPECT(last_multiplication == 6 && last_factorial == 24 && var_int == 7);
+	}
+
+	// Nothing runs if a line does not compile, and the line is named
+	try
+	{
+		last_multiplication = -1;
+		hs.Run(*hs.Compile("multiply 5 5\nno_such_function 1\n"));
+		FAIL("compile error");
+	}
+	catch (HexaScript::Error &e)
+	{
+		cerr << e.ErrorInfo() << endl;
+		EXPECT(e.ErrorInfo().compare(0, 7, "Line 2:") == 0 && last_multiplication == -1);
+	}
+
+	// Test expressions in arguments, evaluated when run
+	hs.RegisterFunction<string>("collect", &collect);
+	hs.ExecLine("collect (1 + 2 * 3)");
+	EXPECT(collected.back() == "7");
+	hs.ExecLine("collect a(2 - 5)b(\"c\" + 1):x");
+	EXPECT(collected.back() == "a-3bc1:x");
+	hs.ExecLine("collect ((7 & 3) << 2 | 1 == 1)");
+	EXPECT(collected.back() == "13");
+	hs.ExecLine("multiply (3 * 3) (-2)");
+	EXPECT(last_multiplication == -18);
+
+	// Test variables, branches and loops
+	collected.clear();
+	hs.Run(*hs.Compile("# Comments are skipped\n"
+	                   "let sum = 0\n"
+	                   "for i = 0, 10\n"
+	                   "  if i % 2 == 0 && i != 4\n"
+	                   "    continue\n"
+	                   "  elif i > 7\n"
+	                   "    break\n"
+	                   "  else\n"
+	                   "    let sum = sum + i\n"
+	                   "  end\n"
+	                   "end\n"
+	                   "let n = 0\n"
+	                   "while n < 3 || n == 3\n"
+	                   "  let n = n + 1\n"
+	                   "end\n"
+	                   "for j = 3, 0, -1\n"
+	                   "  collect (j)\n"
+	                   "end\n"
+	                   "collect (sum):(n)\n"));
+	EXPECT(collected == vector<string>({"3", "2", "1", "20:4"}));
+
+	// Test functions, with recursion and globals
+	collected.clear();
+	hs.Run(*hs.Compile("let calls = 0\n"
+	                   "fn fib(n)\n"
+	                   "  let calls = calls + 1\n"
+	                   "  if n < 2\n"
+	                   "    return n\n"
+	                   "  end\n"
+	                   "  return fib(n - 1) + fib(n - 2)\n"
+	                   "end\n"
+	                   "fn show(a, b)\n"
+	                   "  collect (a + \"=\" + b)\n"
+	                   "end\n"
+	                   "show(\"fib\", fib(10))\n"
+	                   "collect (calls)\n"));
+	EXPECT(collected == vector<string>({"fib=55", "177"}));
+
+	// Test reading from the buffer
+	const string contents("\x01\x02\x03\x04\xfe\xff\xff\xff", 8);
+	StringBuffer buffer(contents);
+	hs.SetBuffer(&buffer);
+
+	hs.ExecLine("collect (u8(0)):(u16le(0)):(u16be(0)):(u32(@)):(i32le(4)):(u32be(4))");
+	EXPECT(collected.back() == "1:513:258:4294837251:-2:4278190079");
+	hs.ExecLine("collect (hex(u64(0))):(filesize()):(len(\"abc\"))");
+	EXPECT(collected.back() == "0xfffffffe04030201:8:3");
+
+	try
+	{
+		hs.Run(*hs.Compile("let pos = 0\n"
+		                   "while 1\n"
+		                   "  let pos = pos + u32(pos)\n"
+		                   "end\n"));
+		FAIL("read past the end");
+	}
+	catch (HexaScript::Error &e)
+	{
+		cerr << e.ErrorInfo() << endl;
+		EXPECT(e.ErrorInfo().compare(0, 7, "Line 3:") == 0);
+	}
+
+	// Test typed arguments, converted once for compiled calls
+	int64_t last_int64 = 0;
+	double last_double = 0;
+	vector<uint8_t> last_bytes;
+	string last_view;
+	hs.RegisterFunction<int64_t, double>("typed",
+	    [&](int64_t i, double d) { last_int64 = i; last_double = d; });
+	hs.RegisterFunction<const vector<uint8_t>&>("bytes",
+	    [&](const vector<uint8_t> &b) { last_bytes = b; });
+	hs.RegisterFunction<string_view>("view",
+	    [&](string_view v) { last_view = string(v); });
+
+	auto typed_program = hs.Compile("typed -9000000000 +1.5e-3\n"
+	                                "bytes 7f454C46\n"
+	                                "view \"a longer text than a short string holds\"\n");
+	for (int i = 0; i < 2; ++i)
+	{
+		last_int64 = 0;
+		last_bytes.clear();
+		last_view.clear();
+		hs.Run(*typed_program);
+		EXPECT(last_int64 == -9000000000 && last_double == 1.5e-3
+		       && last_bytes == vector<uint8_t>({0x7f, 0x45, 0x4c, 0x46})
+		       && last_view == "a longer text than a short string holds");
+	}
+
+	hs.ExecLine("typed (1 << 40) (3).25");
+	EXPECT(last_int64 == (1ll << 40) && last_double == 3.25);
+	hs.ExecLine("view x(-7)y");
+	EXPECT(last_view == "x-7y");
+
+	const char *bad_args[] =
+	{
+		"typed 5x 1",
+		"typed 99999999999999999999 1",
+		"bytes 7f4",
+		"bytes zz",
+		"set var_bool=yes",
+		"typed (\"five\") 1",
+		"multiply (1 << 40) 2",
+	};
+	for (const char *bad_arg : bad_args)
+	{
+		try
+		{
+			hs.ExecLine(bad_arg);
+			FAIL(bad_arg);
+		}
+		catch (HexaScript::Error &e)
+		{
+			cerr << e.ErrorInfo() << endl;
+			PASS(bad_arg);
+		}
+	}
+
+	// Test errors found when compiling
+	const char *bad_programs[] =
+	{
+		"if 1\ncollect a\n",
+		"end\n",
+		"break\n",
+		"collect (no_such_variable)\n",
+		"let x = 1 +\n",
+		"let x = u24(0)\n",
+		"fn f(a)\nend\nlet x = f(1, 2)\n",
+		"while 1\nfn f()\nend\nend\n",
+		"return 1\n",
+	};
+	for (const char *bad_program : bad_programs)
+	{
+		try
+		{
+			hs.Compile(bad_program);
+			FAIL(bad_program);
+		}
+		catch (HexaScript::Error &e)
+		{
+			cerr << e.ErrorInfo() << endl;
+			PASS(bad_program);
+		}
+	}
 
 	return 0;
 }
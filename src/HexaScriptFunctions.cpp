@@ -15,6 +15,8 @@
 // You should have received a copy of the GNU General Public License
 // along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <chrono>
+
 #include <boost/lexical_cast.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 
@@ -22,6 +24,683 @@
 
 using namespace std;
 
+void Hexa::sc_Stats()
+{
+	HexEditor *editor = GetCurrentEditor();
+	FileBuffer *buffer = editor->data;
+
+	int64_t begin = 0;
+	int64_t end = buffer->Size();
+	if (mode == EditorMode::Visual)
+	{
+		begin = min(editor->cursor_pos, editor->selection_start_byte);
+		end = min(end, max(editor->cursor_pos, editor->selection_start_byte) + 1);
+	}
+	if (begin >= end)
+	{
+		SetStatus(StatusType::ERROR, "Nothing to compute statistics of");
+		return;
+	}
+
+	// Each slice is counted into its own histogram on a worker thread, and
+	// they are merged when all are done. A few slices per thread, so threads
+	// finishing early take more.
+	const int64_t kMinSliceLength = 4 << 20;
+	const int64_t length = end - begin;
+	const int64_t slice_count = max<int64_t>(1, min<int64_t>((length + kMinSliceLength - 1) / kMinSliceLength,
+	                                                         worker.ThreadCount() * 4));
+	const int64_t slice_length = (length + slice_count - 1) / slice_count;
+
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const auto start_time = chrono::steady_clock::now();
+
+	const uint64_t buffer_id = buffer->Id();
+	auto histograms = make_shared< vector<ByteHistogram> >(slice_count);
+	auto remaining = make_shared<int64_t>(slice_count);
+
+	for (int64_t slice = 0; slice < slice_count; ++slice)
+	{
+		const int64_t slice_begin = begin + slice * slice_length;
+		const int64_t slice_end = min(end, slice_begin + slice_length);
+
+		worker.Post([this, snapshot, histograms, slice, slice_begin, slice_end]()
+		{
+			ByteHistogram &histogram = (*histograms)[slice];
+
+			// Holes are counted as zeros without reading them.
+			uint64_t data_length = 0;
+			snapshot.ForEachDataSpan(slice_begin, slice_end - slice_begin,
+			    [&](uint64_t, const uint8_t *data, uint64_t span_length)
+			{
+				histogram.Add(data, span_length);
+				data_length += span_length;
+				return !worker.ShuttingDown();
+			});
+			histogram.AddRepeated(0, slice_end - slice_begin - data_length);
+		},
+		[this, buffer_id, begin, end, start_time, histograms, remaining]()
+		{
+			if (--*remaining > 0)
+			{
+				return;
+			}
+
+			auto stats = make_shared<HexEditor::ByteStats>();
+			stats->begin = begin;
+			stats->end = end;
+			for (const ByteHistogram &histogram : *histograms)
+			{
+				stats->histogram.Merge(histogram);
+			}
+			stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+			ForEachEditorOf(buffer_id, [&stats](HexEditor &e) { e.stats = stats; });
+			SetStatus(StatusType::NORMAL, "Press Escape to close statistics");
+		});
+	}
+
+	SetStatus(StatusType::NORMAL, "Computing statistics of " + to_string(length) + " bytes");
+}
+
+void Hexa::sc_Strings(int min_length)
+{
+	if (min_length < 1)
+	{
+		SetStatus(StatusType::ERROR, "Minimum length must be positive");
+		return;
+	}
+
+	HexEditor *editor = GetCurrentEditor();
+	const BufferSnapshot snapshot = editor->data->Snapshot();
+	const int64_t length = snapshot.Size();
+	if (length == 0)
+	{
+		SetStatus(StatusType::ERROR, "Nothing to find strings in");
+		return;
+	}
+
+	if (editor->strings)
+	{
+		editor->strings->cancelled = true;
+	}
+	auto list = make_shared<HexEditor::StringList>();
+	list->min_length = min_length;
+	list->total = length;
+	editor->strings = list;
+
+	// Slices are scanned on worker threads, and their strings are added to
+	// the list as each finishes. Slices cover disjoint ranges of starts, so
+	// each one's strings go in one place.
+	const int64_t kMinSliceLength = 4 << 20;
+	const int64_t slice_count = max<int64_t>(1, min<int64_t>((length + kMinSliceLength - 1) / kMinSliceLength,
+	                                                         worker.ThreadCount() * 4));
+	const int64_t slice_length = (length + slice_count - 1) / slice_count;
+
+	auto remaining = make_shared<int64_t>(slice_count);
+
+	for (int64_t slice = 0; slice < slice_count; ++slice)
+	{
+		const int64_t slice_begin = slice * slice_length;
+		const int64_t slice_end = min(length, slice_begin + slice_length);
+		auto found = make_shared< vector<FoundString> >();
+
+		worker.Post([this, snapshot, list, found, slice_begin, slice_end]()
+		{
+			*found = StringScanner::Scan(snapshot, slice_begin, slice_end, list->min_length,
+			    [this, &list]() { return list->cancelled || worker.ShuttingDown(); });
+		},
+		[this, list, found, remaining, slice_begin, slice_end]()
+		{
+			if (list->cancelled)
+			{
+				return;
+			}
+
+			vector<FoundString> &strings = list->strings;
+			auto pos = lower_bound(strings.begin(), strings.end(), (uint64_t)slice_begin,
+			    [](const FoundString &s, uint64_t p) { return s.begin < p; });
+			strings.insert(pos, make_move_iterator(found->begin()), make_move_iterator(found->end()));
+			list->scanned += slice_end - slice_begin;
+
+			if (--*remaining > 0)
+			{
+				return;
+			}
+			SetStatus(StatusType::NORMAL, to_string(strings.size())
+			          + " strings, ]s and [s move between them, Escape closes the list");
+		});
+	}
+
+	SetStatus(StatusType::NORMAL, "Finding strings of at least " + to_string(min_length) + " characters");
+}
+
+void Hexa::sc_FindValue(string type, string value, string flags)
+try
+{
+	auto search = make_shared<const ValueSearch>(type, value, flags);
+	FindInBackground(search, search->Width(), "", nullptr);
+}
+catch (exception &e)
+{
+	SetStatus(StatusType::ERROR, e.what());
+}
+
+void Hexa::sc_Find(string text)
+try
+{
+	auto search = make_shared<LiteralSearch>(text);
+
+	// Index is only used while it covers the whole file.
+	string note;
+	shared_ptr<MappedFileSource> source = GetCurrentEditor()->data->MappedSource();
+	shared_ptr<const NgramIndex> ngrams = (source ? source->Ngrams() : nullptr);
+	if (ngrams && ngrams->Size() == source->Size() && search->UseIndex(*source, *ngrams))
+	{
+		note = " (" + to_string(search->CandidateBlockCount()) + " of "
+		     + to_string(search->IndexBlockCount()) + " indexed blocks searched)";
+	}
+	FindInBackground(shared_ptr<const LiteralSearch>(search), search->Length(), note, nullptr);
+}
+catch (exception &e)
+{
+	SetStatus(StatusType::ERROR, e.what());
+}
+
+void Hexa::sc_Index()
+{
+	FileBuffer *buffer = GetCurrentEditor()->data;
+	const string &file_name = BufferFileName(buffer);
+	shared_ptr<MappedFileSource> source = buffer->MappedSource();
+	if (!source)
+	{
+		SetStatus(StatusType::ERROR, "Only files on disk can be indexed");
+		return;
+	}
+
+	shared_ptr<const NgramIndex> ngrams = source->Ngrams();
+	if (ngrams && ngrams->Size() == source->Size())
+	{
+		SetStatus(StatusType::NORMAL, "\"" + file_name + "\" is already indexed");
+		return;
+	}
+
+	// Status is copied, the main thread updates it on refreshes.
+	const struct stat st = source->MappedStat();
+	worker.Post([this, source, st]()
+	{
+		shared_ptr<NgramIndex> ngrams = NgramIndex::Load(index_dir, source->FileName(), st, *source);
+		if (!ngrams)
+		{
+			ngrams = NgramIndex::Compute(*source, [this]() { return worker.ShuttingDown(); });
+			if (!ngrams)
+			{
+				return;
+			}
+			ngrams->Save(index_dir, source->FileName(), st);
+		}
+		source->SetNgrams(move(ngrams));
+	},
+	[this, file_name, source]()
+	{
+		if (source->Ngrams())
+		{
+			SetStatus(StatusType::NORMAL, "\"" + file_name + "\" indexed, :find searches only blocks that might match");
+		}
+	});
+
+	SetStatus(StatusType::NORMAL, "Indexing \"" + file_name + "\"");
+}
+
+// Slices are searched on worker threads, and their matches are added to the
+// results as each finishes.
+template <typename Search>
+shared_ptr<HexEditor::SearchResults> Hexa::FindInBackground(shared_ptr<const Search> search,
+                                                             int64_t match_length, const string &note,
+                                                             function<void(shared_ptr<HexEditor::SearchResults>)> done)
+{
+	HexEditor *editor = GetCurrentEditor();
+	const BufferSnapshot snapshot = editor->data->Snapshot();
+	const int64_t length = snapshot.Size();
+
+	if (editor->search)
+	{
+		editor->search->cancelled = true;
+	}
+	auto results = make_shared<HexEditor::SearchResults>();
+	results->description = search->Description();
+	results->length = match_length;
+	results->total = length;
+	editor->search = results;
+
+	// Common values, like u8 0, would match most of the file.
+	const size_t kMaxMatches = 1 << 20;
+
+	auto finish = [this, results, note, done]()
+	{
+		if (!results->cancelled)
+		{
+			results->Truncate(kMaxMatches);
+			ShowSearchStatus(*results, note);
+		}
+		if (done)
+		{
+			done(results);
+		}
+	};
+
+	// Bytes in view are searched first, here, so their matches show up
+	// right away. The rest is split in slices around them, the nearest
+	// ones searched first.
+	const int64_t view_begin = min(editor->first_byte_shown, length);
+	const int64_t view_end = max(view_begin, min(editor->end_byte_shown, length));
+	results->Add(search->Find(snapshot, view_begin, view_end, kMaxMatches, []() { return false; }));
+	results->scanned = view_end - view_begin;
+
+	// Each slice keeps its first matches, so the first of them all are
+	// among those, and slices cover disjoint ranges, so each one's matches
+	// go in one place.
+	const int64_t kMinSliceLength = 4 << 20;
+	const int64_t rest = length - (view_end - view_begin);
+	const int64_t slice_count = max<int64_t>(1, min<int64_t>((rest + kMinSliceLength - 1) / kMinSliceLength,
+	                                                         worker.ThreadCount() * 4));
+	const int64_t slice_length = max<int64_t>(1, (rest + slice_count - 1) / slice_count);
+
+	vector< pair<int64_t, int64_t> > slices;
+	for (int64_t begin = view_end; begin < length; begin += slice_length)
+	{
+		slices.emplace_back(begin, min(length, begin + slice_length));
+	}
+	for (int64_t end = view_begin; end > 0; end -= slice_length)
+	{
+		slices.emplace_back(max<int64_t>(0, end - slice_length), end);
+	}
+	stable_sort(slices.begin(), slices.end(),
+	    [view_begin, view_end](const pair<int64_t, int64_t> &a, const pair<int64_t, int64_t> &b)
+	{
+		auto distance = [view_begin, view_end](const pair<int64_t, int64_t> &slice)
+		{
+			return slice.first >= view_end ? slice.first - view_end : view_begin - slice.second;
+		};
+		return distance(a) < distance(b);
+	});
+
+	if (slices.empty())
+	{
+		finish();
+		return results;
+	}
+
+	auto remaining = make_shared<int64_t>(slices.size());
+
+	for (const auto &slice : slices)
+	{
+		const int64_t slice_begin = slice.first;
+		const int64_t slice_end = slice.second;
+		auto found = make_shared< vector<uint64_t> >();
+
+		worker.Post([this, snapshot, search, results, found, slice_begin, slice_end]()
+		{
+			*found = search->Find(snapshot, slice_begin, slice_end, kMaxMatches,
+			    [this, &results]() { return results->cancelled || worker.ShuttingDown(); });
+		},
+		[results, found, remaining, slice_begin, slice_end, finish]()
+		{
+			if (!results->cancelled)
+			{
+				results->Add(*found);
+				results->scanned += slice_end - slice_begin;
+			}
+			if (--*remaining == 0)
+			{
+				finish();
+			}
+		});
+	}
+
+	SetStatus(StatusType::NORMAL, "Searching for " + search->Description());
+	return results;
+}
+
+// Typed searches in Hexa.cpp use it too.
+template shared_ptr<HexEditor::SearchResults> Hexa::FindInBackground(shared_ptr<const LiteralSearch> search,
+                                                                      int64_t match_length, const string &note,
+                                                                      function<void(shared_ptr<HexEditor::SearchResults>)> done);
+
+void Hexa::ShowSearchStatus(const HexEditor::SearchResults &results, const string &note)
+{
+	const vector<uint64_t> &starts = results.starts;
+	if (starts.empty())
+	{
+		SetStatus(StatusType::ERROR, "No match for " + results.description);
+		return;
+	}
+	SetStatus(StatusType::NORMAL, (results.truncated ? "First " : "")
+	          + to_string(starts.size()) + (starts.size() == 1 ? " match" : " matches")
+	          + " for " + results.description + note
+	          + ", n and N move between them");
+}
+
+void Hexa::sc_Template(string name)
+try
+{
+	// Bare names are of the templates in the runtime directory.
+	string file_name = name;
+	if (name.find('/') == string::npos && name.find('.') == string::npos)
+	{
+		file_name = string(args.runtime_dir_arg) + "/templates/" + name + ".tpl";
+	}
+
+	HexEditor *editor = GetCurrentEditor();
+	editor->structure_template = BinaryTemplate::Load(file_name);
+	editor->structure_template_name = file_name.substr(file_name.rfind('/') + 1);
+	editor->structure = nullptr;
+	editor->structure_shown = true;
+	SetStatus(StatusType::NORMAL, "Template \"" + editor->structure_template_name
+	          + "\" applied, ]f and ]e move between fields and elements");
+}
+catch (exception &e)
+{
+	SetStatus(StatusType::ERROR, e.what());
+}
+
+void Hexa::sc_Tree()
+{
+	HexEditor *editor = GetCurrentEditor();
+	if (!editor->structure_template)
+	{
+		SetStatus(StatusType::ERROR, "No template applied, see :template");
+		return;
+	}
+	editor->structure_shown = !editor->structure_shown;
+	SetStatus(StatusType::NORMAL, editor->structure_shown ? "Structure shown" : "Structure hidden");
+}
+
+void Hexa::sc_Regex(string pattern)
+try
+{
+	auto regex = make_shared<const ByteRegex>(pattern);
+
+	HexEditor *editor = GetCurrentEditor();
+	FileBuffer *buffer = editor->data;
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const uint64_t version = buffer->Version();
+	const uint64_t buffer_id = buffer->Id();
+	const int64_t length = snapshot.Size();
+
+	// Each match is a mark, which are kept in memory and drawn.
+	const size_t kMaxMarks = 100000;
+
+	// Matches of a slice might start in the middle of one from the slice
+	// before, so slices are joined in order when all are done.
+	const int64_t kMinSliceLength = 4 << 20;
+	const int64_t slice_count = max<int64_t>(1, min<int64_t>((length + kMinSliceLength - 1) / kMinSliceLength,
+	                                                         worker.ThreadCount() * 4));
+	const int64_t slice_length = (length + slice_count - 1) / slice_count;
+
+	auto found = make_shared< vector< vector<ByteRegex::Match> > >(slice_count);
+	auto remaining = make_shared<int64_t>(slice_count);
+
+	for (int64_t slice = 0; slice < slice_count; ++slice)
+	{
+		const int64_t slice_begin = slice * slice_length;
+		const int64_t slice_end = min(length, slice_begin + slice_length);
+
+		worker.Post([this, snapshot, regex, found, slice, slice_begin, slice_end]()
+		{
+			(*found)[slice] = regex->Find(snapshot, slice_begin, slice_end, kMaxMarks,
+			    [this]() { return worker.ShuttingDown(); });
+		},
+		[this, buffer_id, version, snapshot, regex, pattern, found, remaining, slice_length]()
+		{
+			if (--*remaining > 0)
+			{
+				return;
+			}
+
+			vector<HexEditor*> editors;
+			if (!ForEachEditorOf(buffer_id, [&editors](HexEditor &e) { editors.push_back(&e); }))
+			{
+				return;
+			}
+			if (editors[0]->data->Version() != version)
+			{
+				SetStatus(StatusType::ERROR, "Buffer changed while searching for /" + pattern + "/");
+				return;
+			}
+
+			vector<ByteRegex::Match> matches = move((*found)[0]);
+			for (size_t slice = 1; slice < found->size() && matches.size() < kMaxMarks; ++slice)
+			{
+				regex->Append(snapshot, matches, (*found)[slice], slice * slice_length);
+			}
+
+			const bool truncated = (matches.size() >= kMaxMarks);
+			if (truncated)
+			{
+				matches.resize(kMaxMarks);
+			}
+			if (matches.empty())
+			{
+				SetStatus(StatusType::ERROR, "No match for /" + pattern + "/");
+				return;
+			}
+
+			for (HexEditor *e : editors)
+			{
+				for (const ByteRegex::Match &match : matches)
+				{
+					e->MarkRange(match.begin, match.end - match.begin, pattern);
+				}
+			}
+			SetStatus(StatusType::NORMAL, (truncated ? "First " : "")
+			          + to_string(matches.size()) + (matches.size() == 1 ? " match" : " matches")
+			          + " of /" + pattern + "/ marked");
+		});
+	}
+
+	SetStatus(StatusType::NORMAL, "Searching for /" + pattern + "/");
+}
+catch (exception &e)
+{
+	SetStatus(StatusType::ERROR, e.what());
+}
+
+void Hexa::sc_Hash(string algorithm)
+{
+	Checksum::Type type;
+	const bool is_checksum = Checksum::FromName(algorithm, type);
+	if (!is_checksum && !Digest::IsKnown(algorithm))
+	{
+		SetStatus(StatusType::ERROR, "Unknown hash \"" + algorithm
+		          + "\", use crc32, crc32c, adler32, md5, sha1 or sha256");
+		return;
+	}
+
+	HexEditor *editor = GetCurrentEditor();
+	FileBuffer *buffer = editor->data;
+
+	// Selection, or the mark under the cursor, or the whole buffer.
+	int64_t begin = 0;
+	int64_t end = buffer->Size();
+	if (mode == EditorMode::Visual)
+	{
+		begin = min(editor->cursor_pos, editor->selection_start_byte);
+		end = min(end, max(editor->cursor_pos, editor->selection_start_byte) + 1);
+	}
+	else if (const auto *mark = editor->GetMarkUnder(editor->cursor_pos))
+	{
+		begin = mark->start_address;
+		end = min(end, mark->start_address + mark->length);
+	}
+	if (begin > end)
+	{
+		SetStatus(StatusType::ERROR, "Nothing to hash");
+		return;
+	}
+
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const auto start_time = chrono::steady_clock::now();
+	const string range = "[" + to_string(begin) + ", " + to_string(end) + ")";
+
+	auto report = [this, algorithm, range, start_time](const string &value, uint64_t read_length,
+	                                                   const string &detail)
+	{
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		char throughput[32] = "";
+		if (read_length > 0)
+		{
+			snprintf(throughput, sizeof(throughput), ", %.0f MB/s", read_length / 1e6 / max(seconds, 1e-6));
+		}
+		SetStatus(StatusType::NORMAL, algorithm + " of " + range + " is " + value
+		          + " (" + detail + throughput + ")");
+	};
+
+	if (!is_checksum)
+	{
+		// Digests can not be split, stream the range on one thread. Holes
+		// are hashed from a block of zeros rather than read.
+		auto digest = make_shared<string>();
+		worker.Post([this, snapshot, algorithm, begin, end, digest]()
+		{
+			static const vector<uint8_t> zeros(1 << 16);
+			Digest d(algorithm);
+			uint64_t pos = begin;
+			auto update_zeros = [&](uint64_t zeros_end)
+			{
+				while (pos < zeros_end && !worker.ShuttingDown())
+				{
+					const uint64_t length = min<uint64_t>(zeros_end - pos, zeros.size());
+					d.Update(zeros.data(), length);
+					pos += length;
+				}
+			};
+			snapshot.ForEachDataSpan(begin, end - begin, [&](uint64_t span_pos, const uint8_t *data, uint64_t span_length)
+			{
+				update_zeros(span_pos);
+				d.Update(data, span_length);
+				pos = span_pos + span_length;
+				return !worker.ShuttingDown();
+			});
+			update_zeros(end);
+			*digest = d.HexFinal();
+		},
+		[report, begin, end, digest]()
+		{
+			report(*digest, end - begin, to_string(end - begin) + " bytes");
+		});
+
+		SetStatus(StatusType::NORMAL, "Computing " + algorithm + " of " + to_string(end - begin) + " bytes");
+		return;
+	}
+
+	// Checksums are computed by chunks, which are then combined. Chunks
+	// with the same contents as in the last run of the same checksum are
+	// not read again.
+	const int64_t kChunkLength = 1 << 20;
+	const int64_t chunk_count = (end - begin + kChunkLength - 1) / kChunkLength;
+
+	auto cache = make_shared<ChecksumCache>();
+	cache->buffer_id = buffer->Id();
+	cache->type = type;
+	cache->begin = begin;
+	cache->end = end;
+	cache->snapshot = snapshot;
+	cache->chunk_values.resize(chunk_count);
+
+	const shared_ptr<const ChecksumCache> last = checksum_cache;
+	const bool reusable = last && last->buffer_id == buffer->Id() && last->type == type
+	                   && last->begin == begin && last->end == end;
+
+	vector<int64_t> changed;
+	for (int64_t chunk = 0; chunk < chunk_count; ++chunk)
+	{
+		const int64_t chunk_begin = begin + chunk * kChunkLength;
+		const int64_t chunk_length = min(end, chunk_begin + kChunkLength) - chunk_begin;
+		if (reusable && snapshot.SameContents(last->snapshot, chunk_begin, chunk_length))
+		{
+			cache->chunk_values[chunk] = last->chunk_values[chunk];
+		}
+		else
+		{
+			changed.push_back(chunk);
+		}
+	}
+
+	auto done = [this, type, cache, changed, chunk_count, report]()
+	{
+		uint32_t value = Checksum::Initial(type);
+		for (int64_t chunk = 0; chunk < chunk_count; ++chunk)
+		{
+			const int64_t chunk_begin = cache->begin + chunk * kChunkLength;
+			const int64_t chunk_length = min(cache->end, chunk_begin + kChunkLength) - chunk_begin;
+			value = Checksum::Combine(type, value, cache->chunk_values[chunk], chunk_length);
+		}
+		checksum_cache = cache;
+
+		uint64_t read_length = 0;
+		for (int64_t chunk : changed)
+		{
+			read_length += min(cache->end, cache->begin + (chunk + 1) * kChunkLength)
+			             - (cache->begin + chunk * kChunkLength);
+		}
+
+		char hex[16];
+		snprintf(hex, sizeof(hex), "%08x", value);
+		report(hex, read_length, to_string(changed.size()) + " of " + to_string(chunk_count)
+		       + " chunks read, " + Checksum::Implementation(type));
+	};
+
+	if (changed.empty())
+	{
+		done();
+		return;
+	}
+
+	// Changed chunks are split in slices over the worker threads.
+	const int64_t slice_count = min<int64_t>(changed.size(), worker.ThreadCount() * 4);
+	const int64_t slice_length = (changed.size() + slice_count - 1) / slice_count;
+	auto remaining = make_shared<int64_t>(slice_count);
+
+	for (int64_t slice = 0; slice < slice_count; ++slice)
+	{
+		const int64_t first = slice * slice_length;
+		const int64_t last_changed = min<int64_t>(changed.size(), first + slice_length);
+
+		worker.Post([this, type, cache, changed, first, last_changed]()
+		{
+			for (int64_t i = first; i < last_changed && !worker.ShuttingDown(); ++i)
+			{
+				const int64_t chunk_begin = cache->begin + changed[i] * kChunkLength;
+				const int64_t chunk_length = min(cache->end, chunk_begin + kChunkLength) - chunk_begin;
+
+				// Holes are zeros, which are combined in without reading them.
+				uint32_t value = Checksum::Initial(type);
+				int64_t pos = chunk_begin;
+				cache->snapshot.ForEachDataSpan(chunk_begin, chunk_length,
+				    [&](uint64_t span_pos, const uint8_t *data, uint64_t span_length)
+				{
+					value = Checksum::UpdateZeros(type, value, span_pos - pos);
+					value = Checksum::Update(type, value, data, span_length);
+					pos = span_pos + span_length;
+					return true;
+				});
+				value = Checksum::UpdateZeros(type, value, chunk_begin + chunk_length - pos);
+				cache->chunk_values[changed[i]] = value;
+			}
+		},
+		[remaining, done]()
+		{
+			if (--*remaining > 0)
+			{
+				return;
+			}
+			done();
+		});
+	}
+
+	SetStatus(StatusType::NORMAL, "Computing " + algorithm + " of " + to_string(end - begin) + " bytes");
+}
+
 void Hexa::sc_SwitchToTab(int tab_no)
 {
 	if (tab_no > (int)tabs.size() || tab_no < 1)
@@ -38,39 +717,176 @@ void Hexa::sc_Quit()
 	quit_requested = true;
 }
 
+void Hexa::sc_Diff(int tab_no)
+{
+	if (tab_no > (int)tabs.size() || tab_no < 1)
+	{
+		SetStatus(StatusType::ERROR, "No such tab: " + to_string(tab_no));
+		return;
+	}
+	if (tab_no - 1 == current_tab)
+	{
+		SetStatus(StatusType::ERROR, "Can not compare a tab with itself");
+		return;
+	}
+
+	HexEditor *editor = GetCurrentEditor();
+	const TabInfo &other = tabs[tab_no - 1];
+
+	if (editor->diff)
+	{
+		editor->diff->Cancel();
+	}
+	editor->diff = make_shared<BufferDiff>(editor->data->Snapshot(), other.editor.data->Snapshot());
+	editor->diff_file_name = other.file_name;
+	editor->diff_version = editor->data->Version();
+	editor->diff_first_row = BufferDiff::Row{0, 0};
+	editor->diff_first_byte = 0;
+	editor->diff_hunk_count = 0;
+
+	ComputeDiff(editor->diff);
+	SetStatus(StatusType::NORMAL, "Comparing with " + other.file_name);
+}
+
 void Hexa::sc_Exec(string file_name)
 {
 	LoadScriptFile(file_name);
 }
 
-void Hexa::sc_MarkAbsoluteRange(string range, string comment)
+void Hexa::sc_Goto(string number)
 {
-	int offset, length;
+	int64_t new_pos;
 	try
 	{
-		size_t sep = range.find(':');
-		if (sep == string::npos)
+		new_pos = stoll(number);
+	}
+	catch (out_of_range &ex)
+	{
+		new_pos = -1;
+	}
+
+	if (new_pos < 0 || new_pos >= (int64_t)GetCurrentEditor()->data->Size())
+	{
+		SetStatus(StatusType::ERROR, "Position out of file boundary: " + number);
+	}
+	else
+	{
+		GetCurrentEditor()->cursor_pos = new_pos;
+	}
+}
+
+void Hexa::sc_Follow()
+{
+	HexEditor *editor = GetCurrentEditor();
+	const string &file_name = BufferFileName(editor->data);
+
+	if (!editor->following)
+	{
+		if (editor->data->IsGrowing())
+		{
+			SetStatus(StatusType::ERROR, "Stream is already followed while being read");
+			return;
+		}
+		if (!editor->data->MappedSource())
+		{
+			SetStatus(StatusType::ERROR, "Only files on disk can be followed");
+			return;
+		}
+		if (!file_watcher.IsWatched(file_name))
+		{
+			SetStatus(StatusType::ERROR, "Unable to watch \"" + file_name + "\"");
+			return;
+		}
+
+		// Catch up with what was appended since the file is opened.
+		editor->data->Refresh();
+		editor->JumpToFileEnd();
+	}
+
+	const bool following = !editor->following;
+	for (TabInfo &ti : tabs)
+	{
+		if (ti.editor.data == editor->data)
+		{
+			ti.editor.following = following;
+		}
+	}
+
+	SetStatus(StatusType::NORMAL, following ? "Following \"" + file_name + "\""
+	                                        : "Stopped following \"" + file_name + "\"");
+}
+
+void Hexa::sc_Reload()
+{
+	FileBuffer *buffer = GetCurrentEditor()->data;
+	const string &file_name = BufferFileName(buffer);
+
+	if (!buffer->MappedSource())
+	{
+		SetStatus(StatusType::ERROR, "Only files on disk can be reloaded");
+		return;
+	}
+
+	auto new_source = make_shared<MappedFileSource>(file_name);
+	if (!new_source->Data())
+	{
+		SetStatus(StatusType::ERROR, "Unable to open \"" + file_name + "\"");
+		return;
+	}
+
+	// Indexing reads the whole file, done in background. Only blocks with
+	// different fingerprints are then replaced in the buffer.
+	const uint64_t buffer_id = buffer->Id();
+	IndexBlocks(new_source, [this, buffer_id, file_name, new_source]()
+	{
+		auto it = file_contents.find(file_name);
+		if (it == file_contents.end() || it->second->Id() != buffer_id)
 		{
-			throw invalid_argument("Invalid range");
+			return;
 		}
-		offset = stoi(range.substr(0, sep));
-		length = stoi(range.substr(sep + 1));
+		FileBuffer *buffer = it->second.get();
+
+		const auto changed = buffer->Reload(new_source);
+		changed_on_disk.erase(buffer);
 
-		if (offset < 0 || length <= 0)
+		// Cursors and marks stay at the same offsets.
+		BufferShrunk(buffer);
+
+		uint64_t changed_bytes = 0;
+		for (const auto &range : changed)
 		{
-			throw invalid_argument("Invalid range");
+			changed_bytes += min(range.second, new_source->Size()) - min(range.first, new_source->Size());
 		}
+		SetStatus(StatusType::NORMAL, "\"" + file_name + "\" reloaded, "
+		    + to_string(changed_bytes) + " bytes changed in " + to_string(changed.size()) + " ranges");
+	});
+
+	SetStatus(StatusType::NORMAL, "Reloading \"" + file_name + "\"");
+}
+
+void Hexa::sc_MarkAbsoluteRange(string_view range, const string &comment)
+{
+	int64_t offset, length;
+	if (!Mark::ParseRange(range, offset, length))
+	{
+		SetStatus(StatusType::ERROR, "Invalid range");
+		return;
 	}
-	catch (std::exception &e)
+	sc_MarkRange(offset, length, comment);
+}
+
+void Hexa::sc_MarkRange(int64_t offset, int64_t length, const string &comment)
+{
+	if (offset < 0 || length <= 0)
 	{
-		SetStatus(StatusType::ERROR, e.what());
+		SetStatus(StatusType::ERROR, "Invalid range");
 		return;
 	}
 
 	GetCurrentEditor()->MarkRange(offset, length, comment);
 
 	SetStatus(StatusType::NORMAL,
-	    "Marked, total marks = " + to_string(GetCurrentEditor()->marks.size()));
+	    "Marked, total marks = " + to_string(GetCurrentEditor()->marks.Size()));
 }
 
 void Hexa::sc_MarkSelection(string comment)
@@ -84,7 +900,188 @@ void Hexa::sc_MarkSelection(string comment)
 	GetCurrentEditor()->MarkSelection(comment);
 
 	SetStatus(StatusType::NORMAL,
-	    "Marked, total marks = " + to_string(GetCurrentEditor()->marks.size()));
+	    "Marked, total marks = " + to_string(GetCurrentEditor()->marks.Size()));
+}
+
+void Hexa::sc_Minimap()
+{
+	HexEditor *editor = GetCurrentEditor();
+	editor->minimap_shown = !editor->minimap_shown;
+
+	// Entropy index is computed on the next render.
+	SetStatus(StatusType::NORMAL, editor->minimap_shown ? "Minimap shown" : "Minimap hidden");
+}
+
+// :s/PATTERN/REPLACEMENT/g, both hex. Matches are found on worker threads
+// like :find's, then replaced in one edit of the piece table.
+void Hexa::sc_Substitute(string expression)
+try
+{
+	const size_t pattern_end = expression.find('/');
+	if (pattern_end == string::npos)
+	{
+		throw invalid_argument("Expected s/PATTERN/REPLACEMENT/ with hex bytes");
+	}
+
+	// Last slash can be left out when there are no flags.
+	size_t replacement_end = expression.find('/', pattern_end + 1);
+	if (replacement_end == string::npos)
+	{
+		replacement_end = expression.size();
+		expression += '/';
+	}
+
+	const string pattern_hex = expression.substr(0, pattern_end);
+	const string replacement = LiteralSearch::ParseHex(expression.substr(pattern_end + 1, replacement_end - pattern_end - 1));
+	const string flags = expression.substr(replacement_end + 1);
+	if (flags != "" && flags != "g")
+	{
+		throw invalid_argument("Unknown flags \"" + flags + "\", only g is supported");
+	}
+	const bool global = (flags == "g");
+
+	auto search = make_shared<LiteralSearch>(LiteralSearch::ParseHex(pattern_hex), pattern_hex);
+	const int64_t match_length = search->Length();
+
+	HexEditor *editor = GetCurrentEditor();
+	FileBuffer *buffer = editor->data;
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const uint64_t version = buffer->Version();
+	const uint64_t buffer_id = buffer->Id();
+
+	int64_t begin = 0;
+	int64_t end = snapshot.Size();
+	if (mode == EditorMode::Visual)
+	{
+		begin = min(editor->cursor_pos, editor->selection_start_byte);
+		end = min(end, max(editor->cursor_pos, editor->selection_start_byte) + 1);
+	}
+
+	shared_ptr<MappedFileSource> source = buffer->MappedSource();
+	shared_ptr<const NgramIndex> ngrams = (source ? source->Ngrams() : nullptr);
+	if (ngrams && ngrams->Size() == source->Size())
+	{
+		search->UseIndex(*source, *ngrams);
+	}
+
+	// Every replacement is a piece of the new table.
+	const size_t kMaxReplacements = 1 << 22;
+
+	// Only matches starting at or after `end - match_length` would go past
+	// the end, so slices stop there.
+	const int64_t last_start = end - match_length + 1;
+	const int64_t length = max<int64_t>(0, last_start - begin);
+	const int64_t kMinSliceLength = 4 << 20;
+	const int64_t slice_count = max<int64_t>(1, min<int64_t>((length + kMinSliceLength - 1) / kMinSliceLength,
+	                                                         worker.ThreadCount() * 4));
+	const int64_t slice_length = (length + slice_count - 1) / slice_count;
+
+	const auto start_time = chrono::steady_clock::now();
+	auto found = make_shared< vector< vector<uint64_t> > >(slice_count);
+	auto remaining = make_shared<int64_t>(slice_count);
+
+	for (int64_t slice = 0; slice < slice_count; ++slice)
+	{
+		const int64_t slice_begin = begin + slice * slice_length;
+		const int64_t slice_end = min(last_start, slice_begin + slice_length);
+
+		worker.Post([this, snapshot, search, found, slice, slice_begin, slice_end, global]()
+		{
+			if (slice_begin < slice_end)
+			{
+				(*found)[slice] = search->Find(snapshot, slice_begin, slice_end, global ? kMaxReplacements + 1 : 1,
+				    [this]() { return worker.ShuttingDown(); });
+			}
+		},
+		[this, buffer_id, version, begin, end, match_length, replacement, global, pattern_hex,
+		 start_time, found, remaining]()
+		{
+			if (--*remaining > 0)
+			{
+				return;
+			}
+
+			vector<HexEditor*> editors;
+			if (!ForEachEditorOf(buffer_id, [&editors](HexEditor &e) { editors.push_back(&e); }))
+			{
+				return;
+			}
+			FileBuffer *buffer = editors[0]->data;
+			if (buffer->Version() != version)
+			{
+				SetStatus(StatusType::ERROR, "Buffer changed while searching for " + pattern_hex);
+				return;
+			}
+
+			// Matches are taken left to right, skipping those overlapping
+			// the one before, like "aa" in "aaa" is replaced once.
+			vector<uint64_t> starts;
+			for (const vector<uint64_t> &slice_found : *found)
+			{
+				if (slice_found.size() > kMaxReplacements)
+				{
+					SetStatus(StatusType::ERROR, "More than " + to_string(kMaxReplacements)
+					          + " matches of " + pattern_hex + ", nothing replaced");
+					return;
+				}
+				for (uint64_t start : slice_found)
+				{
+					if (starts.empty() || start >= starts.back() + match_length)
+					{
+						starts.push_back(start);
+					}
+				}
+				if (!global && !starts.empty())
+				{
+					break;
+				}
+			}
+			if (starts.size() > kMaxReplacements)
+			{
+				SetStatus(StatusType::ERROR, "More than " + to_string(kMaxReplacements)
+				          + " matches of " + pattern_hex + ", nothing replaced");
+				return;
+			}
+			if (starts.empty())
+			{
+				SetStatus(StatusType::ERROR, "No match for " + pattern_hex);
+				return;
+			}
+
+			buffer->ReplaceAll(starts, match_length, replacement.data(), replacement.size());
+
+			for (HexEditor *e : editors)
+			{
+				// Highlighted matches are at old offsets.
+				if (e->search)
+				{
+					e->search->cancelled = true;
+					e->search = nullptr;
+				}
+				if (e->cursor_pos >= (int64_t)buffer->Size())
+				{
+					e->JumpToFileEnd();
+				}
+			}
+
+			// Without g slices stop at their first match, so not everything is read.
+			char throughput[64] = "";
+			if (global)
+			{
+				const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+				snprintf(throughput, sizeof(throughput), " in %.2f s, %.0f MB/s",
+				         seconds, (end - begin) / 1e6 / max(seconds, 1e-6));
+			}
+			SetStatus(StatusType::NORMAL, "Replaced " + to_string(starts.size())
+			          + (starts.size() == 1 ? " match" : " matches") + " of " + pattern_hex + throughput);
+		});
+	}
+
+	SetStatus(StatusType::NORMAL, "Replacing " + pattern_hex);
+}
+catch (exception &e)
+{
+	SetStatus(StatusType::ERROR, e.what());
 }
 
 void Hexa::sc_Replace(string type, string value)
@@ -0,0 +1,86 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "IndexCache.hpp"
+
+using namespace std;
+
+string IndexCacheFileName(const string &index_dir, const string &file_name, const string &extension)
+{
+	if (index_dir.empty())
+	{
+		return "";
+	}
+
+	char *real_path = realpath(file_name.c_str(), nullptr);
+	if (!real_path)
+	{
+		return "";
+	}
+
+	// FNV-1a of the absolute path.
+	uint64_t hash = 14695981039346656037ull;
+	for (const char *c = real_path; *c; ++c)
+	{
+		hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+	}
+	free(real_path);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+	return index_dir + "/" + name + extension;
+}
+
+bool WriteIndexCacheFile(const string &index_dir,
+                         const string &cache_file_name,
+                         const function<void(ofstream&)> &write)
+{
+	if (index_dir.empty() || cache_file_name.empty())
+	{
+		return false;
+	}
+
+	// Create parent directories as needed.
+	for (size_t sep = index_dir.find('/', 1); ; sep = index_dir.find('/', sep + 1))
+	{
+		mkdir(index_dir.substr(0, sep).c_str(), 0755);
+		if (sep == string::npos)
+		{
+			break;
+		}
+	}
+
+	const string tmp_name = cache_file_name + "." + to_string(getpid());
+	{
+		ofstream file(tmp_name, ios::binary | ios::trunc);
+		write(file);
+
+		if (!file)
+		{
+			unlink(tmp_name.c_str());
+			return false;
+		}
+	}
+	return rename(tmp_name.c_str(), cache_file_name.c_str()) == 0;
+}
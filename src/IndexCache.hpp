@@ -0,0 +1,53 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <string>
+
+// Files derived from opened files, like seek indexes of compressed files,
+// are cached in an index directory so they are not computed again. It is
+// one directory for all files, ~/.config/hexa/index, rather than next to
+// each file, which might be read only or shared.
+//
+// Cache files are named after a hash of the absolute path of the file they
+// are derived from. Returns "" if the path can not be resolved.
+std::string IndexCacheFileName(const std::string &index_dir,
+                               const std::string &file_name,
+                               const std::string &extension);
+
+// Creates the index directory as needed, calls `write` on a file aside and
+// renames it to `cache_file_name`, so other instances never read half of
+// it. Returns false if anything fails.
+bool WriteIndexCacheFile(const std::string &index_dir,
+                         const std::string &cache_file_name,
+                         const std::function<void(std::ofstream&)> &write);
+
+// Cache files are only read on the machine that wrote them, fields are in
+// native byte order.
+template <typename T>
+void WriteIndexField(std::ofstream &file, const T &value)
+{
+	file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool ReadIndexField(std::ifstream &file, T &value)
+{
+	return bool(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
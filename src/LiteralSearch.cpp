@@ -0,0 +1,285 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "ByteSource.hpp"
+#include "LiteralSearch.hpp"
+#include "NgramIndex.hpp"
+
+using namespace std;
+
+LiteralSearch::LiteralSearch(const string &text)
+  : description("\"" + text + "\"")
+{
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		if (text[i] != '\\')
+		{
+			bytes.push_back(text[i]);
+			continue;
+		}
+
+		if (++i == text.size())
+		{
+			throw invalid_argument("Text ends with \\");
+		}
+		switch (text[i])
+		{
+		case 'x':
+			if (i + 2 >= text.size() || !isxdigit((uint8_t)text[i + 1]) || !isxdigit((uint8_t)text[i + 2]))
+			{
+				throw invalid_argument("Expected two hex digits after \\x");
+			}
+			bytes.push_back((char)stoi(text.substr(i + 1, 2), nullptr, 16));
+			i += 2;
+			break;
+		case 'n':
+			bytes.push_back('\n');
+			break;
+		case 'r':
+			bytes.push_back('\r');
+			break;
+		case 't':
+			bytes.push_back('\t');
+			break;
+		case '0':
+			bytes.push_back('\0');
+			break;
+		case '\\':
+			bytes.push_back('\\');
+			break;
+		default:
+			throw invalid_argument(string("Unknown escape \\") + text[i]);
+		}
+	}
+
+	if (bytes.empty())
+	{
+		throw invalid_argument("Nothing to find");
+	}
+}
+
+LiteralSearch::LiteralSearch(string bytes, string description)
+  : bytes(move(bytes)), description(move(description))
+{
+	if (this->bytes.empty())
+	{
+		throw invalid_argument("Nothing to find");
+	}
+}
+
+string LiteralSearch::ParseHex(const string &hex)
+{
+	string bytes;
+	int high = -1;
+	for (char c : hex)
+	{
+		if (c == ' ')
+		{
+			continue;
+		}
+		if (!isxdigit((uint8_t)c))
+		{
+			throw invalid_argument(string("Not a hex digit: ") + c);
+		}
+
+		const int digit = isdigit((uint8_t)c) ? c - '0' : tolower((uint8_t)c) - 'a' + 10;
+		if (high < 0)
+		{
+			high = digit;
+		}
+		else
+		{
+			bytes.push_back((char)(high << 4 | digit));
+			high = -1;
+		}
+	}
+
+	if (high >= 0)
+	{
+		throw invalid_argument("Hex digits should come in pairs");
+	}
+	return bytes;
+}
+
+bool LiteralSearch::UseIndex(const ByteSource &source, const NgramIndex &index)
+{
+	if (!index.CandidateBlocks(bytes, candidates))
+	{
+		return false;
+	}
+
+	indexed_data = source.Data();
+	indexed_size = index.Size();
+	index_block_count = index.BlockCount();
+	candidate_block_count = 0;
+	for (uint64_t word : candidates)
+	{
+		candidate_block_count += __builtin_popcountll(word);
+	}
+	return true;
+}
+
+void LiteralSearch::FindInSpan(const uint8_t *data, uint64_t data_pos, uint64_t from, uint64_t to,
+                               vector<uint64_t> &found, size_t limit) const
+{
+	const uint64_t length = bytes.size();
+
+	auto search = [&](uint64_t run_from, uint64_t run_to)
+	{
+		const uint8_t *p = data + run_from;
+		const uint8_t *run_end = data + run_to;
+		while (p < run_end && found.size() < limit)
+		{
+			const void *match = memmem(p, run_end - p + length - 1, bytes.data(), length);
+			if (!match)
+			{
+				return;
+			}
+			p = static_cast<const uint8_t*>(match);
+			found.push_back(data_pos + (p - data));
+			++p;
+		}
+	};
+
+	// Spans are contiguous in their source, so a span of the indexed one is
+	// in it as a whole, unless the source grew since it was indexed.
+	if (!indexed_data || data < indexed_data || data + to + length - 1 > indexed_data + indexed_size)
+	{
+		search(from, to);
+		return;
+	}
+
+	// Runs of candidate blocks are searched, as matches might cross from
+	// one to the next.
+	const uint64_t source_pos = data - indexed_data;
+	const uint64_t block_size = NgramIndex::kBlockSize;
+	uint64_t block = (source_pos + from) / block_size;
+	const uint64_t last_block = (source_pos + to - 1) / block_size;
+
+	while (block <= last_block && found.size() < limit)
+	{
+		if (candidates[block / 64] >> (block % 64) == 0)
+		{
+			// No candidates left in this word.
+			block = (block / 64 + 1) * 64;
+			continue;
+		}
+		if (!(candidates[block / 64] & (1ull << (block % 64))))
+		{
+			++block;
+			continue;
+		}
+
+		const uint64_t run_begin = block;
+		while (block <= last_block && (candidates[block / 64] & (1ull << (block % 64))))
+		{
+			++block;
+		}
+
+		const uint64_t run_from = max(from, run_begin * block_size - min(source_pos, run_begin * block_size));
+		const uint64_t run_to = min(to, block * block_size - source_pos);
+		if (run_from < run_to)
+		{
+			search(run_from, run_to);
+		}
+	}
+}
+
+vector<uint64_t> LiteralSearch::Find(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+                                     size_t limit, const function<bool()> &cancelled) const
+{
+	vector<uint64_t> found;
+
+	const uint64_t length = bytes.size();
+	const uint64_t size = snapshot.Size();
+	end = min(end, size < length ? 0 : size - length + 1);
+	if (begin >= end)
+	{
+		return found;
+	}
+
+	// Starts before this are searched. Matches crossing from a span to the
+	// next are looked for in a copy of the bytes around the junction.
+	uint64_t searched = begin;
+	vector<uint8_t> junction;
+
+	auto search_junction = [&](uint64_t junction_end)
+	{
+		junction_end = min(junction_end, end);
+		if (searched >= junction_end)
+		{
+			return;
+		}
+		junction.resize(junction_end - searched + length - 1);
+		snapshot.Read(searched, junction.data(), junction.size());
+		FindInSpan(junction.data(), searched, 0, junction_end - searched, found, limit);
+		searched = junction_end;
+	};
+
+	snapshot.ForEachSpan(begin, end + length - 1 - begin,
+	    [&](uint64_t pos, const uint8_t *data, uint64_t span_length)
+	{
+		search_junction(pos);
+
+		// Starts whose matches end in the span.
+		if (span_length >= length && found.size() < limit)
+		{
+			const uint64_t span_end = min(pos + span_length - length + 1, end);
+			if (searched < span_end)
+			{
+				FindInSpan(data, pos, searched - pos, span_end - pos, found, limit);
+				searched = span_end;
+			}
+		}
+		return found.size() < limit && !cancelled();
+	});
+
+	if (found.size() < limit)
+	{
+		search_junction(end);
+	}
+	if (found.size() > limit)
+	{
+		found.resize(limit);
+	}
+	return found;
+}
+
+vector<uint64_t> LiteralSearch::FindAt(const BufferSnapshot &snapshot, const vector<uint64_t> &starts,
+                                       const function<bool()> &cancelled) const
+{
+	vector<uint64_t> found;
+	vector<uint8_t> at(bytes.size());
+
+	for (size_t i = 0; i < starts.size(); ++i)
+	{
+		if (i % 4096 == 0 && cancelled())
+		{
+			break;
+		}
+		if (snapshot.Read(starts[i], at.data(), at.size()) == at.size()
+		    && memcmp(at.data(), bytes.data(), at.size()) == 0)
+		{
+			found.push_back(starts[i]);
+		}
+	}
+	return found;
+}
@@ -0,0 +1,95 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FileBuffer.hpp"
+
+class ByteSource;
+class NgramIndex;
+
+// Bytes searched for by :find. Parts of the buffer coming from an indexed
+// source are only searched in blocks the index says can have a match.
+class LiteralSearch
+{
+public:
+	// Text might have \xHH, \n, \r, \t, \0 and \\ escapes for bytes. Throws
+	// invalid_argument if an escape is not valid, or there are no bytes.
+	explicit LiteralSearch(const std::string &text);
+
+	// Searches for `bytes` as they are, `description` is for messages.
+	LiteralSearch(std::string bytes, std::string description);
+
+	// Bytes of hex digit pairs like "de ad be ef", spaces are skipped.
+	// Throws invalid_argument for other characters or an odd digit.
+	static std::string ParseHex(const std::string &hex);
+
+	int64_t Length() const
+	{
+		return bytes.size();
+	}
+
+	// Like "\"PK\\x03\\x04\"", for messages.
+	const std::string& Description() const
+	{
+		return description;
+	}
+
+	// Takes candidate blocks from the index of `source`. Returns false if
+	// the bytes are too short to use it.
+	bool UseIndex(const ByteSource &source, const NgramIndex &index);
+
+	// Blocks of the index, and how many of them are searched.
+	uint64_t IndexBlockCount() const
+	{
+		return index_block_count;
+	}
+	uint64_t CandidateBlockCount() const
+	{
+		return candidate_block_count;
+	}
+
+	// Offsets of matches starting in [begin, end), the first `limit` ones.
+	std::vector<uint64_t> Find(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+	                           size_t limit, const std::function<bool()> &cancelled) const;
+
+	// Those of `starts` a match is at, like when the bytes of an earlier
+	// search are extended.
+	std::vector<uint64_t> FindAt(const BufferSnapshot &snapshot, const std::vector<uint64_t> &starts,
+	                             const std::function<bool()> &cancelled) const;
+
+private:
+	// Appends offsets of matches at positions [from, to) of `data`, whose
+	// first byte is at `data_pos`. `data` has Length() - 1 bytes after `to`.
+	void FindInSpan(const uint8_t *data, uint64_t data_pos, uint64_t from, uint64_t to,
+	                std::vector<uint64_t> &found, size_t limit) const;
+
+	std::string bytes;
+	std::string description;
+
+	// Source the candidates are for, and a bit per block of it.
+	const uint8_t *indexed_data = nullptr;
+	uint64_t indexed_size = 0;
+	std::vector<uint64_t> candidates;
+	uint64_t index_block_count = 0;
+	uint64_t candidate_block_count = 0;
+};
@@ -0,0 +1,55 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <charconv>
+
+#include "MarkProvider.hpp"
+
+using namespace std;
+
+bool Mark::ParseRange(string_view range, int64_t &offset, int64_t &length)
+{
+	// Parsed in place, scripts mark many ranges.
+	auto parse = [](string_view text, int64_t &value)
+	{
+		auto result = from_chars(text.data(), text.data() + text.size(), value);
+		return result.ec == errc() && result.ptr == text.data() + text.size();
+	};
+
+	const size_t sep = range.find(':');
+	return sep != string_view::npos && parse(range.substr(0, sep), offset) && parse(range.substr(sep + 1), length);
+}
+
+void MarkSet::Add(int64_t offset, int64_t length, const string &comment)
+{
+	// TODO prevent overlapping comments, as they'd be hard for rendering.
+	marks.insert(Mark{offset, length, comment});
+	max_length = max(max_length, length);
+}
+
+void MarkSet::MarksIn(int64_t begin, int64_t end, vector<Mark> &out)
+{
+	const Mark key{max(begin - max_length, (int64_t)0), 0, string()};
+	for (auto it = marks.lower_bound(key); it != marks.end() && it->start_address < end; ++it)
+	{
+		if (it->start_address + it->length > begin)
+		{
+			out.push_back(*it);
+		}
+	}
+}
@@ -0,0 +1,74 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Range of bytes drawn in a color, with a comment under it.
+struct Mark
+{
+	int64_t start_address;
+	int64_t length;
+	std::string comment;
+
+	bool operator<(const Mark &o) const
+	{
+		return start_address < o.start_address;
+	}
+
+	// Parses `OFFSET:LENGTH`, as given to the mark command. Returns false
+	// if it is not two integers.
+	static bool ParseRange(std::string_view range, int64_t &offset, int64_t &length);
+};
+
+// Source of marks. The editor asks only for the rows it shows, so marks of
+// structures repeated through a large file are made as they are scrolled
+// to, rather than all up front.
+class MarkProvider
+{
+public:
+	virtual ~MarkProvider() {}
+
+	// Appends marks overlapping [begin, end).
+	virtual void MarksIn(int64_t begin, int64_t end, std::vector<Mark> &out) = 0;
+};
+
+// Marks made by the user, like with :mark.
+class MarkSet : public MarkProvider
+{
+public:
+	// Ignored if there is a mark starting at the same offset.
+	void Add(int64_t offset, int64_t length, const std::string &comment);
+
+	size_t Size() const
+	{
+		return marks.size();
+	}
+
+	void MarksIn(int64_t begin, int64_t end, std::vector<Mark> &out) override;
+
+private:
+	// Sorted by start, and none is longer than `max_length`, so only the
+	// ones starting shortly before a range are looked at.
+	std::set<Mark> marks;
+	int64_t max_length = 0;
+};
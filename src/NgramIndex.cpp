@@ -0,0 +1,301 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "ByteSource.hpp"
+#include "IndexCache.hpp"
+#include "NgramIndex.hpp"
+#include "XXHash64.hpp"
+
+using namespace std;
+
+static const char kNgramIndexMagic[8] = {'H', 'E', 'X', 'A', 'N', 'G', 'R', '1'};
+
+// Blocks with more different buckets than this are dense. Text has a few
+// thousands in a block, random bytes reach this in the first quarter.
+static constexpr size_t kMaxBlockBuckets = 16384;
+
+// Lists are kept in memory while building, blocks after this much are
+// taken as dense.
+static constexpr uint64_t kMaxPostingBytes = 1ull << 30;
+
+// Bytes hashed for SampleHash.
+static constexpr uint64_t kSampleCount = 64;
+static constexpr uint64_t kSampleLength = 4096;
+
+static void AppendVarint(vector<uint8_t> &out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(0x80 | (value & 0x7f));
+		value >>= 7;
+	}
+	out.push_back(value);
+}
+
+uint32_t NgramIndex::BucketOf(const uint8_t *gram)
+{
+	const uint32_t value = gram[0] | (gram[1] << 8) | (gram[2] << 16);
+	return (value * 0x9E3779B1u) >> (32 - kBucketBits);
+}
+
+uint64_t NgramIndex::SampleHash(const ByteSource &source)
+{
+	const uint64_t size = source.Size();
+	uint64_t hash = XXHash64(&size, sizeof(size));
+
+	// Evenly spaced samples, the last one ending at the end.
+	for (uint64_t i = 0; i <= kSampleCount && size > 0; ++i)
+	{
+		const uint64_t length = min(kSampleLength, size);
+		const uint64_t offset = (size - length) / kSampleCount * i;
+		const uint64_t sample_offset = (i == kSampleCount ? size - length : offset);
+
+		source.Materialize(sample_offset, length);
+		hash = XXHash64(source.Data() + sample_offset, length, hash);
+	}
+	return hash;
+}
+
+shared_ptr<NgramIndex> NgramIndex::Compute(const ByteSource &source, const function<bool()> &cancelled)
+{
+	const uint8_t *data = source.Data();
+	const uint64_t size = source.Size();
+
+	auto index = make_shared<NgramIndex>();
+	index->size = size;
+	index->block_count = (size + kBlockSize - 1) / kBlockSize;
+	index->sample_hash = SampleHash(source);
+	index->dense.resize((index->block_count + 63) / 64);
+
+	vector< vector<uint8_t> > lists(kBucketCount);
+	vector<int64_t> last_block(kBucketCount, -1);
+	uint64_t posting_bytes = 0;
+
+	// Buckets of the current block, and a bit per bucket to find them once.
+	vector<uint32_t> buckets;
+	vector<uint64_t> seen(kBucketCount / 64);
+
+	static const uint8_t zero_gram[kGramLength] = {0};
+	auto hole = source.Holes().begin();
+	const auto holes_end = source.Holes().end();
+
+	for (uint64_t block = 0; block < index->block_count; ++block)
+	{
+		if (block % (ByteSource::kCancelCheckBytes / kBlockSize) == 0 && cancelled())
+		{
+			return nullptr;
+		}
+
+		// Sequences starting in the block, the last ones end in the next.
+		const uint64_t offset = block * kBlockSize;
+		const uint64_t gram_end = min(offset + kBlockSize, size - min(size, kGramLength - 1));
+		if (gram_end <= offset)
+		{
+			continue;
+		}
+
+		while (hole != holes_end && hole->second <= offset)
+		{
+			++hole;
+		}
+
+		buckets.clear();
+		if (hole != holes_end && hole->first <= offset && hole->second >= gram_end + kGramLength - 1)
+		{
+			buckets.push_back(BucketOf(zero_gram));
+		}
+		else
+		{
+			source.Materialize(offset, gram_end + kGramLength - 1 - offset);
+			for (uint64_t pos = offset; pos < gram_end && buckets.size() <= kMaxBlockBuckets; ++pos)
+			{
+				const uint32_t bucket = BucketOf(data + pos);
+				uint64_t &word = seen[bucket / 64];
+				const uint64_t bit = 1ull << (bucket % 64);
+				if (!(word & bit))
+				{
+					word |= bit;
+					buckets.push_back(bucket);
+				}
+			}
+			for (uint32_t bucket : buckets)
+			{
+				seen[bucket / 64] = 0;
+			}
+		}
+
+		if (buckets.size() > kMaxBlockBuckets || posting_bytes > kMaxPostingBytes)
+		{
+			index->dense[block / 64] |= 1ull << (block % 64);
+			continue;
+		}
+
+		for (uint32_t bucket : buckets)
+		{
+			vector<uint8_t> &list = lists[bucket];
+			posting_bytes -= list.size();
+			AppendVarint(list, block - last_block[bucket]);
+			posting_bytes += list.size();
+			last_block[bucket] = block;
+		}
+	}
+
+	// Lists are freed as they are moved, so they are not in memory twice.
+	index->offsets.reserve(kBucketCount + 1);
+	index->postings.reserve(posting_bytes);
+	for (vector<uint8_t> &list : lists)
+	{
+		index->offsets.push_back(index->postings.size());
+		index->postings.insert(index->postings.end(), list.begin(), list.end());
+		vector<uint8_t>().swap(list);
+	}
+	index->offsets.push_back(index->postings.size());
+
+	return index;
+}
+
+shared_ptr<NgramIndex> NgramIndex::Load(const string &index_dir,
+                                        const string &file_name,
+                                        const struct stat &st,
+                                        const ByteSource &source)
+{
+	ifstream file(IndexCacheFileName(index_dir, file_name, ".ngr"), ios::binary);
+	char magic[sizeof(kNgramIndexMagic)];
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, kNgramIndexMagic, sizeof(magic)) != 0)
+	{
+		return nullptr;
+	}
+
+	// Index is valid only for the exact file it is built from.
+	uint64_t size, inode, sample_hash, block_count, posting_bytes;
+	int64_t mtime_sec, mtime_nsec;
+	if (!ReadIndexField(file, size) || size != (uint64_t)st.st_size || size != source.Size()
+	    || !ReadIndexField(file, inode) || inode != (uint64_t)st.st_ino
+	    || !ReadIndexField(file, mtime_sec) || mtime_sec != (int64_t)st.st_mtim.tv_sec
+	    || !ReadIndexField(file, mtime_nsec) || mtime_nsec != (int64_t)st.st_mtim.tv_nsec
+	    || !ReadIndexField(file, sample_hash) || sample_hash != SampleHash(source)
+	    || !ReadIndexField(file, block_count) || block_count != (size + kBlockSize - 1) / kBlockSize
+	    || !ReadIndexField(file, posting_bytes))
+	{
+		return nullptr;
+	}
+
+	auto index = make_shared<NgramIndex>();
+	index->size = size;
+	index->block_count = block_count;
+	index->sample_hash = sample_hash;
+	index->dense.resize((block_count + 63) / 64);
+	index->offsets.resize(kBucketCount + 1);
+	index->postings.resize(posting_bytes);
+
+	if (!file.read(reinterpret_cast<char*>(index->dense.data()), index->dense.size() * sizeof(uint64_t))
+	    || !file.read(reinterpret_cast<char*>(index->offsets.data()), index->offsets.size() * sizeof(uint64_t))
+	    || !file.read(reinterpret_cast<char*>(index->postings.data()), posting_bytes)
+	    || index->offsets.back() != posting_bytes)
+	{
+		return nullptr;
+	}
+	return index;
+}
+
+void NgramIndex::Save(const string &index_dir, const string &file_name, const struct stat &st) const
+{
+	// Status must match the indexed contents, or a later load would trust
+	// lists of other contents.
+	if ((uint64_t)st.st_size != size)
+	{
+		return;
+	}
+
+	const string cache_file_name = IndexCacheFileName(index_dir, file_name, ".ngr");
+	WriteIndexCacheFile(index_dir, cache_file_name, [this, &st](ofstream &file)
+	{
+		file.write(kNgramIndexMagic, sizeof(kNgramIndexMagic));
+		WriteIndexField(file, size);
+		WriteIndexField(file, (uint64_t)st.st_ino);
+		WriteIndexField(file, (int64_t)st.st_mtim.tv_sec);
+		WriteIndexField(file, (int64_t)st.st_mtim.tv_nsec);
+		WriteIndexField(file, sample_hash);
+		WriteIndexField(file, block_count);
+		WriteIndexField(file, (uint64_t)postings.size());
+
+		file.write(reinterpret_cast<const char*>(dense.data()), dense.size() * sizeof(uint64_t));
+		file.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+		file.write(reinterpret_cast<const char*>(postings.data()), postings.size());
+	});
+}
+
+void NgramIndex::DecodeBucket(uint32_t bucket, vector<uint64_t> &blocks) const
+{
+	const uint8_t *p = postings.data() + offsets[bucket];
+	const uint8_t *end = postings.data() + offsets[bucket + 1];
+
+	int64_t block = -1;
+	while (p < end)
+	{
+		uint64_t delta = 0;
+		for (int shift = 0; p < end; shift += 7)
+		{
+			const uint8_t byte = *p++;
+			delta |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+			{
+				break;
+			}
+		}
+		block += delta;
+		blocks[block / 64] |= 1ull << (block % 64);
+	}
+}
+
+bool NgramIndex::CandidateBlocks(const string &bytes, vector<uint64_t> &blocks) const
+{
+	if (bytes.size() < kGramLength)
+	{
+		return false;
+	}
+
+	// A match starting in a block has its first sequence in it, and each
+	// later one either in it or in the next block, as long as it starts
+	// less than a block after. More than a few sequences rarely filter
+	// out anything more.
+	const size_t kMaxGrams = 32;
+	const uint8_t *pattern = reinterpret_cast<const uint8_t*>(bytes.data());
+	const size_t gram_count = min(bytes.size() - kGramLength + 1, kMaxGrams);
+
+	blocks = dense;
+	DecodeBucket(BucketOf(pattern), blocks);
+
+	vector<uint64_t> has_gram;
+	for (size_t i = 1; i < gram_count && i < kBlockSize; ++i)
+	{
+		has_gram = dense;
+		DecodeBucket(BucketOf(pattern + i), has_gram);
+
+		for (size_t w = 0; w < blocks.size(); ++w)
+		{
+			// Blocks whose next one has the sequence.
+			const uint64_t next = (has_gram[w] >> 1)
+			                    | (w + 1 < has_gram.size() ? has_gram[w + 1] << 63 : 0);
+			blocks[w] &= has_gram[w] | next;
+		}
+	}
+	return true;
+}
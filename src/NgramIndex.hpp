@@ -0,0 +1,97 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+class ByteSource;
+
+// Which blocks of a source contain which 3-byte sequences, so a search only
+// reads the blocks that can have a match. Built in background on request,
+// and cached in the index directory for later sessions.
+//
+// Sequences are hashed into buckets, and each bucket has the sorted list of
+// blocks having one of its sequences, delta encoded as varints. Blocks with
+// too many different sequences, like compressed data, would be in most
+// lists without filtering anything out, they are kept as dense blocks and
+// always searched.
+class NgramIndex
+{
+public:
+	static constexpr uint64_t kBlockSize = 64 << 10;
+	static constexpr uint64_t kGramLength = 3;
+
+	// Returns null if `cancelled` returns true before it is done.
+	static std::shared_ptr<NgramIndex> Compute(const ByteSource &source,
+	                                           const std::function<bool()> &cancelled);
+
+	// Index saved for the file with status `st`, null if there is none. It
+	// is also dropped if bytes sampled from the source hash differently, as
+	// files can be modified without changing the status, like by writing
+	// through a mapping.
+	static std::shared_ptr<NgramIndex> Load(const std::string &index_dir,
+	                                        const std::string &file_name,
+	                                        const struct stat &st,
+	                                        const ByteSource &source);
+	void Save(const std::string &index_dir,
+	          const std::string &file_name,
+	          const struct stat &st) const;
+
+	// Source size the index covers.
+	uint64_t Size() const
+	{
+		return size;
+	}
+
+	size_t BlockCount() const
+	{
+		return block_count;
+	}
+
+	// Bit per block, set for blocks a match of `bytes` can start in. Returns
+	// false if `bytes` is too short to filter anything.
+	bool CandidateBlocks(const std::string &bytes, std::vector<uint64_t> &blocks) const;
+
+private:
+	static constexpr int kBucketBits = 20;
+	static constexpr size_t kBucketCount = size_t(1) << kBucketBits;
+
+	static uint32_t BucketOf(const uint8_t *gram);
+
+	// Hash of bytes sampled over the whole source.
+	static uint64_t SampleHash(const ByteSource &source);
+
+	// Decodes the bucket's list into a bit per block.
+	void DecodeBucket(uint32_t bucket, std::vector<uint64_t> &blocks) const;
+
+	uint64_t size = 0;
+	uint64_t block_count = 0;
+	uint64_t sample_hash = 0;
+
+	// List of bucket `b` is postings[offsets[b], offsets[b + 1]).
+	std::vector<uint64_t> offsets;
+	std::vector<uint8_t> postings;
+
+	// Bit per block.
+	std::vector<uint64_t> dense;
+};
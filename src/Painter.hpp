@@ -214,6 +214,21 @@ public:
 		return paint_col_end - paint_col_start;
 	}
 
+	// Translates a position on the whole screen, like of a mouse click, to
+	// the painter's area. Returns false if it is outside the area.
+	bool FromScreen(int screen_row, int screen_column, int &row_out, int &column_out) const
+	{
+		if (screen_row < paint_row_start || screen_row >= paint_row_end ||
+		    screen_column < paint_col_start || screen_column >= paint_col_end)
+		{
+			return false;
+		}
+
+		row_out = screen_row - paint_row_start;
+		column_out = screen_column - paint_col_start;
+		return true;
+	}
+
 private:
 
 	// String must be valid utf-8
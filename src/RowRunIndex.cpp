@@ -0,0 +1,227 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cstring>
+
+#include "RowRunIndex.hpp"
+
+using namespace std;
+
+// Rows are compared in blocks of about this size.
+static constexpr uint64_t kBlockSize = 1 << 20;
+
+RowRunIndex RowRunIndex::Build(const BufferSnapshot &snapshot,
+                               uint64_t version,
+                               int row_length,
+                               const atomic<bool> &cancelled)
+{
+	RowRunIndex index;
+	index.version = version;
+	index.row_length = row_length;
+	index.snapshot = snapshot;
+
+	if (!Scan(snapshot, row_length, 0, snapshot.Size(), cancelled, index.runs))
+	{
+		return RowRunIndex();
+	}
+	return index;
+}
+
+RowRunIndex RowRunIndex::Update(const RowRunIndex &previous,
+                                const BufferSnapshot &snapshot,
+                                uint64_t version,
+                                const atomic<bool> &cancelled)
+{
+	const int64_t row_length = previous.row_length;
+	const BufferSnapshot &old = previous.snapshot;
+	const int64_t old_size = old.Size();
+	const int64_t size = snapshot.Size();
+	const int64_t prefix = snapshot.SamePrefixLength(old);
+	const int64_t suffix = min<int64_t>(snapshot.SameSuffixLength(old), min(old_size, size) - prefix);
+	const int64_t shift = size - old_size;
+
+	// Whether the unchanged row at `pos` is the same as the one before it.
+	// Runs only hold the longer repeats, so others are read.
+	auto repeats = [&](int64_t pos)
+	{
+		if (previous.RunAt(pos) != nullptr)
+		{
+			return true;
+		}
+		if (pos < row_length)
+		{
+			return false;
+		}
+
+		vector<uint8_t> rows(2 * row_length);
+		old.Read(pos - row_length, rows.data(), rows.size());
+		return memcmp(rows.data(), rows.data() + row_length, row_length) == 0;
+	};
+
+	// Rows are scanned from one whose previous row does not repeat, so no
+	// run crosses `begin`, ...
+	int64_t begin = prefix / row_length * row_length;
+	if (begin > 0)
+	{
+		const int64_t last_kept = begin - row_length;
+		if (const Run *run = previous.RunAt(last_kept))
+		{
+			begin = run->begin;
+		}
+		else if (repeats(last_kept))
+		{
+			begin = last_kept;
+		}
+	}
+
+	// ... to a row which does not repeat, after the edited ones and the row
+	// following them. Both are unchanged, so found in the old rows.
+	int64_t end = size;
+	int64_t old_end = old_size;
+	const int64_t edited_end = size - suffix;
+	const int64_t unchanged = (edited_end + row_length - 1) / row_length * row_length + row_length;
+	if (shift % row_length == 0 && unchanged - shift + row_length <= old_size)
+	{
+		old_end = unchanged - shift;
+		if (const Run *run = previous.RunAt(old_end))
+		{
+			old_end = run->end;
+		}
+		else if (repeats(old_end))
+		{
+			old_end += row_length;
+		}
+		end = old_end + shift;
+	}
+
+	RowRunIndex index;
+	index.version = version;
+	index.row_length = row_length;
+	index.snapshot = snapshot;
+
+	for (const Run &run : previous.runs)
+	{
+		if (run.end > begin)
+		{
+			break;
+		}
+		index.runs.push_back(run);
+	}
+	if (!Scan(snapshot, row_length, begin, end, cancelled, index.runs))
+	{
+		return RowRunIndex();
+	}
+	auto after = lower_bound(previous.runs.begin(), previous.runs.end(), old_end, [](const Run &run, int64_t pos)
+	{
+		return run.begin < pos;
+	});
+	for (; after != previous.runs.end(); ++after)
+	{
+		index.runs.push_back(Run{after->begin + shift, after->end + shift});
+	}
+	return index;
+}
+
+bool RowRunIndex::Scan(const BufferSnapshot &snapshot,
+                       int row_length,
+                       uint64_t begin,
+                       uint64_t end,
+                       const atomic<bool> &cancelled,
+                       vector<Run> &runs)
+{
+	const uint64_t rows_per_block = max<uint64_t>(1, kBlockSize / row_length);
+
+	vector<uint8_t> block(rows_per_block * row_length);
+	vector<uint8_t> last_row(row_length);
+	bool have_last_row = false;
+	if (begin >= uint64_t(row_length) && begin <= end)
+	{
+		snapshot.Read(begin - row_length, last_row.data(), row_length);
+		have_last_row = true;
+	}
+
+	int64_t run_begin = -1;
+	auto end_run = [&](int64_t run_end)
+	{
+		if (run_begin >= 0 && run_end - run_begin >= kMinRunRows * row_length)
+		{
+			runs.push_back(Run{run_begin, run_end});
+		}
+		run_begin = -1;
+	};
+
+	// A partial last row is never part of a run.
+	uint64_t pos = begin;
+	for (; pos + row_length <= end; )
+	{
+		if (cancelled.load(memory_order_relaxed))
+		{
+			return false;
+		}
+
+		const uint64_t row_count = min(rows_per_block, (end - pos) / row_length);
+		const uint64_t length = row_count * row_length;
+
+		// Holes and blocks the source index knows to be a single byte are
+		// not read.
+		const int uniform = snapshot.KnownUniformByte(pos, length);
+		if (uniform != BlockIndex::kNotUniform)
+		{
+			memset(block.data(), uniform, length);
+		}
+		else
+		{
+			snapshot.Read(pos, block.data(), length);
+		}
+
+		for (uint64_t r = 0; r < row_count; ++r)
+		{
+			const uint8_t *row = block.data() + r * row_length;
+			const uint8_t *previous = (r == 0 ? last_row.data() : row - row_length);
+
+			const bool same = (r > 0 || have_last_row) && memcmp(row, previous, row_length) == 0;
+			if (same && run_begin < 0)
+			{
+				run_begin = pos + r * row_length;
+			}
+			else if (!same)
+			{
+				end_run(pos + r * row_length);
+			}
+		}
+
+		memcpy(last_row.data(), block.data() + length - row_length, row_length);
+		have_last_row = true;
+		pos += length;
+	}
+	end_run(pos);
+
+	return true;
+}
+
+const RowRunIndex::Run* RowRunIndex::RunAt(int64_t pos) const
+{
+	auto it = upper_bound(runs.begin(), runs.end(), pos, [](int64_t pos, const Run &run)
+	{
+		return pos < run.begin;
+	});
+	if (it == runs.begin() || pos >= prev(it)->end)
+	{
+		return nullptr;
+	}
+	return &*prev(it);
+}
@@ -0,0 +1,97 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "FileBuffer.hpp"
+
+// Runs of rows which repeat the row before them, like zero padding or
+// erased flash, for one buffer version and row length.
+//
+// Built on a background thread, the editor then folds each run into a
+// single line and finds them with a binary search.
+class RowRunIndex
+{
+public:
+	struct Run
+	{
+		// [begin, end), multiples of the row length. Every row in the run is
+		// the same as the one starting at `begin - row_length`.
+		int64_t begin;
+		int64_t end;
+	};
+
+	// Shorter runs are not worth folding.
+	static constexpr int64_t kMinRunRows = 2;
+
+	RowRunIndex() = default;
+
+	// Returns an empty index if `cancelled` is set before it is done.
+	static RowRunIndex Build(const BufferSnapshot &snapshot,
+	                         uint64_t version,
+	                         int row_length,
+	                         const std::atomic<bool> &cancelled);
+
+	// Same as Build for `snapshot`, an edited version of the one `previous`
+	// was built for. Only rows around the edited bytes are read, the runs
+	// before and after them are kept, shifted if the edit inserted or erased
+	// whole rows. Rows after any other insertion or erasure are all read.
+	static RowRunIndex Update(const RowRunIndex &previous,
+	                          const BufferSnapshot &snapshot,
+	                          uint64_t version,
+	                          const std::atomic<bool> &cancelled);
+
+	uint64_t Version() const
+	{
+		return version;
+	}
+
+	int RowLength() const
+	{
+		return row_length;
+	}
+
+	// Sorted by offset.
+	const std::vector<Run>& Runs() const
+	{
+		return runs;
+	}
+
+private:
+	// Finds the runs of rows in [begin, end) into `runs`, `begin` a multiple
+	// of the row length whose previous row is not in a run. Returns false if
+	// cancelled.
+	static bool Scan(const BufferSnapshot &snapshot,
+	                 int row_length,
+	                 uint64_t begin,
+	                 uint64_t end,
+	                 const std::atomic<bool> &cancelled,
+	                 std::vector<Run> &runs);
+
+	// The run containing the row at `pos`, or null.
+	const Run* RunAt(int64_t pos) const;
+
+	uint64_t version = 0;
+	int row_length = 0;
+	std::vector<Run> runs;
+
+	// What the runs were found in, for Update.
+	BufferSnapshot snapshot;
+};
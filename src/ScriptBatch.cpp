@@ -0,0 +1,607 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "BinaryTemplate.hpp"
+#include "Checksum.hpp"
+#include "Encoding/utf8_iterator.hpp"
+#include "FileBuffer.hpp"
+#include "MarkProvider.hpp"
+#include "ScriptBatch.hpp"
+#include "TemplateTree.hpp"
+#include "Worker.hpp"
+
+#include "HexaScript/HexaScript.hpp"
+
+using namespace std;
+
+// Streams and compressed files are read in background, scripts run once
+// they are read completely. Returns null if the input can not be opened.
+static unique_ptr<FileBuffer> OpenInput(const string &input, uint64_t stream_memory_limit)
+{
+	struct stat st;
+	if (input != "-" && (stat(input.c_str(), &st) != 0 || S_ISDIR(st.st_mode) || access(input.c_str(), R_OK) != 0))
+	{
+		return nullptr;
+	}
+
+	// Shared with the callback, which is called from the reader thread.
+	struct Growth
+	{
+		mutex m;
+		condition_variable cv;
+		bool grown = false;
+	};
+	auto growth = make_shared<Growth>();
+	auto on_growth = [growth]()
+	{
+		lock_guard<mutex> lock(growth->m);
+		growth->grown = true;
+		growth->cv.notify_one();
+	};
+
+	unique_ptr<FileBuffer> buffer;
+	if (input == "-")
+		buffer = FileBuffer::OpenStream(dup(STDIN_FILENO), stream_memory_limit, on_growth);
+	else
+		buffer = FileBuffer::Open(input, stream_memory_limit, "", on_growth);
+
+	while (buffer->IsGrowing())
+	{
+		{
+			unique_lock<mutex> lock(growth->m);
+			growth->cv.wait_for(lock, chrono::milliseconds(100), [&]() { return growth->grown; });
+			growth->grown = false;
+		}
+		buffer->SyncWithSource();
+	}
+	buffer->SyncWithSource();
+
+	return buffer;
+}
+
+class ScriptBatch::Runner : public HexaScript::Buffer
+{
+public:
+	// Throws HexaScript::Error if the script does not compile.
+	explicit Runner(const ScriptBatch &batch);
+
+	std::vector<Record> Process(const std::string &input);
+
+	uint64_t Size() const override
+	{
+		return buffer ? buffer->Size() : 0;
+	}
+
+	uint64_t Read(uint64_t pos, void *out, uint64_t length) const override
+	{
+		return buffer ? buffer->Read(pos, out, length) : 0;
+	}
+
+	uint64_t Cursor() const override
+	{
+		return cursor;
+	}
+
+private:
+	// Same as the commands of the editor, marks and hashes are recorded
+	// instead of shown.
+	void Exec(const std::string &file_name);
+	void Goto(const std::string &number);
+	void Hash(const std::string &algorithm);
+	void MarkRange(int64_t offset, int64_t length, const std::string &comment);
+	void SetFileType(const std::string &name);
+	void Template(const std::string &name);
+
+	void Fail(const std::string &message)
+	{
+		records.push_back(Record{Record::Type::Error, 0, 0, "", message});
+	}
+
+	const ScriptBatch &batch;
+
+	HexaScript engine;
+	std::shared_ptr<const HexaScript::Program> program;
+
+	// Scripts loaded by `exec` or for file types, compiled once per thread.
+	std::map< std::string, std::shared_ptr<const HexaScript::Program> > loaded_scripts;
+	std::map< std::string, std::shared_ptr<const BinaryTemplate> > loaded_templates;
+
+	std::unique_ptr<FileBuffer> buffer;
+	uint64_t cursor = 0;
+	std::vector<Record> records;
+};
+
+ScriptBatch::Runner::Runner(const ScriptBatch &batch)
+  : batch(batch)
+{
+	engine.RegisterFunction<string>("exec", [this](string f){this->Exec(f);});
+	engine.RegisterFunction<string>("hash", [this](string algorithm){this->Hash(algorithm);});
+	engine.RegisterFunction<string>("template", [this](string name){this->Template(name);});
+
+	engine.RegisterFunction<string_view, const string&>("mark",
+	    [this](string_view range, const string &comment)
+	{
+		int64_t offset, length;
+		if (!Mark::ParseRange(range, offset, length))
+		{
+			this->Fail("Invalid range");
+			return;
+		}
+		this->MarkRange(offset, length, comment);
+	});
+	engine.RegisterFunction<int64_t, int64_t, const string&>("mark",
+	    [this](int64_t offset, int64_t length, const string &comment){this->MarkRange(offset, length, comment);});
+
+	engine.RegisterNumberCommand([this](const string &number){this->Goto(number);});
+
+	engine.RegisterVariable<string>("filetype", [this](string v){this->SetFileType(v);});
+
+	// Only change how bytes are shown, accepted so scripts written for the
+	// editor run as they are.
+	engine.RegisterVariable<int>("byte-padding-left", [](int){});
+	engine.RegisterVariable<int>("byte-padding-right", [](int){});
+	engine.RegisterOption("big-endian", [](){});
+	engine.RegisterOption("little-endian", [](){});
+
+	engine.SetBuffer(this);
+
+	program = engine.Compile(batch.script_source);
+}
+
+vector<ScriptBatch::Record> ScriptBatch::Runner::Process(const string &input)
+{
+	records.clear();
+	cursor = 0;
+
+	try
+	{
+		buffer = OpenInput(input, (uint64_t)batch.args.stream_memory_arg << 20);
+	}
+	catch (exception &e)
+	{
+		buffer = nullptr;
+	}
+
+	if (!buffer)
+	{
+		Fail("Unable to open \"" + input + "\"");
+		return move(records);
+	}
+
+	records.push_back(Record{Record::Type::File, 0, (int64_t)buffer->Size(), "", ""});
+
+	try
+	{
+		engine.Run(*program);
+	}
+	catch (HexaScript::Error &e)
+	{
+		Fail(e.ErrorInfo());
+	}
+	catch (exception &e)
+	{
+		Fail(e.what());
+	}
+
+	buffer = nullptr;
+	return move(records);
+}
+
+void ScriptBatch::Runner::Exec(const string &file_name)
+{
+	auto it = loaded_scripts.find(file_name);
+	if (it == loaded_scripts.end())
+	{
+		ifstream script(file_name);
+		if (!script.is_open())
+		{
+			Fail("Unable to load \"" + file_name + "\"");
+			return;
+		}
+
+		stringstream source;
+		source << script.rdbuf();
+		try
+		{
+			it = loaded_scripts.emplace(file_name, engine.Compile(source.str())).first;
+		}
+		catch (HexaScript::Error &e)
+		{
+			Fail("\"" + file_name + "\" " + e.ErrorInfo());
+			return;
+		}
+	}
+
+	// Kept alive, the script might load itself again.
+	shared_ptr<const HexaScript::Program> loaded = it->second;
+	try
+	{
+		engine.Run(*loaded);
+	}
+	catch (HexaScript::Error &e)
+	{
+		Fail("\"" + file_name + "\" " + e.ErrorInfo());
+	}
+}
+
+void ScriptBatch::Runner::Goto(const string &number)
+{
+	int64_t new_pos;
+	auto result = from_chars(number.data(), number.data() + number.size(), new_pos);
+	if (result.ec != errc() || new_pos < 0 || new_pos >= (int64_t)buffer->Size())
+	{
+		Fail("Position out of file boundary: " + number);
+		return;
+	}
+	cursor = new_pos;
+}
+
+void ScriptBatch::Runner::Hash(const string &algorithm)
+{
+	Checksum::Type type;
+	const bool is_checksum = Checksum::FromName(algorithm, type);
+	if (!is_checksum && !Digest::IsKnown(algorithm))
+	{
+		Fail("Unknown hash \"" + algorithm + "\", use crc32, crc32c, adler32, md5, sha1 or sha256");
+		return;
+	}
+
+	// The last mark under the cursor, or the whole buffer, like :hash
+	// without a selection.
+	int64_t begin = 0;
+	int64_t end = buffer->Size();
+	for (auto it = records.rbegin(); it != records.rend(); ++it)
+	{
+		if (it->type == Record::Type::Mark && it->offset <= (int64_t)cursor
+		    && (int64_t)cursor < it->offset + it->length)
+		{
+			begin = it->offset;
+			end = min(end, it->offset + it->length);
+			break;
+		}
+	}
+	if (begin > end)
+	{
+		Fail("Nothing to hash");
+		return;
+	}
+
+	const BufferSnapshot &snapshot = buffer->Snapshot();
+	string value;
+	if (is_checksum)
+	{
+		uint32_t checksum = Checksum::Initial(type);
+		snapshot.ForEachSpan(begin, end - begin, [&](uint64_t, const uint8_t *data, uint64_t length)
+		{
+			checksum = Checksum::Update(type, checksum, data, length);
+			return true;
+		});
+
+		char hex[16];
+		snprintf(hex, sizeof(hex), "%08x", checksum);
+		value = hex;
+	}
+	else
+	{
+		Digest digest(algorithm);
+		snapshot.ForEachSpan(begin, end - begin, [&](uint64_t, const uint8_t *data, uint64_t length)
+		{
+			digest.Update(data, length);
+			return true;
+		});
+		value = digest.HexFinal();
+	}
+
+	records.push_back(Record{Record::Type::Hash, begin, end - begin, algorithm, value});
+}
+
+void ScriptBatch::Runner::MarkRange(int64_t offset, int64_t length, const string &comment)
+{
+	if (offset < 0 || length <= 0)
+	{
+		Fail("Invalid range");
+		return;
+	}
+
+	records.push_back(Record{Record::Type::Mark, offset, length, "", comment});
+}
+
+void ScriptBatch::Runner::SetFileType(const string &name)
+{
+	const string runtime_dir = batch.args.runtime_dir_arg;
+	if (access((runtime_dir + "/templates/" + name + ".tpl").c_str(), R_OK) == 0)
+	{
+		Template(name);
+		return;
+	}
+	Exec(runtime_dir + "/marks/" + name + ".hexa");
+}
+
+void ScriptBatch::Runner::Template(const string &name)
+{
+	// Bare names are of the templates in the runtime directory.
+	string file_name = name;
+	if (name.find('/') == string::npos && name.find('.') == string::npos)
+	{
+		file_name = string(batch.args.runtime_dir_arg) + "/templates/" + name + ".tpl";
+	}
+
+	auto it = loaded_templates.find(file_name);
+	if (it == loaded_templates.end())
+	{
+		try
+		{
+			it = loaded_templates.emplace(file_name, BinaryTemplate::Load(file_name)).first;
+		}
+		catch (exception &e)
+		{
+			Fail(e.what());
+			return;
+		}
+	}
+
+	// Leaf fields of the whole input are marked with their names, the same
+	// ones the editor marks in the rows it shows.
+	TemplateTree tree(it->second, buffer->Snapshot());
+	vector<Mark> marks;
+	tree.MarksIn(0, buffer->Size(), marks);
+	for (const Mark &m : marks)
+	{
+		records.push_back(Record{Record::Type::Mark, m.start_address, m.length, "", m.comment});
+	}
+}
+
+ScriptBatch::ScriptBatch(const gengetopt_args_info &args)
+  : args(args)
+{
+	csv = (string(args.format_arg) == "csv");
+}
+
+int ScriptBatch::Run(const vector<string> &inputs)
+{
+	ifstream script(args.script_arg);
+	if (!script.is_open())
+	{
+		cerr << "Unable to load \"" << args.script_arg << "\"\n";
+		return 1;
+	}
+	stringstream source;
+	source << script.rdbuf();
+	script_source = source.str();
+
+	// Compiled here first, so errors are reported once rather than for each
+	// input.
+	try
+	{
+		Runner runner(*this);
+	}
+	catch (HexaScript::Error &e)
+	{
+		cerr << "\"" << args.script_arg << "\" " << e.ErrorInfo() << "\n";
+		return 1;
+	}
+
+	if (csv)
+	{
+		cout << "file,type,offset,length,name,text\n";
+	}
+
+	// Outputs are kept until the ones of the inputs before them are
+	// printed.
+	vector<string> outputs(inputs.size());
+	vector<bool> finished(inputs.size(), false);
+	size_t printed = 0;
+	bool failed = false;
+
+	atomic<size_t> next_input{0};
+
+	int thread_count = (args.jobs_arg > 0 ? args.jobs_arg : (int)thread::hardware_concurrency());
+	thread_count = max(1, min<int>(thread_count, inputs.size()));
+	Worker worker(thread_count);
+
+	// A runner per thread, taking inputs until none is left, so the script
+	// is compiled once per thread instead of once per input.
+	for (int i = 0; i < thread_count; ++i)
+	{
+		worker.Post([this, &inputs, &outputs, &finished, &failed, &next_input, &worker]()
+		{
+			Runner runner(*this);
+			for (size_t input; (input = next_input++) < inputs.size() && !worker.ShuttingDown(); )
+			{
+				const vector<Record> records = runner.Process(inputs[input]);
+				const bool input_failed = any_of(records.begin(), records.end(),
+				    [](const Record &r) { return r.type == Record::Type::Error; });
+
+				worker.PostToMain([&outputs, &finished, &failed, input, input_failed,
+				                   output = Format(inputs[input], records)]()
+				{
+					outputs[input] = output;
+					finished[input] = true;
+					failed = failed || input_failed;
+				});
+			}
+		});
+	}
+
+	while (printed < inputs.size())
+	{
+		pollfd fd = {worker.NotifyFd(), POLLIN, 0};
+		poll(&fd, 1, -1);
+		worker.RunCompletions();
+
+		for (; printed < inputs.size() && finished[printed]; ++printed)
+		{
+			cout << outputs[printed];
+			string().swap(outputs[printed]);
+		}
+	}
+	cout.flush();
+
+	return failed ? 1 : 0;
+}
+
+// Comments and file names might not be UTF-8, which JSON has to be. Bytes
+// not part of a valid sequence are each replaced with U+FFFD.
+static void AppendJsonString(string &out, const string &text)
+{
+	const uint8_t *p = reinterpret_cast<const uint8_t*>(text.data());
+	const uint8_t *end = p + text.size();
+
+	out += '"';
+	while (p < end)
+	{
+		const uint8_t c = *p;
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		}
+		else if (c < 0x80)
+		{
+			out += c;
+		}
+		else
+		{
+			char32_t code_point;
+			const int length = unicode_iterator::utf8_detail::DecodeSequence(p, end - p, code_point);
+			if (length == 0)
+			{
+				out += "\\ufffd";
+				++p;
+				continue;
+			}
+			out.append(reinterpret_cast<const char*>(p), length);
+			p += length;
+			continue;
+		}
+		++p;
+	}
+	out += '"';
+}
+
+static void AppendCsvField(string &out, const string &text)
+{
+	if (text.find_first_of(",\"\r\n") == string::npos)
+	{
+		out += text;
+		return;
+	}
+
+	out += '"';
+	for (char c : text)
+	{
+		if (c == '"')
+		{
+			out += '"';
+		}
+		out += c;
+	}
+	out += '"';
+}
+
+// JSON lines like
+//   {"file":"a.png","type":"mark","offset":8,"length":4,"comment":"Length"}
+// or CSV rows with the columns file,type,offset,length,name,text.
+string ScriptBatch::Format(const string &input, const vector<Record> &records) const
+{
+	static const char *type_names[] = {"file", "mark", "hash", "error"};
+
+	string out;
+	for (const Record &r : records)
+	{
+		const char *type_name = type_names[(int)r.type];
+
+		if (csv)
+		{
+			AppendCsvField(out, input);
+			out += ',';
+			out += type_name;
+			out += ',';
+			if (r.type != Record::Type::Error)
+			{
+				out += to_string(r.offset) + ',' + to_string(r.length);
+			}
+			else
+			{
+				out += ',';
+			}
+			out += ',';
+			AppendCsvField(out, r.name);
+			out += ',';
+			AppendCsvField(out, r.text);
+			out += '\n';
+			continue;
+		}
+
+		out += "{\"file\":";
+		AppendJsonString(out, input);
+		out += ",\"type\":\"";
+		out += type_name;
+		out += '"';
+
+		switch (r.type)
+		{
+		case Record::Type::File:
+			out += ",\"size\":" + to_string(r.length);
+			break;
+		case Record::Type::Mark:
+			out += ",\"offset\":" + to_string(r.offset) + ",\"length\":" + to_string(r.length);
+			out += ",\"comment\":";
+			AppendJsonString(out, r.text);
+			break;
+		case Record::Type::Hash:
+			out += ",\"offset\":" + to_string(r.offset) + ",\"length\":" + to_string(r.length);
+			out += ",\"algorithm\":";
+			AppendJsonString(out, r.name);
+			out += ",\"value\":";
+			AppendJsonString(out, r.text);
+			break;
+		case Record::Type::Error:
+			out += ",\"message\":";
+			AppendJsonString(out, r.text);
+			break;
+		}
+		out += "}\n";
+	}
+	return out;
+}
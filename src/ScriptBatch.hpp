@@ -0,0 +1,70 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CommandLineFlags.hpp"
+
+// Runs a script on files without a terminal, like `hexa --batch --script
+// check.hexa *.bin` in a pipeline.
+//
+// Inputs are processed on worker threads, each with a script engine of its
+// own compiling the script once. What scripts mark or compute is printed to
+// stdout as JSON lines or CSV, in the order of the inputs.
+class ScriptBatch
+{
+public:
+	explicit ScriptBatch(const gengetopt_args_info &args);
+	ScriptBatch(const ScriptBatch &ot) = delete;
+	ScriptBatch& operator=(const ScriptBatch &ot) = delete;
+
+	// Returns the exit status, non zero if the script failed on any input.
+	int Run(const std::vector<std::string> &inputs);
+
+private:
+	// Something a script produced for an input.
+	struct Record
+	{
+		enum class Type
+		{
+			File,  // First one of each input, with its size in `length`.
+			Mark,  // `text` is the comment.
+			Hash,  // `name` is the algorithm, `text` the value.
+			Error, // `text` is the message.
+		};
+
+		Type type;
+		int64_t offset;
+		int64_t length;
+		std::string name;
+		std::string text;
+	};
+
+	// Script engine bound to the input being processed, one per thread.
+	class Runner;
+
+	// Lines printed for an input.
+	std::string Format(const std::string &input, const std::vector<Record> &records) const;
+
+	const gengetopt_args_info &args;
+
+	std::string script_source;
+	bool csv = false;
+};
@@ -0,0 +1,319 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ByteRegex.hpp"
+#include "ByteSource.hpp"
+#include "FileBuffer.hpp"
+#include "NgramIndex.hpp"
+#include "StringScanner.hpp"
+#include "ValueSearch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+using namespace std;
+
+#define EXPECT(a) {\
+  std::cerr << ((a) ? "\033[32m[PASS]\033[0m" :"\033[31m[FAIL]\033[0m")  \
+            << " at line " << __LINE__ \
+            << " expr (" << #a << ")" << std::endl; }
+
+// Buffer of `contents`, stored the way bytes of edits are.
+unique_ptr<FileBuffer> MakeBuffer(const string &contents)
+{
+	auto store = make_shared<ChunkStore>();
+	store->Append(contents.data(), contents.size());
+	return unique_ptr<FileBuffer>(new FileBuffer(static_pointer_cast<ByteSource>(store)));
+}
+
+bool NeverCancelled()
+{
+	return false;
+}
+
+// `length` bytes picked from `alphabet`, the same ones on each run.
+string RandomText(size_t length, const string &alphabet, unsigned seed)
+{
+	mt19937 rng(seed);
+	string text(length, ' ');
+	for (char &c : text)
+	{
+		c = alphabet[rng() % alphabet.size()];
+	}
+	return text;
+}
+
+typedef vector< pair<uint64_t, uint64_t> > Ranges;
+
+Ranges RegexMatches(const string &pattern, const string &contents)
+{
+	unique_ptr<FileBuffer> buffer = MakeBuffer(contents);
+	Ranges matches;
+	for (const ByteRegex::Match &match : ByteRegex(pattern).Find(buffer->Snapshot(), 0, contents.size(),
+	                                                             1000, &NeverCancelled))
+	{
+		matches.emplace_back(match.begin, match.end);
+	}
+	return matches;
+}
+
+// Searches slices of `slice_length` one by one and joins them, like :regex
+// does with slices searched in parallel.
+Ranges SlicedRegexMatches(const string &pattern, const string &contents, uint64_t slice_length)
+{
+	unique_ptr<FileBuffer> buffer = MakeBuffer(contents);
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const ByteRegex regex(pattern);
+
+	vector<ByteRegex::Match> all;
+	for (uint64_t begin = 0; begin < contents.size(); begin += slice_length)
+	{
+		const uint64_t end = min<uint64_t>(contents.size(), begin + slice_length);
+		regex.Append(snapshot, all, regex.Find(snapshot, begin, end, 1 << 20, &NeverCancelled), begin);
+	}
+
+	Ranges matches;
+	for (const ByteRegex::Match &match : all)
+	{
+		matches.emplace_back(match.begin, match.end);
+	}
+	return matches;
+}
+
+void TestRegex()
+{
+	EXPECT(RegexMatches("ab", "xxabab") == Ranges({{2, 4}, {4, 6}}));
+	EXPECT(RegexMatches("a.*z|b", "a b z b") == Ranges({{0, 5}, {6, 7}}));
+	EXPECT(RegexMatches("(a|ab)(c|bcd)", "abcd") == Ranges({{0, 4}}));
+	EXPECT(RegexMatches("x+", "xxaxxxx") == Ranges({{0, 2}, {3, 7}}));
+	EXPECT(RegexMatches("a|a.*c", "aaaa") == Ranges({{0, 1}, {1, 2}, {2, 3}, {3, 4}}));
+
+	// Each start would run to the end, and matches are longer than a block.
+	string zeros(4 << 20, '\0');
+	EXPECT(RegexMatches("\\x00.*\\x01", zeros).empty());
+	zeros.back() = '\x01';
+	EXPECT(RegexMatches("\\x00.*\\x01", zeros) == Ranges({{0, zeros.size()}}));
+}
+
+void TestRegexSlices()
+{
+	// Few letters, so matches are frequent and slices cut through them.
+	const string text = RandomText(20000, "abxz ", 1);
+	for (const char *pattern : {"ab", "a[bx]*z", "a.*z|b", "x+", "(a|ab)(x|bxz)", "[^ ]+ "})
+	{
+		const Ranges whole = SlicedRegexMatches(pattern, text, text.size());
+		EXPECT(!whole.empty());
+		EXPECT(SlicedRegexMatches(pattern, text, 7) == whole);
+		EXPECT(SlicedRegexMatches(pattern, text, 64) == whole);
+		EXPECT(SlicedRegexMatches(pattern, text, 1000) == whole);
+	}
+}
+
+typedef vector< tuple<uint64_t, uint64_t, TextEncoding, string> > Strings;
+
+Strings ScanStrings(const BufferSnapshot &snapshot, uint64_t slice_length)
+{
+	Strings strings;
+	for (uint64_t begin = 0; begin < snapshot.Size(); begin += slice_length)
+	{
+		const uint64_t end = min(snapshot.Size(), begin + slice_length);
+		for (const FoundString &s : StringScanner::Scan(snapshot, begin, end, 4, &NeverCancelled))
+		{
+			strings.emplace_back(s.begin, s.end, s.encoding, s.text);
+		}
+	}
+	return strings;
+}
+
+// Text in each encoding, some of it longer than the slices, at any
+// alignment between random bytes.
+string MixedText(size_t pieces, unsigned seed)
+{
+	mt19937 rng(seed);
+	string contents;
+	for (size_t i = 0; i < pieces; ++i)
+	{
+		contents += RandomText(rng() % 40, string("\x00\x01\x80\xff\xc3\x0a", 6), rng());
+
+		const string text = RandomText(rng() % 8 == 0 ? 1000 + rng() % 3000 : 1 + rng() % 30,
+		                               "Hello, world 0123", rng());
+		const int kind = rng() % 6;
+		switch (kind)
+		{
+		case 0:
+			contents += text;
+			break;
+		case 1:
+			// Two and three byte code points.
+			for (char c : text)
+			{
+				contents += (c == 'o' ? "\xc3\xb6" : c == '0' ? "\xe2\x82\xac" : string(1, c));
+			}
+			break;
+		case 2:
+		case 3:
+			for (char c : text)
+			{
+				contents += (kind == 3 ? string(1, '\0') + c : string(1, c) + '\0');
+			}
+			break;
+		default:
+			for (char c : text)
+			{
+				contents += (kind == 5 ? string(3, '\0') + c : string(1, c) + string(3, '\0'));
+			}
+			break;
+		}
+	}
+	return contents;
+}
+
+void TestStringSlices()
+{
+	const string contents = MixedText(2000, 2);
+	unique_ptr<FileBuffer> buffer = MakeBuffer(contents);
+	const BufferSnapshot snapshot = buffer->Snapshot();
+
+	const Strings whole = ScanStrings(snapshot, contents.size());
+	EXPECT(whole.size() > 1000);
+	EXPECT(ScanStrings(snapshot, 64) == whole);
+	EXPECT(ScanStrings(snapshot, 777) == whole);
+	EXPECT(ScanStrings(snapshot, 1000) == whole);
+	EXPECT(ScanStrings(snapshot, 100000) == whole);
+}
+
+// Whether Find gives the offsets checked one by one, for searches starting
+// at each alignment.
+bool ValueMatchesEachOffset(const string &type, const string &value, const string &flags,
+                            const string &contents)
+{
+	const ValueSearch search(type, value, flags);
+	const bool aligned = (flags.find("aligned") != string::npos);
+	unique_ptr<FileBuffer> buffer = MakeBuffer(contents);
+	const BufferSnapshot snapshot = buffer->Snapshot();
+	const uint8_t *data = reinterpret_cast<const uint8_t*>(contents.data());
+
+	bool found_unaligned = false;
+	for (uint64_t begin = 0; begin < 9; ++begin)
+	{
+		for (uint64_t end : {contents.size(), contents.size() - 37})
+		{
+			vector<uint64_t> expected;
+			for (uint64_t pos = begin; pos + search.Width() <= contents.size() && pos < end; ++pos)
+			{
+				if ((!aligned || pos % search.Width() == 0) && search.MatchesAt(data + pos))
+				{
+					expected.push_back(pos);
+					found_unaligned |= (pos % search.Width() != 0);
+				}
+			}
+			if (expected.empty() || search.Find(snapshot, begin, end, 1 << 20, &NeverCancelled) != expected)
+			{
+				return false;
+			}
+		}
+	}
+	return found_unaligned != aligned;
+}
+
+// Random bytes with `value` put at every offset modulo 8, in both byte
+// orders.
+string WithValueBytes(const void *value, size_t width, unsigned seed)
+{
+	string contents = RandomText(8000, string("\x00\x12\x34\xde\xad\xbe\xef\xc0\x3f", 9), seed);
+	string reversed(static_cast<const char*>(value), width);
+	reverse(reversed.begin(), reversed.end());
+	for (size_t pos = 100; pos + 64 < contents.size(); pos += 97)
+	{
+		contents.replace(pos, width, static_cast<const char*>(value), width);
+		contents.replace(pos + 40, width, reversed);
+	}
+	return contents;
+}
+
+void TestValueAlignment()
+{
+	const uint16_t v16 = 0x1234;
+	const uint32_t v32 = 0xdeadbeef;
+	const uint64_t v64 = 0x12345678deadbeef;
+	const float f32 = 1.5;
+	const double f64 = -2.25;
+
+	for (const char *flags : {"", "aligned", "le,aligned", "be,aligned"})
+	{
+		EXPECT(ValueMatchesEachOffset("u16", "0x1234", flags, WithValueBytes(&v16, 2, 3)));
+		EXPECT(ValueMatchesEachOffset("u32", "0xdeadbeef", flags, WithValueBytes(&v32, 4, 4)));
+		EXPECT(ValueMatchesEachOffset("u64", "0x12345678deadbeef", flags, WithValueBytes(&v64, 8, 5)));
+		EXPECT(ValueMatchesEachOffset("f32", "1.5", flags, WithValueBytes(&f32, 4, 6)));
+		EXPECT(ValueMatchesEachOffset("f64", "-2.25", flags, WithValueBytes(&f64, 8, 7)));
+	}
+}
+
+bool HasBlock(const vector<uint64_t> &blocks, uint64_t block)
+{
+	return (blocks[block / 64] >> (block % 64)) & 1;
+}
+
+void TestNgramBlocks()
+{
+	const uint64_t kBlockSize = NgramIndex::kBlockSize;
+	string contents(70 * kBlockSize, '\0');
+	const string pattern = "needle in a haystack";
+
+	// Across the boundary of blocks 2 and 3, and of words 63 and 64 of
+	// the bits, and at the start of block 66.
+	contents.replace(3 * kBlockSize - 5, pattern.size(), pattern);
+	contents.replace(64 * kBlockSize - 1, pattern.size(), pattern);
+	contents.replace(66 * kBlockSize, pattern.size(), pattern);
+
+	auto store = make_shared<ChunkStore>();
+	store->Append(contents.data(), contents.size());
+	shared_ptr<NgramIndex> index = NgramIndex::Compute(*store, &NeverCancelled);
+	EXPECT(index && index->BlockCount() == 70);
+
+	vector<uint64_t> blocks;
+	EXPECT(index->CandidateBlocks(pattern, blocks));
+	vector<uint64_t> candidates;
+	for (uint64_t block = 0; block < index->BlockCount(); ++block)
+	{
+		if (HasBlock(blocks, block))
+		{
+			candidates.push_back(block);
+		}
+	}
+	EXPECT(candidates == vector<uint64_t>({2, 63, 66}));
+
+	// Its end only, which starts in the block after.
+	EXPECT(index->CandidateBlocks("haystack", blocks));
+	EXPECT(HasBlock(blocks, 3) && HasBlock(blocks, 64) && HasBlock(blocks, 66) && !HasBlock(blocks, 2));
+
+	EXPECT(!index->CandidateBlocks("ne", blocks));
+}
+
+int main()
+{
+	TestRegex();
+	TestRegexSlices();
+	TestStringSlices();
+	TestValueAlignment();
+	TestNgramBlocks();
+}
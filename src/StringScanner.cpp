@@ -0,0 +1,646 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HEXA_X86_PREFILTER
+#endif
+
+#include "StringScanner.hpp"
+#include "Unicode.hpp"
+
+#include "Encoding/utf8_iterator.hpp"
+
+using namespace std;
+
+// Bytes read at once.
+static constexpr uint64_t kBlockSize = 64 << 10;
+
+// Bytes needed after a position: the prefilter window starting there and
+// the one after it, and the longest code unit.
+static constexpr uint64_t kLookahead = 2 * 64 + 4;
+
+// Bytes of a string kept for listing.
+static constexpr uint64_t kPreviewLength = 240;
+
+// Code points of UTF-8 text decoded at once.
+static constexpr size_t kDecodeBatch = 64;
+
+const char* TextEncodingName(TextEncoding encoding)
+{
+	switch (encoding)
+	{
+	case TextEncoding::Utf8:
+		return "utf8";
+	case TextEncoding::Utf16LE:
+		return "utf16le";
+	case TextEncoding::Utf16BE:
+		return "utf16be";
+	case TextEncoding::Utf32LE:
+		return "utf32le";
+	case TextEncoding::Utf32BE:
+		return "utf32be";
+	}
+	return "";
+}
+
+static int UnitLength(TextEncoding encoding)
+{
+	switch (encoding)
+	{
+	case TextEncoding::Utf8:
+		return 1;
+	case TextEncoding::Utf16LE:
+	case TextEncoding::Utf16BE:
+		return 2;
+	case TextEncoding::Utf32LE:
+	case TextEncoding::Utf32BE:
+		return 4;
+	}
+	return 1;
+}
+
+static bool IsLittleEndian(TextEncoding encoding)
+{
+	return encoding == TextEncoding::Utf16LE || encoding == TextEncoding::Utf32LE;
+}
+
+static bool IsAsciiText(uint8_t c)
+{
+	return (c >= 0x20 && c < 0x7f) || c == '\t';
+}
+
+static bool IsTextCodePoint(char32_t code_point)
+{
+	return code_point < 0x80 ? IsAsciiText(code_point) : !IsControlCodePoint(code_point);
+}
+
+// Length of the UTF-8 character at `p`, and whether it is printable. Bytes
+// not starting a valid character are taken one by one.
+static int DecodeUtf8(const uint8_t *p, uint64_t available, bool &text)
+{
+	if (p[0] < 0x80)
+	{
+		text = IsAsciiText(p[0]);
+		return 1;
+	}
+
+	char32_t code_point;
+	const int length = ::unicode_iterator::utf8_detail::DecodeSequence(p, available, code_point);
+	text = (length > 0 && IsTextCodePoint(code_point));
+	return max(length, 1);
+}
+
+#ifdef HEXA_X86_PREFILTER
+
+__attribute__((target("avx2")))
+static void ClassifyAvx2(const uint8_t *p, uint64_t &ascii, uint64_t &high)
+{
+	const __m256i space_minus_one = _mm256_set1_epi8(0x1f);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	const __m256i tab = _mm256_set1_epi8('\t');
+
+	ascii = high = 0;
+	for (int half = 0; half < 2; ++half)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * half));
+
+		// Signed compares, bytes above 0x7f are negative.
+		const __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, space_minus_one),
+		                                           _mm256_cmpgt_epi8(del, v));
+		const __m256i text = _mm256_or_si256(printable, _mm256_cmpeq_epi8(v, tab));
+
+		ascii |= (uint64_t)(uint32_t)_mm256_movemask_epi8(text) << (32 * half);
+		high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << (32 * half);
+	}
+}
+
+static void ClassifySse2(const uint8_t *p, uint64_t &ascii, uint64_t &high)
+{
+	const __m128i space_minus_one = _mm_set1_epi8(0x1f);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	const __m128i tab = _mm_set1_epi8('\t');
+
+	ascii = high = 0;
+	for (int quarter = 0; quarter < 4; ++quarter)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * quarter));
+
+		const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, space_minus_one),
+		                                        _mm_cmpgt_epi8(del, v));
+		const __m128i text = _mm_or_si128(printable, _mm_cmpeq_epi8(v, tab));
+
+		ascii |= (uint64_t)(uint16_t)_mm_movemask_epi8(text) << (16 * quarter);
+		high |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << (16 * quarter);
+	}
+}
+
+#else
+
+static void ClassifyPortable(const uint8_t *p, uint64_t &ascii, uint64_t &high)
+{
+	ascii = high = 0;
+	for (int i = 0; i < 64; ++i)
+	{
+		ascii |= (uint64_t)IsAsciiText(p[i]) << i;
+		high |= (uint64_t)(p[i] >= 0x80) << i;
+	}
+}
+
+#endif
+
+// Prefilter, sets bit i of `ascii` for printable ASCII bytes, and of `high`
+// for bytes which are not ASCII, for 64 bytes at `p`.
+static void Classify(const uint8_t *p, uint64_t &ascii, uint64_t &high)
+{
+#ifdef HEXA_X86_PREFILTER
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+	{
+		ClassifyAvx2(p, ascii, high);
+	}
+	else
+	{
+		ClassifySse2(p, ascii, high);
+	}
+#else
+	ClassifyPortable(p, ascii, high);
+#endif
+}
+
+// Whether a run of `chars` characters might start in the 64 bytes at `p`,
+// which is followed by 64 more. Might be true when none does. A run has text bytes in each of its first
+// characters, 1, 2 or 4 bytes apart. Only ASCII is taken for UTF-16 and
+// UTF-32, bytes which are not ASCII might be parts of UTF-8 characters.
+static bool MayStartRun(const uint8_t *p, int chars)
+{
+	uint64_t ascii, high, next_ascii, next_high;
+	Classify(p, ascii, high);
+	Classify(p + 64, next_ascii, next_high);
+
+	auto run = [chars](uint64_t bits, uint64_t next_bits, int stride)
+	{
+		uint64_t starts = bits;
+		for (int k = 1; k < chars; ++k)
+		{
+			const int shift = k * stride;
+			starts &= (bits >> shift) | (next_bits << (64 - shift));
+		}
+		return starts;
+	};
+
+	// Big endian units end with their text byte, which is in the next 64
+	// bytes for units starting at the last few bytes.
+	const uint64_t late_ascii = (ascii >> 3) | (next_ascii << 61);
+	const uint64_t late_next_ascii = next_ascii >> 3;
+
+	return (run(ascii | high, next_ascii | next_high, 1)
+	      | run(ascii, next_ascii, 2)
+	      | run(ascii, next_ascii, 4)
+	      | run(late_ascii, late_next_ascii, 2)
+	      | run(late_ascii, late_next_ascii, 4)) != 0;
+}
+
+// Length of the printable UTF-8 text at `p`, up to `length` bytes, and
+// the characters in it. `p` has kLookahead bytes after `length`. Printable
+// ASCII is taken 64 bytes at a time from the prefilter classes, which is
+// most of the text in binaries.
+static uint64_t Utf8TextLength(const uint8_t *p, uint64_t length, uint64_t &chars)
+{
+	uint64_t i = 0;
+	chars = 0;
+	while (i < length)
+	{
+		uint64_t ascii, high;
+		Classify(p + i, ascii, high);
+		const int printable = (~ascii == 0 ? 64 : __builtin_ctzll(~ascii));
+		const uint64_t n = min<uint64_t>(printable, length - i);
+		i += n;
+		chars += n;
+		if (printable == 64)
+		{
+			continue;
+		}
+		if (i >= length || p[i] < 0x80)
+		{
+			break;
+		}
+
+		// Text in other scripts has long runs of characters which are not
+		// ASCII, they are decoded in bulk. Decoding stops at bytes which
+		// are not valid UTF-8.
+		const char *it = reinterpret_cast<const char*>(p + i);
+		char32_t code_points[kDecodeBatch];
+		const size_t count = ::unicode_iterator::utf8_decode(it, it + (length - i), code_points, kDecodeBatch);
+
+		size_t k = 0;
+		for (; k < count && IsTextCodePoint(code_points[k]); ++k)
+		{
+			i += ::unicode_iterator::utf8_detail::EncodedLength(code_points[k]);
+		}
+		chars += k;
+		if (k < count || count == 0)
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+// Text of a found string for listing.
+static string Preview(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end, TextEncoding encoding)
+{
+	uint8_t bytes[kPreviewLength];
+	const uint64_t length = snapshot.Read(begin, bytes, min(end - begin, kPreviewLength));
+
+	string text;
+	auto append = [&text](char c)
+	{
+		text += (c == '\t' ? ' ' : c);
+	};
+
+	if (encoding == TextEncoding::Utf8)
+	{
+		const char *it = reinterpret_cast<const char*>(bytes);
+		char32_t code_points[kPreviewLength];
+		const size_t count = ::unicode_iterator::utf8_decode(it, it + length, code_points, kPreviewLength);
+		for (size_t i = 0; i < count && IsTextCodePoint(code_points[i]); ++i)
+		{
+			if (code_points[i] < 0x80)
+			{
+				append(code_points[i]);
+			}
+			else
+			{
+				AppendCodePointAsUtf8(text, code_points[i]);
+			}
+		}
+		return text;
+	}
+
+	// Wide runs are ASCII, take the low byte of each unit.
+	const int unit = UnitLength(encoding);
+	const int low = (encoding == TextEncoding::Utf16LE || encoding == TextEncoding::Utf32LE ? 0 : unit - 1);
+	for (uint64_t i = low; i < length; i += unit)
+	{
+		append(bytes[i]);
+	}
+	return text;
+}
+
+namespace
+{
+
+// Scans a slice, position by position. Each encoding and alignment has a
+// lane tracking the run it is in.
+class SliceScanner
+{
+public:
+	SliceScanner(const BufferSnapshot &snapshot, uint64_t end, size_t min_length)
+	  : snapshot(snapshot), size(snapshot.Size()), end(end), min_length(min_length)
+	{
+	}
+
+	// Takes runs going on at `begin` as started before it, so they are not
+	// found again by the scan of the slice after the one they start in.
+	void SkipContinuedRuns(uint64_t begin);
+
+	// Whether any lane is in a run.
+	bool Active() const
+	{
+		return utf8.chars > 0 || WideActive();
+	}
+
+	bool WideActive() const
+	{
+		for (const Run &run : utf16)
+			if (run.chars > 0)
+				return true;
+		for (const Run &run : utf32)
+			if (run.chars > 0)
+				return true;
+		return false;
+	}
+
+	// Steps all lanes from `pos`, `p` points to its byte and has kLookahead
+	// bytes after `available_end`. Returns the position to step next.
+	uint64_t Step(uint64_t pos, const uint8_t *p, uint64_t available_end)
+	{
+		const uint64_t left = size - pos;
+
+		// In UTF-8 text, no wide lane can start before the last byte, as
+		// they need zeros next to text. Lanes are stepped to there at once,
+		// if a few ASCII characters suggest it is text.
+		if (pos >= utf8_next && IsAsciiText(p[0]) && IsAsciiText(p[1]) && IsAsciiText(p[2])
+		    && IsAsciiText(p[3]) && !WideActive() && (utf8.chars > 0 || pos < end))
+		{
+			uint64_t chars;
+			const uint64_t length = Utf8TextLength(p, available_end - pos, chars);
+			if (length > 1)
+			{
+				if (utf8.chars == 0)
+				{
+					utf8.begin = pos;
+				}
+				utf8.chars += chars;
+				utf8.end = pos + length;
+				utf8_next = pos + length;
+				return pos + length - 1;
+			}
+		}
+
+		Run *wide16 = utf16 + 2 * (pos & 1);
+		Advance(wide16[0], pos, 2, left >= 2 && p[1] == 0 && IsAsciiText(p[0]), TextEncoding::Utf16LE);
+		Advance(wide16[1], pos, 2, left >= 2 && p[0] == 0 && IsAsciiText(p[1]), TextEncoding::Utf16BE);
+
+		Run *wide32 = utf32 + 2 * (pos & 3);
+		const bool zero_middle = (left >= 4 && p[1] == 0 && p[2] == 0);
+		Advance(wide32[0], pos, 4, zero_middle && p[3] == 0 && IsAsciiText(p[0]), TextEncoding::Utf32LE);
+		Advance(wide32[1], pos, 4, zero_middle && p[0] == 0 && IsAsciiText(p[3]), TextEncoding::Utf32BE);
+
+		if (pos >= utf8_next)
+		{
+			bool text;
+			const int length = DecodeUtf8(p, min<uint64_t>(left, 4), text);
+			Advance(utf8, pos, length, text, TextEncoding::Utf8);
+			utf8_next = pos + length;
+		}
+		return pos + 1;
+	}
+
+	// Called for 64 byte windows skipped by the prefilter, while no lane is
+	// in a run.
+	void Skip(uint64_t window_end)
+	{
+		utf8_next = max(utf8_next, window_end);
+	}
+
+	// Ends the runs at the end of the buffer.
+	void Finish()
+	{
+		End(utf8, TextEncoding::Utf8);
+		for (int i = 0; i < 4; ++i)
+		{
+			End(utf16[i], i % 2 ? TextEncoding::Utf16BE : TextEncoding::Utf16LE);
+		}
+		for (int i = 0; i < 8; ++i)
+		{
+			End(utf32[i], i % 2 ? TextEncoding::Utf32BE : TextEncoding::Utf32LE);
+		}
+	}
+
+	vector<FoundString> Take()
+	{
+		sort(found.begin(), found.end(), [](const FoundString &x, const FoundString &y)
+		{
+			return x.begin < y.begin || (x.begin == y.begin && x.encoding < y.encoding);
+		});
+
+		// ASCII in UTF-16LE read a byte later is UTF-16BE, less its first
+		// character, and the other way around. Same for UTF-32. Keep the
+		// longer of such overlapping runs, or the little endian one if they
+		// are as long.
+		vector<bool> shadowed(found.size());
+		for (size_t i = 0; i < found.size(); ++i)
+		{
+			const int unit = UnitLength(found[i].encoding);
+			for (size_t j = i + 1; unit > 1 && j < found.size() && found[j].begin < found[i].begin + unit; ++j)
+			{
+				if (UnitLength(found[j].encoding) == unit && found[j].encoding != found[i].encoding)
+				{
+					const uint64_t length_i = found[i].end - found[i].begin;
+					const uint64_t length_j = found[j].end - found[j].begin;
+					const bool keep_j = (length_j > length_i
+					                     || (length_j == length_i && IsLittleEndian(found[j].encoding)));
+					shadowed[keep_j ? i : j] = true;
+				}
+			}
+		}
+
+		vector<FoundString> result;
+		for (size_t i = 0; i < found.size(); ++i)
+		{
+			if (!shadowed[i])
+			{
+				result.push_back(move(found[i]));
+			}
+		}
+		found.clear();
+		return result;
+	}
+
+private:
+	struct Run
+	{
+		uint64_t begin = 0;
+		uint64_t end = 0;
+		uint64_t chars = 0;
+
+		// Started before the slice, not to be reported.
+		bool continued = false;
+	};
+
+	void Advance(Run &run, uint64_t pos, int length, bool text, TextEncoding encoding)
+	{
+		// Runs are followed after the slice, but not started.
+		if (text && (run.chars > 0 || pos < end))
+		{
+			if (run.chars == 0)
+			{
+				run.begin = pos;
+			}
+			++run.chars;
+			run.end = pos + length;
+			return;
+		}
+		End(run, encoding);
+	}
+
+	void End(Run &run, TextEncoding encoding)
+	{
+		if (run.chars >= min_length && !run.continued)
+		{
+			found.push_back(FoundString{run.begin, run.end, encoding,
+			                            Preview(snapshot, run.begin, run.end, encoding)});
+		}
+		run.chars = 0;
+		run.continued = false;
+	}
+
+	const BufferSnapshot &snapshot;
+	const uint64_t size;
+	const uint64_t end;
+	const size_t min_length;
+
+	Run utf8;
+	uint64_t utf8_next = 0;
+
+	// LE and BE lanes for each alignment.
+	Run utf16[2 * 2];
+	Run utf32[2 * 4];
+
+	vector<FoundString> found;
+};
+
+void SliceScanner::SkipContinuedRuns(uint64_t begin)
+{
+	utf8_next = begin;
+	if (begin == 0)
+	{
+		return;
+	}
+
+	// Bytes from a unit before `begin` to a few after, zeros past the end.
+	uint8_t window[12] = {0};
+	const uint64_t window_begin = (begin >= 4 ? begin - 4 : 0);
+	snapshot.Read(window_begin, window, sizeof(window));
+	auto at = [&](uint64_t pos) { return window + (pos - window_begin); };
+
+	auto continue_run = [](Run &run)
+	{
+		run.chars = 1;
+		run.continued = true;
+	};
+
+	// First unit of each wide lane starts in [begin, begin + unit length).
+	// A run goes on if the unit before it is text.
+	for (uint64_t pos = begin; pos < begin + 2 && pos <= size; ++pos)
+	{
+		if (pos >= 2)
+		{
+			const uint8_t *p = at(pos - 2);
+			Run *wide16 = utf16 + 2 * (pos & 1);
+			if (p[1] == 0 && IsAsciiText(p[0]))
+				continue_run(wide16[0]);
+			if (p[0] == 0 && IsAsciiText(p[1]))
+				continue_run(wide16[1]);
+		}
+	}
+	for (uint64_t pos = begin; pos < begin + 4 && pos <= size; ++pos)
+	{
+		if (pos >= 4)
+		{
+			const uint8_t *p = at(pos - 4);
+			const bool zero_middle = (p[1] == 0 && p[2] == 0);
+			Run *wide32 = utf32 + 2 * (pos & 3);
+			if (zero_middle && p[3] == 0 && IsAsciiText(p[0]))
+				continue_run(wide32[0]);
+			if (zero_middle && p[0] == 0 && IsAsciiText(p[3]))
+				continue_run(wide32[1]);
+		}
+	}
+
+	// Continuation bytes at `begin` belong to the character before it.
+	while (utf8_next < begin + 3 && utf8_next < size && (*at(utf8_next) & 0xc0) == 0x80)
+	{
+		++utf8_next;
+	}
+
+	// Same as above, if the character before is text ending where the lane
+	// starts.
+	uint64_t lead = utf8_next - 1;
+	while (lead > window_begin && utf8_next - lead < 4 && (*at(lead) & 0xc0) == 0x80)
+	{
+		--lead;
+	}
+	bool text;
+	const int length = DecodeUtf8(at(lead), min<uint64_t>(4, size - lead), text);
+	if (text && lead + length == utf8_next)
+	{
+		continue_run(utf8);
+	}
+}
+
+} // namespace
+
+vector<FoundString> StringScanner::Scan(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+                                        size_t min_length, const function<bool()> &cancelled)
+{
+	min_length = max<size_t>(1, min_length);
+	const uint64_t size = snapshot.Size();
+	end = min(end, size);
+	if (begin >= end)
+	{
+		return {};
+	}
+
+	// Runs shadowing each other start less than a unit apart, see Take.
+	// Those starting a unit around the slice are found too, so scans of
+	// adjacent slices keep the same one of such pairs.
+	const uint64_t scan_begin = begin - min<uint64_t>(begin, 4);
+	const uint64_t scan_end = min(size, end + 4);
+
+	SliceScanner scanner(snapshot, scan_end, min_length);
+	scanner.SkipContinuedRuns(scan_begin);
+
+	auto take = [&]()
+	{
+		vector<FoundString> found = scanner.Take();
+		found.erase(remove_if(found.begin(), found.end(), [&](const FoundString &s)
+		{
+			return s.begin < begin || s.begin >= end;
+		}), found.end());
+		return found;
+	};
+
+	const int prefilter_chars = (int)min<size_t>(min_length, 4);
+	vector<uint8_t> block(kBlockSize + kLookahead);
+
+	for (uint64_t pos = scan_begin; pos < size; pos += kBlockSize)
+	{
+		if ((pos >= scan_end && !scanner.Active()) || cancelled())
+		{
+			return take();
+		}
+
+		// Zeros past the end, so lookahead does not need checks.
+		const uint64_t length = snapshot.Read(pos, block.data(), block.size());
+		memset(block.data() + length, 0, block.size() - length);
+
+		const uint64_t block_end = min(size, pos + kBlockSize);
+		for (uint64_t window = pos; window < block_end; )
+		{
+			const uint64_t window_end = min(block_end, window + 64);
+			const uint8_t *p = block.data() + (window - pos);
+
+			if (!scanner.Active())
+			{
+				if (window >= scan_end)
+				{
+					return take();
+				}
+				if (!MayStartRun(p, prefilter_chars))
+				{
+					scanner.Skip(window_end);
+					window = window_end;
+					continue;
+				}
+			}
+
+			// Steps in text might go past the window.
+			while (window < window_end)
+			{
+				window = scanner.Step(window, block.data() + (window - pos), block_end);
+			}
+		}
+	}
+
+	scanner.Finish();
+	return take();
+}
@@ -0,0 +1,61 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FileBuffer.hpp"
+
+enum class TextEncoding
+{
+	Utf8,
+	Utf16LE,
+	Utf16BE,
+	Utf32LE,
+	Utf32BE,
+};
+
+const char* TextEncodingName(TextEncoding encoding);
+
+// Run of printable text found in a buffer.
+struct FoundString
+{
+	uint64_t begin;
+	uint64_t end;
+	TextEncoding encoding;
+
+	// Start of the text as UTF-8, for listing.
+	std::string text;
+};
+
+// Finds runs of printable text, like `strings`, in all of the encodings at
+// once. UTF-8 runs take any printable code point. UTF-16 and UTF-32 runs
+// take printable ASCII only, like `strings -e`, as nearly any pair of bytes
+// is some printable UTF-16 code point; they are found at every alignment.
+class StringScanner
+{
+public:
+	// Runs of at least `min_length` characters starting in [begin, end),
+	// sorted by start. Runs crossing `end` are followed to their end, and
+	// ones continuing from before `begin` are left out, so scans of
+	// adjacent slices can be concatenated.
+	static std::vector<FoundString> Scan(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+	                                     size_t min_length, const std::function<bool()> &cancelled);
+};
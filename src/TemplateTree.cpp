@@ -0,0 +1,907 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <stdexcept>
+
+#include "TemplateTree.hpp"
+
+using namespace std;
+
+typedef BinaryTemplate::Expr Expr;
+typedef BinaryTemplate::Statement Statement;
+typedef BinaryTemplate::Type Type;
+
+// Bytes of texts kept for showing and comparing them.
+static const uint64_t kMaxTextLength = 256;
+
+// Decoded elements kept before they are freed, each might have fields.
+static const size_t kMaxElements = 10000;
+
+// Elements of open-ended arrays between the ones whose starts are kept.
+static const uint64_t kCheckpointInterval = 256;
+
+static bool IsTrue(int64_t number, const string &text, bool is_text)
+{
+	return is_text ? !text.empty() : number != 0;
+}
+
+TemplateTree::TemplateTree(shared_ptr<const BinaryTemplate> tpl, const BufferSnapshot &snapshot)
+  : tpl(move(tpl)), snapshot(snapshot)
+{
+	root.reset(new Node);
+	root->kind = Node::Struct;
+	root->name = "file";
+	root->type_name = "file";
+	DecodeBody(*root, this->tpl->Root().body);
+}
+
+unique_ptr<TemplateTree::Node> TemplateTree::MakeNode(const Statement &statement, Node *parent, uint64_t offset)
+{
+	unique_ptr<Node> node(new Node);
+	node->name = statement.name;
+	node->statement = &statement;
+	node->offset = offset;
+	node->parent = parent;
+	node->endianness = (statement.type.has_endianness ? statement.type.endianness : parent->endianness);
+
+	if (!statement.is_array)
+	{
+		const uint64_t length = (statement.count ? EvalNumber(*statement.count, parent, -1)
+		                                         : snapshot.Size() - min(offset, snapshot.Size()));
+		Decode(*node, statement.type, length);
+		return node;
+	}
+
+	node->kind = Node::Array;
+	node->element_type = &statement.type;
+	node->walked_end = offset;
+
+	if (statement.type.base == Type::Integer)
+	{
+		node->element_size = statement.type.width;
+	}
+	else if (statement.type.base == Type::Struct)
+	{
+		node->element_size = statement.type.def->fixed_size;
+	}
+
+	if (statement.count)
+	{
+		node->count = EvalNumber(*statement.count, parent, -1);
+		if (node->count < 0)
+		{
+			throw runtime_error("Negative count " + to_string(node->count) + " of " + statement.name);
+		}
+	}
+	else if (node->element_size > 0 && !statement.while_condition)
+	{
+		// Up to the end of the file.
+		node->count = (snapshot.Size() - min(offset, snapshot.Size())) / node->element_size;
+	}
+
+	if (IsIndexed(*node))
+	{
+		node->size_known = true;
+		node->size = node->count * node->element_size;
+		if (offset + node->size > snapshot.Size())
+		{
+			node->error = "Extends past the end of the file";
+		}
+		node->type_name = statement.type.name + "[" + to_string(node->count) + "]";
+	}
+	else
+	{
+		node->type_name = statement.type.name + "[]";
+	}
+	return node;
+}
+
+unique_ptr<TemplateTree::Node> TemplateTree::MakeElement(Node &array, uint64_t index, uint64_t offset)
+{
+	unique_ptr<Node> node(new Node);
+	node->name = "[" + to_string(index) + "]";
+	node->statement = array.statement;
+	node->offset = offset;
+	node->parent = &array;
+	node->index = index;
+	node->endianness = array.endianness;
+	Decode(*node, *array.element_type, 0);
+	return node;
+}
+
+void TemplateTree::Decode(Node &node, const Type &type, uint64_t length)
+{
+	const uint64_t file_size = snapshot.Size();
+	const uint64_t available = file_size - min(node.offset, file_size);
+
+	switch (type.base)
+	{
+	case Type::Integer:
+		node.kind = Node::Integer;
+		node.type_name = type.name;
+		node.size_known = true;
+		node.size = type.width;
+		if ((uint64_t)type.width > available)
+		{
+			node.error = "Past the end of the file";
+			return;
+		}
+		node.value = ReadInteger(node.offset, type.width, type.is_signed, node.endianness);
+		return;
+
+	case Type::Char:
+	case Type::Bytes:
+		node.kind = (type.base == Type::Char ? Node::Text : Node::Bytes);
+		node.type_name = type.name + "[" + to_string(length) + "]";
+		node.size_known = true;
+		node.size = length;
+		if (length > available)
+		{
+			node.error = "Extends past the end of the file";
+		}
+		node.text.resize(min(min(length, available), kMaxTextLength));
+		snapshot.Read(node.offset, &node.text[0], node.text.size());
+		return;
+
+	case Type::Struct:
+		node.kind = Node::Struct;
+		node.type_name = type.def->name;
+		if (type.def->fixed_size >= 0)
+		{
+			node.size_known = true;
+			node.size = type.def->fixed_size;
+		}
+		DecodeBody(node, type.def->body);
+		return;
+	}
+}
+
+bool TemplateTree::DecodeBody(Node &node, const vector<Statement> &body)
+{
+	for (const Statement &statement : body)
+	{
+		try
+		{
+			switch (statement.kind)
+			{
+			case Statement::SetEndianness:
+				node.endianness = statement.endianness;
+				break;
+
+			case Statement::If:
+			{
+				const Value condition = Eval(*statement.condition, &node, -1);
+				if (!DecodeBody(node, IsTrue(condition.number, condition.text, condition.is_text)
+				                      ? statement.then_body : statement.else_body))
+				{
+					return false;
+				}
+				break;
+			}
+
+			case Statement::Field:
+			{
+				uint64_t offset;
+				if (statement.at)
+				{
+					const int64_t at = EvalNumber(*statement.at, &node, -1);
+					if (at < 0 || (uint64_t)at >= snapshot.Size())
+					{
+						throw runtime_error("Offset " + to_string(at) + " of " + statement.name
+						                    + " is outside the file");
+					}
+					offset = at;
+				}
+				else
+				{
+					offset = NextOffset(node);
+					if (offset > snapshot.Size())
+					{
+						// Truncated file, the rest of the fields are not there.
+						node.error = "Ends before " + statement.name;
+						return false;
+					}
+				}
+
+				unique_ptr<Node> field = MakeNode(statement, &node, offset);
+				field->index = node.fields.size();
+				const bool failed = !field->error.empty();
+				if (!statement.at)
+				{
+					node.last_sequential = field.get();
+				}
+				node.fields.push_back(move(field));
+				if (failed)
+				{
+					return false;
+				}
+				break;
+			}
+			}
+		}
+		catch (exception &e)
+		{
+			node.error = "Line " + to_string(statement.line) + ": " + e.what();
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t TemplateTree::NextOffset(Node &node)
+{
+	if (!node.last_sequential)
+	{
+		return node.offset;
+	}
+	return node.last_sequential->offset + Size(*node.last_sequential);
+}
+
+uint64_t TemplateTree::Size(const Node &const_node)
+{
+	Node &node = const_cast<Node&>(const_node);
+	if (node.size_known)
+	{
+		return node.size;
+	}
+
+	if (node.kind == Node::Struct)
+	{
+		node.size = NextOffset(node) - node.offset;
+	}
+	else
+	{
+		WalkTo(node, UINT64_MAX);
+		node.size = node.walked_end - node.offset;
+	}
+	node.size_known = true;
+	return node.size;
+}
+
+bool TemplateTree::WalkTo(Node &array, uint64_t index)
+{
+	if (IsIndexed(array))
+	{
+		return index < (uint64_t)array.count;
+	}
+
+	while (!array.complete && array.walked_count <= index)
+	{
+		const uint64_t pos = array.walked_end;
+		const uint64_t next = array.walked_count;
+		if ((array.count >= 0 && next >= (uint64_t)array.count) || pos >= snapshot.Size())
+		{
+			array.complete = true;
+			break;
+		}
+
+		uint64_t element_size = array.element_size;
+		try
+		{
+			const Expr *condition = array.statement->while_condition.get();
+			if (condition)
+			{
+				const Value v = Eval(*condition, array.parent, pos);
+				if (!IsTrue(v.number, v.text, v.is_text))
+				{
+					array.complete = true;
+					break;
+				}
+			}
+
+			if (array.element_size < 0)
+			{
+				element_size = ElementSize(array, next, pos);
+			}
+		}
+		catch (exception &e)
+		{
+			array.error = "Line " + to_string(array.statement->line) + ": " + e.what();
+			array.complete = true;
+			break;
+		}
+
+		if (element_size == 0)
+		{
+			array.complete = true;
+			break;
+		}
+		if (next % kCheckpointInterval == 0)
+		{
+			array.checkpoints.push_back(pos);
+		}
+		++array.walked_count;
+		array.walked_end = pos + element_size;
+	}
+	return index < array.walked_count;
+}
+
+uint64_t TemplateTree::ElementSize(Node &array, uint64_t index, uint64_t start)
+{
+	if (array.element_size >= 0)
+	{
+		return array.element_size;
+	}
+
+	// Decoded to find the size, then freed unless it was kept.
+	auto kept = array.elements.find(index);
+	if (kept != array.elements.end())
+	{
+		return Size(*kept->second);
+	}
+	unique_ptr<Node> element = MakeElement(array, index, start);
+	return Size(*element);
+}
+
+void TemplateTree::NearestKnownElement(const Node &array, uint64_t index, uint64_t pos,
+                                       uint64_t &known_index, uint64_t &known_start) const
+{
+	const auto &checkpoints = array.checkpoints;
+	const size_t last = min<uint64_t>(index / kCheckpointInterval, checkpoints.size() - 1);
+	const size_t checkpoint = max<ptrdiff_t>(0, upper_bound(checkpoints.begin(), checkpoints.begin() + last + 1, pos)
+	                                            - checkpoints.begin() - 1);
+	known_index = checkpoint * kCheckpointInterval;
+	known_start = checkpoints[checkpoint];
+
+	// Elements listed or looked at are usually next to a decoded one.
+	for (auto it = array.elements.upper_bound(known_index);
+	     it != array.elements.end() && it->first <= index && it->second->offset <= pos; ++it)
+	{
+		known_index = it->first;
+		known_start = it->second->offset;
+	}
+}
+
+uint64_t TemplateTree::ElementStart(Node &array, uint64_t index)
+{
+	if (array.element_size >= 0)
+	{
+		return array.offset + index * array.element_size;
+	}
+
+	uint64_t i, start;
+	NearestKnownElement(array, index, UINT64_MAX, i, start);
+	for (; i < index; ++i)
+	{
+		start += ElementSize(array, i, start);
+	}
+	return start;
+}
+
+TemplateTree::Node* TemplateTree::Element(Node &array, uint64_t index)
+{
+	auto kept = array.elements.find(index);
+	if (kept != array.elements.end())
+	{
+		return kept->second.get();
+	}
+	return Element(array, index, ElementStart(array, index));
+}
+
+TemplateTree::Node* TemplateTree::Element(Node &array, uint64_t index, uint64_t start)
+{
+	unique_ptr<Node> &element = array.elements[index];
+	if (!element)
+	{
+		element = MakeElement(array, index, start);
+		++element_count;
+	}
+	return element.get();
+}
+
+TemplateTree::Node* TemplateTree::ElementAt(Node &array, uint64_t pos)
+{
+	if (pos < array.offset)
+	{
+		return nullptr;
+	}
+
+	if (IsIndexed(array))
+	{
+		const uint64_t index = (pos - array.offset) / array.element_size;
+		return index < (uint64_t)array.count ? Element(array, index) : nullptr;
+	}
+
+	while (!array.complete && array.walked_end <= pos)
+	{
+		WalkTo(array, array.walked_count);
+	}
+	if (array.walked_count == 0 || pos >= array.walked_end)
+	{
+		return nullptr;
+	}
+
+	if (array.element_size >= 0)
+	{
+		return Element(array, (pos - array.offset) / array.element_size);
+	}
+
+	uint64_t i, start;
+	NearestKnownElement(array, UINT64_MAX, pos, i, start);
+	while (i + 1 < array.walked_count)
+	{
+		const uint64_t next = start + ElementSize(array, i, start);
+		if (next > pos)
+		{
+			break;
+		}
+		start = next;
+		++i;
+	}
+	return Element(array, i, start);
+}
+
+bool TemplateTree::EndsAfter(Node &node, uint64_t pos)
+{
+	if (node.size_known)
+	{
+		return pos < node.offset + node.size;
+	}
+	if (node.kind == Node::Struct)
+	{
+		return node.last_sequential && EndsAfter(*node.last_sequential, pos);
+	}
+
+	while (!node.complete && node.walked_end <= pos)
+	{
+		WalkTo(node, node.walked_count);
+	}
+	return pos < node.walked_end;
+}
+
+vector<const TemplateTree::Node*> TemplateTree::PathTo(uint64_t pos)
+{
+	Trim();
+
+	vector<const Node*> path;
+	Node *node = root.get();
+	while (node)
+	{
+		path.push_back(node);
+
+		Node *next = nullptr;
+		if (node->kind == Node::Struct)
+		{
+			for (const unique_ptr<Node> &field : node->fields)
+			{
+				if (field->offset <= pos && EndsAfter(*field, pos))
+				{
+					next = field.get();
+					break;
+				}
+			}
+		}
+		else if (node->kind == Node::Array)
+		{
+			next = ElementAt(*node, pos);
+		}
+		node = next;
+	}
+	return path;
+}
+
+const TemplateTree::Node* TemplateTree::Child(const Node &const_node, uint64_t index)
+{
+	Node &node = const_cast<Node&>(const_node);
+	if (node.kind == Node::Struct)
+	{
+		return index < node.fields.size() ? node.fields[index].get() : nullptr;
+	}
+	if (node.kind == Node::Array && WalkTo(node, index))
+	{
+		return Element(node, index);
+	}
+	return nullptr;
+}
+
+uint64_t TemplateTree::KnownChildCount(const Node &node) const
+{
+	if (node.kind == Node::Struct)
+	{
+		return node.fields.size();
+	}
+	if (node.kind == Node::Array)
+	{
+		return IsIndexed(node) ? node.count : node.walked_count;
+	}
+	return 0;
+}
+
+bool TemplateTree::ChildCountKnown(const Node &node) const
+{
+	return node.kind != Node::Array || IsIndexed(node) || node.complete;
+}
+
+void TemplateTree::MarksIn(int64_t begin, int64_t end, vector<Mark> &out)
+{
+	Trim();
+	MarksIn(*root, max<int64_t>(begin, 0), max<int64_t>(end, 0), out);
+}
+
+void TemplateTree::MarksIn(Node &node, uint64_t begin, uint64_t end, vector<Mark> &out)
+{
+	switch (node.kind)
+	{
+	case Node::Struct:
+		for (const unique_ptr<Node> &field : node.fields)
+		{
+			if (field->offset < end && EndsAfter(*field, begin))
+			{
+				MarksIn(*field, begin, end, out);
+			}
+		}
+		return;
+
+	case Node::Array:
+		for (Node *element = ElementAt(node, max(begin, node.offset));
+		     element && element->offset < end;
+		     element = (WalkTo(node, element->index + 1) ? Element(node, element->index + 1) : nullptr))
+		{
+			MarksIn(*element, begin, end, out);
+		}
+		return;
+
+	default:
+		if (Size(node) > 0)
+		{
+			out.push_back(Mark{(int64_t)node.offset, (int64_t)Size(node), node.name});
+		}
+		return;
+	}
+}
+
+bool TemplateTree::IndexArrays(const atomic<bool> &cancelled)
+{
+	return IndexArrays(*root, cancelled);
+}
+
+bool TemplateTree::IndexArrays(Node &node, const atomic<bool> &cancelled)
+{
+	if (node.kind == Node::Struct)
+	{
+		for (const unique_ptr<Node> &field : node.fields)
+		{
+			if (!IndexArrays(*field, cancelled))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	if (node.kind != Node::Array || IsIndexed(node))
+	{
+		return true;
+	}
+
+	while (!node.complete)
+	{
+		if (cancelled)
+		{
+			return false;
+		}
+		WalkTo(node, node.walked_count + kCheckpointInterval);
+	}
+	return true;
+}
+
+void TemplateTree::AdoptIndex(const TemplateTree &indexed)
+{
+	AdoptIndex(*root, *indexed.root);
+}
+
+void TemplateTree::AdoptIndex(Node &node, const Node &indexed)
+{
+	if (node.statement != indexed.statement || node.kind != indexed.kind || node.offset != indexed.offset)
+	{
+		return;
+	}
+
+	if (node.kind == Node::Struct)
+	{
+		for (size_t i = 0; i < min(node.fields.size(), indexed.fields.size()); ++i)
+		{
+			AdoptIndex(*node.fields[i], *indexed.fields[i]);
+		}
+		return;
+	}
+	if (node.kind != Node::Array || IsIndexed(node) || node.walked_count >= indexed.walked_count)
+	{
+		return;
+	}
+
+	node.walked_count = indexed.walked_count;
+	node.checkpoints = indexed.checkpoints;
+	node.walked_end = indexed.walked_end;
+	node.complete = indexed.complete;
+	node.error = indexed.error;
+	node.size_known = indexed.size_known;
+	node.size = indexed.size;
+}
+
+TemplateTree::Node* TemplateTree::Lookup(const vector<string> &path, Node *scope)
+{
+	Node *found = nullptr;
+	for (Node *s = scope; s && !found; s = s->parent)
+	{
+		for (auto it = s->fields.rbegin(); it != s->fields.rend(); ++it)
+		{
+			if ((*it)->name == path[0])
+			{
+				found = it->get();
+				break;
+			}
+		}
+	}
+
+	for (size_t i = 1; i < path.size() && found; ++i)
+	{
+		Node *parent = found;
+		found = nullptr;
+		for (const unique_ptr<Node> &field : parent->fields)
+		{
+			if (field->name == path[i])
+			{
+				found = field.get();
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+uint64_t TemplateTree::ReadInteger(uint64_t offset, int width, bool is_signed, Endianness endianness) const
+{
+	uint8_t bytes[8];
+	if (offset > snapshot.Size() || snapshot.Size() - offset < (uint64_t)width
+	    || snapshot.Read(offset, bytes, width) != (uint64_t)width)
+	{
+		throw runtime_error("Read past the end of the file at " + to_string(offset));
+	}
+
+	uint64_t value = 0;
+	for (int i = 0; i < width; ++i)
+	{
+		const int byte = (endianness == Endianness::BigEndian ? i : width - 1 - i);
+		value = value << 8 | bytes[byte];
+	}
+	if (is_signed && width < 8 && (value >> (width * 8 - 1)) & 1)
+	{
+		value |= ~0ull << (width * 8);
+	}
+	return value;
+}
+
+// Octal numbers of tar headers, padded with spaces or NULs. Large ones
+// are in base 256 with the high bit of the first byte set.
+static int64_t ParseOctal(const string &text)
+{
+	int64_t value = 0;
+	if (!text.empty() && (text[0] & 0x80))
+	{
+		value = text[0] & 0x3f;
+		for (size_t i = 1; i < text.size(); ++i)
+		{
+			value = value << 8 | (uint8_t)text[i];
+		}
+		return value;
+	}
+
+	size_t i = 0;
+	while (i < text.size() && (text[i] == ' ' || text[i] == '\0'))
+	{
+		++i;
+	}
+	for (; i < text.size() && text[i] >= '0' && text[i] <= '7'; ++i)
+	{
+		value = value * 8 + (text[i] - '0');
+	}
+	return value;
+}
+
+TemplateTree::Value TemplateTree::Eval(const Expr &expr, Node *scope, int64_t at)
+{
+	Value v;
+	switch (expr.kind)
+	{
+	case Expr::Number:
+		v.number = expr.number;
+		return v;
+
+	case Expr::String:
+		v.is_text = true;
+		v.text = expr.text;
+		return v;
+
+	case Expr::Offset:
+		v.number = (at >= 0 ? at : NextOffset(*scope));
+		return v;
+
+	case Expr::Name:
+	{
+		Node *node = Lookup(expr.path, scope);
+		string name = expr.path[0];
+		for (size_t i = 1; i < expr.path.size(); ++i)
+		{
+			name += "." + expr.path[i];
+		}
+		if (!node)
+		{
+			throw runtime_error("Unknown field " + name);
+		}
+
+		switch (node->kind)
+		{
+		case Node::Integer:
+			v.number = node->value;
+			return v;
+		case Node::Text:
+			v.is_text = true;
+			v.text = node->text.substr(0, node->text.find('\0'));
+			return v;
+		case Node::Array:
+			// Count of elements.
+			Size(*node);
+			v.number = KnownChildCount(*node);
+			return v;
+		default:
+			throw runtime_error(name + " has no value");
+		}
+	}
+
+	case Expr::Unary:
+	{
+		const int64_t operand = EvalNumber(*expr.args[0], scope, at);
+		v.number = (expr.text == "-" ? -operand : expr.text == "!" ? !operand : ~operand);
+		return v;
+	}
+
+	case Expr::Conditional:
+	{
+		const Value condition = Eval(*expr.args[0], scope, at);
+		return Eval(*expr.args[IsTrue(condition.number, condition.text, condition.is_text) ? 1 : 2], scope, at);
+	}
+
+	case Expr::Binary:
+	{
+		const string &op = expr.text;
+		const Value lhs = Eval(*expr.args[0], scope, at);
+		if (op == "&&" || op == "||")
+		{
+			const bool left = IsTrue(lhs.number, lhs.text, lhs.is_text);
+			if (left == (op == "||"))
+			{
+				v.number = left;
+				return v;
+			}
+			const Value rhs = Eval(*expr.args[1], scope, at);
+			v.number = IsTrue(rhs.number, rhs.text, rhs.is_text);
+			return v;
+		}
+
+		const Value rhs = Eval(*expr.args[1], scope, at);
+		if (lhs.is_text || rhs.is_text)
+		{
+			if (!(lhs.is_text && rhs.is_text) || (op != "==" && op != "!="))
+			{
+				throw runtime_error("Texts can only be compared with == and !=");
+			}
+			v.number = ((lhs.text == rhs.text) == (op == "=="));
+			return v;
+		}
+
+		const int64_t a = lhs.number;
+		const int64_t b = rhs.number;
+		if ((op == "/" || op == "%") && b == 0)
+		{
+			throw runtime_error("Division by zero");
+		}
+
+		if (op == "+") v.number = a + b;
+		else if (op == "-") v.number = a - b;
+		else if (op == "*") v.number = a * b;
+		else if (op == "/") v.number = a / b;
+		else if (op == "%") v.number = a % b;
+		else if (op == "&") v.number = a & b;
+		else if (op == "|") v.number = a | b;
+		else if (op == "^") v.number = a ^ b;
+		else if (op == "<<") v.number = (uint64_t)a << (b & 63);
+		else if (op == ">>") v.number = (uint64_t)a >> (b & 63);
+		else if (op == "==") v.number = (a == b);
+		else if (op == "!=") v.number = (a != b);
+		else if (op == "<") v.number = (a < b);
+		else if (op == "<=") v.number = (a <= b);
+		else if (op == ">") v.number = (a > b);
+		else if (op == ">=") v.number = (a >= b);
+		return v;
+	}
+
+	case Expr::Call:
+	{
+		const string &name = expr.text;
+		if (name == "octal")
+		{
+			const Value text = Eval(*expr.args[0], scope, at);
+			if (!text.is_text)
+			{
+				throw runtime_error("octal takes a char field");
+			}
+			v.number = ParseOctal(text.text);
+		}
+		else if (name == "align")
+		{
+			const int64_t value = EvalNumber(*expr.args[0], scope, at);
+			const int64_t alignment = EvalNumber(*expr.args[1], scope, at);
+			v.number = (alignment > 0 ? (value + alignment - 1) / alignment * alignment : value);
+		}
+		else if (name == "filesize")
+		{
+			v.number = snapshot.Size();
+		}
+		else if (name == "size" || name == "offset")
+		{
+			Node *node = Lookup(expr.args[0]->path, scope);
+			if (!node)
+			{
+				throw runtime_error("Unknown field " + expr.args[0]->path[0]);
+			}
+			v.number = (name == "size" ? Size(*node) : node->offset);
+		}
+		else
+		{
+			Type type;
+			BinaryTemplate::ParseIntegerType(name, type);
+			const int64_t offset = EvalNumber(*expr.args[0], scope, at);
+			if (offset < 0)
+			{
+				throw runtime_error("Negative offset " + to_string(offset));
+			}
+			v.number = ReadInteger(offset, type.width, type.is_signed,
+			                       type.has_endianness ? type.endianness : scope->endianness);
+		}
+		return v;
+	}
+	}
+	return v;
+}
+
+int64_t TemplateTree::EvalNumber(const Expr &expr, Node *scope, int64_t at)
+{
+	const Value v = Eval(expr, scope, at);
+	if (v.is_text)
+	{
+		throw runtime_error("Expected a number, not \"" + v.text + "\"");
+	}
+	return v.number;
+}
+
+void TemplateTree::Trim()
+{
+	if (element_count > kMaxElements)
+	{
+		FreeElements(*root);
+		element_count = 0;
+	}
+}
+
+void TemplateTree::FreeElements(Node &node)
+{
+	for (const unique_ptr<Node> &field : node.fields)
+	{
+		FreeElements(*field);
+	}
+	node.elements.clear();
+}
@@ -0,0 +1,204 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BinaryTemplate.hpp"
+#include "FileBuffer.hpp"
+#include "MarkProvider.hpp"
+
+// Structure of a buffer snapshot by a BinaryTemplate. Nodes are decoded
+// when they are looked at, so only the structures around the cursor are
+// read. Elements of arrays are located by arithmetic if their size is
+// fixed, otherwise by walking over the ones before. Offsets of every
+// 256th element walked over are kept, so memory does not
+// grow with the element count, and an element is found by walking from the
+// checkpoint before it.
+//
+// Leaf fields are given to the editor as marks, for the rows it shows.
+class TemplateTree : public MarkProvider
+{
+public:
+	TemplateTree(std::shared_ptr<const BinaryTemplate> tpl, const BufferSnapshot &snapshot);
+	TemplateTree(const TemplateTree &ot) = delete;
+	TemplateTree& operator=(const TemplateTree &ot) = delete;
+
+	struct Node
+	{
+		enum Kind
+		{
+			Integer,
+			Text,
+			Bytes,
+			Struct,
+			Array,
+		};
+		Kind kind;
+
+		// Field name, or like "[12]" for array elements.
+		std::string name;
+		// Like "u32", "char[100]" or "Entry[]".
+		std::string type_name;
+		uint64_t offset = 0;
+		Node *parent = nullptr;
+
+		int64_t value = 0;
+		// First bytes of text, as they are.
+		std::string text;
+
+		// Why decoding stopped at this node, like a read past the end.
+		std::string error;
+
+		// Position among the fields of the parent, or element index.
+		uint64_t index = 0;
+
+	private:
+		const BinaryTemplate::Statement *statement = nullptr;
+		Endianness endianness = Endianness::LittleEndian;
+
+		bool size_known = false;
+		uint64_t size = 0;
+
+		// Of structs. Size is up to the end of the last field not placed by
+		// an offset.
+		std::vector< std::unique_ptr<Node> > fields;
+		Node *last_sequential = nullptr;
+
+		// Of arrays. Elements walked over so far, starts of every
+		// 256th one of them, and where the next one would
+		// start.
+		const BinaryTemplate::Type *element_type = nullptr;
+		int64_t count = -1;
+		int64_t element_size = -1;
+		uint64_t walked_count = 0;
+		std::vector<uint64_t> checkpoints;
+		uint64_t walked_end = 0;
+		bool complete = false;
+		std::map< uint64_t, std::unique_ptr<Node> > elements;
+
+	friend class TemplateTree;
+	};
+
+	const Node& Root() const
+	{
+		return *root;
+	}
+
+	// Nodes from the root to the innermost one containing `pos`. Decodes
+	// what is needed, and might free nodes decoded before, so pointers
+	// returned by earlier calls are not valid anymore.
+	std::vector<const Node*> PathTo(uint64_t pos);
+
+	// Element or field at `index` of a struct or array, null past the end.
+	const Node* Child(const Node &node, uint64_t index);
+
+	// Children known so far. Exact for structs and arrays whose elements
+	// are counted or were all walked over.
+	uint64_t KnownChildCount(const Node &node) const;
+	bool ChildCountKnown(const Node &node) const;
+
+	uint64_t Size(const Node &node);
+
+	// Leaf fields overlapping [begin, end), named after the fields.
+	void MarksIn(int64_t begin, int64_t end, std::vector<Mark> &out) override;
+
+	// Walks open-ended arrays, other than the ones in array elements, to
+	// their end. That reads every element, which takes long for large files,
+	// so it is done on a tree of its own in background, and the result is
+	// then adopted by the one shown. Returns false if cancelled.
+	bool IndexArrays(const std::atomic<bool> &cancelled);
+
+	// Takes the walks of `indexed`, a tree of the same template and
+	// snapshot, for arrays it walked further than this one.
+	void AdoptIndex(const TemplateTree &indexed);
+
+private:
+	struct Value
+	{
+		bool is_text = false;
+		int64_t number = 0;
+		std::string text;
+	};
+
+	// Decodes the field of `statement` at `offset`, and the fields in it if
+	// it is a struct. Errors are kept in the node, not thrown.
+	std::unique_ptr<Node> MakeNode(const BinaryTemplate::Statement &statement, Node *parent, uint64_t offset);
+	std::unique_ptr<Node> MakeElement(Node &array, uint64_t index, uint64_t offset);
+
+	// Decodes value of integers and texts, and fields of structs.
+	void Decode(Node &node, const BinaryTemplate::Type &type, uint64_t length);
+	// Appends fields to a struct, its endianness is changed by `endian`.
+	// Returns false if decoding stopped at an error.
+	bool DecodeBody(Node &node, const std::vector<BinaryTemplate::Statement> &body);
+
+	// Offset the next field of a struct goes at.
+	uint64_t NextOffset(Node &node);
+
+	// Whether elements are located by arithmetic, without walking.
+	static bool IsIndexed(const Node &array)
+	{
+		return array.element_size >= 0 && array.count >= 0 && !array.statement->while_condition;
+	}
+	Node* Element(Node &array, uint64_t index);
+	Node* Element(Node &array, uint64_t index, uint64_t start);
+
+	// Walks the array until element `index` is found or it ends. Returns
+	// whether it has the element.
+	bool WalkTo(Node &array, uint64_t index);
+	// Same, until the element containing `pos`, which it returns or null.
+	Node* ElementAt(Node &array, uint64_t pos);
+
+	// Of elements walked over.
+	uint64_t ElementStart(Node &array, uint64_t index);
+	uint64_t ElementSize(Node &array, uint64_t index, uint64_t start);
+
+	// Last element at or before `index`, starting at or before `pos`,
+	// whose start is known without walking, from the checkpoints and the
+	// decoded elements. At least one element must be walked over.
+	void NearestKnownElement(const Node &array, uint64_t index, uint64_t pos,
+	                         uint64_t &known_index, uint64_t &known_start) const;
+
+	// Whether `pos` is before the end of the node, without walking arrays
+	// further than that.
+	bool EndsAfter(Node &node, uint64_t pos);
+
+	// Fields are looked up from `scope` up. `@` is `at`, or the next
+	// offset of `scope` if it is negative. Throws runtime_error.
+	Value Eval(const BinaryTemplate::Expr &expr, Node *scope, int64_t at);
+	int64_t EvalNumber(const BinaryTemplate::Expr &expr, Node *scope, int64_t at);
+	Node* Lookup(const std::vector<std::string> &path, Node *scope);
+	uint64_t ReadInteger(uint64_t offset, int width, bool is_signed, Endianness endianness) const;
+
+	void MarksIn(Node &node, uint64_t begin, uint64_t end, std::vector<Mark> &out);
+	bool IndexArrays(Node &node, const std::atomic<bool> &cancelled);
+	void AdoptIndex(Node &node, const Node &indexed);
+
+	// Frees decoded elements if there are too many.
+	void Trim();
+	void FreeElements(Node &node);
+	size_t element_count = 0;
+
+	std::shared_ptr<const BinaryTemplate> tpl;
+	BufferSnapshot snapshot;
+	std::unique_ptr<Node> root;
+};
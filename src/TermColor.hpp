@@ -22,6 +22,7 @@ enum class TermColor
 	None = -1,
 	Black = 0,
 	Red = 1,
+	Green = 2,
 	Yellow = 3,
 	Magenta = 5,
 	Cyan = 6,
@@ -50,6 +50,7 @@ enum Key
 
 	ESCAPE = 27,
 
+	SLASH = 47,
 	COLON = 58,
 
 	UPPERCASE_A = 65,
@@ -79,6 +80,9 @@ enum Key
 	UPPERCASE_Y,
 	UPPERCASE_Z,
 
+	LEFT_BRACKET = 91,
+	RIGHT_BRACKET = 93,
+
 	LOWERCASE_A = 97,
 	LOWERCASE_B,
 	LOWERCASE_C,
@@ -113,4 +117,7 @@ enum Key
 	ARROW_RIGHT,
 	ARROW_UP,
 	ARROW_DOWN,
+
+	// Position is kept by the Terminal, see Terminal::ClickRow.
+	MOUSE_LEFT_CLICK,
 };
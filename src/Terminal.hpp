@@ -55,6 +55,7 @@ public:
 	{
 		// Restore old terminal attributes.
 		tcsetattr(input_fd, TCSANOW, &old_input_attr);
+		SetMouseReporting(false);
 		if (alternate_screen_set)
 		{
 			ResetAlternateScreen();
@@ -82,6 +83,31 @@ public:
 		alternate_screen_set = false;
 	}
 
+	// Clicks are reported as keys only while this is set, as reporting
+	// takes over text selection of the terminal.
+	void SetMouseReporting(bool enabled)
+	{
+		if (enabled == mouse_reporting)
+		{
+			return;
+		}
+		mouse_reporting = enabled;
+
+		// Button presses, in SGR encoding which has no column limit.
+		output_buffer << (enabled ? "\033[?1000h\033[?1006h" : "\033[?1006l\033[?1000l");
+	}
+
+	// Zero based screen position of the last MOUSE_LEFT_CLICK.
+	int ClickRow() const
+	{
+		return click_row;
+	}
+
+	int ClickColumn() const
+	{
+		return click_column;
+	}
+
 	void SwapBuffers()
 	{
 		UpdateScreen(output_buffer, prev_screen, draft_screen);
@@ -115,7 +141,7 @@ public:
 	Key GetKeyPress()
 	{
 		char input_buf[100];
-		int s = read(input_fd, input_buf, 100);
+		int s = read(input_fd, input_buf, sizeof(input_buf) - 1);
 
 		// TODO move parsing logic to TermInput.hpp so it will be defined in the
 		// same place with the enum
@@ -135,6 +161,20 @@ public:
 			if (input_buf[1] == '[' && input_buf[2] == 'D')
 				return Key::ARROW_LEFT;
 		}
+		if (s > 3 && input_buf[0] == 033 && input_buf[1] == '[' && input_buf[2] == '<')
+		{
+			// Mouse report: ESC [ < button ; column ; row M, `m` on release.
+			int button, column, row;
+			char final_char;
+			input_buf[s] = '\0';
+			if (sscanf(input_buf + 3, "%d;%d;%d%c", &button, &column, &row, &final_char) == 4
+			    && button == 0 && final_char == 'M')
+			{
+				click_row = row - 1;
+				click_column = column - 1;
+				return Key::MOUSE_LEFT_CLICK;
+			}
+		}
 
 		return Key::UNKNOWN;
 	}
@@ -180,6 +220,10 @@ private:
 
 	bool alternate_screen_set = false;
 
+	bool mouse_reporting = false;
+	int click_row = -1;
+	int click_column = -1;
+
 	// Buffer of output sequences, written when Flush() is called.
 	stringstream output_buffer;
 };
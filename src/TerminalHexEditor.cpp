@@ -15,6 +15,7 @@
 // You should have received a copy of the GNU General Public License
 // along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <iomanip>
 #include <cstdint>
 #include <cstdlib>
@@ -28,6 +29,7 @@
 #include <vector>
 using namespace std;
 
+#include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
 #include <sys/epoll.h>
@@ -38,6 +40,7 @@ using namespace std;
 #include "Terminal.hpp"
 #include "Hexa.hpp"
 #include "HexEditor.hpp"
+#include "ScriptBatch.hpp"
 
 #include "CommandLineFlags.hpp"
 
@@ -64,12 +67,38 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	if (args.inputs_num < 1)
+	// `cmd | hexa` reads the pipe like `hexa -` does.
+	vector<string> inputs(args.inputs, args.inputs + args.inputs_num);
+	if (inputs.empty() && !isatty(STDIN_FILENO))
+	{
+		inputs.push_back("-");
+	}
+
+	if (inputs.empty())
 	{
 		cerr << gengetopt_args_info_usage << "\n";
 		exit(1);
 	}
 
+	// Nothing of the editor is set up for scripts run without a terminal.
+	if (args.batch_flag)
+	{
+		ScriptBatch batch{args};
+		return batch.Run(inputs);
+	}
+
+	// Keys are read from the controlling terminal when stdin is the data.
+	int input_fd = STDIN_FILENO;
+	if (find(inputs.begin(), inputs.end(), "-") != inputs.end())
+	{
+		input_fd = open("/dev/tty", O_RDWR | O_CLOEXEC);
+		if (input_fd < 0)
+		{
+			cerr << "Unable to open /dev/tty for reading keys\n";
+			exit(1);
+		}
+	}
+
 	Hexa hexa{args};
 
 	const char *env_home = getenv("HOME");
@@ -81,11 +110,12 @@ int main(int argc, char *argv[])
 		history_file_name = home_dir + "/.config/hexa/history";
 
 		hexa.GetCommandHistory().LoadFromFile(history_file_name);
+		hexa.SetIndexDir(home_dir + "/.config/hexa/index");
 	}
 
-	for (int i = 0; i < (int)args.inputs_num; ++i)
+	for (const string &input : inputs)
 	{
-		hexa.AddNewTab(args.inputs[i]);
+		hexa.AddNewTab(input);
 	}
 
 	// Create epooll structire with signalfd and STDIN
@@ -94,13 +124,16 @@ int main(int argc, char *argv[])
 	enum EpollFd {
 		EPOLL_STDIN,
 		EPOLL_SIGNAL_FD,
+		EPOLL_BACKGROUND,
+		EPOLL_FILE_WATCHER,
+		EPOLL_TRUNCATION,
 	};
 
 	{
 		epoll_event ev;
 		ev.events = EPOLLIN;
 		ev.data.u32 = EpollFd::EPOLL_STDIN;
-		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, input_fd, &ev);
 	}
 	int signal_fd = MakeSignalFd(); // TODO store this with epoll_event
 	{
@@ -109,11 +142,29 @@ int main(int argc, char *argv[])
 		ev.data.u32 = EpollFd::EPOLL_SIGNAL_FD;
 		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
 	}
+	{
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = EpollFd::EPOLL_BACKGROUND;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, hexa.BackgroundEventFd(), &ev);
+	}
+	{
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = EpollFd::EPOLL_FILE_WATCHER;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, hexa.FileWatcherFd(), &ev);
+	}
+	{
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = EpollFd::EPOLL_TRUNCATION;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, hexa.TruncationFd(), &ev);
+	}
 
 	struct winsize term_size;
-	ioctl(STDIN_FILENO, TIOCGWINSZ, &term_size);
+	ioctl(input_fd, TIOCGWINSZ, &term_size);
 
-	Terminal terminal(STDIN_FILENO, STDOUT_FILENO, term_size.ws_row, term_size.ws_col);
+	Terminal terminal(input_fd, STDOUT_FILENO, term_size.ws_row, term_size.ws_col);
 
 	terminal.SetRawInputMode();
 	terminal.SetAlternateScreen();
@@ -139,6 +190,12 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
+			if (k == Key::MOUSE_LEFT_CLICK)
+			{
+				hexa.InputClick(terminal.ClickRow(), terminal.ClickColumn());
+				break;
+			}
+
 			hexa.InputKey(k);
 			break;
 		}
@@ -151,12 +208,21 @@ int main(int argc, char *argv[])
 			if (fdsi.ssi_signo == SIGWINCH)
 			{
 				struct winsize new_size;
-				ioctl(STDIN_FILENO, TIOCGWINSZ, &new_size);
+				ioctl(input_fd, TIOCGWINSZ, &new_size);
 				terminal.UpdateSize(new_size.ws_row, new_size.ws_col);
 			}
 
 			break;
 		}
+		case EpollFd::EPOLL_BACKGROUND:
+			hexa.ProcessBackgroundEvents();
+			break;
+		case EpollFd::EPOLL_FILE_WATCHER:
+			hexa.ProcessFileEvents();
+			break;
+		case EpollFd::EPOLL_TRUNCATION:
+			hexa.ProcessTruncatedFiles();
+			break;
 		default:
 			;
 		}
@@ -174,6 +240,7 @@ int main(int argc, char *argv[])
 
 		screen_painter = Painter(&terminal.GetScreenBuffer());
 		hexa.RenderTo(screen_painter);
+		terminal.SetMouseReporting(hexa.WantsMouse());
 		terminal.SwapBuffers();
 	}
 
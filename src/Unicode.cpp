@@ -72,5 +72,5 @@ int GetCodePointWidth(char32_t code_point)
 
 void AppendCodePointAsUtf8(std::string &s, char32_t code_point)
 {
-	UnicodeString((UChar32)code_point).toUTF8String(s);
+	icu::UnicodeString((UChar32)code_point).toUTF8String(s);
 }
@@ -0,0 +1,465 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HEXA_X86_VALUE_SEARCH
+#endif
+
+#include "ValueSearch.hpp"
+
+using namespace std;
+
+// Value bits of an integer given in decimal, or in hex with 0x. Hex values
+// of signed types might set the sign bit, like 0xffff for -1 in i16.
+static uint64_t ParseInteger(const string &text, const string &type, int width, bool is_signed)
+{
+	const bool negative = (!text.empty() && text[0] == '-');
+	const char *digits = text.c_str() + negative;
+
+	int base = 10;
+	if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))
+	{
+		base = 16;
+		digits += 2;
+	}
+
+	char *digits_end;
+	errno = 0;
+	const uint64_t magnitude = isxdigit((unsigned char)digits[0]) ? strtoull(digits, &digits_end, base) : 0;
+	if (!isxdigit((unsigned char)digits[0]) || *digits_end != '\0')
+	{
+		throw invalid_argument("\"" + text + "\" is not a number");
+	}
+
+	const uint64_t mask = (width == 8 ? ~0ull : (1ull << (8 * width)) - 1);
+	const uint64_t signed_max = mask >> 1;
+
+	bool fits;
+	if (negative)
+	{
+		fits = (is_signed && magnitude <= signed_max + 1);
+	}
+	else
+	{
+		fits = (magnitude <= (is_signed && base == 10 ? signed_max : mask));
+	}
+	if (errno == ERANGE || !fits)
+	{
+		throw invalid_argument(text + " does not fit in " + type);
+	}
+
+	return (negative ? 0 - magnitude : magnitude) & mask;
+}
+
+static double ParseFloat(const string &text)
+{
+	char *text_end;
+	const double value = strtod(text.c_str(), &text_end);
+	if (text.empty() || *text_end != '\0' || isspace((unsigned char)text[0]))
+	{
+		throw invalid_argument("\"" + text + "\" is not a number");
+	}
+	return value;
+}
+
+ValueSearch::ValueSearch(const string &type, const string &value, const string &flags)
+{
+	static const struct
+	{
+		const char *name;
+		int width;
+		bool is_signed;
+		bool is_float;
+	} kTypes[] = {
+		{"u8",  1, false, false},
+		{"i8",  1, true,  false},
+		{"u16", 2, false, false},
+		{"i16", 2, true,  false},
+		{"u32", 4, false, false},
+		{"i32", 4, true,  false},
+		{"u64", 8, false, false},
+		{"i64", 8, true,  false},
+		{"f32", 4, true,  true},
+		{"f64", 8, true,  true},
+	};
+
+	bool is_signed = false;
+	for (const auto &t : kTypes)
+	{
+		if (type == t.name)
+		{
+			width = t.width;
+			is_signed = t.is_signed;
+			is_float = t.is_float;
+		}
+	}
+	if (width == 0)
+	{
+		throw invalid_argument("Unknown type \"" + type + "\", use u8 to u64, i8 to i64, f32 or f64");
+	}
+
+	for (size_t begin = 0; begin <= flags.size(); )
+	{
+		const size_t end = min(flags.find(',', begin), flags.size());
+		const string flag = flags.substr(begin, end - begin);
+		begin = end + 1;
+
+		if (flag == "le")
+			big_endian = false;
+		else if (flag == "be")
+			little_endian = false;
+		else if (flag == "aligned")
+			aligned = true;
+		else if (!flag.empty())
+			throw invalid_argument("Unknown flag \"" + flag + "\", use le, be or aligned");
+	}
+	if (!little_endian && !big_endian)
+	{
+		throw invalid_argument("Only one of le and be can be given");
+	}
+
+	if (is_float)
+	{
+		const size_t tilde = value.find('~');
+		const double v = ParseFloat(value.substr(0, tilde));
+		const double tolerance = (tilde == string::npos ? 0 : ParseFloat(value.substr(tilde + 1)));
+		if (!isfinite(v) || !(tolerance >= 0) || !isfinite(tolerance))
+		{
+			throw invalid_argument("Value and tolerance must be finite, tolerance not negative");
+		}
+
+		if (width == 4)
+		{
+			// Bounds rounded outwards, so floats are compared as floats.
+			const double v32 = (float)v;
+			low32 = (float)(v32 - tolerance);
+			if (low32 > v32 - tolerance)
+				low32 = nextafterf(low32, -INFINITY);
+			high32 = (float)(v32 + tolerance);
+			if (high32 < v32 + tolerance)
+				high32 = nextafterf(high32, INFINITY);
+		}
+		low = v - tolerance;
+		high = v + tolerance;
+	}
+	else
+	{
+		const uint64_t bits = ParseInteger(value, type, width, is_signed);
+
+		vector<uint8_t> le(width), be(width);
+		for (int i = 0; i < width; ++i)
+		{
+			le[i] = be[width - 1 - i] = bits >> (8 * i);
+		}
+		if (little_endian)
+			patterns.push_back(le);
+		if (big_endian && (!little_endian || be != le))
+			patterns.push_back(be);
+	}
+
+	// Bytes have no endianness.
+	string notes = (width == 1 ? "" : little_endian && big_endian ? "LE, BE" : little_endian ? "LE" : "BE");
+	if (aligned && width > 1)
+	{
+		notes += ", aligned";
+	}
+	description = type + " " + value + (notes.empty() ? "" : " (" + notes + ")");
+}
+
+bool ValueSearch::MatchesAt(const uint8_t *p) const
+{
+	if (!is_float)
+	{
+		for (const vector<uint8_t> &pattern : patterns)
+		{
+			if (memcmp(p, pattern.data(), width) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint8_t swapped[8];
+	reverse_copy(p, p + width, swapped);
+
+	for (int big = 0; big < 2; ++big)
+	{
+		if (big ? !big_endian : !little_endian)
+		{
+			continue;
+		}
+		const uint8_t *bytes = (big ? swapped : p);
+
+		if (width == 4)
+		{
+			float f;
+			memcpy(&f, bytes, 4);
+			if (f >= low32 && f <= high32)
+				return true;
+		}
+		else
+		{
+			double d;
+			memcpy(&d, bytes, 8);
+			if (d >= low && d <= high)
+				return true;
+		}
+	}
+	return false;
+}
+
+#ifdef HEXA_X86_VALUE_SEARCH
+
+// Integers are found by their first and last bytes, and checked fully.
+__attribute__((target("avx2")))
+static uint32_t IntegerCandidatesAvx2(const uint8_t *p, int width, const vector< vector<uint8_t> > &patterns)
+{
+	const __m256i first = _mm256_loadu_si256((const __m256i*)p);
+	const __m256i last = _mm256_loadu_si256((const __m256i*)(p + width - 1));
+
+	uint32_t mask = 0;
+	for (const vector<uint8_t> &pattern : patterns)
+	{
+		const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_set1_epi8(pattern[0])),
+		                                    _mm256_cmpeq_epi8(last, _mm256_set1_epi8(pattern[width - 1])));
+		mask |= (uint32_t)_mm256_movemask_epi8(eq);
+	}
+	return mask;
+}
+
+static uint32_t IntegerCandidatesSse2(const uint8_t *p, int width, const vector< vector<uint8_t> > &patterns)
+{
+	uint32_t mask = 0;
+	for (int half = 0; half < 2; ++half)
+	{
+		const __m128i first = _mm_loadu_si128((const __m128i*)(p + 16 * half));
+		const __m128i last = _mm_loadu_si128((const __m128i*)(p + 16 * half + width - 1));
+
+		for (const vector<uint8_t> &pattern : patterns)
+		{
+			const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(first, _mm_set1_epi8(pattern[0])),
+			                                 _mm_cmpeq_epi8(last, _mm_set1_epi8(pattern[width - 1])));
+			mask |= (uint32_t)_mm_movemask_epi8(eq) << (16 * half);
+		}
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t InRange(__m256 v, __m256 lo, __m256 hi)
+{
+	return _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(v, lo, _CMP_GE_OQ), _mm256_cmp_ps(v, hi, _CMP_LE_OQ)));
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t InRange(__m256d v, __m256d lo, __m256d hi)
+{
+	return _mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(v, lo, _CMP_GE_OQ), _mm256_cmp_pd(v, hi, _CMP_LE_OQ)));
+}
+
+// Floats at each of the 4 (or 8) offsets in a unit are loaded 8 (or 4) at
+// a time, so 32 positions take 4 (or 8) loads, and compared with the range
+// as is and byte swapped.
+__attribute__((target("avx2")))
+static uint32_t Float32CandidatesAvx2(const uint8_t *p, float low, float high, bool little_endian, bool big_endian)
+{
+	const __m256 lo = _mm256_set1_ps(low);
+	const __m256 hi = _mm256_set1_ps(high);
+	const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	                                      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	uint32_t mask = 0;
+	for (int offset = 0; offset < 4; ++offset)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(p + offset));
+		uint32_t lanes = 0;
+		if (little_endian)
+			lanes |= InRange(_mm256_castsi256_ps(v), lo, hi);
+		if (big_endian)
+			lanes |= InRange(_mm256_castsi256_ps(_mm256_shuffle_epi8(v, swap)), lo, hi);
+
+		for (int k = 0; k < 8; ++k)
+			mask |= ((lanes >> k) & 1) << (offset + 4 * k);
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint32_t Float64CandidatesAvx2(const uint8_t *p, double low, double high, bool little_endian, bool big_endian)
+{
+	const __m256d lo = _mm256_set1_pd(low);
+	const __m256d hi = _mm256_set1_pd(high);
+	const __m256i swap = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+	                                      7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+	uint32_t mask = 0;
+	for (int offset = 0; offset < 8; ++offset)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(p + offset));
+		uint32_t lanes = 0;
+		if (little_endian)
+			lanes |= InRange(_mm256_castsi256_pd(v), lo, hi);
+		if (big_endian)
+			lanes |= InRange(_mm256_castsi256_pd(_mm256_shuffle_epi8(v, swap)), lo, hi);
+
+		for (int k = 0; k < 4; ++k)
+			mask |= ((lanes >> k) & 1) << (offset + 8 * k);
+	}
+	return mask;
+}
+
+#endif
+
+uint32_t ValueSearch::Candidates32(const uint8_t *p, uint64_t pos) const
+{
+	uint32_t mask = 0;
+#ifdef HEXA_X86_VALUE_SEARCH
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (!is_float)
+	{
+		mask = (has_avx2 ? IntegerCandidatesAvx2(p, width, patterns)
+		                 : IntegerCandidatesSse2(p, width, patterns));
+	}
+	else if (has_avx2 && width == 4)
+	{
+		mask = Float32CandidatesAvx2(p, low32, high32, little_endian, big_endian);
+	}
+	else if (has_avx2)
+	{
+		mask = Float64CandidatesAvx2(p, low, high, little_endian, big_endian);
+	}
+	else
+#endif
+	{
+		for (int i = 0; i < 32; ++i)
+		{
+			mask |= (uint32_t)MatchesAt(p + i) << i;
+		}
+	}
+
+	if (aligned)
+	{
+		// Bits of offsets multiple of the width.
+		static const uint32_t kAlignedBits[] = {0, 0xffffffff, 0x55555555, 0, 0x11111111, 0, 0, 0, 0x01010101};
+		mask &= kAlignedBits[width] << ((width - pos % width) % width);
+	}
+	return mask;
+}
+
+void ValueSearch::FindInSpan(const uint8_t *data, uint64_t data_pos, uint64_t from, uint64_t to,
+                             vector<uint64_t> &found, size_t limit) const
+{
+	uint64_t i = from;
+	for (; i + 32 <= to && found.size() < limit; i += 32)
+	{
+		for (uint32_t mask = Candidates32(data + i, data_pos + i); mask != 0; mask &= mask - 1)
+		{
+			const int k = __builtin_ctz(mask);
+			if (MatchesAt(data + i + k) && found.size() < limit)
+			{
+				found.push_back(data_pos + i + k);
+			}
+		}
+	}
+
+	for (; i < to && found.size() < limit; ++i)
+	{
+		if ((!aligned || (data_pos + i) % width == 0) && MatchesAt(data + i))
+		{
+			found.push_back(data_pos + i);
+		}
+	}
+}
+
+vector<uint64_t> ValueSearch::Find(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+                                   size_t limit, const function<bool()> &cancelled) const
+{
+	vector<uint64_t> found;
+	const uint64_t size = snapshot.Size();
+	if (size < (uint64_t)width)
+	{
+		return found;
+	}
+
+	// Starts of the values checked, they need `width` bytes.
+	end = min(end, size - width + 1);
+	if (begin >= end)
+	{
+		return found;
+	}
+
+	// Positions before this are checked.
+	uint64_t checked = begin;
+
+	// Values crossing span boundaries are read one by one.
+	auto check_crossing = [&](uint64_t from, uint64_t to)
+	{
+		to = min(to, end);
+		for (uint64_t pos = max(from, checked); pos < to && found.size() < limit; ++pos)
+		{
+			uint8_t bytes[8];
+			snapshot.Read(pos, bytes, width);
+			if ((!aligned || pos % width == 0) && MatchesAt(bytes))
+			{
+				found.push_back(pos);
+			}
+		}
+		checked = max(checked, to);
+	};
+
+	auto find_in_span = [&](uint64_t span_pos, const uint8_t *data, uint64_t span_length)
+	{
+		const uint64_t span_end = span_pos + span_length;
+		check_crossing(span_pos - min<uint64_t>(span_pos, width - 1), span_pos);
+
+		if (span_length >= (uint64_t)width)
+		{
+			const uint64_t from = max(checked, span_pos);
+			const uint64_t to = min(end, span_end - width + 1);
+			if (from < to && found.size() < limit)
+			{
+				FindInSpan(data, span_pos, from - span_pos, to - span_pos, found, limit);
+				checked = to;
+			}
+		}
+
+		check_crossing(span_end - min<uint64_t>(span_length, width - 1), span_end);
+		return checked < end && found.size() < limit && !cancelled();
+	};
+
+	// Values which are not all zeros can not be in holes.
+	const uint8_t zeros[8] = {0};
+	if (MatchesAt(zeros))
+	{
+		snapshot.ForEachSpan(begin, end + width - 1 - begin, find_in_span);
+	}
+	else
+	{
+		snapshot.ForEachDataSpan(begin, end + width - 1 - begin, find_in_span);
+	}
+
+	return found;
+}
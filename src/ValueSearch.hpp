@@ -0,0 +1,82 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FileBuffer.hpp"
+
+// Integer or float searched for by :findval, in one or both endiannesses.
+class ValueSearch
+{
+public:
+	// Parses the type (u8 to u64, i8 to i64, f32 or f64) and the value.
+	// Integers might be given in hex with 0x. Floats might end with
+	// "~tolerance", otherwise they are matched exactly once rounded to the
+	// type. `flags` are separated by commas: "le" or "be" to search one
+	// endianness only, and "aligned" to take offsets multiple of the width
+	// only. Throws invalid_argument if any is not valid.
+	ValueSearch(const std::string &type, const std::string &value, const std::string &flags);
+
+	int Width() const
+	{
+		return width;
+	}
+
+	// Like "u32 3735928559 (LE, BE)", for messages.
+	const std::string& Description() const
+	{
+		return description;
+	}
+
+	// Offsets of matches starting in [begin, end), the first `limit` ones.
+	std::vector<uint64_t> Find(const BufferSnapshot &snapshot, uint64_t begin, uint64_t end,
+	                           size_t limit, const std::function<bool()> &cancelled) const;
+
+	// Whether the value is at `p`, which has Width() bytes.
+	bool MatchesAt(const uint8_t *p) const;
+
+private:
+	// Appends offsets of matches at positions [from, to) of `data`, whose
+	// first byte is at `data_pos`. `data` has Width() - 1 bytes after `to`.
+	void FindInSpan(const uint8_t *data, uint64_t data_pos, uint64_t from, uint64_t to,
+	                std::vector<uint64_t> &found, size_t limit) const;
+
+	// Bitmask of positions among the 32 at `p`, which is at `pos`, the value
+	// might be at. Bits of integers are exact, floats are checked fully.
+	uint32_t Candidates32(const uint8_t *p, uint64_t pos) const;
+
+	int width = 0;
+	bool aligned = false;
+	bool is_float = false;
+	bool little_endian = true;
+	bool big_endian = true;
+
+	// Bytes of an integer in each endianness searched, the same ones once.
+	std::vector< std::vector<uint8_t> > patterns;
+
+	// Range of floats matched, in the type searched.
+	double low = 0;
+	double high = 0;
+	float low32 = 0;
+	float high32 = 0;
+
+	std::string description;
+};
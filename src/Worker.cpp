@@ -0,0 +1,134 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstdint>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "Worker.hpp"
+
+using namespace std;
+
+Worker::Worker(int thread_count)
+{
+	if (thread_count <= 0)
+	{
+		// Keep at least two threads, so a long job does not block
+		// everything else even on single core machines.
+		thread_count = max(2u, thread::hardware_concurrency());
+	}
+
+	notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	for (int i = 0; i < thread_count; ++i)
+	{
+		threads.emplace_back(&Worker::ThreadMain, this);
+	}
+}
+
+Worker::~Worker()
+{
+	Stop();
+	close(notify_fd);
+}
+
+void Worker::Stop()
+{
+	{
+		lock_guard<mutex> lock(jobs_mutex);
+		shutting_down = true;
+		jobs.clear();
+	}
+	jobs_cv.notify_all();
+
+	for (thread &t : threads)
+	{
+		t.join();
+	}
+	threads.clear();
+}
+
+void Worker::Post(function<void()> work, function<void()> done)
+{
+	{
+		lock_guard<mutex> lock(jobs_mutex);
+		jobs.push_back(Job{move(work), move(done)});
+	}
+	jobs_cv.notify_one();
+}
+
+void Worker::PostToMain(function<void()> fn)
+{
+	bool was_empty;
+	{
+		lock_guard<mutex> lock(completions_mutex);
+		was_empty = completions.empty();
+		completions.push_back(move(fn));
+	}
+
+	if (was_empty)
+	{
+		uint64_t one = 1;
+		write(notify_fd, &one, sizeof(one));
+	}
+}
+
+void Worker::RunCompletions()
+{
+	uint64_t counter;
+	read(notify_fd, &counter, sizeof(counter));
+
+	deque< function<void()> > ready;
+	{
+		lock_guard<mutex> lock(completions_mutex);
+		ready.swap(completions);
+	}
+
+	for (function<void()> &fn : ready)
+	{
+		fn();
+	}
+}
+
+void Worker::ThreadMain()
+{
+	while (1)
+	{
+		Job job;
+		{
+			unique_lock<mutex> lock(jobs_mutex);
+			jobs_cv.wait(lock, [this]() { return shutting_down || !jobs.empty(); });
+
+			if (shutting_down)
+			{
+				return;
+			}
+
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job.work();
+
+		if (job.done)
+		{
+			PostToMain(move(job.done));
+		}
+	}
+}
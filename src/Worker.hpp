@@ -0,0 +1,94 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs jobs on background threads and hands their results back to the
+// main loop.
+//
+// Main loop adds `NotifyFd()` to its epoll set and calls `RunCompletions()`
+// whenever it becomes readable, so completion callbacks always run on the
+// main thread and are free to touch editor state.
+class Worker
+{
+public:
+	// Zero threads means one per core.
+	explicit Worker(int thread_count = 0);
+	Worker(const Worker &ot) = delete;
+	Worker& operator=(const Worker &ot) = delete;
+	~Worker();
+
+	// Runs `work` on a background thread, then `done` on the main thread.
+	void Post(std::function<void()> work, std::function<void()> done = nullptr);
+
+	// Queues `fn` to run on the main thread. Can be called from any thread.
+	void PostToMain(std::function<void()> fn);
+
+	// Runs the main thread callbacks queued so far.
+	void RunCompletions();
+
+	// Drops queued jobs and waits for running ones to return. Callbacks can
+	// still be queued with PostToMain until the worker is destroyed.
+	void Stop();
+
+	int NotifyFd() const
+	{
+		return notify_fd;
+	}
+
+	int ThreadCount() const
+	{
+		return (int)threads.size();
+	}
+
+	// Long running jobs should poll this and return early when set.
+	bool ShuttingDown() const
+	{
+		return shutting_down.load(std::memory_order_relaxed);
+	}
+
+private:
+	void ThreadMain();
+
+	struct Job
+	{
+		std::function<void()> work;
+		std::function<void()> done;
+	};
+
+	std::vector<std::thread> threads;
+
+	std::mutex jobs_mutex;
+	std::condition_variable jobs_cv;
+	std::deque<Job> jobs;
+
+	std::mutex completions_mutex;
+	std::deque< std::function<void()> > completions;
+
+	// eventfd signalled when `completions` becomes non empty.
+	int notify_fd = -1;
+
+	std::atomic<bool> shutting_down{false};
+};
@@ -0,0 +1,134 @@
+// Copyright 2016 Mustafa Serdar Sanli
+//
+// This file is part of HexArtisan.
+//
+// HexArtisan is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// HexArtisan is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with HexArtisan.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// XXH64 from xxHash by Yann Collet, https://github.com/Cyan4973/xxHash
+//
+// Input is consumed in four independent lanes, which keeps the multipliers
+// busy in parallel. A 4 KiB block hashes at several GB/s without any
+// library dependency.
+namespace xxhash64_detail
+{
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t RotateLeft(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t Read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input)
+{
+	acc += input * kPrime2;
+	acc = RotateLeft(acc, 31);
+	return acc * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t acc, uint64_t val)
+{
+	acc ^= Round(0, val);
+	return acc * kPrime1 + kPrime4;
+}
+
+} // namespace xxhash64_detail
+
+// Reads are little endian as in the reference implementation, which is
+// what all supported platforms are.
+inline uint64_t XXHash64(const void *input, size_t length, uint64_t seed = 0)
+{
+	using namespace xxhash64_detail;
+
+	const uint8_t *p = static_cast<const uint8_t*>(input);
+	const uint8_t *const end = p + length;
+	uint64_t h;
+
+	if (length >= 32)
+	{
+		uint64_t v1 = seed + kPrime1 + kPrime2;
+		uint64_t v2 = seed + kPrime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - kPrime1;
+
+		const uint8_t *const limit = end - 32;
+		do
+		{
+			v1 = Round(v1, Read64(p));
+			v2 = Round(v2, Read64(p + 8));
+			v3 = Round(v3, Read64(p + 16));
+			v4 = Round(v4, Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+		h = MergeRound(h, v1);
+		h = MergeRound(h, v2);
+		h = MergeRound(h, v3);
+		h = MergeRound(h, v4);
+	}
+	else
+	{
+		h = seed + kPrime5;
+	}
+
+	h += length;
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= Round(0, Read64(p));
+		h = RotateLeft(h, 27) * kPrime1 + kPrime4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= (uint64_t)Read32(p) * kPrime1;
+		h = RotateLeft(h, 23) * kPrime2 + kPrime3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+	{
+		h ^= (*p) * kPrime5;
+		h = RotateLeft(h, 11) * kPrime1;
+	}
+
+	h ^= h >> 33;
+	h *= kPrime2;
+	h ^= h >> 29;
+	h *= kPrime3;
+	h ^= h >> 32;
+	return h;
+}